@@ -5,6 +5,7 @@
 #include <ifaddrs.h>
 #include <stddef.h>
 #include "endian.h"
+#include "offload.h"
 
 namespace sylar {
 
@@ -99,7 +100,16 @@ bool Address::Lookup(std::vector<Address::ptr> &result, const std::string &host,
     if (node.empty()) {
         node = host;
     }
-    int error = getaddrinfo(node.c_str(), service, &hints, &results);
+    //getaddrinfo会阻塞在DNS查询上，交给阻塞调用线程池，参数按值拷贝，不引用协程栈
+    bool has_service = service != NULL;
+    std::string service_str = has_service ? service : "";
+    std::pair<int, addrinfo *> rt = offload([node, service_str, has_service, hints]() {
+        addrinfo *res = NULL;
+        int err = getaddrinfo(node.c_str(), has_service ? service_str.c_str() : NULL, &hints, &res);
+        return std::make_pair(err, res);
+    });
+    int error = rt.first;
+    results   = rt.second;
     if (error) {
         SYLAR_LOG_DEBUG(g_logger) << "Address::Lookup getaddress(" << host << ", "
                                   << family << ", " << type << ") err=" << error << " errstr="
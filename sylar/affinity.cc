@@ -0,0 +1,259 @@
+#include "affinity.h"
+#include <sched.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <fstream>
+#include <sstream>
+#include <set>
+#include <atomic>
+#include <algorithm>
+#include "config.h"
+#include "log.h"
+
+namespace sylar {
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+/// 调度器名称到放置策略的映射，"*"对应没有单独配置的调度器
+static ConfigVar<std::map<std::string, std::string> >::ptr g_scheduler_affinity =
+    Config::Lookup("scheduler.affinity", std::map<std::string, std::string>(),
+                   "scheduler thread placement policy by scheduler name: none, cpus:<list>, core, node, node:<n>");
+
+/// node策略自动分配的下一个NUMA节点
+static std::atomic<int> s_next_node = {0};
+
+static bool ReadLine(const std::string& path, std::string& line) {
+    std::ifstream ifs(path);
+    if(!ifs) {
+        return false;
+    }
+    std::getline(ifs, line);
+    return true;
+}
+
+static int ReadInt(const std::string& path, int def) {
+    std::string line;
+    if(!ReadLine(path, line) || line.empty()) {
+        return def;
+    }
+    return atoi(line.c_str());
+}
+
+CpuTopology::CpuTopology() {
+    // 用进程的亲和性而不是当前线程的，调度线程可能已经绑定了CPU
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if(sched_getaffinity(getpid(), sizeof(set), &set) == 0) {
+        for(int i = 0; i < CPU_SETSIZE; ++i) {
+            if(CPU_ISSET(i, &set)) {
+                m_cpus.push_back(i);
+            }
+        }
+    }
+    if(m_cpus.empty()) {
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        for(long i = 0; i < n; ++i) {
+            m_cpus.push_back(i);
+        }
+    }
+    std::set<int> allowed(m_cpus.begin(), m_cpus.end());
+
+    DIR* dir = opendir("/sys/devices/system/node");
+    if(dir) {
+        struct dirent* ent = nullptr;
+        while((ent = readdir(dir)) != nullptr) {
+            if(strncmp(ent->d_name, "node", 4) || !isdigit(ent->d_name[4])) {
+                continue;
+            }
+            int node = atoi(ent->d_name + 4);
+            std::string line;
+            if(!ReadLine(std::string("/sys/devices/system/node/") + ent->d_name + "/cpulist", line)) {
+                continue;
+            }
+            if((int)m_nodes.size() <= node) {
+                m_nodes.resize(node + 1);
+            }
+            for(auto cpu : ParseCpuList(line)) {
+                if(allowed.count(cpu)) {
+                    m_nodes[node].push_back(cpu);
+                    m_cpuNode[cpu] = node;
+                }
+            }
+        }
+        closedir(dir);
+    }
+    if(m_nodes.empty()) {
+        m_nodes.push_back(m_cpus);
+        for(auto cpu : m_cpus) {
+            m_cpuNode[cpu] = 0;
+        }
+    }
+
+    // 每个物理核心先取一个逻辑CPU，超线程的兄弟CPU放到后面
+    std::set<std::pair<int, int> > cores;
+    std::vector<int> siblings;
+    for(auto cpu : m_cpus) {
+        std::string base = "/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/";
+        int package = ReadInt(base + "physical_package_id", 0);
+        int core = ReadInt(base + "core_id", cpu);
+        if(cores.insert(std::make_pair(package, core)).second) {
+            m_coreOrdered.push_back(cpu);
+        } else {
+            siblings.push_back(cpu);
+        }
+    }
+    m_coreCount = m_coreOrdered.size();
+    m_coreOrdered.insert(m_coreOrdered.end(), siblings.begin(), siblings.end());
+
+    SYLAR_LOG_INFO(g_logger) << "cpu topology: " << toString();
+}
+
+const std::vector<int>& CpuTopology::getNodeCpus(int node) const {
+    static const std::vector<int> s_empty;
+    if(node < 0 || node >= (int)m_nodes.size()) {
+        return s_empty;
+    }
+    return m_nodes[node];
+}
+
+int CpuTopology::getCpuNode(int cpu) const {
+    auto it = m_cpuNode.find(cpu);
+    return it == m_cpuNode.end() ? -1 : it->second;
+}
+
+int CpuTopology::getNodeOf(const std::vector<int>& cpus) const {
+    int node = -1;
+    for(auto cpu : cpus) {
+        int n = getCpuNode(cpu);
+        if(n < 0 || (node >= 0 && n != node)) {
+            return -1;
+        }
+        node = n;
+    }
+    return node;
+}
+
+std::string CpuTopology::toString() const {
+    std::stringstream ss;
+    ss << "cpus=" << FormatCpuList(m_cpus) << " physical_cores=" << m_coreCount
+       << " nodes=" << m_nodes.size();
+    for(size_t i = 0; i < m_nodes.size(); ++i) {
+        ss << " node" << i << "=[" << FormatCpuList(m_nodes[i]) << "]";
+    }
+    return ss.str();
+}
+
+std::vector<int> CpuTopology::ParseCpuList(const std::string& str) {
+    std::vector<int> cpus;
+    std::stringstream ss(str);
+    std::string item;
+    while(std::getline(ss, item, ',')) {
+        if(item.empty()) {
+            continue;
+        }
+        size_t pos = item.find('-');
+        int first = atoi(item.c_str());
+        int last = pos == std::string::npos ? first : atoi(item.c_str() + pos + 1);
+        for(int i = first; i <= last; ++i) {
+            cpus.push_back(i);
+        }
+    }
+    std::sort(cpus.begin(), cpus.end());
+    cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+    return cpus;
+}
+
+std::string CpuTopology::FormatCpuList(const std::vector<int>& cpus) {
+    std::stringstream ss;
+    for(size_t i = 0; i < cpus.size(); ++i) {
+        size_t j = i;
+        while(j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1) {
+            ++j;
+        }
+        if(i) {
+            ss << ",";
+        }
+        ss << cpus[i];
+        if(j > i) {
+            ss << "-" << cpus[j];
+        }
+        i = j;
+    }
+    return ss.str();
+}
+
+AffinityPolicy::AffinityPolicy(const std::string& policy) {
+    if(policy.empty() || policy == "none") {
+        return;
+    }
+    CpuTopology* topo = CpuTopologyMgr::GetInstance();
+    if(policy == "core") {
+        m_type = CORE;
+        return;
+    }
+    if(policy == "node" || policy.compare(0, 5, "node:") == 0) {
+        m_node = policy == "node" ? (int)(s_next_node++ % topo->getNodeCount())
+                                  : atoi(policy.c_str() + 5);
+        m_cpus = topo->getNodeCpus(m_node);
+        m_type = NODE;
+    } else if(policy.compare(0, 5, "cpus:") == 0) {
+        for(auto cpu : CpuTopology::ParseCpuList(policy.substr(5))) {
+            if(topo->getCpuNode(cpu) >= 0) {
+                m_cpus.push_back(cpu);
+            }
+        }
+        m_type = CPUS;
+    } else {
+        SYLAR_LOG_ERROR(g_logger) << "invalid affinity policy: " << policy;
+        return;
+    }
+    if(m_cpus.empty()) {
+        SYLAR_LOG_ERROR(g_logger) << "affinity policy " << policy << " has no usable cpu";
+        m_type = NONE;
+        m_node = -1;
+    }
+}
+
+AffinityPolicy AffinityPolicy::ForScheduler(const std::string& name) {
+    auto policies = g_scheduler_affinity->getValue();
+    auto it = policies.find(name);
+    if(it == policies.end()) {
+        it = policies.find("*");
+    }
+    return AffinityPolicy(it == policies.end() ? "" : it->second);
+}
+
+std::vector<int> AffinityPolicy::getThreadCpus(size_t idx) const {
+    switch(m_type) {
+        case CPUS:
+        case NODE:
+            return m_cpus;
+        case CORE: {
+            const std::vector<int>& cpus = CpuTopologyMgr::GetInstance()->getCoreOrderedCpus();
+            if(cpus.empty()) {
+                return std::vector<int>();
+            }
+            return std::vector<int>(1, cpus[idx % cpus.size()]);
+        }
+        default:
+            return std::vector<int>();
+    }
+}
+
+std::string AffinityPolicy::toString() const {
+    switch(m_type) {
+        case CPUS:
+            return "cpus:" + CpuTopology::FormatCpuList(m_cpus);
+        case CORE:
+            return "core";
+        case NODE:
+            return "node:" + std::to_string(m_node);
+        default:
+            return "none";
+    }
+}
+
+}
@@ -0,0 +1,135 @@
+/**
+ * @file affinity.h
+ * @brief CPU拓扑和调度线程的CPU亲和性策略
+ * @version 0.1
+ */
+#ifndef __SYLAR_AFFINITY_H__
+#define __SYLAR_AFFINITY_H__
+
+#include <string>
+#include <vector>
+#include <map>
+#include "singleton.h"
+
+namespace sylar {
+
+/**
+ * @brief CPU拓扑
+ * @details 从/sys/devices/system读取NUMA节点和物理核心信息，只包含当前进程允许使用的CPU。
+ *          读取失败时当作只有一个节点，包含所有允许使用的CPU
+ */
+class CpuTopology {
+public:
+    CpuTopology();
+
+    /**
+     * @brief 当前进程允许使用的CPU
+     */
+    const std::vector<int>& getCpus() const { return m_cpus;}
+
+    /**
+     * @brief 按物理核心排列的CPU，每个核心的第一个逻辑CPU排在前面，超线程的兄弟CPU排在后面
+     */
+    const std::vector<int>& getCoreOrderedCpus() const { return m_coreOrdered;}
+
+    /**
+     * @brief NUMA节点数量
+     */
+    size_t getNodeCount() const { return m_nodes.size();}
+
+    /**
+     * @brief NUMA节点中允许使用的CPU，节点不存在时返回空
+     */
+    const std::vector<int>& getNodeCpus(int node) const;
+
+    /**
+     * @brief CPU所在的NUMA节点，未知返回-1
+     */
+    int getCpuNode(int cpu) const;
+
+    /**
+     * @brief 一组CPU都在同一个NUMA节点上时返回该节点，否则返回-1
+     */
+    int getNodeOf(const std::vector<int>& cpus) const;
+
+    /**
+     * @brief 拓扑的文字描述
+     */
+    std::string toString() const;
+
+    /**
+     * @brief 解析"0-3,8,10-11"格式的CPU列表
+     */
+    static std::vector<int> ParseCpuList(const std::string& str);
+
+    /**
+     * @brief 输出"0-3,8,10-11"格式的CPU列表
+     */
+    static std::string FormatCpuList(const std::vector<int>& cpus);
+private:
+    /// 允许使用的CPU
+    std::vector<int> m_cpus;
+    /// 按物理核心排列的CPU
+    std::vector<int> m_coreOrdered;
+    /// 物理核心数
+    size_t m_coreCount = 0;
+    /// 每个NUMA节点允许使用的CPU，下标是节点号
+    std::vector<std::vector<int> > m_nodes;
+    /// CPU到NUMA节点的映射
+    std::map<int, int> m_cpuNode;
+};
+
+/// CPU拓扑单例
+typedef Singleton<CpuTopology> CpuTopologyMgr;
+
+/**
+ * @brief 调度线程的放置策略
+ * @details 配置格式:
+ *          none          不设置亲和性(默认)
+ *          cpus:0-3,8    所有线程都绑定到这组CPU
+ *          core          每个线程绑定一个物理核心，线程数多于核心时轮转
+ *          node:1        所有线程绑定到NUMA节点1的CPU
+ *          node          每个使用该策略的调度器依次占用一个NUMA节点
+ */
+class AffinityPolicy {
+public:
+    enum Type {
+        NONE,
+        CPUS,
+        CORE,
+        NODE
+    };
+
+    /**
+     * @brief 解析策略，格式错误时记录错误日志，当作none
+     */
+    AffinityPolicy(const std::string& policy);
+
+    /**
+     * @brief 读取scheduler.affinity中调度器名称对应的策略，没有配置时使用"*"对应的策略
+     */
+    static AffinityPolicy ForScheduler(const std::string& name);
+
+    Type getType() const { return m_type;}
+
+    /**
+     * @brief 第idx个调度线程绑定的CPU，空表示不绑定
+     */
+    std::vector<int> getThreadCpus(size_t idx) const;
+
+    /**
+     * @brief 策略的文字描述
+     */
+    std::string toString() const;
+private:
+    /// 策略类型
+    Type m_type = NONE;
+    /// CPUS和NODE策略绑定的CPU
+    std::vector<int> m_cpus;
+    /// NODE策略的节点
+    int m_node = -1;
+};
+
+}
+
+#endif
@@ -0,0 +1,332 @@
+/**
+ * @file channel.h
+ * @brief 协程间的有界通道
+ * @details 多生产者多消费者，push/pop在通道满/空时只挂起当前协程，不阻塞调度线程。
+ *          非协程线程也可以使用，此时阻塞线程，并且可以唤醒在其他调度器上等待的协程
+ * @version 0.1
+ */
+#ifndef __SYLAR_CHANNEL_H__
+#define __SYLAR_CHANNEL_H__
+
+#include <memory>
+#include <list>
+#include <deque>
+#include <vector>
+#include "fiber_sync.h"
+#include "mutex.h"
+#include "util.h"
+#include "noncopyable.h"
+
+namespace sylar {
+
+/**
+ * @brief 有界通道
+ * @details 等待者被唤醒后重新检查通道状态(wake-and-retry)，所以唤醒不会丢失也不会重复消费。
+ *          通道关闭后push返回false，pop把剩余的数据取完之后返回false
+ */
+template<class T>
+class Channel : Noncopyable {
+public:
+    typedef std::shared_ptr<Channel> ptr;
+
+    /**
+     * @brief 构造函数
+     * @param[in] capacity 通道容量，至少为1
+     */
+    Channel(size_t capacity)
+        :m_capacity(capacity ? capacity : 1) {
+    }
+
+    /**
+     * @brief 写入数据，通道满时挂起当前协程
+     * @param[in] v 数据
+     * @param[in] timeout_ms 超时时间(毫秒)，~0ull表示不超时
+     * @return 写入成功返回true，超时或通道已关闭返回false
+     */
+    bool push(const T& v, uint64_t timeout_ms = ~0ull) {
+        uint64_t deadline = GetDeadline(timeout_ms);
+        FiberWaiter::ptr waiter;
+        while(true) {
+            {
+                Spinlock::Lock lock(m_mutex);
+                if(m_closed) {
+                    return false;
+                }
+                if(m_queue.size() < m_capacity) {
+                    m_queue.push_back(v);
+                    lock.unlock();
+                    notifyOne(m_readers);
+                    return true;
+                }
+                if(waiter) {
+                    m_writers.push_back(waiter);
+                }
+            }
+            if(!waiter) {
+                // 在锁外创建等待者，再重新检查一次
+                waiter.reset(new FiberWaiter);
+                continue;
+            }
+            if(!waitFor(waiter, m_writers, deadline)) {
+                return false;
+            }
+            waiter.reset();
+        }
+    }
+
+    /**
+     * @brief 读取数据，通道空时挂起当前协程
+     * @param[out] v 数据
+     * @param[in] timeout_ms 超时时间(毫秒)，~0ull表示不超时
+     * @return 读取成功返回true，超时或通道已关闭且没有数据返回false
+     */
+    bool pop(T& v, uint64_t timeout_ms = ~0ull) {
+        uint64_t deadline = GetDeadline(timeout_ms);
+        FiberWaiter::ptr waiter;
+        while(true) {
+            {
+                Spinlock::Lock lock(m_mutex);
+                if(!m_queue.empty()) {
+                    v = m_queue.front();
+                    m_queue.pop_front();
+                    lock.unlock();
+                    notifyOne(m_writers);
+                    return true;
+                }
+                if(m_closed) {
+                    return false;
+                }
+                if(waiter) {
+                    m_readers.push_back(waiter);
+                }
+            }
+            if(!waiter) {
+                waiter.reset(new FiberWaiter);
+                continue;
+            }
+            if(!waitFor(waiter, m_readers, deadline)) {
+                return false;
+            }
+            waiter.reset();
+        }
+    }
+
+    /**
+     * @brief 尝试写入，不等待
+     */
+    bool tryPush(const T& v) {
+        {
+            Spinlock::Lock lock(m_mutex);
+            if(m_closed || m_queue.size() >= m_capacity) {
+                return false;
+            }
+            m_queue.push_back(v);
+        }
+        notifyOne(m_readers);
+        return true;
+    }
+
+    /**
+     * @brief 尝试读取，不等待
+     */
+    bool tryPop(T& v) {
+        {
+            Spinlock::Lock lock(m_mutex);
+            if(m_queue.empty()) {
+                return false;
+            }
+            v = m_queue.front();
+            m_queue.pop_front();
+        }
+        notifyOne(m_writers);
+        return true;
+    }
+
+    /**
+     * @brief 关闭通道，唤醒所有等待者
+     */
+    void close() {
+        std::list<FiberWaiter::ptr> readers;
+        std::list<FiberWaiter::ptr> writers;
+        {
+            Spinlock::Lock lock(m_mutex);
+            m_closed = true;
+            readers.swap(m_readers);
+            writers.swap(m_writers);
+        }
+        for(auto& i : readers) {
+            i->notify();
+        }
+        for(auto& i : writers) {
+            i->notify();
+        }
+    }
+
+    /**
+     * @brief 通道是否已关闭
+     */
+    bool isClosed() {
+        Spinlock::Lock lock(m_mutex);
+        return m_closed;
+    }
+
+    /**
+     * @brief 返回通道中的数据数量
+     */
+    size_t size() {
+        Spinlock::Lock lock(m_mutex);
+        return m_queue.size();
+    }
+
+    /**
+     * @brief 返回通道容量
+     */
+    size_t capacity() const { return m_capacity;}
+
+    /**
+     * @brief 从多个通道中读取，任意一个通道有数据就返回
+     * @param[in] chans 通道数组
+     * @param[out] v 数据
+     * @param[in] timeout_ms 超时时间(毫秒)，~0ull表示不超时
+     * @return 读到数据的通道在chans中的下标，超时或者所有通道都已关闭且没有数据返回-1
+     * @details 同一个等待者登记在所有通道上，被任意一个通道唤醒后撤销登记，重新检查所有通道。
+     *          如果消费的唤醒不是来自最终读到数据的通道，把唤醒转交给那个通道的其他等待者
+     */
+    static int Select(const std::vector<ptr>& chans, T& v, uint64_t timeout_ms = ~0ull) {
+        uint64_t deadline = GetDeadline(timeout_ms);
+        bool woken = false;
+        while(true) {
+            FiberWaiter::ptr waiter(new FiberWaiter);
+            int idx = -1;
+            bool all_closed = true;
+            size_t visited = 0;
+            for(; visited < chans.size(); ++visited) {
+                Channel& ch = *chans[visited];
+                Spinlock::Lock lock(ch.m_mutex);
+                if(!ch.m_queue.empty()) {
+                    v = ch.m_queue.front();
+                    ch.m_queue.pop_front();
+                    lock.unlock();
+                    ch.notifyOne(ch.m_writers);
+                    idx = visited;
+                    break;
+                }
+                if(!ch.m_closed) {
+                    all_closed = false;
+                    ch.m_readers.push_back(waiter);
+                }
+            }
+
+            if(idx >= 0 || all_closed) {
+                // 撤销已经登记的等待者，如果撤销之前已经被唤醒了，消费掉这次唤醒并转交出去
+                Unregister(chans, visited, waiter);
+                if(!waiter->cancel()) {
+                    waiter->wait();
+                    woken = true;
+                }
+                if(woken) {
+                    PassOn(chans);
+                }
+                return idx;
+            }
+
+            uint64_t now = GetElapsedMS();
+            bool notified = false;
+            if(deadline != ~0ull && now >= deadline) {
+                notified = !waiter->cancel();
+                if(notified) {
+                    waiter->wait();
+                }
+            } else {
+                notified = waiter->wait(deadline == ~0ull ? ~0ull : deadline - now);
+            }
+            Unregister(chans, chans.size(), waiter);
+            if(notified) {
+                woken = true;
+            } else {
+                if(woken) {
+                    PassOn(chans);
+                }
+                return -1;
+            }
+        }
+    }
+private:
+    static uint64_t GetDeadline(uint64_t timeout_ms) {
+        return timeout_ms == ~0ull ? ~0ull : GetElapsedMS() + timeout_ms;
+    }
+
+    /**
+     * @brief 等待被唤醒或者到达截止时间
+     * @return 被唤醒返回true，超时返回false，超时的等待者从等待队列中移除
+     */
+    bool waitFor(const FiberWaiter::ptr& waiter, std::list<FiberWaiter::ptr>& waiters, uint64_t deadline) {
+        uint64_t now = GetElapsedMS();
+        bool notified = false;
+        if(deadline != ~0ull && now >= deadline) {
+            notified = !waiter->cancel();
+            if(notified) {
+                waiter->wait();
+            }
+        } else {
+            notified = waiter->wait(deadline == ~0ull ? ~0ull : deadline - now);
+        }
+        if(!notified) {
+            Spinlock::Lock lock(m_mutex);
+            waiters.remove(waiter);
+        }
+        return notified;
+    }
+
+    /**
+     * @brief 唤醒队首的一个等待者，跳过已经超时或取消的等待者
+     */
+    void notifyOne(std::list<FiberWaiter::ptr>& waiters) {
+        while(true) {
+            FiberWaiter::ptr waiter;
+            {
+                Spinlock::Lock lock(m_mutex);
+                if(waiters.empty()) {
+                    return;
+                }
+                waiter = waiters.front();
+                waiters.pop_front();
+            }
+            if(waiter->notify()) {
+                return;
+            }
+        }
+    }
+
+    static void Unregister(const std::vector<ptr>& chans, size_t n, const FiberWaiter::ptr& waiter) {
+        for(size_t i = 0; i < n; ++i) {
+            Spinlock::Lock lock(chans[i]->m_mutex);
+            chans[i]->m_readers.remove(waiter);
+        }
+    }
+
+    static void PassOn(const std::vector<ptr>& chans) {
+        for(auto& i : chans) {
+            if(i->size() > 0) {
+                i->notifyOne(i->m_readers);
+            }
+        }
+    }
+private:
+    /// 保护内部状态
+    Spinlock m_mutex;
+    /// 通道容量
+    size_t m_capacity;
+    /// 是否已关闭
+    bool m_closed = false;
+    /// 数据
+    std::deque<T> m_queue;
+    /// 等待读的等待者
+    std::list<FiberWaiter::ptr> m_readers;
+    /// 等待写的等待者
+    std::list<FiberWaiter::ptr> m_writers;
+};
+
+}
+
+#endif
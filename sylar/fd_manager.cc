@@ -3,46 +3,54 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <stdlib.h>
+#include <new>
 
 namespace sylar {
 
-FdCtx::FdCtx(int fd) 
+/// 下一个FdCtx的id
+static std::atomic<uint64_t> s_next_fd_ctx_id = {1};
+
+FdCtx::FdCtx()
     :m_isInit(false)
     ,m_isSocket(false)
+    ,m_isRegular(false)
     ,m_sysNonblock(false)
     ,m_userNonblock(false)
     ,m_isClosed(false)
-    ,m_fd(fd)
+    ,m_state(0)
     ,m_recvTimeout(-1)
-    ,m_sendTimeout(-1) {
-    init();
+    ,m_sendTimeout(-1)
+    ,m_id(0) {
 }
 
 FdCtx::~FdCtx() {
 }
 
 bool FdCtx::init() {
-    if(m_isInit) {
-        return true;
-    }
+    // 记录复用时上一个句柄的属性都要重置
+    m_id = s_next_fd_ctx_id++;
+    m_isInit = false;
     m_recvTimeout = -1;
     m_sendTimeout = -1;
 
-    //获取fd信息，检查是否是socket
+    //获取fd信息，检查是否是socket、普通文件
     struct stat fd_stat;
-    if(-1 == fstat(m_fd, &fd_stat)) {
+    if(-1 == fstat(fd, &fd_stat)) {
         m_isInit = false;
         m_isSocket = false;
+        m_isRegular = false;
     } else {
         m_isInit = true;
         m_isSocket = S_ISSOCK(fd_stat.st_mode);
+        m_isRegular = S_ISREG(fd_stat.st_mode);
     }
 
     if(m_isSocket) {
-        int flags = fcntl_f(m_fd, F_GETFL, 0);
+        int flags = fcntl_f(fd, F_GETFL, 0);
         //设置socket非阻塞
         if(!(flags & O_NONBLOCK)) {
-            fcntl_f(m_fd, F_SETFL, flags | O_NONBLOCK);
+            fcntl_f(fd, F_SETFL, flags | O_NONBLOCK);
         }
         m_sysNonblock = true;
     } else {
@@ -71,42 +79,96 @@ uint64_t FdCtx::getTimeout(int type) {
 }
 
 FdManager::FdManager() {
-    m_datas.resize(64);
+    for(int i = 0; i < MAX_CHUNKS; ++i) {
+        m_chunks[i] = nullptr;
+    }
+    // 和原来预留64个句柄一样，先分配第一块
+    allocChunk(0);
 }
 
-FdCtx::ptr FdManager::get(int fd, bool auto_create) {
-    if(fd == -1) {
-        return nullptr;
-    }
-    //读锁，如果管理器中有该fd，并且不要自动创建fd，返回该fd上下文
-    RWMutexType::ReadLock lock(m_mutex);
-    if((int) m_datas.size() <= fd) {
-        if(auto_create == false) {
-            return nullptr;
+FdManager::~FdManager() {
+    for(int i = 0; i < MAX_CHUNKS; ++i) {
+        FdCtx* chunk = m_chunks[i];
+        if(!chunk) {
+            continue;
         }
-    } else {
-        if(m_datas[fd] || !auto_create) {
-            return m_datas[fd];
+        for(int j = 0; j < CHUNK_SIZE; ++j) {
+            chunk[j].~FdCtx();
         }
+        free(chunk);
     }
-    lock.unlock();
+}
+
+FdCtx* FdManager::allocChunk(int index) {
+    // C++11的new不保证超过16字节的对齐，手动按缓存行分配
+    void* mem = nullptr;
+    int rt = posix_memalign(&mem, alignof(FdCtx), sizeof(FdCtx) * CHUNK_SIZE);
+    SYLAR_ASSERT2(rt == 0, "posix_memalign rt=" << rt);
+    FdCtx* chunk = (FdCtx*)mem;
+    for(int i = 0; i < CHUNK_SIZE; ++i) {
+        new (&chunk[i]) FdCtx();
+        chunk[i].fd = index * CHUNK_SIZE + i;
+    }
+
+    FdCtx* expected = nullptr;
+    if(!m_chunks[index].compare_exchange_strong(expected, chunk, std::memory_order_acq_rel)) {
+        // 其他线程先分配好了
+        for(int i = 0; i < CHUNK_SIZE; ++i) {
+            chunk[i].~FdCtx();
+        }
+        free(chunk);
+        return expected;
+    }
+    return chunk;
+}
 
-    //写锁，管理器中没有该fd上下文，自动创建fd上下文
-    RWMutexType::WriteLock lock2(m_mutex);
-    FdCtx::ptr ctx(new FdCtx(fd));
-    if(fd >= (int)m_datas.size()) {
-        m_datas.resize(fd * 1.5);
+FdCtx* FdManager::get(int fd, bool auto_create) {
+    FdCtx* ctx = at(fd, auto_create);
+    if(!ctx) {
+        return nullptr;
+    }
+    //已经受管理，直接返回，不加锁
+    uint8_t state = ctx->m_state.load(std::memory_order_acquire);
+    if(SYLAR_LIKELY(state == 2)) {
+        return ctx;
+    }
+    if(!auto_create) {
+        return nullptr;
     }
-    m_datas[fd] = ctx;
-    return ctx;
 
+    //记录还没有被管理，抢到初始化权的线程初始化，其他线程等它完成
+    while(true) {
+        if(state == 0 && ctx->m_state.compare_exchange_weak(state, 1, std::memory_order_acquire)) {
+            ctx->init();
+            ctx->m_state.store(2, std::memory_order_release);
+            return ctx;
+        }
+        if(state == 2) {
+            return ctx;
+        }
+        sched_yield();
+        state = ctx->m_state.load(std::memory_order_acquire);
+    }
 }
 
 void FdManager::del(int fd) {
-    RWMutexType::WriteLock lock(m_mutex);
-    if((int)m_datas.size() <= fd) {
+    FdCtx* ctx = at(fd);
+    if(!ctx) {
         return;
     }
-    m_datas[fd].reset();
+    ctx->m_isClosed = true;
+    ctx->m_state.store(0, std::memory_order_release);
+}
+
+void FdManager::foreach(const std::function<void(FdCtx*)>& cb) {
+    for(int i = 0; i < MAX_CHUNKS; ++i) {
+        FdCtx* chunk = m_chunks[i].load(std::memory_order_acquire);
+        if(!chunk) {
+            continue;
+        }
+        for(int j = 0; j < CHUNK_SIZE; ++j) {
+            cb(&chunk[j]);
+        }
+    }
+}
 }
-}
\ No newline at end of file
@@ -3,8 +3,12 @@
 
 #include <memory>
 #include <vector>
+#include <atomic>
+#include <functional>
 #include "thread.h"
 #include "singleton.h"
+#include "iomanager.h"
+#include "macro.h"
 
 namespace sylar {
 
@@ -12,14 +16,16 @@ namespace sylar {
  * @brief 文件句柄上下文类
  * @details 管理文件句柄类型(是否socket)
  *          是否阻塞,是否关闭,读/写超时时间
+ *          同时也是IOManager在这个fd上的事件上下文，hook的IO调用只查一次表就拿到全部状态。
+ *          每个fd一条记录，按缓存行对齐，放在FdManager的两级表里，分配之后不移动也不释放，
+ *          fd关闭之后再打开复用同一条记录，用getId()区分先后打开的句柄
  */
-class FdCtx : public std::enable_shared_from_this<FdCtx> {
+class alignas(64) FdCtx : public IOManager::FdContext {
 public:
-    typedef std::shared_ptr<FdCtx> ptr;
     /**
-     * @brief 通过文件句柄构造FdCtx
+     * @brief 构造函数，记录创建时句柄还不受管理，由FdManager::get(fd, true)初始化
      */
-    FdCtx(int fd);
+    FdCtx();
 
     /**
      * @brief 析构函数
@@ -36,6 +42,11 @@ public:
      */
     bool isSocket() const { return m_isSocket;}
 
+    /**
+     * @brief 是否普通文件
+     */
+    bool isRegularFile() const { return m_isRegular;}
+
     /**
      * @brief 是否已关闭
      */
@@ -77,63 +88,116 @@ public:
      */
     uint64_t getTimeout(int type);
 
+    /**
+     * @brief 进程内唯一的id，同一个fd号关闭后重新打开时id不同
+     */
+    uint64_t getId() const { return m_id;}
+
 private:
     /**
      * @brief 初始化
      */
     bool init();
 private:
+    friend class FdManager;
+
     /// 是否初始化
     bool m_isInit: 1;
     /// 是否socket
     bool m_isSocket: 1;
+    /// 是否普通文件
+    bool m_isRegular: 1;
     /// 是否hook非阻塞
     bool m_sysNonblock: 1;
     /// 是否用户主动设置非阻塞
     bool m_userNonblock: 1;
     /// 是否关闭
     bool m_isClosed: 1;
-    /// 文件句柄
-    int m_fd;
+    /// 句柄是否受FdManager管理，0未管理，1正在初始化，2已管理
+    std::atomic<uint8_t> m_state;
     /// 读超时时间毫秒
     uint64_t m_recvTimeout;
     /// 写超时时间毫秒
     uint64_t m_sendTimeout;
+    /// 唯一id
+    uint64_t m_id;
 };
 
 
 /**
  * @brief 文件句柄管理类
+ * @details 两级表：第一级是固定大小的块指针数组，第二级每块CHUNK_SIZE条记录，按需分配后用CAS挂上去。
+ *          扩容不移动已有的记录，查表不加锁，返回裸指针，没有引用计数
  */
 class FdManager {
 public:
-    typedef RWMutex RWMutexType;
+    /// 每块记录数的位数
+    static const int CHUNK_BITS = 8;
+    /// 每块的记录数
+    static const int CHUNK_SIZE = 1 << CHUNK_BITS;
+    /// 块数，能管理的fd上限是MAX_CHUNKS * CHUNK_SIZE
+    static const int MAX_CHUNKS = 4096;
+
     /**
      * @brief 无参构造函数
      */
     FdManager();
 
+    /**
+     * @brief 析构函数，释放所有记录
+     */
+    ~FdManager();
+
     /**
      * @brief 获取/创建文件句柄类FdCtx
      * @param[in] fd 文件句柄
      * @param[in] auto_create 是否自动创建
-     * @return 返回对应文件句柄类FdCtx::ptr
+     * @return 返回对应文件句柄类FdCtx，句柄不受管理并且不自动创建时返回nullptr
      */
-    FdCtx::ptr get(int fd, bool auto_create = false);
+    FdCtx* get(int fd, bool auto_create = false);
+
+    /**
+     * @brief 获取fd的记录，不管句柄是否受管理，IOManager用来存放事件上下文
+     * @param[in] fd 文件句柄
+     * @param[in] auto_create 记录所在的块还没有分配时是否分配
+     * @return fd超出上限，或者块没有分配并且不自动分配时返回nullptr
+     */
+    FdCtx* at(int fd, bool auto_create = false) {
+        if(SYLAR_UNLIKELY(fd < 0 || fd >= MAX_CHUNKS * CHUNK_SIZE)) {
+            return nullptr;
+        }
+        FdCtx* chunk = m_chunks[fd >> CHUNK_BITS].load(std::memory_order_acquire);
+        if(SYLAR_UNLIKELY(!chunk)) {
+            if(!auto_create) {
+                return nullptr;
+            }
+            chunk = allocChunk(fd >> CHUNK_BITS);
+        }
+        return chunk + (fd & (CHUNK_SIZE - 1));
+    }
 
     /**
      * @brief 删除文件句柄类
+     * @details 记录本身保留，只是不再受管理
      * @param[in] fd 文件句柄
      */
     void del(int fd);
+
+    /**
+     * @brief 遍历已经分配的记录
+     */
+    void foreach(const std::function<void(FdCtx*)>& cb);
+private:
+    /**
+     * @brief 分配第index块记录，并发分配时只有一个生效
+     */
+    FdCtx* allocChunk(int index);
 private:
-    ///读写锁
-    RWMutexType m_mutex;
-    ///文件句柄集合
-    std::vector<FdCtx::ptr> m_datas;
+    /// 记录块，分配之后不会改变
+    std::atomic<FdCtx*> m_chunks[MAX_CHUNKS];
 };
 /// 文件句柄单例
 typedef Singleton<FdManager> FdMgr;
 
 }
-#endif
\ No newline at end of file
+#endif
@@ -4,6 +4,21 @@
 #include "log.h"
 #include "scheduler.h"
 #include <atomic>
+#include <deque>
+#include <unordered_map>
+#include <map>
+#include <algorithm>
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include <unistd.h>
+#ifdef SYLAR_FIBER_UCONTEXT
+#include <ucontext.h>
+#else
+#include <boost/context/detail/fcontext.hpp>
+#endif
 
 namespace sylar{
     static Logger::ptr g_logger = SYLAR_LOG_NAME("system");
@@ -18,7 +33,14 @@ namespace sylar{
     //协程栈大小，可通过配置文件获取，默认128k
     static ConfigVar<uint32_t>::ptr g_fiber_stack_size = 
     Config::Lookup<uint32_t>("fiber.stack_size", 128*1024, "fiber stack size");
+    //是否统计协程栈使用量，开启后每个新栈都要填充canary，只建议在压测时开启
+    static ConfigVar<bool>::ptr g_fiber_stack_profile =
+    Config::Lookup<bool>("fiber.stack_profile", false, "profile fiber stack high-water mark");
 
+/**
+ * @brief malloc协程栈分配器
+ * @details 没有保护页，只在mmap失败时使用
+ */
 class MallocStackAllocator{
 public:
     static void* Alloc(size_t size){
@@ -30,7 +52,444 @@ public:
     }
 };
 
-using StackAllocator = MallocStackAllocator;
+/// 栈池中单个线程每种栈大小最多缓存的空闲栈数量，超过则直接munmap
+static ConfigVar<uint32_t>::ptr g_stack_pool_size =
+    Config::Lookup<uint32_t>("fiber.stack_pool.size", 256, "max idle fiber stacks cached per thread");
+/// 栈池中保持物理内存常驻的空闲栈数量超过高水位时，通过madvise归还物理内存
+static ConfigVar<uint32_t>::ptr g_stack_pool_high_watermark =
+    Config::Lookup<uint32_t>("fiber.stack_pool.high_watermark", 64, "fiber stack pool high watermark");
+/// 归还物理内存时，保留常驻的空闲栈数量
+static ConfigVar<uint32_t>::ptr g_stack_pool_low_watermark =
+    Config::Lookup<uint32_t>("fiber.stack_pool.low_watermark", 16, "fiber stack pool low watermark");
+
+//栈池参数会在每次分配和释放栈时读取，缓存一份避免每次都去拿ConfigVar的读锁
+static std::atomic<uint32_t> s_stack_pool_size{256};
+static std::atomic<uint32_t> s_stack_pool_high_watermark{64};
+static std::atomic<uint32_t> s_stack_pool_low_watermark{16};
+
+/// 栈池统计
+static std::atomic<uint64_t> s_stack_pool_hits{0};
+static std::atomic<uint64_t> s_stack_pool_misses{0};
+static std::atomic<uint64_t> s_stack_pool_released{0};
+static std::atomic<uint64_t> s_stack_pool_unmapped{0};
+static std::atomic<uint64_t> s_stack_pool_cached{0};
+static std::atomic<uint64_t> s_stack_malloc_fallbacks{0};
+
+//默认栈大小和栈统计开关在每次创建协程时读取，同样缓存一份
+static std::atomic<uint32_t> s_fiber_stack_size{128 * 1024};
+static std::atomic<bool> s_fiber_stack_profile{false};
+
+struct _StackPoolIniter {
+    _StackPoolIniter() {
+        s_fiber_stack_size = g_fiber_stack_size->getValue();
+        s_fiber_stack_profile = g_fiber_stack_profile->getValue();
+        g_fiber_stack_size->addListener([](const uint32_t& old_value, const uint32_t& new_value) {
+            s_fiber_stack_size = new_value;
+        });
+        g_fiber_stack_profile->addListener([](const bool& old_value, const bool& new_value) {
+            s_fiber_stack_profile = new_value;
+        });
+        s_stack_pool_size = g_stack_pool_size->getValue();
+        s_stack_pool_high_watermark = g_stack_pool_high_watermark->getValue();
+        s_stack_pool_low_watermark = g_stack_pool_low_watermark->getValue();
+        g_stack_pool_size->addListener([](const uint32_t& old_value, const uint32_t& new_value) {
+            s_stack_pool_size = new_value;
+        });
+        g_stack_pool_high_watermark->addListener([](const uint32_t& old_value, const uint32_t& new_value) {
+            s_stack_pool_high_watermark = new_value;
+        });
+        g_stack_pool_low_watermark->addListener([](const uint32_t& old_value, const uint32_t& new_value) {
+            s_stack_pool_low_watermark = new_value;
+        });
+    }
+};
+
+static _StackPoolIniter s_stack_pool_initer;
+
+static size_t GetPageSize() {
+    static size_t s_page_size = sysconf(_SC_PAGESIZE);
+    return s_page_size;
+}
+
+/**
+ * @brief mmap协程栈分配器
+ * @details 每个栈在低地址端多映射一个PROT_NONE的保护页，栈溢出时直接触发段错误，而不是悄悄踩坏相邻的内存
+ *          返回给调用者的地址是保护页之上的栈底，栈大小按页大小向上取整
+ */
+class MmapStackAllocator {
+public:
+    static size_t RoundSize(size_t size) {
+        size_t page = GetPageSize();
+        return (size + page - 1) / page * page;
+    }
+
+    static void* Alloc(size_t size) {
+        size_t page = GetPageSize();
+        size = RoundSize(size);
+        void* base = mmap(nullptr, size + page, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+        if(base == MAP_FAILED) {
+            //保护页让每个栈占两个映射，协程很多时会超过vm.max_map_count，由调用者退回malloc
+            return nullptr;
+        }
+        int node = Thread::GetNumaNode();
+        if(node >= 0 && node < 64) {
+            //线程绑定了NUMA节点，栈的物理内存优先从这个节点分配，不依赖第一次访问栈的是哪个线程
+            unsigned long mask = 1UL << node;
+            syscall(SYS_mbind, base, size + page, MPOL_PREFERRED, &mask, sizeof(mask) * 8, 0);
+        }
+        if(mprotect(base, page, PROT_NONE)) {
+            SYLAR_LOG_ERROR(g_logger) << "mprotect guard page fail, errno=" << errno
+                                      << " errstr=" << strerror(errno);
+        }
+        return (char*)base + page;
+    }
+
+    static void Dealloc(void* vp, size_t size) {
+        size_t page = GetPageSize();
+        size = RoundSize(size);
+        munmap((char*)vp - page, size + page);
+    }
+
+    /**
+     * @brief 归还栈占用的物理内存，虚拟地址保留，下次访问时由内核重新分配页面
+     */
+    static void Release(void* vp, size_t size) {
+        size = RoundSize(size);
+#ifdef MADV_FREE
+        if(madvise(vp, size, MADV_FREE) == 0) {
+            return;
+        }
+#endif
+        madvise(vp, size, MADV_DONTNEED);
+    }
+};
+
+/**
+ * @brief 线程局部的协程栈池
+ * @details 按栈大小分桶，每个桶里的空闲栈分为两部分：hot是物理内存仍然常驻的栈，按LIFO复用，
+ *          cold是已经通过madvise归还了物理内存的栈。hot数量超过高水位时，把最早放入的栈归还物理内存，
+ *          直到hot数量降到低水位；空闲栈总数超过栈池大小时，多出的栈直接munmap
+ */
+class StackPool : Noncopyable {
+public:
+    ~StackPool() {
+        for(auto& i : m_buckets) {
+            for(auto& vp : i.second.hot) {
+                MmapStackAllocator::Dealloc(vp, i.first);
+            }
+            for(auto& vp : i.second.cold) {
+                MmapStackAllocator::Dealloc(vp, i.first);
+            }
+            s_stack_pool_cached -= i.second.hot.size() + i.second.cold.size();
+        }
+    }
+
+    void* alloc(size_t size) {
+        Bucket& b = m_buckets[size];
+        void* vp = nullptr;
+        if(!b.hot.empty()) {
+            vp = b.hot.back();
+            b.hot.pop_back();
+        } else if(!b.cold.empty()) {
+            vp = b.cold.back();
+            b.cold.pop_back();
+        }
+        if(vp) {
+            ++s_stack_pool_hits;
+            --s_stack_pool_cached;
+            return vp;
+        }
+        ++s_stack_pool_misses;
+        return MmapStackAllocator::Alloc(size);
+    }
+
+    void dealloc(void* vp, size_t size) {
+        Bucket& b = m_buckets[size];
+        if(b.hot.size() + b.cold.size() >= s_stack_pool_size) {
+            ++s_stack_pool_unmapped;
+            MmapStackAllocator::Dealloc(vp, size);
+            return;
+        }
+        b.hot.push_back(vp);
+        ++s_stack_pool_cached;
+
+        uint32_t high = s_stack_pool_high_watermark;
+        uint32_t low = std::min((uint32_t)s_stack_pool_low_watermark, high);
+        if(b.hot.size() > high) {
+            while(b.hot.size() > low) {
+                void* cold = b.hot.front();
+                b.hot.pop_front();
+                MmapStackAllocator::Release(cold, size);
+                b.cold.push_back(cold);
+                ++s_stack_pool_released;
+            }
+        }
+    }
+private:
+    struct Bucket {
+        /// 物理内存常驻的空闲栈
+        std::deque<void*> hot;
+        /// 已归还物理内存的空闲栈
+        std::vector<void*> cold;
+    };
+    /// 栈大小 -> 空闲栈
+    std::unordered_map<size_t, Bucket> m_buckets;
+};
+
+/**
+ * @brief 线程局部栈池的持有者，线程退出时释放栈池
+ * @details 线程退出时其他thread_local对象(比如线程主协程)可能晚于栈池析构，
+ *          栈池析构之后再释放的栈直接munmap
+ */
+struct StackPoolHolder {
+    ~StackPoolHolder() {
+        delete pool;
+        pool = nullptr;
+        destroyed = true;
+    }
+    StackPool* get() {
+        if(!pool && !destroyed) {
+            pool = new StackPool;
+        }
+        return pool;
+    }
+
+    StackPool* pool = nullptr;
+    bool destroyed = false;
+};
+
+static thread_local StackPoolHolder t_stack_pool;
+
+/**
+ * @brief 栈池分配器
+ * @details 从当前线程的栈池中分配mmap栈，释放时归还到当前线程的栈池，协程可以在A线程创建、在B线程析构
+ */
+class PooledStackAllocator {
+public:
+    static void* Alloc(size_t size) {
+        size = MmapStackAllocator::RoundSize(size);
+        StackPool* pool = t_stack_pool.get();
+        if(SYLAR_UNLIKELY(!pool)) {
+            return MmapStackAllocator::Alloc(size);
+        }
+        return pool->alloc(size);
+    }
+
+    static void Dealloc(void* vp, size_t size) {
+        size = MmapStackAllocator::RoundSize(size);
+        StackPool* pool = t_stack_pool.get();
+        if(SYLAR_UNLIKELY(!pool)) {
+            MmapStackAllocator::Dealloc(vp, size);
+            return;
+        }
+        pool->dealloc(vp, size);
+    }
+};
+
+using StackAllocator = PooledStackAllocator;
+
+/**
+ * @brief 分配协程栈，mmap失败时退回malloc分配没有保护页的栈
+ * @param[out] malloced 栈是否由malloc分配，释放时原样传给DeallocStack
+ */
+static void* AllocStack(size_t size, bool& malloced) {
+    void* vp = StackAllocator::Alloc(size);
+    malloced = (vp == nullptr);
+    if(SYLAR_UNLIKELY(malloced)) {
+        if(s_stack_malloc_fallbacks++ == 0) {
+            SYLAR_LOG_WARN(g_logger) << "mmap fiber stack fail, fall back to malloc without guard page, errno="
+                                     << errno << " errstr=" << strerror(errno);
+        }
+        vp = MallocStackAllocator::Alloc(size);
+        SYLAR_ASSERT2(vp, "malloc fiber stack fail, size=" << size);
+    }
+    return vp;
+}
+
+static void DeallocStack(void* vp, size_t size, bool malloced) {
+    if(SYLAR_UNLIKELY(malloced)) {
+        MallocStackAllocator::Dealloc(vp, size);
+    } else {
+        StackAllocator::Dealloc(vp, size);
+    }
+}
+
+/// 每个线程的共享栈数量
+static ConfigVar<uint32_t>::ptr g_shared_stack_count =
+    Config::Lookup<uint32_t>("fiber.shared_stack.count", 4, "shared fiber stacks per thread");
+/// 共享栈大小
+static ConfigVar<uint32_t>::ptr g_shared_stack_size =
+    Config::Lookup<uint32_t>("fiber.shared_stack.size", 1024 * 1024, "shared fiber stack size");
+
+/// 共享栈统计
+static std::atomic<uint64_t> s_shared_stack_switches{0};
+static std::atomic<uint64_t> s_shared_stack_saves{0};
+static std::atomic<uint64_t> s_shared_stack_save_bytes{0};
+static std::atomic<uint64_t> s_shared_stack_restores{0};
+static std::atomic<uint64_t> s_shared_stack_restore_bytes{0};
+
+/**
+ * @brief 共享栈
+ */
+struct SharedStack {
+    /// 栈底(低地址)
+    char* stack = nullptr;
+    /// 栈大小
+    size_t size = 0;
+    /// 栈上当前保存着哪个协程的内容
+    Fiber* occupant = nullptr;
+    /// 栈是否由malloc分配
+    bool malloced = false;
+
+    char* top() const { return stack + size; }
+};
+
+/**
+ * @brief 线程局部的共享栈集合，协程按轮转的方式绑定共享栈
+ */
+class SharedStackPool : Noncopyable {
+public:
+    SharedStackPool() {
+        uint32_t count = std::max(g_shared_stack_count->getValue(), 1u);
+        size_t size = g_shared_stack_size->getValue();
+        m_stacks.resize(count);
+        for(auto& i : m_stacks) {
+            i.size = size;
+            i.stack = (char*)AllocStack(size, i.malloced);
+        }
+    }
+
+    ~SharedStackPool() {
+        for(auto& i : m_stacks) {
+            DeallocStack(i.stack, i.size, i.malloced);
+        }
+    }
+
+    SharedStack* next() {
+        SharedStack* ss = &m_stacks[m_next];
+        m_next = (m_next + 1) % m_stacks.size();
+        return ss;
+    }
+private:
+    std::vector<SharedStack> m_stacks;
+    size_t m_next = 0;
+};
+
+static thread_local std::unique_ptr<SharedStackPool> t_shared_stacks;
+
+/// 填充协程栈的canary
+static const uint64_t s_stack_canary = 0xcdcdcdcdcdcdcdcdull;
+
+/**
+ * @brief 协程栈使用量统计
+ * @details 按标签聚合，没有设置标签的协程按入口函数聚合：函数指针按函数地址，其他可调用对象(lambda、bind等)按类型，
+ *          函数名和类型名在查询时才解析
+ */
+class StackProfiler : Noncopyable {
+public:
+    static StackProfiler* GetInstance() {
+        static StackProfiler s_instance;
+        return &s_instance;
+    }
+
+    void record(const std::string& tag, const std::type_info* type, void* func,
+                size_t used, size_t stack_size) {
+        Mutex::Lock lock(m_mutex);
+        Entry& e = !tag.empty() ? m_tags[tag]
+                 : (func ? m_funcs[func] : m_types[type ? type->name() : ""]);
+        ++e.count;
+        e.max_used = std::max(e.max_used, (uint64_t)used);
+        e.total_used += used;
+        e.stack_size = std::max(e.stack_size, (uint64_t)stack_size);
+    }
+
+    void get(std::vector<Fiber::StackProfileEntry>& entries) {
+        Mutex::Lock lock(m_mutex);
+        entries.clear();
+        for(auto& i : m_tags) {
+            entries.push_back(i.second.toEntry(i.first));
+        }
+        for(auto& i : m_funcs) {
+            entries.push_back(i.second.toEntry(Symbolize(i.first)));
+        }
+        for(auto& i : m_types) {
+            entries.push_back(i.second.toEntry(Demangle(i.first)));
+        }
+    }
+private:
+    struct Entry {
+        uint64_t count = 0;
+        uint64_t max_used = 0;
+        uint64_t total_used = 0;
+        uint64_t stack_size = 0;
+
+        Fiber::StackProfileEntry toEntry(const std::string& tag) const {
+            Fiber::StackProfileEntry e;
+            e.tag = tag;
+            e.count = count;
+            e.max_used = max_used;
+            e.total_used = total_used;
+            e.stack_size = stack_size;
+            return e;
+        }
+    };
+
+    static std::string Demangle(const char* name) {
+        int status = 0;
+        char* v = abi::__cxa_demangle(name, nullptr, nullptr, &status);
+        if(status != 0 || !v) {
+            return name;
+        }
+        std::string rt(v);
+        free(v);
+        return rt;
+    }
+
+    static std::string Symbolize(void* func) {
+        Dl_info info;
+        if(dladdr(func, &info) && info.dli_sname) {
+            return Demangle(info.dli_sname);
+        }
+        std::stringstream ss;
+        ss << func;
+        return ss.str();
+    }
+private:
+    Mutex m_mutex;
+    /// 标签 -> 统计
+    std::map<std::string, Entry> m_tags;
+    /// 入口函数地址 -> 统计
+    std::map<void*, Entry> m_funcs;
+    /// 入口函数类型名(mangled) -> 统计
+    std::map<const char*, Entry> m_types;
+};
+
+#ifdef SYLAR_FIBER_UCONTEXT
+struct Fiber::ContextOps {
+    /**
+     * @brief 返回协程的ucontext_t，第一次使用时在堆上分配
+     */
+    static ucontext_t* Get(Fiber* f) {
+        if(!f->m_ctx) {
+            f->m_ctx = new ucontext_t;
+        }
+        return static_cast<ucontext_t*>(f->m_ctx);
+    }
+};
+#else
+struct Fiber::ContextOps {
+    /**
+     * @brief fcontext的入口函数
+     * @details 保存切换过来的协程的上下文之后进入MainFunc。
+     *          fcontext切换时不保存信号掩码，不需要rt_sigprocmask系统调用
+     */
+    static void Entry(boost::context::detail::transfer_t t) {
+        static_cast<Fiber*>(t.data)->m_ctx = t.fctx;
+        MainFunc();
+    }
+};
+#endif
 
 //返回的是当前正在运行的协程ID
 uint64_t Fiber::GetFiberId(){
@@ -44,9 +503,11 @@ Fiber::Fiber() {
     SetThis(this);
     m_state = RUNNING;
 
-    if (getcontext(&m_ctx)) {
+#ifdef SYLAR_FIBER_UCONTEXT
+    if (getcontext(ContextOps::Get(this))) {
         SYLAR_ASSERT2(false, "getcontext");
     }
+#endif
 
     ++s_fiber_count;
     m_id = s_fiber_id++; 
@@ -57,19 +518,21 @@ Fiber::Fiber() {
 /**
  * 带参数的构造函数用于创建其他协程，需要分配栈
  */
-Fiber::Fiber(std::function<void()> cb, size_t stacksize, bool run_in_scheduler)
+Fiber::Fiber(std::function<void()> cb, size_t stacksize, bool run_in_scheduler, bool shared_stack)
     :m_id(s_fiber_id++), m_cb(cb), m_runInScheduler(run_in_scheduler){
+    m_cbType = &m_cb.target_type();
     ++s_fiber_count;
-    m_stacksize = stacksize ? stacksize : g_fiber_stack_size->getValue();
-    m_stack = StackAllocator::Alloc(m_stacksize);
-    if(getcontext(&m_ctx)){
-        SYLAR_ASSERT2(false, "getcontext");//getcontext报错
+#ifndef SYLAR_FIBER_UCONTEXT
+    m_sharedStack = shared_stack;
+#endif
+    if(m_sharedStack) {
+        // 共享栈协程在第一次resume时才绑定共享栈并初始化上下文
+        return;
     }
-    m_ctx.uc_link = nullptr;//下次要执行的协程
-    m_ctx.uc_stack.ss_sp = m_stack;
-    m_ctx.uc_stack.ss_size = m_stacksize;
-
-    makecontext(&m_ctx, &Fiber::MainFunc, 0);
+    m_stacksize = stacksize ? stacksize : s_fiber_stack_size.load();
+    m_stack = AllocStack(m_stacksize, m_mallocStack);
+    paintStack();
+    makeContext();
 
     SYLAR_LOG_DEBUG(g_logger) << "Fiber::Fiber id = " << m_id;
 
@@ -82,10 +545,17 @@ Fiber::Fiber(std::function<void()> cb, size_t stacksize, bool run_in_scheduler)
 Fiber::~Fiber() {
     SYLAR_LOG_DEBUG(g_logger) << "Fiber::~Fiber() id = " << m_id;
     --s_fiber_count;
-    if (m_stack) {
+#ifdef SYLAR_FIBER_UCONTEXT
+    delete static_cast<ucontext_t*>(m_ctx);
+#endif
+    if (m_sharedStack) {
+        // 共享栈协程结束时已经解除了与共享栈的绑定，只需要释放私有缓冲区
+        SYLAR_ASSERT(m_state == TERM);
+        free(m_saveBuffer);
+    } else if (m_stack) {
         // 有栈，说明是子协程，需要确保子协程一定是结束状态
         SYLAR_ASSERT(m_state == TERM);
-        StackAllocator::Dealloc(m_stack, m_stacksize);
+        DeallocStack(m_stack, m_stacksize, m_mallocStack);
         SYLAR_LOG_DEBUG(g_logger) << "dealloc stack, id = " << m_id;
     } else {
         // 没有栈，说明是线程的主协程
@@ -100,20 +570,145 @@ Fiber::~Fiber() {
 }
 
 void Fiber::reset(std::function<void()> cb){
-    SYLAR_ASSERT(m_stack);
+    SYLAR_ASSERT(m_stack || m_sharedStack);
     SYLAR_ASSERT(m_state == TERM );
     m_cb = cb;
-    if(getcontext(&m_ctx)){
-        SYLAR_ASSERT2(false, "getcontext");
+    m_cbType = &m_cb.target_type();
+    m_stackTag.clear();
+    if(m_sharedStack) {
+#ifndef SYLAR_FIBER_UCONTEXT
+        // 和构造时一样，等到resume时再初始化上下文
+        m_ctx = nullptr;
+#endif
+    } else {
+        paintStack();
+        makeContext();
     }
-    m_ctx.uc_link = nullptr;
-    m_ctx.uc_stack.ss_sp = m_stack;
-    m_ctx.uc_stack.ss_size = m_stacksize;
-   
-    makecontext(&m_ctx, &Fiber::MainFunc, 0);
     m_state = READY;
 }
 
+void Fiber::paintStack() {
+    m_stackPainted = s_fiber_stack_profile;
+    if(!m_stackPainted) {
+        return;
+    }
+    void (* const* func)() = m_cb.target<void(*)()>();
+    m_cbFunc = func ? reinterpret_cast<void*>(*func) : nullptr;
+    uint64_t* p = static_cast<uint64_t*>(m_stack);
+    std::fill(p, p + m_stacksize / sizeof(uint64_t), s_stack_canary);
+}
+
+void Fiber::profileStack() {
+    if(!m_stackPainted) {
+        return;
+    }
+    // 栈从高地址向低地址增长，从栈底往上第一个被改写的位置就是最高水位
+    const uint64_t* p = static_cast<const uint64_t*>(m_stack);
+    size_t n = m_stacksize / sizeof(uint64_t);
+    size_t i = 0;
+    while(i < n && p[i] == s_stack_canary) {
+        ++i;
+    }
+    StackProfiler::GetInstance()->record(m_stackTag, m_cbType, m_cbFunc,
+                                         m_stacksize - i * sizeof(uint64_t), m_stacksize);
+    m_stackPainted = false;
+}
+
+void Fiber::makeContext() {
+#ifdef SYLAR_FIBER_UCONTEXT
+    ucontext_t* ctx = ContextOps::Get(this);
+    if(getcontext(ctx)){
+        SYLAR_ASSERT2(false, "getcontext");//getcontext报错
+    }
+    ctx->uc_link = nullptr;//下次要执行的协程
+    ctx->uc_stack.ss_sp = m_stack;
+    ctx->uc_stack.ss_size = m_stacksize;
+
+    makecontext(ctx, &Fiber::MainFunc, 0);
+#else
+    // fcontext的栈从高地址向低地址增长，传入的是栈顶地址
+    m_ctx = boost::context::detail::make_fcontext((char*)m_stack + m_stacksize,
+                                                  m_stacksize, &ContextOps::Entry);
+#endif
+}
+
+void Fiber::acquireSharedStack() {
+#ifndef SYLAR_FIBER_UCONTEXT
+    if(!m_shared) {
+        if(!t_shared_stacks) {
+            t_shared_stacks.reset(new SharedStackPool);
+        }
+        m_shared = t_shared_stacks->next();
+        m_boundThread = GetThreadId();
+    }
+    SYLAR_ASSERT2(m_boundThread == GetThreadId(), "shared stack fiber id=" << m_id
+                  << " bound to thread " << m_boundThread);
+    ++s_shared_stack_switches;
+
+    SharedStack* ss = m_shared;
+    if(ss->occupant == this) {
+        // 挂起之后共享栈没有被其他协程用过，栈内容还在，不需要拷贝
+        return;
+    }
+    if(ss->occupant) {
+        ss->occupant->saveSharedStack();
+    }
+    ss->occupant = this;
+
+    if(!m_ctx) {
+        // 新创建或者reset之后的协程，在共享栈上初始化上下文
+        m_ctx = boost::context::detail::make_fcontext(ss->top(), ss->size, &ContextOps::Entry);
+        return;
+    }
+    SYLAR_ASSERT((char*)m_ctx == ss->top() - m_saveSize);
+    memcpy(ss->top() - m_saveSize, m_saveBuffer, m_saveSize);
+    ++s_shared_stack_restores;
+    s_shared_stack_restore_bytes += m_saveSize;
+#endif
+}
+
+void Fiber::saveSharedStack() {
+#ifndef SYLAR_FIBER_UCONTEXT
+    SYLAR_ASSERT(m_state == READY);
+    // 挂起时m_ctx就是栈指针，共享栈上从m_ctx到栈顶是已使用的部分
+    size_t used = m_shared->top() - (char*)m_ctx;
+    // 缓冲区按实际使用量分配，容量不够或者浪费一半以上时重新分配
+    if(m_saveCapacity < used || m_saveCapacity > used * 2) {
+        free(m_saveBuffer);
+        m_saveBuffer = (char*)malloc(used);
+        m_saveCapacity = used;
+    }
+    memcpy(m_saveBuffer, m_ctx, used);
+    m_saveSize = used;
+    ++s_shared_stack_saves;
+    s_shared_stack_save_bytes += used;
+#endif
+}
+
+void Fiber::releaseSharedStack() {
+    if(m_shared && m_shared->occupant == this) {
+        m_shared->occupant = nullptr;
+    }
+    m_shared = nullptr;
+    m_boundThread = -1;
+    free(m_saveBuffer);
+    m_saveBuffer = nullptr;
+    m_saveCapacity = 0;
+    m_saveSize = 0;
+}
+
+void Fiber::SwapContext(Fiber* from, Fiber* to) {
+#ifdef SYLAR_FIBER_UCONTEXT
+    if (swapcontext(ContextOps::Get(from), ContextOps::Get(to))) {
+        SYLAR_ASSERT2(false, "swapcontext");
+    }
+#else
+    // jump_fcontext返回时说明有协程切回了from，t.fctx是那个协程挂起时的上下文，t.data是那个协程本身
+    boost::context::detail::transfer_t t = boost::context::detail::jump_fcontext(to->m_ctx, from);
+    static_cast<Fiber*>(t.data)->m_ctx = t.fctx;
+#endif
+}
+
 
 void Fiber::SetThis(Fiber* f){
     t_fiber = f;
@@ -137,24 +732,27 @@ Fiber::ptr Fiber::GetThis(){
 
 void Fiber::resume() {
     SYLAR_ASSERT(m_state != TERM && m_state != RUNNING);
+    if (m_sharedStack) {
+        // 在切换之前完成共享栈的拷贝，此时运行在调度协程或线程主协程的栈上
+        acquireSharedStack();
+    }
     SetThis(this);
     m_state = RUNNING;
 
     // 如果协程参与调度器调度，那么应该和调度器的主协程进行swap，而不是线程主协程
     if (m_runInScheduler) {
-        if (swapcontext(&(Scheduler::GetMainFiber()->m_ctx), &m_ctx)) {
-            SYLAR_ASSERT2(false, "swapcontext");
-        }
+        SwapContext(Scheduler::GetMainFiber(), this);
     } else {
-        if (swapcontext(&(t_thread_fiber->m_ctx), &m_ctx)) {
-            SYLAR_ASSERT2(false, "swapcontext");
-        }
+        SwapContext(t_thread_fiber.get(), this);
     }
 }
 
 void Fiber::yield() {
     // 协程运行完之后会自动yield一次，用于回到主协程，此时状态已为结束状态
     SYLAR_ASSERT(m_state == RUNNING || m_state == TERM);
+#ifndef NDEBUG
+    SYLAR_ASSERT2(!Scheduler::InInlineTask(), "inline task must not yield");
+#endif
     SetThis(t_thread_fiber.get());
     if (m_state != TERM) {
         m_state = READY;
@@ -162,13 +760,9 @@ void Fiber::yield() {
 
     // 如果协程参与调度器调度，那么应该和调度器的主协程进行swap，而不是线程主协程
     if (m_runInScheduler) {
-        if (swapcontext(&m_ctx, &(Scheduler::GetMainFiber()->m_ctx))) {
-            SYLAR_ASSERT2(false, "swapcontext");
-        }
+        SwapContext(this, Scheduler::GetMainFiber());
     } else {
-        if (swapcontext(&m_ctx, &(t_thread_fiber->m_ctx))) {
-            SYLAR_ASSERT2(false, "swapcontext");
-        }
+        SwapContext(this, t_thread_fiber.get());
     }
 }
 
@@ -176,6 +770,58 @@ uint64_t Fiber::TotalFibers() {
     return s_fiber_count;
 }
 
+uint32_t Fiber::GetDefaultStackSize() {
+    return s_fiber_stack_size;
+}
+
+void Fiber::SetStackTag(const std::string& tag) {
+    if(!s_fiber_stack_profile || !t_fiber) {
+        return;
+    }
+    t_fiber->m_stackTag = tag;
+}
+
+void Fiber::GetStackProfile(std::vector<StackProfileEntry>& entries) {
+    StackProfiler::GetInstance()->get(entries);
+}
+
+void Fiber::DumpStackProfile() {
+    std::vector<StackProfileEntry> entries;
+    GetStackProfile(entries);
+    for(auto& i : entries) {
+        SYLAR_LOG_INFO(g_logger) << "fiber stack profile: tag=" << i.tag
+            << " count=" << i.count
+            << " max_used=" << i.max_used
+            << " avg_used=" << (i.count ? i.total_used / i.count : 0)
+            << " stack_size=" << i.stack_size;
+    }
+}
+
+Fiber::StackPoolStats Fiber::GetStackPoolStats() {
+    StackPoolStats stats;
+    stats.hits = s_stack_pool_hits;
+    stats.misses = s_stack_pool_misses;
+    stats.released = s_stack_pool_released;
+    stats.unmapped = s_stack_pool_unmapped;
+    stats.cached = s_stack_pool_cached;
+    stats.mallocFallbacks = s_stack_malloc_fallbacks;
+    return stats;
+}
+
+bool Fiber::HasThreadSharedStacks() {
+    return t_shared_stacks != nullptr;
+}
+
+Fiber::SharedStackStats Fiber::GetSharedStackStats() {
+    SharedStackStats stats;
+    stats.switches = s_shared_stack_switches;
+    stats.saves = s_shared_stack_saves;
+    stats.save_bytes = s_shared_stack_save_bytes;
+    stats.restores = s_shared_stack_restores;
+    stats.restore_bytes = s_shared_stack_restore_bytes;
+    return stats;
+}
+
 /**
  * 这里没有处理协程函数出现异常的情况，同样是为了简化状态管理，并且个人认为协程的异常不应该由框架处理，应该由开发者自行处理
  */
@@ -185,6 +831,11 @@ void Fiber::MainFunc(){
     cur->m_cb();
     cur->m_cb = nullptr;
     cur->m_state = TERM;
+    cur->profileStack();
+    if (cur->m_sharedStack) {
+        // 协程已经结束，栈上的内容不再需要保存，其他协程可以直接使用这个共享栈
+        cur->releaseSharedStack();
+    }
   
     auto raw_ptr = cur.get();
     cur.reset();//cur变空，cur指向的资源引用计数减一
@@ -2,12 +2,18 @@
 #define __SYLAR_FIBER_H__
 
 #include <memory>
+#include <atomic>
 #include <functional>
-#include <ucontext.h>
+#include <string>
+#include <vector>
+#include <typeinfo>
 #include "thread.h"
 
 namespace sylar{
 
+struct SharedStack;
+class Scheduler;
+
 /**
  * @brief 协程类
  */
@@ -29,6 +35,56 @@ public:
         /// 结束态，协程的回调函数执行完之后为TERM状态
         TERM
     };
+
+    /**
+     * @brief 协程栈池统计信息
+     */
+    struct StackPoolStats {
+        /// 从栈池中命中空闲栈的次数
+        uint64_t hits = 0;
+        /// 栈池中没有空闲栈，新mmap栈的次数
+        uint64_t misses = 0;
+        /// 空闲栈通过madvise归还物理内存的次数
+        uint64_t released = 0;
+        /// 栈池已满，释放的栈被直接munmap的次数
+        uint64_t unmapped = 0;
+        /// 当前所有线程的栈池中缓存的空闲栈数量
+        uint64_t cached = 0;
+        /// mmap失败，退回malloc分配没有保护页的栈的次数
+        uint64_t mallocFallbacks = 0;
+    };
+
+    /**
+     * @brief 共享栈统计信息
+     */
+    struct SharedStackStats {
+        /// 共享栈协程被resume的次数
+        uint64_t switches = 0;
+        /// 协程让出共享栈时，把栈内容拷贝到私有缓冲区的次数
+        uint64_t saves = 0;
+        /// 拷出的总字节数
+        uint64_t save_bytes = 0;
+        /// 协程重新占用共享栈时，把私有缓冲区拷回共享栈的次数
+        uint64_t restores = 0;
+        /// 拷回的总字节数
+        uint64_t restore_bytes = 0;
+    };
+
+    /**
+     * @brief 协程栈使用量统计，按标签聚合
+     */
+    struct StackProfileEntry {
+        /// 标签，默认是协程入口函数的类型名，Servlet中是Servlet名称
+        std::string tag;
+        /// 统计的协程数
+        uint64_t count = 0;
+        /// 栈使用量的最大值(字节)
+        uint64_t max_used = 0;
+        /// 栈使用量的总和(字节)，除以count得到平均值
+        uint64_t total_used = 0;
+        /// 分配的栈大小的最大值(字节)
+        uint64_t stack_size = 0;
+    };
 private:
     /**
      * @brief 构造函数
@@ -42,8 +98,12 @@ public:
      * @param[in] cb 协程入口函数
      * @param[in] stacksize 栈大小
      * @param[in] run_in_scheduler 本协程是否参与调度器调度，默认为true
+     * @param[in] shared_stack 是否运行在线程的共享栈上，默认为false
+     * @details 共享栈协程第一次resume时绑定当前线程的一个共享栈，之后只能在该线程上运行；
+     *          挂起时栈内容留在共享栈上，直到另一个协程要使用同一个共享栈时，才把已使用的部分拷贝到按需分配的私有缓冲区。
+     *          共享栈协程挂起期间不能把栈上变量的地址交给其他协程使用。ucontext模式下不支持共享栈，退化为私有栈
      */
-    Fiber(std::function<void()> cb, size_t stacksize = 0, bool run_in_scheduler = true);
+    Fiber(std::function<void()> cb, size_t stacksize = 0, bool run_in_scheduler = true, bool shared_stack = false);
     ~Fiber();
 
      /**
@@ -66,6 +126,26 @@ public:
 
     uint64_t getId() const { return m_id;}
     State getState() const { return m_state;}
+
+    /**
+     * @brief 本协程是否参与调度器调度，线程主协程返回false
+     */
+    bool isRunInScheduler() const { return m_runInScheduler;}
+
+    /**
+     * @brief 是否运行在共享栈上
+     */
+    bool isSharedStack() const { return m_sharedStack;}
+
+    /**
+     * @brief 返回协程绑定的线程id，只有已经运行过且未结束的共享栈协程才绑定线程，否则返回-1
+     */
+    int getBoundThread() const { return m_boundThread;}
+
+    /**
+     * @brief 返回协程栈大小，共享栈协程和线程主协程返回0
+     */
+    uint32_t getStackSize() const { return m_stacksize;}
 public:
 
     /**
@@ -84,6 +164,45 @@ public:
 
     static uint64_t TotalFibers();
 
+    /**
+     * @brief 获取协程栈池的统计信息
+     */
+    static StackPoolStats GetStackPoolStats();
+
+    /**
+     * @brief 获取共享栈的统计信息
+     */
+    static SharedStackStats GetSharedStackStats();
+
+    /**
+     * @brief 当前线程是否创建过共享栈
+     * @details 绑定在本线程共享栈上的协程只能回到本线程运行，这样的线程不能提前退出
+     */
+    static bool HasThreadSharedStacks();
+
+    /**
+     * @brief 默认的协程栈大小，即fiber.stack_size配置
+     */
+    static uint32_t GetDefaultStackSize();
+
+    /**
+     * @brief 设置当前协程的栈使用量统计标签
+     * @details 只在开启fiber.stack_profile时生效。没有设置标签时按协程入口函数的类型聚合，
+     *          同一个协程多次设置时，以协程结束前最后一次设置的为准
+     */
+    static void SetStackTag(const std::string& tag);
+
+    /**
+     * @brief 获取按标签聚合的协程栈使用量
+     * @param[out] entries 每个标签一项
+     */
+    static void GetStackProfile(std::vector<StackProfileEntry>& entries);
+
+    /**
+     * @brief 把协程栈使用量统计输出到system日志
+     */
+    static void DumpStackProfile();
+
     /**
      * @brief 协程入口函数
      */
@@ -94,20 +213,90 @@ public:
      */
     static uint64_t GetFiberId();
 private:
+    /**
+     * @brief 在协程栈上初始化上下文，入口函数为MainFunc
+     */
+    void makeContext();
+
+    /**
+     * @brief 保存from协程的上下文，切换到to协程
+     */
+    static void SwapContext(Fiber* from, Fiber* to);
+
+    /**
+     * @brief 共享栈协程切入前占用共享栈
+     * @details 如果共享栈被其他挂起的协程占用，先把它的栈内容拷出，再把本协程保存的栈内容拷回
+     */
+    void acquireSharedStack();
+
+    /**
+     * @brief 把本协程在共享栈上已使用的部分拷贝到私有缓冲区
+     */
+    void saveSharedStack();
+
+    /**
+     * @brief 协程结束时解除与共享栈和线程的绑定
+     */
+    void releaseSharedStack();
+
+    /**
+     * @brief 开启栈使用量统计时，用canary填充整个栈
+     */
+    void paintStack();
+
+    /**
+     * @brief 协程结束时从栈底扫描canary，得到栈使用量的最高水位并记录
+     */
+    void profileStack();
+
+    /**
+     * @brief 上下文切换的实现，定义在fiber.cc中，头文件不依赖ucontext和boost.context
+     */
+    struct ContextOps;
+private:
+    friend class Scheduler;
+
     /// 协程id
     uint64_t m_id = 0;
     /// 协程栈大小
     uint32_t m_stacksize = 0;
     /// 协程状态
     State m_state = READY;
-    /// 协程上下文
-    ucontext_t m_ctx;
+    /// 协程上下文，fcontext模式下就是fcontext_t，ucontext模式下指向堆上的ucontext_t，
+    /// 类的布局不随SYLAR_FIBER_UCONTEXT变化
+    void* m_ctx = nullptr;
     /// 协程栈地址
     void* m_stack = nullptr;
+    /// 协程栈是否由malloc分配(mmap失败时的退路)
+    bool m_mallocStack = false;
     /// 协程入口函数
     std::function<void()> m_cb;
     /// 本协程是否参与调度器调度
-    bool m_runInScheduler;
+    bool m_runInScheduler = false;
+    /// 由Scheduler维护：在调度线程上运行期间不为空，运行期间被唤醒时指向推迟入队的调度任务
+    std::atomic<void*> m_pendingWake{nullptr};
+    /// 推迟入队的调度任务所属的调度器
+    Scheduler* m_wakeScheduler = nullptr;
+    /// 是否运行在共享栈上
+    bool m_sharedStack = false;
+    /// 共享栈模式下当前绑定的共享栈
+    SharedStack* m_shared = nullptr;
+    /// 共享栈模式下绑定的线程id
+    int m_boundThread = -1;
+    /// 共享栈模式下保存栈内容的私有缓冲区
+    char* m_saveBuffer = nullptr;
+    /// 私有缓冲区的容量
+    size_t m_saveCapacity = 0;
+    /// 私有缓冲区中保存的栈内容大小
+    size_t m_saveSize = 0;
+    /// 栈是否已经用canary填充
+    bool m_stackPainted = false;
+    /// 入口函数的类型，没有设置栈统计标签时按它聚合
+    const std::type_info* m_cbType = nullptr;
+    /// 入口函数是函数指针时的函数地址，按函数聚合
+    void* m_cbFunc = nullptr;
+    /// 栈使用量统计标签
+    std::string m_stackTag;
 };
 }
 #endif
\ No newline at end of file
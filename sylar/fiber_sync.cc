@@ -0,0 +1,240 @@
+#include "fiber_sync.h"
+#include "scheduler.h"
+#include "iomanager.h"
+#include "macro.h"
+#include "util.h"
+
+namespace sylar {
+
+FiberWaiter::FiberWaiter() {
+    m_scheduler = Scheduler::GetThis();
+    if(!m_scheduler || Scheduler::InInlineTask()) {
+        // 不在调度器中，或者运行在调度协程上，不能挂起协程，只能阻塞线程
+        return;
+    }
+    Fiber::ptr cur = Fiber::GetThis();
+    if(cur->isRunInScheduler()) {
+        m_fiber = cur;
+        m_thread = GetThreadId();
+    }
+}
+
+bool FiberWaiter::wait(uint64_t timeout_ms) {
+    if(!m_fiber) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        auto pred = [this]() { return m_state != WAITING; };
+        if(timeout_ms == ~0ull) {
+            m_cond.wait(lock, pred);
+        } else if(!m_cond.wait_for(lock, std::chrono::milliseconds(timeout_ms), pred)) {
+            // 已经持有m_mutex，不能走wake，直接切换状态；切换失败说明notify刚好抢先了
+            int expected = WAITING;
+            m_state.compare_exchange_strong(expected, TIMEDOUT);
+        }
+        return m_state == NOTIFIED;
+    }
+
+    SYLAR_ASSERT(m_fiber.get() == Fiber::GetThis().get());
+    Timer::ptr timer;
+    if(timeout_ms != ~0ull) {
+        IOManager* iom = IOManager::GetThis();
+        SYLAR_ASSERT2(iom, "FiberWaiter timeout requires IOManager");
+        std::weak_ptr<FiberWaiter> weak(shared_from_this());
+        timer = iom->addConditionTimer(timeout_ms, [weak]() {
+            auto waiter = weak.lock();
+            if(waiter) {
+                waiter->wake(TIMEDOUT);
+            }
+        }, weak, false, true);
+    }
+    // 不管notify和超时是否已经发生，生效的一方都会把协程加入调度，所以这里一定要yield一次
+    Fiber* fiber = m_fiber.get();
+    fiber->yield();
+    if(timer) {
+        timer->cancel();
+    }
+    m_fiber.reset();
+    return m_state == NOTIFIED;
+}
+
+bool FiberWaiter::notify() {
+    return wake(NOTIFIED);
+}
+
+bool FiberWaiter::cancel() {
+    int expected = WAITING;
+    return m_state.compare_exchange_strong(expected, CANCELLED);
+}
+
+bool FiberWaiter::wake(State to) {
+    int expected = WAITING;
+    if(!m_state.compare_exchange_strong(expected, to)) {
+        return false;
+    }
+    if(m_fiber) {
+        // 回到挂起时的线程运行，挂起的协程在yield之前不会被那个线程取走
+        m_scheduler->schedule(m_fiber, m_thread);
+    } else {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_cond.notify_one();
+    }
+    return true;
+}
+
+bool FiberMutex::tryLock() {
+    Spinlock::Lock lock(m_mutex);
+    if(m_locked) {
+        return false;
+    }
+    m_locked = true;
+    return true;
+}
+
+void FiberMutex::lock() {
+    timedLock(~0ull);
+}
+
+bool FiberMutex::timedLock(uint64_t timeout_ms) {
+    if(tryLock()) {
+        return true;
+    }
+    FiberWaiter::ptr waiter(new FiberWaiter);
+    {
+        Spinlock::Lock lock(m_mutex);
+        if(!m_locked) {
+            m_locked = true;
+            return true;
+        }
+        m_waiters.push_back(waiter);
+    }
+    if(waiter->wait(timeout_ms)) {
+        // 解锁方已经把锁直接交给了当前协程
+        return true;
+    }
+    Spinlock::Lock lock(m_mutex);
+    m_waiters.remove(waiter);
+    return false;
+}
+
+void FiberMutex::unlock() {
+    while(true) {
+        FiberWaiter::ptr waiter;
+        {
+            Spinlock::Lock lock(m_mutex);
+            SYLAR_ASSERT(m_locked);
+            if(m_waiters.empty()) {
+                m_locked = false;
+                return;
+            }
+            waiter = m_waiters.front();
+            m_waiters.pop_front();
+        }
+        if(waiter->notify()) {
+            return;
+        }
+        // 这个等待者已经超时，锁交给下一个
+    }
+}
+
+bool FiberCondition::wait(FiberMutex::Lock& lock, uint64_t timeout_ms) {
+    FiberWaiter::ptr waiter(new FiberWaiter);
+    {
+        Spinlock::Lock l(m_mutex);
+        m_waiters.push_back(waiter);
+    }
+    lock.unlock();
+    bool rt = waiter->wait(timeout_ms);
+    if(!rt) {
+        Spinlock::Lock l(m_mutex);
+        m_waiters.remove(waiter);
+    }
+    lock.lock();
+    return rt;
+}
+
+void FiberCondition::notifyOne() {
+    while(true) {
+        FiberWaiter::ptr waiter;
+        {
+            Spinlock::Lock lock(m_mutex);
+            if(m_waiters.empty()) {
+                return;
+            }
+            waiter = m_waiters.front();
+            m_waiters.pop_front();
+        }
+        if(waiter->notify()) {
+            return;
+        }
+    }
+}
+
+void FiberCondition::notifyAll() {
+    std::list<FiberWaiter::ptr> waiters;
+    {
+        Spinlock::Lock lock(m_mutex);
+        waiters.swap(m_waiters);
+    }
+    for(auto& i : waiters) {
+        i->notify();
+    }
+}
+
+FiberSemaphore::FiberSemaphore(uint32_t count)
+    :m_count(count) {
+}
+
+bool FiberSemaphore::tryWait() {
+    Spinlock::Lock lock(m_mutex);
+    if(m_count > 0) {
+        --m_count;
+        return true;
+    }
+    return false;
+}
+
+bool FiberSemaphore::wait(uint64_t timeout_ms) {
+    if(tryWait()) {
+        return true;
+    }
+    FiberWaiter::ptr waiter(new FiberWaiter);
+    {
+        Spinlock::Lock lock(m_mutex);
+        if(m_count > 0) {
+            --m_count;
+            return true;
+        }
+        m_waiters.push_back(waiter);
+    }
+    if(waiter->wait(timeout_ms)) {
+        // notify直接把信号量交给了当前协程
+        return true;
+    }
+    Spinlock::Lock lock(m_mutex);
+    m_waiters.remove(waiter);
+    return false;
+}
+
+void FiberSemaphore::notify() {
+    while(true) {
+        FiberWaiter::ptr waiter;
+        {
+            Spinlock::Lock lock(m_mutex);
+            if(m_waiters.empty()) {
+                ++m_count;
+                return;
+            }
+            waiter = m_waiters.front();
+            m_waiters.pop_front();
+        }
+        if(waiter->notify()) {
+            return;
+        }
+    }
+}
+
+uint32_t FiberSemaphore::getCount() {
+    Spinlock::Lock lock(m_mutex);
+    return m_count;
+}
+
+}
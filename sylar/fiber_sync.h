@@ -0,0 +1,208 @@
+/**
+ * @file fiber_sync.h
+ * @brief 协程同步原语
+ * @details mutex.h中的锁基于pthread，协程持有锁期间如果因为hook的IO调用挂起，其他协程抢锁会阻塞整个调度线程。
+ *          这里的同步原语在等待时只挂起当前协程，调度线程可以继续运行其他协程，被唤醒的协程优先回到挂起时所在的线程运行。
+ *          在非调度器协程中(比如普通线程)使用时退化为条件变量等待
+ * @version 0.1
+ */
+#ifndef __SYLAR_FIBER_SYNC_H__
+#define __SYLAR_FIBER_SYNC_H__
+
+#include <memory>
+#include <list>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include "mutex.h"
+#include "fiber.h"
+#include "noncopyable.h"
+
+namespace sylar {
+
+class Scheduler;
+
+/**
+ * @brief 协程等待者，挂起和唤醒单个协程的基础原语
+ * @details 在等待方构造，记录当前协程、调度器和线程。wait挂起当前协程，notify或者超时二者只有一个生效，
+ *          生效的一方把协程重新加入调度，指定在挂起时的线程上运行
+ */
+class FiberWaiter : public std::enable_shared_from_this<FiberWaiter>, Noncopyable {
+public:
+    typedef std::shared_ptr<FiberWaiter> ptr;
+
+    /**
+     * @brief 等待状态
+     */
+    enum State {
+        /// 等待中
+        WAITING,
+        /// 已被唤醒
+        NOTIFIED,
+        /// 等待超时
+        TIMEDOUT,
+        /// 等待方取消了等待
+        CANCELLED
+    };
+
+    /**
+     * @brief 构造函数，必须在等待方调用
+     */
+    FiberWaiter();
+
+    /**
+     * @brief 挂起当前协程直到被唤醒或者超时
+     * @param[in] timeout_ms 超时时间(毫秒)，~0ull表示不超时。协程中使用超时需要运行在IOManager上
+     * @return 被唤醒返回true，超时返回false
+     */
+    bool wait(uint64_t timeout_ms = ~0ull);
+
+    /**
+     * @brief 唤醒等待方
+     * @return 本次调用唤醒了等待方返回true，等待方已经被唤醒或者已经超时返回false
+     */
+    bool notify();
+
+    /**
+     * @brief 取消等待，用于等待方登记了等待者但还没有调用wait的情况
+     * @return 取消成功返回true，之后不能再调用wait；返回false说明已经被唤醒，等待方仍然要调用一次wait消费这次唤醒
+     */
+    bool cancel();
+
+    /**
+     * @brief 返回等待状态
+     */
+    State getState() const { return (State)m_state.load();}
+private:
+    /**
+     * @brief 从WAITING切换到to状态，成功的一方负责唤醒等待方
+     */
+    bool wake(State to);
+private:
+    /// 等待状态
+    std::atomic<int> m_state{WAITING};
+    /// 等待的协程，为空表示不在调度器协程中，使用条件变量等待
+    Fiber::ptr m_fiber;
+    /// 等待的协程所在的调度器
+    Scheduler* m_scheduler = nullptr;
+    /// 等待的协程所在的线程
+    int m_thread = -1;
+    /// 非协程等待时使用的锁
+    std::mutex m_mutex;
+    /// 非协程等待时使用的条件变量
+    std::condition_variable m_cond;
+};
+
+/**
+ * @brief 协程互斥锁
+ * @details 解锁时如果有等待者，锁直接交给队首的等待者(handoff)，保证先到先得，不会被后来的协程抢走
+ */
+class FiberMutex : Noncopyable {
+public:
+    /// 局部锁
+    typedef ScopedLockImpl<FiberMutex> Lock;
+
+    /**
+     * @brief 加锁，锁被占用时挂起当前协程
+     */
+    void lock();
+
+    /**
+     * @brief 带超时的加锁
+     * @param[in] timeout_ms 超时时间(毫秒)
+     * @return 加锁成功返回true，超时返回false
+     */
+    bool timedLock(uint64_t timeout_ms);
+
+    /**
+     * @brief 尝试加锁，不等待
+     */
+    bool tryLock();
+
+    /**
+     * @brief 解锁
+     */
+    void unlock();
+private:
+    /// 保护内部状态
+    Spinlock m_mutex;
+    /// 是否已加锁
+    bool m_locked = false;
+    /// 等待队列
+    std::list<FiberWaiter::ptr> m_waiters;
+};
+
+/**
+ * @brief 协程条件变量
+ */
+class FiberCondition : Noncopyable {
+public:
+    /**
+     * @brief 释放锁并挂起当前协程，被唤醒或超时后重新加锁
+     * @param[in] lock 已加锁的协程互斥锁
+     * @param[in] timeout_ms 超时时间(毫秒)，~0ull表示不超时
+     * @return 被唤醒返回true，超时返回false
+     */
+    bool wait(FiberMutex::Lock& lock, uint64_t timeout_ms = ~0ull);
+
+    /**
+     * @brief 唤醒一个等待者
+     */
+    void notifyOne();
+
+    /**
+     * @brief 唤醒所有等待者
+     */
+    void notifyAll();
+private:
+    /// 保护等待队列
+    Spinlock m_mutex;
+    /// 等待队列
+    std::list<FiberWaiter::ptr> m_waiters;
+};
+
+/**
+ * @brief 协程信号量
+ * @details 释放信号量时如果有等待者，直接交给队首的等待者，不增加计数
+ */
+class FiberSemaphore : Noncopyable {
+public:
+    /**
+     * @brief 构造函数
+     * @param[in] count 信号量初始值
+     */
+    FiberSemaphore(uint32_t count = 0);
+
+    /**
+     * @brief 获取信号量，信号量为0时挂起当前协程
+     * @param[in] timeout_ms 超时时间(毫秒)，~0ull表示不超时
+     * @return 获取成功返回true，超时返回false
+     */
+    bool wait(uint64_t timeout_ms = ~0ull);
+
+    /**
+     * @brief 尝试获取信号量，不等待
+     */
+    bool tryWait();
+
+    /**
+     * @brief 释放信号量
+     */
+    void notify();
+
+    /**
+     * @brief 返回当前信号量的值
+     */
+    uint32_t getCount();
+private:
+    /// 保护内部状态
+    Spinlock m_mutex;
+    /// 信号量的值
+    uint32_t m_count;
+    /// 等待队列
+    std::list<FiberWaiter::ptr> m_waiters;
+};
+
+}
+
+#endif
@@ -0,0 +1,389 @@
+/**
+ * @file future.h
+ * @brief 协程版的Future/Promise
+ * @details 通过async把任务交给调度器执行，在协程中等待结果时只挂起当前协程。
+ *          非协程线程等待时阻塞线程。whenAll/whenAny用于同时等待多个Future
+ * @version 0.1
+ */
+#ifndef __SYLAR_FUTURE_H__
+#define __SYLAR_FUTURE_H__
+
+#include <memory>
+#include <list>
+#include <vector>
+#include <atomic>
+#include <functional>
+#include <exception>
+#include <future>
+#include <stdexcept>
+#include <type_traits>
+#include "fiber_sync.h"
+#include "scheduler.h"
+#include "mutex.h"
+
+namespace sylar {
+
+/**
+ * @brief Future和Promise的共享状态中与结果类型无关的部分
+ */
+class FutureStateBase : Noncopyable {
+public:
+    /**
+     * @brief 是否已经有结果
+     */
+    bool isReady() const { return m_ready;}
+
+    /**
+     * @brief 等待结果
+     * @param[in] timeout_ms 超时时间(毫秒)，~0ull表示不超时
+     * @return 有结果返回true，超时返回false
+     */
+    bool wait(uint64_t timeout_ms = ~0ull) {
+        if(m_ready) {
+            return true;
+        }
+        FiberWaiter::ptr waiter(new FiberWaiter);
+        {
+            Spinlock::Lock lock(m_mutex);
+            if(m_ready) {
+                return true;
+            }
+            m_waiters.push_back(waiter);
+        }
+        if(!waiter->wait(timeout_ms)) {
+            Spinlock::Lock lock(m_mutex);
+            m_waiters.remove(waiter);
+        }
+        return m_ready;
+    }
+
+    /**
+     * @brief 添加有结果之后执行的回调，已经有结果时直接执行
+     * @details 回调在设置结果的线程/协程中执行，不能阻塞
+     */
+    void onReady(std::function<void()> cb) {
+        {
+            Spinlock::Lock lock(m_mutex);
+            if(!m_ready) {
+                m_callbacks.push_back(cb);
+                return;
+            }
+        }
+        cb();
+    }
+
+    /**
+     * @brief 设置异常
+     * @return 第一次设置结果返回true，已经有结果返回false
+     */
+    bool setException(std::exception_ptr e) {
+        Spinlock::Lock lock(m_mutex);
+        if(m_ready) {
+            return false;
+        }
+        m_error = e;
+        complete(lock);
+        return true;
+    }
+
+    /**
+     * @brief 有结果之后，结果是异常时重新抛出
+     */
+    void rethrow() const {
+        if(m_error) {
+            std::rethrow_exception(m_error);
+        }
+    }
+protected:
+    /**
+     * @brief 标记已经有结果，唤醒所有等待者并执行回调，调用时持有m_mutex
+     */
+    void complete(Spinlock::Lock& lock) {
+        std::list<FiberWaiter::ptr> waiters;
+        std::vector<std::function<void()> > callbacks;
+        waiters.swap(m_waiters);
+        callbacks.swap(m_callbacks);
+        m_ready = true;
+        lock.unlock();
+
+        for(auto& i : waiters) {
+            i->notify();
+        }
+        for(auto& i : callbacks) {
+            i();
+        }
+    }
+protected:
+    /// 保护内部状态
+    Spinlock m_mutex;
+    /// 是否已经有结果
+    std::atomic<bool> m_ready{false};
+    /// 异常结果
+    std::exception_ptr m_error;
+    /// 等待结果的协程/线程
+    std::list<FiberWaiter::ptr> m_waiters;
+    /// 有结果之后执行的回调
+    std::vector<std::function<void()> > m_callbacks;
+};
+
+/**
+ * @brief Future和Promise的共享状态
+ */
+template<class T>
+class FutureState : public FutureStateBase {
+public:
+    typedef std::shared_ptr<FutureState> ptr;
+
+    bool setValue(const T& v) {
+        Spinlock::Lock lock(m_mutex);
+        if(m_ready) {
+            return false;
+        }
+        m_value.reset(new T(v));
+        complete(lock);
+        return true;
+    }
+
+    const T& getValue() const { return *m_value;}
+private:
+    /// 结果
+    std::unique_ptr<T> m_value;
+};
+
+template<>
+class FutureState<void> : public FutureStateBase {
+public:
+    typedef std::shared_ptr<FutureState> ptr;
+
+    bool setValue() {
+        Spinlock::Lock lock(m_mutex);
+        if(m_ready) {
+            return false;
+        }
+        complete(lock);
+        return true;
+    }
+};
+
+/**
+ * @brief Future，获取异步任务的结果
+ */
+template<class T>
+class Future {
+public:
+    Future() {}
+    Future(typename FutureState<T>::ptr state)
+        :m_state(state) {
+    }
+
+    /**
+     * @brief 是否关联了共享状态
+     */
+    bool valid() const { return !!m_state;}
+
+    /**
+     * @brief 是否已经有结果
+     */
+    bool isReady() const { return m_state->isReady();}
+
+    /**
+     * @brief 等待结果，协程中只挂起当前协程
+     * @param[in] timeout_ms 超时时间(毫秒)，~0ull表示不超时，协程中使用超时需要运行在IOManager上
+     * @return 有结果返回true，超时返回false
+     */
+    bool wait(uint64_t timeout_ms = ~0ull) const { return m_state->wait(timeout_ms);}
+
+    /**
+     * @brief 等待并返回结果，结果是异常时抛出该异常
+     */
+    T get() const {
+        m_state->wait();
+        m_state->rethrow();
+        return m_state->getValue();
+    }
+
+    /**
+     * @brief 添加有结果之后执行的回调，回调不能阻塞
+     */
+    void onReady(std::function<void()> cb) const { m_state->onReady(cb);}
+private:
+    typename FutureState<T>::ptr m_state;
+};
+
+template<>
+class Future<void> {
+public:
+    Future() {}
+    Future(FutureState<void>::ptr state)
+        :m_state(state) {
+    }
+
+    bool valid() const { return !!m_state;}
+    bool isReady() const { return m_state->isReady();}
+    bool wait(uint64_t timeout_ms = ~0ull) const { return m_state->wait(timeout_ms);}
+
+    /**
+     * @brief 等待结果，结果是异常时抛出该异常
+     */
+    void get() const {
+        m_state->wait();
+        m_state->rethrow();
+    }
+
+    void onReady(std::function<void()> cb) const { m_state->onReady(cb);}
+private:
+    FutureState<void>::ptr m_state;
+};
+
+/**
+ * @brief 同一个Promise的所有拷贝共享的所有者
+ * @details 最后一个拷贝销毁时还没有结果，把结果设置为broken_promise异常，唤醒等待的一方
+ */
+class PromiseOwner : Noncopyable {
+public:
+    PromiseOwner(std::shared_ptr<FutureStateBase> state)
+        :m_state(state) {
+    }
+
+    ~PromiseOwner() {
+        if(!m_state->isReady()) {
+            m_state->setException(std::make_exception_ptr(
+                std::future_error(std::future_errc::broken_promise)));
+        }
+    }
+private:
+    std::shared_ptr<FutureStateBase> m_state;
+};
+
+/**
+ * @brief Promise，设置异步任务的结果
+ * @details 可以拷贝，所有拷贝共享同一个结果，只有第一次设置的结果生效。
+ *          所有拷贝都销毁时还没有设置结果(比如async的任务因为调度器停止被丢弃)，
+ *          结果是std::future_error(broken_promise)异常，Future::get时抛出
+ */
+template<class T>
+class Promise {
+public:
+    Promise()
+        :m_state(new FutureState<T>)
+        ,m_owner(new PromiseOwner(m_state)) {
+    }
+
+    Future<T> getFuture() const { return Future<T>(m_state);}
+
+    bool setValue(const T& v) { return m_state->setValue(v);}
+
+    bool setException(std::exception_ptr e) { return m_state->setException(e);}
+private:
+    typename FutureState<T>::ptr m_state;
+    std::shared_ptr<PromiseOwner> m_owner;
+};
+
+template<>
+class Promise<void> {
+public:
+    Promise()
+        :m_state(new FutureState<void>)
+        ,m_owner(new PromiseOwner(m_state)) {
+    }
+
+    Future<void> getFuture() const { return Future<void>(m_state);}
+
+    bool setValue() { return m_state->setValue();}
+
+    bool setException(std::exception_ptr e) { return m_state->setException(e);}
+private:
+    FutureState<void>::ptr m_state;
+    std::shared_ptr<PromiseOwner> m_owner;
+};
+
+/**
+ * @brief 执行函数并把返回值或异常设置到Promise
+ */
+template<class T>
+struct PromiseRunner {
+    template<class Fn>
+    static void Run(Promise<T>& p, Fn& fn) {
+        try {
+            p.setValue(fn());
+        } catch(...) {
+            p.setException(std::current_exception());
+        }
+    }
+};
+
+template<>
+struct PromiseRunner<void> {
+    template<class Fn>
+    static void Run(Promise<void>& p, Fn& fn) {
+        try {
+            fn();
+            p.setValue();
+        } catch(...) {
+            p.setException(std::current_exception());
+        }
+    }
+};
+
+/**
+ * @brief 把任务交给调度器执行，返回任务结果的Future
+ * @param[in] sc 调度器
+ * @param[in] fn 任务，返回值就是Future的结果，抛出的异常在Future::get时重新抛出
+ * @param[in] thread 指定运行任务的线程号，-1表示任意线程
+ */
+template<class Fn>
+Future<typename std::result_of<Fn()>::type> async(Scheduler* sc, Fn fn, int thread = -1) {
+    typedef typename std::result_of<Fn()>::type R;
+    Promise<R> p;
+    Future<R> f = p.getFuture();
+    sc->schedule(std::function<void()>([p, fn]() mutable {
+        PromiseRunner<R>::Run(p, fn);
+    }), thread);
+    return f;
+}
+
+/**
+ * @brief 所有Future都有结果之后就绪
+ * @details 返回的Future只表示全部完成，各个任务的结果或异常从原来的Future中获取
+ */
+template<class T>
+Future<void> whenAll(const std::vector<Future<T> >& futures) {
+    Promise<void> p;
+    if(futures.empty()) {
+        p.setValue();
+        return p.getFuture();
+    }
+    std::shared_ptr<std::atomic<size_t> > left(new std::atomic<size_t>(futures.size()));
+    for(auto& i : futures) {
+        i.onReady([p, left]() mutable {
+            if(--*left == 0) {
+                p.setValue();
+            }
+        });
+    }
+    return p.getFuture();
+}
+
+/**
+ * @brief 任意一个Future有结果之后就绪
+ * @return 结果是最先就绪的Future在futures中的下标，futures为空时结果是异常
+ */
+template<class T>
+Future<size_t> whenAny(const std::vector<Future<T> >& futures) {
+    Promise<size_t> p;
+    if(futures.empty()) {
+        p.setException(std::make_exception_ptr(std::invalid_argument("whenAny: no futures")));
+        return p.getFuture();
+    }
+    for(size_t i = 0; i < futures.size(); ++i) {
+        futures[i].onReady([p, i]() mutable {
+            // 只有第一次设置的结果生效
+            p.setValue(i);
+        });
+    }
+    return p.getFuture();
+}
+
+}
+
+#endif
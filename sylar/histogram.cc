@@ -0,0 +1,96 @@
+#include "histogram.h"
+#include <algorithm>
+#include <sstream>
+
+namespace sylar {
+
+void HistogramSnapshot::merge(const HistogramSnapshot& other) {
+    if (!other.count) {
+        return;
+    }
+    if (buckets.empty()) {
+        buckets.resize(LatencyHistogram::BUCKETS, 0);
+    }
+    for (size_t i = 0; i < other.buckets.size(); ++i) {
+        buckets[i] += other.buckets[i];
+    }
+    count += other.count;
+    sum += other.sum;
+    max = std::max(max, other.max);
+}
+
+void HistogramSnapshot::subtract(const HistogramSnapshot& prev) {
+    if (prev.buckets.empty() || buckets.empty()) {
+        return;
+    }
+    // 读取没有加锁，桶和总数不是同一时刻的值，差值不能为负
+    int top = -1;
+    for (size_t i = 0; i < buckets.size(); ++i) {
+        buckets[i] = buckets[i] > prev.buckets[i] ? buckets[i] - prev.buckets[i] : 0;
+        if (buckets[i]) {
+            top = i;
+        }
+    }
+    count = count > prev.count ? count - prev.count : 0;
+    sum = sum > prev.sum ? sum - prev.sum : 0;
+    // 累计的最大值可能发生在之前，用差值中最高的桶估计
+    max = top < 0 ? 0 : std::min(max, LatencyHistogram::BucketUpperBound(top));
+}
+
+uint64_t HistogramSnapshot::percentile(double p) const {
+    uint64_t total = 0;
+    for (auto i : buckets) {
+        total += i;
+    }
+    if (!total) {
+        return 0;
+    }
+    uint64_t target = std::max<uint64_t>((uint64_t)(p * total + 0.5), 1);
+    uint64_t n = 0;
+    for (size_t i = 0; i < buckets.size(); ++i) {
+        n += buckets[i];
+        if (n >= target) {
+            return std::min(LatencyHistogram::BucketUpperBound(i), max);
+        }
+    }
+    return max;
+}
+
+std::string HistogramSnapshot::toString() const {
+    std::stringstream ss;
+    ss << "n=" << count << " avg=" << mean() << " p50=" << percentile(0.5)
+       << " p90=" << percentile(0.9) << " p99=" << percentile(0.99) << " max=" << max;
+    return ss.str();
+}
+
+LatencyHistogram::LatencyHistogram() {
+    for (int i = 0; i < BUCKETS; ++i) {
+        m_buckets[i] = 0;
+    }
+}
+
+uint64_t LatencyHistogram::BucketUpperBound(int idx) {
+    if (idx < SUB_COUNT) {
+        return idx;
+    }
+    int shift = idx / SUB_COUNT - 1;
+    uint64_t low = (uint64_t)(SUB_COUNT + idx % SUB_COUNT) << shift;
+    return low + (1ull << shift) - 1;
+}
+
+void LatencyHistogram::snapshot(HistogramSnapshot& s) const {
+    if (!getCount()) {
+        return;
+    }
+    if (s.buckets.empty()) {
+        s.buckets.resize(BUCKETS, 0);
+    }
+    for (int i = 0; i < BUCKETS; ++i) {
+        s.buckets[i] += m_buckets[i].load(std::memory_order_relaxed);
+    }
+    s.count += m_count.load(std::memory_order_relaxed);
+    s.sum += m_sum.load(std::memory_order_relaxed);
+    s.max = std::max(s.max, m_max.load(std::memory_order_relaxed));
+}
+
+}
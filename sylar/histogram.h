@@ -0,0 +1,133 @@
+/**
+ * @file histogram.h
+ * @brief 低开销的延迟直方图
+ * @version 0.1
+ */
+#ifndef __SYLAR_HISTOGRAM_H__
+#define __SYLAR_HISTOGRAM_H__
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include "noncopyable.h"
+
+namespace sylar {
+
+/**
+ * @brief 直方图的快照，多个线程的直方图读取时合并到一个快照
+ */
+struct HistogramSnapshot {
+    /// 记录的次数
+    uint64_t count = 0;
+    /// 记录的值的总和
+    uint64_t sum = 0;
+    /// 最大值，两个快照相减后是差值中最高的桶的上界
+    uint64_t max = 0;
+    /// 每个桶的次数，为空表示没有记录
+    std::vector<uint64_t> buckets;
+
+    /**
+     * @brief 合并另一个快照
+     */
+    void merge(const HistogramSnapshot& other);
+
+    /**
+     * @brief 减去之前的快照，得到两次读取之间的统计
+     * @param[in] prev 同一个直方图之前的快照
+     */
+    void subtract(const HistogramSnapshot& prev);
+
+    /**
+     * @brief 平均值
+     */
+    uint64_t mean() const { return count ? (sum + count / 2) / count : 0;}
+
+    /**
+     * @brief 分位数，返回所在桶的上界，误差不超过1/8
+     * @param[in] p 分位，0~1
+     */
+    uint64_t percentile(double p) const;
+
+    /**
+     * @brief 格式化为 n=.. avg=.. p50=.. p90=.. p99=.. max=..
+     */
+    std::string toString() const;
+};
+
+/**
+ * @brief 延迟直方图
+ * @details HDR风格的对数线性分桶，每个2的幂区间再分8个子桶，相对误差不超过1/8，小于16的值精确记录。
+ *          只允许一个线程记录，记录时只有普通的读写没有原子的读改写，其他线程可以随时读取
+ */
+class LatencyHistogram : Noncopyable {
+public:
+    /// 子桶的位数
+    static const int SUB_BITS = 3;
+    /// 每个2的幂区间的子桶数
+    static const int SUB_COUNT = 1 << SUB_BITS;
+    /// 可以区分的最大值的位数，更大的值记入最后一个桶
+    static const int MAX_BITS = 36;
+    /// 桶数
+    static const int BUCKETS = (MAX_BITS - SUB_BITS + 1) * SUB_COUNT;
+
+    LatencyHistogram();
+
+    /**
+     * @brief 记录一个值，只能由所属线程调用
+     */
+    void record(uint64_t v) {
+        Add(m_buckets[BucketIndex(v)], 1);
+        Add(m_count, 1);
+        Add(m_sum, v);
+        if (v > m_max.load(std::memory_order_relaxed)) {
+            m_max.store(v, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * @brief 记录的次数
+     */
+    uint64_t getCount() const { return m_count.load(std::memory_order_relaxed);}
+
+    /**
+     * @brief 合并到快照
+     */
+    void snapshot(HistogramSnapshot& s) const;
+
+    /**
+     * @brief 值所在的桶
+     */
+    static int BucketIndex(uint64_t v) {
+        if (v < (uint64_t)SUB_COUNT) {
+            return (int)v;
+        }
+        int msb = 63 - __builtin_clzll(v);
+        if (msb >= MAX_BITS) {
+            return BUCKETS - 1;
+        }
+        int shift = msb - SUB_BITS;
+        return (shift + 1) * SUB_COUNT + (int)((v >> shift) & (SUB_COUNT - 1));
+    }
+
+    /**
+     * @brief 桶的上界(包含)
+     */
+    static uint64_t BucketUpperBound(int idx);
+private:
+    /**
+     * @brief 单写者的加法，不需要lock前缀的指令
+     */
+    static void Add(std::atomic<uint64_t>& v, uint64_t n) {
+        v.store(v.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+private:
+    std::atomic<uint64_t> m_buckets[BUCKETS];
+    std::atomic<uint64_t> m_count{0};
+    std::atomic<uint64_t> m_sum{0};
+    std::atomic<uint64_t> m_max{0};
+};
+
+}
+
+#endif
@@ -1,5 +1,7 @@
 #include "hook.h"
 #include <dlfcn.h>
+#include <sys/stat.h>
+#include <type_traits>
 
 #include "config.h"
 #include "log.h"
@@ -7,6 +9,7 @@
 #include "iomanager.h"
 #include "fd_manager.h"
 #include "macro.h"
+#include "offload.h"
 
 sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
 namespace sylar {
@@ -14,8 +17,65 @@ namespace sylar {
 static sylar::ConfigVar<int>::ptr g_tcp_connect_timeout = 
     sylar::Config::Lookup("tcp.connect.timeout", 5000, "tcp connect timeout");
 
+static sylar::ConfigVar<bool>::ptr g_offload_file_io =
+    sylar::Config::Lookup("offload.file_io", false, "run hooked io on regular files in the offload pool");
+
 static thread_local bool t_hook_enable = false;
 
+/**
+ * @brief 直接阻塞执行的IO调用计数，按hook函数名分槽
+ */
+struct BlockingCallCounter {
+    /// hook函数名，为空表示槽未使用
+    std::atomic<const char*> name{nullptr};
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> totalUs{0};
+    std::atomic<uint64_t> maxUs{0};
+};
+
+/// 走do_io的hook函数不超过这个数量
+static const int s_blocking_call_slots = 16;
+static BlockingCallCounter s_blocking_calls[s_blocking_call_slots];
+
+static void record_blocking_call(const char* name, uint64_t us) {
+    //hook函数名都是字面量，按指针比较就可以
+    for(int i = 0; i < s_blocking_call_slots; ++i) {
+        BlockingCallCounter& c = s_blocking_calls[i];
+        const char* cur = c.name.load(std::memory_order_acquire);
+        if(!cur) {
+            const char* expected = nullptr;
+            if(!c.name.compare_exchange_strong(expected, name) && expected != name) {
+                continue;
+            }
+        } else if(cur != name) {
+            continue;
+        }
+        c.count.fetch_add(1, std::memory_order_relaxed);
+        c.totalUs.fetch_add(us, std::memory_order_relaxed);
+        if(us > c.maxUs.load(std::memory_order_relaxed)) {
+            c.maxUs.store(us, std::memory_order_relaxed);
+        }
+        return;
+    }
+}
+
+void get_blocking_call_stats(std::vector<BlockingCallStats>& stats) {
+    stats.clear();
+    for(int i = 0; i < s_blocking_call_slots; ++i) {
+        BlockingCallCounter& c = s_blocking_calls[i];
+        const char* name = c.name.load(std::memory_order_acquire);
+        if(!name) {
+            break;
+        }
+        BlockingCallStats s;
+        s.name = name;
+        s.count = c.count;
+        s.totalUs = c.totalUs;
+        s.maxUs = c.maxUs;
+        stats.push_back(s);
+    }
+}
+
 #define HOOK_FUN(XX) \
     XX(sleep) \
     XX(usleep) \
@@ -51,6 +111,7 @@ void hook_init() {
 }
 
 static uint64_t s_connect_timeout = -1;
+static std::atomic<bool> s_offload_file_io{false};
 struct _HookIniter {
     _HookIniter() {
         hook_init();
@@ -60,11 +121,19 @@ struct _HookIniter {
                                          << old_value << " to " << new_value;
                 s_connect_timeout = new_value;
         });
+        s_offload_file_io = g_offload_file_io->getValue();
+        g_offload_file_io->addListener([](const bool& old_value, const bool& new_value) {
+            s_offload_file_io = new_value;
+        });
     }
 };
 
 static _HookIniter s_hook_initer;
 
+bool is_file_io_offloaded() {
+    return s_offload_file_io;
+}
+
 bool is_hook_enable() {
     return t_hook_enable;
 }
@@ -78,17 +147,67 @@ struct timer_info {
     int cancelled = 0;
 };
 
+/**
+ * @brief 没有fdctx的句柄是否普通文件
+ * @details 普通文件不受FdManager管理，这里不创建记录：经stdio等内部close关闭的句柄不会删除记录，
+ *          号码复用给socket时会拿到过期的记录
+ */
+static bool is_regular_file(int fd) {
+    struct stat fd_stat;
+    return fstat(fd, &fd_stat) == 0 && S_ISREG(fd_stat.st_mode);
+}
+
+/**
+ * @brief 开启了hook但不能走协程调度的普通文件IO调用
+ * @details 开启了offload.file_io时交给阻塞调用线程池执行，否则直接执行并计入阻塞调用统计
+ */
 template<typename OriginFun, typename...Args>
-static ssize_t do_io(int fd, OriginFun fun, const char* hook_fun_name,
-        uint32_t event, int timeout_so, Args&&... args) {
+static ssize_t blocking_io(int fd, OriginFun fun, const char* hook_fun_name, Args&&... args) {
+    //参数可能指向协程栈，共享栈协程挂起时栈内容会被换出，不能交给其他线程；
+    //调度协程、idle协程和inline任务不能挂起等待结果，直接执行
+    if(sylar::is_file_io_offloaded() && !sylar::Scheduler::InSchedulerContext()
+            && !sylar::Fiber::GetThis()->isSharedStack()) {
+        //不设超时，协程等到调用完成才返回，参数引用一直有效
+        return sylar::offload([&]() {
+            return fun(fd, std::forward<Args>(args)...);
+        });
+    }
+    uint64_t begin = sylar::GetElapsedUS();
+    ssize_t n = fun(fd, std::forward<Args>(args)...);
+    sylar::record_blocking_call(hook_fun_name, sylar::GetElapsedUS() - begin);
+    return n;
+}
+
+/**
+ * @brief 把IO调用提交成io_uring完成式请求
+ * @details prep按hook函数的参数填写提交项，参数在协程栈上，请求完成之前协程不会返回
+ */
+template<typename Prep, typename...Args>
+static int submit_io(sylar::IOManager* iom, int fd, uint64_t timeout_ms, Prep prep, Args&... args) {
+    return iom->submitIo(fd, [&](io_uring_sqe* sqe) {
+        prep(sqe, args...);
+    }, timeout_ms);
+}
+
+template<typename...Args>
+static int submit_io(sylar::IOManager* iom, int fd, uint64_t timeout_ms, std::nullptr_t prep, Args&... args) {
+    return -EAGAIN;
+}
+
+template<typename OriginFun, typename Prep, typename...Args>
+static ssize_t do_io_prep(int fd, OriginFun fun, const char* hook_fun_name,
+        uint32_t event, int timeout_so, Prep prep, Args&&... args) {
     if(!sylar::t_hook_enable) {
         return fun(fd, std::forward<Args>(args)...);
     }
 
-    sylar::FdCtx::ptr ctx = sylar::FdMgr::GetInstance()->get(fd);
-    //不存在相应fdctx
+    sylar::FdCtx* ctx = sylar::FdMgr::GetInstance()->get(fd);
+    //不存在相应fdctx，比如普通文件、管道
     if(!ctx) {
-        return fun(fd, std::forward<Args>(args)...);
+        if(!is_regular_file(fd)) {
+            return fun(fd, std::forward<Args>(args)...);
+        }
+        return blocking_io(fd, fun, hook_fun_name, std::forward<Args>(args)...);
     }
 
     //fd已经关闭
@@ -96,10 +215,17 @@ static ssize_t do_io(int fd, OriginFun fun, const char* hook_fun_name,
         errno = EBADF;
         return -1;
     }
-    //fd不是socket,或者用户设置了非阻塞
-    if(!ctx->isSocket() || ctx->getUserNonblock()) {
+    //用户设置了非阻塞
+    if(ctx->getUserNonblock()) {
         return fun(fd, std::forward<Args>(args)...);
     }
+    //fd不是socket，只有普通文件按阻塞调用处理，管道、终端等原样执行
+    if(!ctx->isSocket()) {
+        if(!ctx->isRegularFile()) {
+            return fun(fd, std::forward<Args>(args)...);
+        }
+        return blocking_io(fd, fun, hook_fun_name, std::forward<Args>(args)...);
+    }
 
     uint64_t to = ctx->getTimeout(timeout_so);
     std::shared_ptr<timer_info> tinfo(new timer_info);
@@ -118,7 +244,27 @@ retry:
         n = fun(fd, std::forward<Args>(args)...);
     }
     if(n == -1 && errno == EAGAIN) {
+#ifndef NDEBUG
+        SYLAR_ASSERT2(!sylar::Scheduler::InInlineTask(), hook_fun_name << " would block in inline task");
+#endif
         sylar::IOManager* iom = sylar::IOManager::GetThis();
+        //io_uring后端直接提交完成式请求，省掉等待就绪之后的再一次系统调用
+        sylar::Fiber* cur = sylar::Fiber::GetThis().get();
+        if(!std::is_same<Prep, std::nullptr_t>::value && iom->canSubmitIo()
+                && cur->isRunInScheduler() && !cur->isSharedStack()) {
+            int rt = submit_io(iom, fd, to, prep, args...);
+            if(rt == -ECANCELED) {
+                //提交请求的线程退出了，内核取消了请求，重新走一遍
+                goto retry;
+            }
+            if(rt != -EAGAIN) {
+                if(rt < 0) {
+                    errno = -rt;
+                    return -1;
+                }
+                return rt;
+            }
+        }
         sylar::Timer::ptr timer;
         std::weak_ptr<timer_info> winfo(tinfo);
 
@@ -130,10 +276,10 @@ retry:
                 }
                 t->cancelled = ETIMEDOUT;
             iom->cancelEvent(fd, (sylar::IOManager::Event)(event));
-            }, winfo);
+            }, winfo, false, true);
         }
         //添加事件
-        int rt = iom->addEvent(fd, (sylar::IOManager::Event)(event));
+        int rt = iom->addEvent(ctx, (sylar::IOManager::Event)(event));
         if(SYLAR_UNLIKELY(rt)) {
             SYLAR_LOG_ERROR(g_logger) << hook_fun_name << " addEvent("
                 << fd << ", " << event << ")";
@@ -157,6 +303,71 @@ retry:
     return n;
 }
 
+template<typename OriginFun, typename...Args>
+static ssize_t do_io(int fd, OriginFun fun, const char* hook_fun_name,
+        uint32_t event, int timeout_so, Args&&... args) {
+    return do_io_prep(fd, fun, hook_fun_name, event, timeout_so, nullptr, std::forward<Args>(args)...);
+}
+
+/**
+ * @brief hook函数对应的io_uring提交项，fd由IOManager::submitIo填写
+ */
+static void prep_accept(io_uring_sqe* sqe, struct sockaddr* addr, socklen_t* addrlen) {
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->addr = (uint64_t)(uintptr_t)addr;
+    sqe->addr2 = (uint64_t)(uintptr_t)addrlen;
+}
+
+static void prep_recv(io_uring_sqe* sqe, void* buf, size_t len, int flags) {
+    sqe->opcode = IORING_OP_RECV;
+    sqe->addr = (uint64_t)(uintptr_t)buf;
+    sqe->len = len;
+    sqe->msg_flags = flags;
+}
+
+static void prep_read(io_uring_sqe* sqe, void* buf, size_t count) {
+    prep_recv(sqe, buf, count, 0);
+}
+
+static void prep_send(io_uring_sqe* sqe, const void* buf, size_t len, int flags) {
+    sqe->opcode = IORING_OP_SEND;
+    sqe->addr = (uint64_t)(uintptr_t)buf;
+    sqe->len = len;
+    sqe->msg_flags = flags;
+}
+
+static void prep_write(io_uring_sqe* sqe, const void* buf, size_t count) {
+    prep_send(sqe, buf, count, 0);
+}
+
+static void prep_readv(io_uring_sqe* sqe, const struct iovec* iov, int iovcnt) {
+    sqe->opcode = IORING_OP_READV;
+    sqe->addr = (uint64_t)(uintptr_t)iov;
+    sqe->len = iovcnt;
+    sqe->off = (uint64_t)-1;
+}
+
+static void prep_writev(io_uring_sqe* sqe, const struct iovec* iov, int iovcnt) {
+    sqe->opcode = IORING_OP_WRITEV;
+    sqe->addr = (uint64_t)(uintptr_t)iov;
+    sqe->len = iovcnt;
+    sqe->off = (uint64_t)-1;
+}
+
+static void prep_recvmsg(io_uring_sqe* sqe, struct msghdr* msg, int flags) {
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->addr = (uint64_t)(uintptr_t)msg;
+    sqe->len = 1;
+    sqe->msg_flags = flags;
+}
+
+static void prep_sendmsg(io_uring_sqe* sqe, const struct msghdr* msg, int flags) {
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->addr = (uint64_t)(uintptr_t)msg;
+    sqe->len = 1;
+    sqe->msg_flags = flags;
+}
+
 extern "C" {
 
 #define XX(name) name ## _fun name ## _f = nullptr;
@@ -171,8 +382,8 @@ unsigned int sleep(unsigned int seconds) {
     sylar::Fiber::ptr fiber = sylar::Fiber::GetThis();
     sylar::IOManager* iom = sylar::IOManager::GetThis();
     iom->addTimer(seconds * 1000, std::bind((void(sylar::Scheduler::*)
-            (sylar::Fiber::ptr, int thread))&sylar::IOManager::schedule
-            ,iom, fiber, -1));
+            (sylar::Fiber::ptr, int thread, size_t stacksize, sylar::Scheduler::Priority priority))&sylar::IOManager::schedule
+            ,iom, fiber, -1, 0, sylar::Scheduler::NORMAL), false, true);
     sylar::Fiber::GetThis()->yield();
     return 0;
 }
@@ -184,8 +395,8 @@ int usleep(useconds_t usec) {
     sylar::Fiber::ptr fiber = sylar::Fiber::GetThis();
     sylar::IOManager* iom = sylar::IOManager::GetThis();
     iom->addTimer(usec / 1000, std::bind((void(sylar::Scheduler::*)
-            (sylar::Fiber::ptr, int thread))&sylar::IOManager::schedule
-            ,iom, fiber, -1));
+            (sylar::Fiber::ptr, int thread, size_t stacksize, sylar::Scheduler::Priority priority))&sylar::IOManager::schedule
+            ,iom, fiber, -1, 0, sylar::Scheduler::NORMAL), false, true);
     sylar::Fiber::GetThis()->yield();
     return 0;
 }
@@ -199,8 +410,8 @@ int nanosleep(const struct timespec *req, struct timespec *rem) {
     sylar::Fiber::ptr fiber = sylar::Fiber::GetThis();
     sylar::IOManager* iom = sylar::IOManager::GetThis();
     iom->addTimer(timeout_ms, std::bind((void(sylar::Scheduler::*)
-            (sylar::Fiber::ptr, int thread))&sylar::IOManager::schedule
-            ,iom, fiber, -1));
+            (sylar::Fiber::ptr, int thread, size_t stacksize, sylar::Scheduler::Priority priority))&sylar::IOManager::schedule
+            ,iom, fiber, -1, 0, sylar::Scheduler::NORMAL), false, true);
     sylar::Fiber::GetThis()->yield();
     return 0;
 }
@@ -221,7 +432,7 @@ int connect_with_timeout(int fd, const struct sockaddr* addr, socklen_t addrlen,
     if(!sylar::t_hook_enable) {
         return connect_f(fd, addr, addrlen);
     }
-    sylar::FdCtx::ptr ctx = sylar::FdMgr::GetInstance()->get(fd);
+    sylar::FdCtx* ctx = sylar::FdMgr::GetInstance()->get(fd);
     if(!ctx || ctx->isClose()) {
             errno = EBADF;
             return -1;
@@ -235,6 +446,23 @@ int connect_with_timeout(int fd, const struct sockaddr* addr, socklen_t addrlen,
         return connect_f(fd, addr, addrlen);
     }
 
+    //io_uring后端提交完成式connect，内核等待连接完成后直接返回结果
+    sylar::IOManager* uring_iom = sylar::IOManager::GetThis();
+    sylar::Fiber* cur = sylar::Fiber::GetThis().get();
+    if(uring_iom && uring_iom->canSubmitIo() && cur->isRunInScheduler() && !cur->isSharedStack()
+            && !sylar::Scheduler::InInlineTask()) {
+        int rt = uring_iom->submitIo(fd, [addr, addrlen](io_uring_sqe* sqe) {
+            sqe->opcode = IORING_OP_CONNECT;
+            sqe->addr = (uint64_t)(uintptr_t)addr;
+            sqe->off = addrlen;
+        }, timeout_ms);
+        if(rt < 0) {
+            errno = -rt;
+            return -1;
+        }
+        return 0;
+    }
+
     int n = connect_f(fd, addr, addrlen);
     if(n == 0) {
         return 0;
@@ -242,6 +470,9 @@ int connect_with_timeout(int fd, const struct sockaddr* addr, socklen_t addrlen,
         return n;
     }
     //当 errno == EINPROGRESS
+#ifndef NDEBUG
+    SYLAR_ASSERT2(!sylar::Scheduler::InInlineTask(), "connect would block in inline task");
+#endif
     sylar::IOManager* iom = sylar::IOManager::GetThis();
     sylar::Timer::ptr timer;
     std::shared_ptr<timer_info> tinfo(new timer_info);
@@ -263,10 +494,10 @@ int connect_with_timeout(int fd, const struct sockaddr* addr, socklen_t addrlen,
                 }
                 t->cancelled = ETIMEDOUT;
                 iom->cancelEvent(fd, sylar::IOManager::WRITE);
-        }, winfo);
+        }, winfo, false, true);
     }
 
-    int rt = iom->addEvent(fd, sylar::IOManager::WRITE);
+    int rt = iom->addEvent(ctx, sylar::IOManager::WRITE);
     if(rt == 0) {
         sylar::Fiber::GetThis()->yield();
         
@@ -305,7 +536,7 @@ int connect(int sockfd, const struct sockaddr *addr, socklen_t addrlen) {
 }
 
 int accept(int s, struct sockaddr *addr, socklen_t *addrlen) {
-    int fd = do_io(s, accept_f, "accept", sylar::IOManager::READ, SO_RCVTIMEO, addr, addrlen);
+    int fd = do_io_prep(s, accept_f, "accept", sylar::IOManager::READ, SO_RCVTIMEO, prep_accept, addr, addrlen);
     if(fd >= 0) {
         sylar::FdMgr::GetInstance()->get(fd, true);
     }
@@ -313,15 +544,15 @@ int accept(int s, struct sockaddr *addr, socklen_t *addrlen) {
 }
 
 ssize_t read(int fd, void *buf, size_t count) {
-    return do_io(fd, read_f, "read", sylar::IOManager::READ, SO_RCVTIMEO, buf, count);
+    return do_io_prep(fd, read_f, "read", sylar::IOManager::READ, SO_RCVTIMEO, prep_read, buf, count);
 }
 
 ssize_t readv(int fd, const struct iovec *iov, int iovcnt) {
-    return do_io(fd, readv_f, "readv", sylar::IOManager::READ, SO_RCVTIMEO, iov, iovcnt);
+    return do_io_prep(fd, readv_f, "readv", sylar::IOManager::READ, SO_RCVTIMEO, prep_readv, iov, iovcnt);
 }
 
 ssize_t recv(int sockfd, void *buf, size_t len, int flags) {
-    return do_io(sockfd, recv_f, "recv", sylar::IOManager::READ, SO_RCVTIMEO, buf, len, flags);
+    return do_io_prep(sockfd, recv_f, "recv", sylar::IOManager::READ, SO_RCVTIMEO, prep_recv, buf, len, flags);
 }
 
 ssize_t recvfrom(int sockfd, void *buf, size_t len, int flags, struct sockaddr *src_addr, socklen_t *addrlen) {
@@ -329,19 +560,19 @@ ssize_t recvfrom(int sockfd, void *buf, size_t len, int flags, struct sockaddr *
 }
 
 ssize_t recvmsg(int sockfd, struct msghdr *msg, int flags) {
-    return do_io(sockfd, recvmsg_f, "recvmsg", sylar::IOManager::READ, SO_RCVTIMEO, msg, flags);
+    return do_io_prep(sockfd, recvmsg_f, "recvmsg", sylar::IOManager::READ, SO_RCVTIMEO, prep_recvmsg, msg, flags);
 }
 
 ssize_t write(int fd, const void *buf, size_t count) {
-    return do_io(fd, write_f, "write", sylar::IOManager::WRITE, SO_SNDTIMEO, buf, count);
+    return do_io_prep(fd, write_f, "write", sylar::IOManager::WRITE, SO_SNDTIMEO, prep_write, buf, count);
 }
 
 ssize_t writev(int fd, const struct iovec *iov, int iovcnt) {
-    return do_io(fd, writev_f, "writev", sylar::IOManager::WRITE, SO_SNDTIMEO, iov, iovcnt);
+    return do_io_prep(fd, writev_f, "writev", sylar::IOManager::WRITE, SO_SNDTIMEO, prep_writev, iov, iovcnt);
 }
 
 ssize_t send(int s, const void *msg, size_t len, int flags) {
-    return do_io(s, send_f, "send", sylar::IOManager::WRITE, SO_SNDTIMEO, msg, len, flags);
+    return do_io_prep(s, send_f, "send", sylar::IOManager::WRITE, SO_SNDTIMEO, prep_send, msg, len, flags);
 }
 
 ssize_t sendto(int s, const void *msg, size_t len, int flags, const struct sockaddr *to, socklen_t tolen) {
@@ -349,7 +580,7 @@ ssize_t sendto(int s, const void *msg, size_t len, int flags, const struct socka
 }
 
 ssize_t sendmsg(int s, const struct msghdr *msg, int flags) {
-    return do_io(s, sendmsg_f, "sendmsg", sylar::IOManager::WRITE, SO_SNDTIMEO, msg, flags);
+    return do_io_prep(s, sendmsg_f, "sendmsg", sylar::IOManager::WRITE, SO_SNDTIMEO, prep_sendmsg, msg, flags);
 }
 
 
@@ -359,11 +590,12 @@ int close(int fd) {
     }
 
     //取消所有事件
-    sylar::FdCtx::ptr ctx = sylar::FdMgr::GetInstance()->get(fd);
+    sylar::FdCtx* ctx = sylar::FdMgr::GetInstance()->get(fd);
     if(ctx) {
         auto iom = sylar::IOManager::GetThis();
         if(iom) {
             iom->cancelAll(fd);
+            iom->unregisterFd(fd);
         }
         sylar::FdMgr::GetInstance()->del(fd);
     }
@@ -380,7 +612,7 @@ int fcntl(int fd, int cmd, ... /* arg */ ) {
                 int arg = va_arg(va, int);
                 //C 库宏 void va_end(va_list ap) 允许使用了 va_start 宏的带有可变参数的函数返回。如果在从函数返回之前没有调用 va_end，则结果为未定义
                 va_end(va);
-                sylar::FdCtx::ptr ctx = sylar::FdMgr::GetInstance()->get(fd);
+                sylar::FdCtx* ctx = sylar::FdMgr::GetInstance()->get(fd);
                 if(!ctx || ctx->isClose() || !ctx->isSocket()) {
                     return fcntl_f(fd, cmd, arg);
                 }
@@ -397,7 +629,7 @@ int fcntl(int fd, int cmd, ... /* arg */ ) {
             {
                 va_end(va);
                 int arg = fcntl_f(fd, cmd);
-                sylar::FdCtx::ptr ctx = sylar::FdMgr::GetInstance()->get(fd);
+                sylar::FdCtx* ctx = sylar::FdMgr::GetInstance()->get(fd);
                 if(!ctx || ctx->isClose() || !ctx->isSocket()) {
                     return arg;
                 }
@@ -468,7 +700,7 @@ int ioctl(int d, unsigned long int request, ...) {
     //设置和清除非阻塞标志
     if(FIONBIO == request) {
         bool user_nonblock = !!*(int*)arg;
-        sylar::FdCtx::ptr ctx = sylar::FdMgr::GetInstance()->get(d);
+        sylar::FdCtx* ctx = sylar::FdMgr::GetInstance()->get(d);
         if(!ctx || ctx->isClose() || !ctx->isSocket()) {
             return ioctl_f(d, request, arg);
         }
@@ -488,7 +720,7 @@ int setsockopt(int sockfd, int level, int optname, const void *optval, socklen_t
     //先设置接收超时时间或者发送超时时间
     if(level == SOL_SOCKET) {
         if(optname == SO_RCVTIMEO || optname == SO_SNDTIMEO) {
-            sylar::FdCtx::ptr ctx = sylar::FdMgr::GetInstance()->get(sockfd);
+            sylar::FdCtx* ctx = sylar::FdMgr::GetInstance()->get(sockfd);
             if(ctx) {
                 const timeval* v = (const timeval*)optval;
                 ctx->setTimeout(optname, v->tv_sec * 1000 + v->tv_usec / 1000);
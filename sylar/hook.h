@@ -8,6 +8,8 @@
 #include <stdint.h>
 #include <time.h>
 #include <unistd.h>
+#include <string>
+#include <vector>
 
 namespace sylar {
     /**
@@ -19,6 +21,32 @@ namespace sylar {
      */
     void set_hook_enable(bool flag);
 
+    /**
+     * @brief 是否把普通文件的IO调用交给阻塞调用线程池(offload.file_io)
+     */
+    bool is_file_io_offloaded();
+
+    /**
+     * @brief 开启了hook的线程上，没有走协程调度、直接阻塞执行的IO调用的统计
+     * @details 只统计普通文件的读写，这些调用会阻塞整个调度线程；管道、终端等其他句柄不计入
+     */
+    struct BlockingCallStats {
+        /// hook函数名
+        std::string name;
+        /// 调用次数
+        uint64_t count = 0;
+        /// 总耗时(微秒)
+        uint64_t totalUs = 0;
+        /// 最大耗时(微秒)
+        uint64_t maxUs = 0;
+    };
+
+    /**
+     * @brief 获取直接阻塞执行的IO调用统计
+     * @param[out] stats 每个出现过的hook函数一项
+     */
+    void get_blocking_call_stats(std::vector<BlockingCallStats>& stats);
+
 }
 
 //按c语言方式编译和链接
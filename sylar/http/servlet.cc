@@ -25,6 +25,8 @@ int32_t ServletDispatch::handle(sylar::http::HttpRequest::ptr request
                , sylar::http::HttpSession::ptr session) {
     auto slt = getMatchedServlet(request->getPath());
     if(slt) {
+        // 开启协程栈统计时按Servlet聚合栈使用量
+        sylar::Fiber::SetStackTag(slt->getName());
         slt->handle(request, response, session);
     }
     return 0;
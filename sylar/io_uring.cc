@@ -0,0 +1,218 @@
+#include "io_uring.h"
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+#include "log.h"
+
+namespace sylar {
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+static int IoUringSetup(uint32_t entries, io_uring_params* p) {
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int IoUringEnter(int fd, uint32_t to_submit, uint32_t min_complete, uint32_t flags,
+                        const void* arg, size_t argsz) {
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+static int IoUringRegister(int fd, uint32_t opcode, void* arg, uint32_t nr_args) {
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+template<class T>
+static T* RingPtr(void* ring, uint32_t offset) {
+    return (T*)((char*)ring + offset);
+}
+
+IoUring::IoUring(uint32_t entries) {
+    io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = entries * 2;
+    int fd = IoUringSetup(entries, &p);
+    if (fd < 0) {
+        SYLAR_LOG_WARN(g_logger) << "io_uring_setup(" << entries << ") errno=" << errno
+                                 << " " << strerror(errno);
+        return;
+    }
+    m_features = p.features;
+
+    m_sqRingSize = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+    m_cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    bool single_mmap = m_features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap) {
+        m_sqRingSize = m_cqRingSize = std::max(m_sqRingSize, m_cqRingSize);
+    }
+    m_sqRing = mmap(nullptr, m_sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    fd, IORING_OFF_SQ_RING);
+    if (m_sqRing == MAP_FAILED) {
+        m_sqRing = nullptr;
+        close(fd);
+        return;
+    }
+    if (single_mmap) {
+        m_cqRing = m_sqRing;
+    } else {
+        m_cqRing = mmap(nullptr, m_cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        fd, IORING_OFF_CQ_RING);
+        if (m_cqRing == MAP_FAILED) {
+            m_cqRing = nullptr;
+            munmap(m_sqRing, m_sqRingSize);
+            m_sqRing = nullptr;
+            close(fd);
+            return;
+        }
+    }
+    m_sqesSize = p.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        if (m_cqRing != m_sqRing) {
+            munmap(m_cqRing, m_cqRingSize);
+        }
+        munmap(m_sqRing, m_sqRingSize);
+        m_sqRing = m_cqRing = nullptr;
+        close(fd);
+        return;
+    }
+    m_sqes = (io_uring_sqe*)sqes;
+
+    m_sqHead = RingPtr<std::atomic<uint32_t> >(m_sqRing, p.sq_off.head);
+    m_sqTail = RingPtr<std::atomic<uint32_t> >(m_sqRing, p.sq_off.tail);
+    m_sqMask = *RingPtr<uint32_t>(m_sqRing, p.sq_off.ring_mask);
+    m_sqEntries = *RingPtr<uint32_t>(m_sqRing, p.sq_off.ring_entries);
+    m_sqLocalTail = m_sqTail->load(std::memory_order_relaxed);
+    // 提交项按顺序使用，索引数组固定为恒等映射
+    uint32_t* array = RingPtr<uint32_t>(m_sqRing, p.sq_off.array);
+    for (uint32_t i = 0; i < m_sqEntries; ++i) {
+        array[i] = i;
+    }
+
+    m_cqHead = RingPtr<std::atomic<uint32_t> >(m_cqRing, p.cq_off.head);
+    m_cqTail = RingPtr<std::atomic<uint32_t> >(m_cqRing, p.cq_off.tail);
+    m_cqMask = *RingPtr<uint32_t>(m_cqRing, p.cq_off.ring_mask);
+    m_cqes = RingPtr<io_uring_cqe>(m_cqRing, p.cq_off.cqes);
+
+    m_fd = fd;
+    probe();
+}
+
+IoUring::~IoUring() {
+    if (m_sqes) {
+        munmap(m_sqes, m_sqesSize);
+    }
+    if (m_cqRing && m_cqRing != m_sqRing) {
+        munmap(m_cqRing, m_cqRingSize);
+    }
+    if (m_sqRing) {
+        munmap(m_sqRing, m_sqRingSize);
+    }
+    if (m_fd >= 0) {
+        close(m_fd);
+    }
+}
+
+void IoUring::probe() {
+    size_t len = sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op);
+    io_uring_probe* probe = (io_uring_probe*)calloc(1, len);
+    if (IoUringRegister(m_fd, IORING_REGISTER_PROBE, probe, 256) == 0) {
+        for (int i = 0; i < probe->ops_len && i < 256; ++i) {
+            if (probe->ops[i].flags & IO_URING_OP_SUPPORTED) {
+                m_supportedOps[probe->ops[i].op / 64] |= 1ull << (probe->ops[i].op % 64);
+            }
+        }
+    }
+    free(probe);
+}
+
+bool IoUring::isOpSupported(uint8_t op) const {
+    return m_supportedOps[op / 64] & (1ull << (op % 64));
+}
+
+io_uring_sqe* IoUring::getSqe() {
+    uint32_t head = m_sqHead->load(std::memory_order_acquire);
+    if (m_sqLocalTail - head >= m_sqEntries) {
+        return nullptr;
+    }
+    io_uring_sqe* sqe = &m_sqes[m_sqLocalTail & m_sqMask];
+    ++m_sqLocalTail;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+void IoUring::publish() {
+    m_sqTail->store(m_sqLocalTail, std::memory_order_release);
+}
+
+uint32_t IoUring::getPendingSubmit() const {
+    return m_sqTail->load(std::memory_order_acquire) - m_sqHead->load(std::memory_order_acquire);
+}
+
+int IoUring::enter(uint32_t to_submit, uint32_t min_complete, uint32_t flags,
+                   const sigset_t* sigmask, uint64_t timeout_ms) {
+    if (!(flags & IORING_ENTER_GETEVENTS) || (!sigmask && timeout_ms == ~0ull)) {
+        int rt = IoUringEnter(m_fd, to_submit, min_complete, flags, nullptr, 0);
+        return rt < 0 ? -errno : rt;
+    }
+    __kernel_timespec ts;
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = (timeout_ms % 1000) * 1000000;
+    io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    arg.sigmask = (uint64_t)(uintptr_t)sigmask;
+    arg.sigmask_sz = _NSIG / 8;
+    arg.ts = timeout_ms == ~0ull ? 0 : (uint64_t)(uintptr_t)&ts;
+    int rt = IoUringEnter(m_fd, to_submit, min_complete, flags | IORING_ENTER_EXT_ARG,
+                          &arg, sizeof(arg));
+    return rt < 0 ? -errno : rt;
+}
+
+int IoUring::submit() {
+    uint32_t n = getPendingSubmit();
+    if (!n) {
+        return 0;
+    }
+    return enter(n, 0, 0, nullptr, ~0ull);
+}
+
+int IoUring::submitAndWait(uint64_t timeout_ms, const sigset_t* sigmask) {
+    return enter(getPendingSubmit(), 1, IORING_ENTER_GETEVENTS, sigmask, timeout_ms);
+}
+
+uint32_t IoUring::reap(io_uring_cqe* cqes, uint32_t max) {
+    uint32_t head = m_cqHead->load(std::memory_order_relaxed);
+    uint32_t tail = m_cqTail->load(std::memory_order_acquire);
+    uint32_t n = 0;
+    while (head != tail && n < max) {
+        cqes[n++] = m_cqes[head & m_cqMask];
+        ++head;
+    }
+    m_cqHead->store(head, std::memory_order_release);
+    return n;
+}
+
+bool IoUring::hasCompletions() const {
+    return m_cqTail->load(std::memory_order_acquire) != m_cqHead->load(std::memory_order_relaxed);
+}
+
+bool IoUring::KernelAtLeast(int major, int minor) {
+    struct utsname u;
+    if (uname(&u)) {
+        return false;
+    }
+    int ma = 0;
+    int mi = 0;
+    if (sscanf(u.release, "%d.%d", &ma, &mi) != 2) {
+        return false;
+    }
+    return ma > major || (ma == major && mi >= minor);
+}
+
+}
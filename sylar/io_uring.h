@@ -0,0 +1,135 @@
+/**
+ * @file io_uring.h
+ * @brief io_uring的薄封装
+ * @details 直接使用io_uring_setup/io_uring_enter/io_uring_register系统调用，不依赖liburing。
+ *          提交队列由调用方加锁保护，完成队列的读取也由调用方加锁保护，io_uring_enter可以在任何线程不加锁调用
+ * @version 0.1
+ */
+#ifndef __SYLAR_IO_URING_H__
+#define __SYLAR_IO_URING_H__
+
+#include <stdint.h>
+#include <signal.h>
+#include <atomic>
+#include <linux/io_uring.h>
+#include "noncopyable.h"
+
+namespace sylar {
+
+class IoUring : Noncopyable {
+public:
+    /**
+     * @brief 构造函数，创建失败时isValid返回false
+     * @param[in] entries 提交队列大小，完成队列是它的两倍
+     */
+    IoUring(uint32_t entries);
+
+    ~IoUring();
+
+    /**
+     * @brief 是否创建成功
+     */
+    bool isValid() const { return m_fd >= 0;}
+
+    /**
+     * @brief 内核是否支持这个操作
+     */
+    bool isOpSupported(uint8_t op) const;
+
+    /**
+     * @brief 内核是否支持这个特性(IORING_FEAT_*)
+     */
+    bool hasFeature(uint32_t feature) const { return m_features & feature;}
+
+    /**
+     * @brief 取一个空的提交项，提交队列满了返回nullptr，调用方持有提交队列的锁
+     * @details 取出的提交项在publish之前内核看不到
+     */
+    io_uring_sqe* getSqe();
+
+    /**
+     * @brief 把getSqe取出的提交项交给内核，调用方持有提交队列的锁
+     */
+    void publish();
+
+    /**
+     * @brief 已经publish但内核还没有取走的提交项数
+     */
+    uint32_t getPendingSubmit() const;
+
+    /**
+     * @brief 提交所有已经publish的提交项，不等待完成
+     * @return 提交的数量，失败返回-errno
+     */
+    int submit();
+
+    /**
+     * @brief 提交所有已经publish的提交项，并等待至少一个完成项
+     * @param[in] timeout_ms 超时时间(毫秒)，~0ull表示不超时
+     * @param[in] sigmask 等待期间的信号屏蔽字，为空表示不改变
+     * @return 成功返回提交的数量，超时返回-ETIME，被信号中断返回-EINTR
+     */
+    int submitAndWait(uint64_t timeout_ms, const sigset_t* sigmask);
+
+    /**
+     * @brief 取出完成项，调用方持有完成队列的锁
+     * @param[out] cqes 完成项
+     * @param[in] max 最多取出的数量
+     * @return 取出的数量
+     */
+    uint32_t reap(io_uring_cqe* cqes, uint32_t max);
+
+    /**
+     * @brief 完成队列是否有完成项，不需要系统调用，用于自旋
+     */
+    bool hasCompletions() const;
+
+    /**
+     * @brief 内核版本是否不低于major.minor
+     */
+    static bool KernelAtLeast(int major, int minor);
+private:
+    /**
+     * @brief 探测内核支持的操作
+     */
+    void probe();
+
+    /**
+     * @brief 调用io_uring_enter
+     */
+    int enter(uint32_t to_submit, uint32_t min_complete, uint32_t flags,
+              const sigset_t* sigmask, uint64_t timeout_ms);
+private:
+    /// io_uring的fd
+    int m_fd = -1;
+    /// 内核支持的特性
+    uint32_t m_features = 0;
+    /// 内核支持的操作，按操作码的位图
+    uint64_t m_supportedOps[4] = {0, 0, 0, 0};
+
+    /// 提交队列环的映射
+    void* m_sqRing = nullptr;
+    size_t m_sqRingSize = 0;
+    /// 完成队列环的映射，内核支持IORING_FEAT_SINGLE_MMAP时和提交队列环是同一块
+    void* m_cqRing = nullptr;
+    size_t m_cqRingSize = 0;
+    /// 提交项数组的映射
+    io_uring_sqe* m_sqes = nullptr;
+    size_t m_sqesSize = 0;
+
+    std::atomic<uint32_t>* m_sqHead = nullptr;
+    std::atomic<uint32_t>* m_sqTail = nullptr;
+    uint32_t m_sqMask = 0;
+    uint32_t m_sqEntries = 0;
+    /// 已经取出但还没有publish的提交项的下一个位置
+    uint32_t m_sqLocalTail = 0;
+
+    std::atomic<uint32_t>* m_cqHead = nullptr;
+    std::atomic<uint32_t>* m_cqTail = nullptr;
+    uint32_t m_cqMask = 0;
+    io_uring_cqe* m_cqes = nullptr;
+};
+
+}
+
+#endif
@@ -1,13 +1,224 @@
 #include <unistd.h>    // for pipe()
 #include <sys/epoll.h> 
 #include <fcntl.h>    
+#include <signal.h>
+#include <pthread.h>
+#include <sched.h>
+#include <poll.h>
+#include <deque>
 #include "iomanager.h"
+#include "config.h"
+#include "fd_manager.h"
+#include "hook.h"
+#include "fiber_sync.h"
 #include "log.h"
 #include "macro.h"
 
 namespace sylar {
     
 static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+static ConfigVar<std::string>::ptr g_iomanager_backend =
+    Config::Lookup<std::string>("iomanager.backend", "epoll", "io backend of IOManager, epoll or io_uring, falls back to epoll when io_uring is unavailable");
+
+static ConfigVar<bool>::ptr g_iomanager_persistent_epoll =
+    Config::Lookup<bool>("iomanager.persistent_epoll", false, "register sockets in epoll once (edge-triggered, read and write) and cache readiness instead of epoll_ctl on every wait, read when an IOManager is created");
+
+static ConfigVar<uint32_t>::ptr g_iomanager_accept_queue_max =
+    Config::Lookup<uint32_t>("iomanager.accept_queue_max", 128, "max connections taken by an io_uring multishot accept but not yet accepted by the application, further connections stay in the listen backlog, read when an IOManager is created");
+
+static ConfigVar<int>::ptr g_iomanager_wake_signal =
+    Config::Lookup<int>("iomanager.wake_signal", 0, "signal used to wake a specific iomanager thread, 0 for SIGRTMIN, read when the first IOManager is created");
+
+/// io_uring提交队列大小，完成队列是它的两倍
+static const uint32_t s_uring_entries = 1024;
+
+/**
+ * @brief io_uring请求user_data低3位的标记，区分完成项的来源
+ * @details 高16位是序号，中间是FdContext或IoRequest的地址，user_data为0的完成项不需要处理
+ */
+enum UringTag {
+    /// FdContext上读事件的一次性poll
+    TAG_POLL_READ = 1,
+    /// FdContext上写事件的一次性poll
+    TAG_POLL_WRITE = 2,
+    /// tickle管道上的multishot poll
+    TAG_TICKLE = 3,
+    /// 完成式IO，地址是协程栈上的IoRequest
+    TAG_IO = 4,
+    /// FdContext上的multishot accept
+    TAG_ACCEPT = 5,
+};
+
+static const uint64_t s_tag_mask = 7;
+static const int s_seq_shift = 48;
+
+/**
+ * @brief 把地址、标签和序号打包成user_data
+ * @details 地址按8字节对齐，低3位放标签；x86_64和aarch64在4级页表下用户态地址只有48位，高16位放序号。
+ *          开启5级页表并且映射了128T以上的地址时这个假设不成立，由断言发现
+ */
+static uint64_t MakeUserData(const void* ptr, UringTag tag, uint16_t seq = 0) {
+    SYLAR_ASSERT2(((uintptr_t)ptr >> s_seq_shift) == 0 && ((uintptr_t)ptr & s_tag_mask) == 0,
+                  "io_uring user_data pointer " << ptr);
+    return (uint64_t)(uintptr_t)ptr | tag | ((uint64_t)seq << s_seq_shift);
+}
+
+static void* UserDataPtr(uint64_t user_data) {
+    return (void*)(uintptr_t)(user_data & ((1ull << s_seq_shift) - 1) & ~s_tag_mask);
+}
+
+static uint16_t UserDataSeq(uint64_t user_data) {
+    return user_data >> s_seq_shift;
+}
+
+/**
+ * @brief 创建io_uring，内核不支持需要的特性时返回nullptr
+ * @details 按fd取消请求和multishot accept需要5.19
+ */
+static IoUring* CreateUring(const std::string& name) {
+    if(!IoUring::KernelAtLeast(5, 19)) {
+        SYLAR_LOG_WARN(g_logger) << "IOManager " << name << " io_uring requires linux 5.19+";
+        return nullptr;
+    }
+    std::unique_ptr<IoUring> ring(new IoUring(s_uring_entries));
+    if(!ring->isValid() || !ring->hasFeature(IORING_FEAT_EXT_ARG)
+            || !ring->hasFeature(IORING_FEAT_NODROP)) {
+        SYLAR_LOG_WARN(g_logger) << "IOManager " << name << " io_uring setup failed";
+        return nullptr;
+    }
+    static const uint8_t ops[] = {IORING_OP_POLL_ADD, IORING_OP_POLL_REMOVE, IORING_OP_ASYNC_CANCEL,
+        IORING_OP_LINK_TIMEOUT, IORING_OP_RECV, IORING_OP_SEND, IORING_OP_READV, IORING_OP_WRITEV,
+        IORING_OP_RECVMSG, IORING_OP_SENDMSG, IORING_OP_ACCEPT, IORING_OP_CONNECT};
+    for(auto op : ops) {
+        if(!ring->isOpSupported(op)) {
+            SYLAR_LOG_WARN(g_logger) << "IOManager " << name << " io_uring op " << (int)op << " unsupported";
+            return nullptr;
+        }
+    }
+    return ring.release();
+}
+
+/**
+ * @brief 一个完成式IO请求，放在发起请求的协程栈上，请求完成之前协程不会返回
+ */
+struct IoRequest {
+    /// 等待完成的协程
+    Fiber::ptr fiber;
+    /// 协程所在的调度器
+    Scheduler* scheduler = nullptr;
+    /// 协程挂起时所在的线程，完成后回到这个线程运行
+    int thread = -1;
+    /// 操作的结果
+    int res = 0;
+    /// 链接的超时时间
+    __kernel_timespec ts;
+};
+
+/**
+ * @brief fd上multishot accept收到的连接
+ * @details 连接先放进队列，accept的协程从队列取；队列空时协程在waiters上等待。
+ *          fd关闭时gen加1，之前的accept请求收到的连接直接关闭。
+ *          队列长度到达iomanager.accept_queue_max时取消multishot accept，队列取空之后再注册
+ */
+struct IOManager::AcceptQueue {
+    Mutex mutex;
+    /// 注册multishot accept的IOManager，析构时释放它创建的队列
+    IOManager* iom = nullptr;
+    /// 收到还没有被取走的连接
+    std::deque<int> fds;
+    /// 等待连接的协程
+    std::list<FiberWaiter::ptr> waiters;
+    /// multishot accept请求是否还在内核里
+    bool armed = false;
+    /// 队列满了，已经提交了取消multishot accept的请求，请求结束时清除
+    bool cancelling = false;
+    /// accept请求的序号
+    uint16_t gen = 0;
+    /// multishot accept因为错误结束时的errno，交给下一个accept调用返回
+    int error = 0;
+};
+
+/// 本线程推迟提交io_uring请求的次数
+static thread_local uint32_t t_deferred_submits = 0;
+
+static void OnWakeSignal(int) {
+    // 只用于中断epoll_pwait
+}
+
+/**
+ * @brief 安装唤醒信号的处理函数
+ * @return 使用的信号，信号无效或者应用程序已经设置了处理函数时返回0
+ */
+static int InstallWakeSignal() {
+    int sig = g_iomanager_wake_signal->getValue();
+    if(!sig) {
+        sig = SIGRTMIN;
+    }
+    struct sigaction old;
+    if(sig < 1 || sig > SIGRTMAX || sigaction(sig, nullptr, &old)) {
+        SYLAR_LOG_WARN(g_logger) << "invalid iomanager.wake_signal " << sig
+                                 << ", pinned tasks are woken through the tickle pipe";
+        return 0;
+    }
+    if((old.sa_flags & SA_SIGINFO) || old.sa_handler != SIG_DFL) {
+        // 不覆盖应用程序自己的处理函数
+        SYLAR_LOG_WARN(g_logger) << "signal " << sig << " already has a handler, set iomanager.wake_signal"
+                                 << " to a free signal, pinned tasks are woken through the tickle pipe";
+        return 0;
+    }
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = &OnWakeSignal;
+    sigemptyset(&sa.sa_mask);
+    // 不在epoll_pwait期间到达的信号都被屏蔽，SA_RESTART只是保险
+    sa.sa_flags = SA_RESTART;
+    sigaction(sig, &sa, nullptr);
+    return sig;
+}
+
+/// 唤醒指定调度线程的信号，第一个IOManager构造时安装，为0时不用信号唤醒
+static int GetWakeSignal() {
+    static int s_wake_signal = InstallWakeSignal();
+    return s_wake_signal;
+}
+
+/**
+ * @brief 在调度线程上屏蔽唤醒信号，得到等待期间使用的信号掩码
+ * @details 唤醒信号平时屏蔽，只在epoll_pwait/io_uring_enter期间解除屏蔽，
+ *          这样信号要么中断等待，要么挂起到下一次等待
+ */
+static void BlockWakeSignal(sigset_t* old_mask, sigset_t* wait_mask) {
+    int sig = GetWakeSignal();
+    sigset_t wake_set;
+    sigemptyset(&wake_set);
+    if(sig) {
+        sigaddset(&wake_set, sig);
+    }
+    pthread_sigmask(SIG_BLOCK, &wake_set, old_mask);
+    *wait_mask = *old_mask;
+    if(sig) {
+        sigdelset(wait_mask, sig);
+    }
+}
+
+/// 自旋等待时让出流水线资源给同一核心上的超线程
+static inline void CpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield" ::: "memory");
+#endif
+}
+
+/// 等其他线程结束对事件上下文的独占，自旋一会儿之后让出CPU，独占的线程可能被切走了
+static inline void SpinWait(uint32_t& spins) {
+    if(++spins < 64) {
+        CpuRelax();
+    } else {
+        sched_yield();
+    }
+}
 enum EpollCtlOp { 
 
 };
@@ -74,122 +285,650 @@ void IOManager::FdContext::resetEventContext(EventContext& ctx){
     ctx.cb = nullptr;
 }
 
+bool IOManager::FdContext::claimWaiter(IOManager::Event event) {
+    std::atomic<uint8_t>& state = states[EventIndex(event)];
+    uint8_t s = state.load(std::memory_order_acquire);
+    uint32_t spins = 0;
+    while(true) {
+        if(s == WAITING) {
+            if(state.compare_exchange_weak(s, CLAIMED, std::memory_order_acquire)) {
+                return true;
+            }
+            continue;
+        }
+        if(s != CLAIMED && s != CLAIMED_READY) {
+            return false;
+        }
+        //其他线程正在添加或触发这个方向的事件，只有几条指令，很快就会结束
+        SpinWait(spins);
+        s = state.load(std::memory_order_acquire);
+    }
+}
+
+bool IOManager::FdContext::publishWaiter(IOManager::Event event) {
+    std::atomic<uint8_t>& state = states[EventIndex(event)];
+    uint8_t s = CLAIMED;
+    if(state.compare_exchange_strong(s, WAITING, std::memory_order_release)) {
+        return true;
+    }
+    //独占期间已经就绪，继续独占，由调用方触发
+    state.store(CLAIMED, std::memory_order_relaxed);
+    return false;
+}
+
+void IOManager::FdContext::releaseClaim(IOManager::Event event) {
+    std::atomic<uint8_t>& state = states[EventIndex(event)];
+    uint8_t s = CLAIMED;
+    if(!state.compare_exchange_strong(s, IDLE, std::memory_order_release)) {
+        //独占期间就绪过，等待者已经不在了，留给下一个等待者
+        state.store(READY, std::memory_order_release);
+    }
+}
+
+bool IOManager::FdContext::markReady(IOManager::Event event, bool cache) {
+    std::atomic<uint8_t>& state = states[EventIndex(event)];
+    uint8_t s = state.load(std::memory_order_acquire);
+    while(true) {
+        uint8_t next = IDLE;
+        switch(s) {
+            case WAITING:
+                next = CLAIMED;
+                break;
+            case CLAIMED:
+                next = CLAIMED_READY;
+                break;
+            case IDLE:
+                if(!cache) {
+                    return false;
+                }
+                next = READY;
+                break;
+            default:
+                return false;
+        }
+        if(state.compare_exchange_weak(s, next, std::memory_order_acq_rel)) {
+            return next == CLAIMED;
+        }
+    }
+}
+
+void IOManager::FdContext::clearReady() {
+    for(int i = 0; i < 2; ++i) {
+        uint8_t s = READY;
+        states[i].compare_exchange_strong(s, IDLE, std::memory_order_relaxed);
+    }
+}
+
+bool IOManager::FdContext::hasWaiter(IOManager::Event event) const {
+    uint8_t s = states[EventIndex(event)].load(std::memory_order_acquire);
+    return s == WAITING || s == CLAIMED || s == CLAIMED_READY;
+}
+
 void IOManager::FdContext::triggerEvent(IOManager::Event event){
-    //待触发的事件必须已被注册过
-    SYLAR_ASSERT(events & event);
-    /**
-     *  清除该事件，表示不再关注该事件了
-     * 也就是说，注册的IO事件是一次性的，如果想持续关注某个socket fd的读写事件，那么每次触发事件之后都要重新添加
-     */
-    events = (Event) (events & ~event);
-
-    //调度对应的协程
+    //先取走事件上下文再结束独占，被唤醒的协程马上再添加同一个事件时不用等
     EventContext &ctx = getEventContext(event); 
-    if(ctx.cb) {
-        ctx.scheduler->schedule(ctx.cb);
+    Scheduler* scheduler = ctx.scheduler;
+    Fiber::ptr fiber;
+    std::function<void()> cb;
+    fiber.swap(ctx.fiber);
+    cb.swap(ctx.cb);
+    ctx.scheduler = nullptr;
+    releaseClaim(event);
+
+    //调度对应的协程，IO事件唤醒的协程对延迟敏感，使用高优先级
+    if(cb) {
+        scheduler->schedule(cb, -1, 0, Scheduler::HIGH);
     } else {
-        ctx.scheduler->schedule(ctx.fiber);
+        scheduler->schedule(fiber, -1, 0, Scheduler::HIGH);
+    }
+}
+
+void IOManager::FdContext::triggerEvent(IOManager::Event event, Scheduler* batch_sc,
+                                        std::vector<Fiber::ptr>& fibers,
+                                        std::vector<std::function<void()> >& cbs) {
+    EventContext &ctx = getEventContext(event);
+    Scheduler* scheduler = ctx.scheduler;
+    Fiber::ptr fiber;
+    std::function<void()> cb;
+    fiber.swap(ctx.fiber);
+    cb.swap(ctx.cb);
+    ctx.scheduler = nullptr;
+    releaseClaim(event);
+
+    if(scheduler != batch_sc) {
+        //注册事件时所在的调度器不是批量调度的调度器，直接调度
+        if(cb) {
+            scheduler->schedule(cb, -1, 0, Scheduler::HIGH);
+        } else {
+            scheduler->schedule(fiber, -1, 0, Scheduler::HIGH);
+        }
+    } else if(cb) {
+        cbs.push_back(std::move(cb));
+    } else {
+        fibers.push_back(std::move(fiber));
     }
-    resetEventContext(ctx);
-    return;
 }
 
 IOManager::IOManager(size_t threads, bool use_Caller, const std::string &name) 
-    : Scheduler(threads, use_Caller, name) {
-    m_epfd = epoll_create(5000);//提示内核事件表需要多大
-    SYLAR_ASSERT(m_epfd > 0);
+    : IOManager(threads, use_Caller, name, std::vector<int>()) {
+}
+
+IOManager::IOManager(size_t threads, bool use_Caller, const std::string &name, const std::vector<int>& cpus)
+    : Scheduler(threads, use_Caller, name, cpus) {
+    //事件上下文放在FdManager的记录里，保证FdManager先于IOManager构造、后于IOManager析构
+    FdMgr::GetInstance();
+    //调度线程启动之前安装唤醒信号的处理函数
+    GetWakeSignal();
+    if(g_iomanager_backend->getValue() == "io_uring") {
+        m_uring.reset(CreateUring(name));
+        if(!m_uring) {
+            SYLAR_LOG_WARN(g_logger) << "IOManager " << name << " fall back to epoll";
+        }
+    }
 
     int rt = pipe(m_tickleFds);//成功返回0
     SYLAR_ASSERT(!rt);
 
-    // 关注pipe读句柄的可读事件，用于tickle协程
-    epoll_event event;
-    memset(&event, 0, sizeof(epoll_event));
-    event.events = EPOLLIN | EPOLLET;
-    event.data.fd = m_tickleFds[0];
-
     // 设置m_tickleFds[0]非阻塞方式，配合边缘触发
     rt = fcntl(m_tickleFds[0], F_SETFL, O_NONBLOCK);
     SYLAR_ASSERT(!rt);
-    //往事件表上注册fd上的事件
-    rt = epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_tickleFds[0], &event);
-    SYLAR_ASSERT(!rt);
-    //socket事件上下文的容器初始化大小
-    contextResize(32);
-    //启动调度器
-    start();
 
-}
+    if(m_uring) {
+        m_acceptQueueMax = std::max<uint32_t>(g_iomanager_accept_queue_max->getValue(), 1);
+        armTickle();
+        flushSubmissions(true);
+    } else {
+        m_persistent = g_iomanager_persistent_epoll->getValue();
+        m_epfd = epoll_create(5000);//提示内核事件表需要多大
+        SYLAR_ASSERT(m_epfd > 0);
 
-void IOManager::contextResize(size_t size) {
-    m_fdContexts.resize(size);
+        // 关注pipe读句柄的可读事件，用于tickle协程
+        epoll_event event;
+        memset(&event, 0, sizeof(epoll_event));
+        event.events = EPOLLIN | EPOLLET;
+        event.data.fd = m_tickleFds[0];
 
-    for (size_t i = 0; i < m_fdContexts.size(); ++i) {
-        if (!m_fdContexts[i]) {
-            m_fdContexts[i] = new FdContext;//这里用了 new
-            m_fdContexts[i]->fd = i;
-        }
+        //往事件表上注册fd上的事件
+        rt = epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_tickleFds[0], &event);
+        SYLAR_ASSERT(!rt);
     }
+    //启动调度器
+    start();
+
 }
 
 IOManager::~IOManager() {
     stop();
-    close(m_epfd);
+    if (m_epfd >= 0) {
+        close(m_epfd);
+    }
     close(m_tickleFds[0]);
     close(m_tickleFds[1]);
 
-    for (size_t i = 0; i < m_fdContexts.size(); ++i) {
-        if (m_fdContexts[i]) {
-            delete m_fdContexts[i];
+    // 记录由FdManager保留，只清掉属于这个IOManager的状态
+    FdMgr::GetInstance()->foreach([this](FdCtx* fd_ctx) {
+        FdContext::MutexType::Lock lock(fd_ctx->mutex);
+        if (fd_ctx->acceptQueue && fd_ctx->acceptQueue->iom == this) {
+            // 还没有被accept取走的连接
+            for (int fd : fd_ctx->acceptQueue->fds) {
+                close(fd);
+            }
+            delete fd_ctx->acceptQueue;
+            fd_ctx->acceptQueue = nullptr;
+        }
+        if (fd_ctx->owner == this) {
+            // 停止时已经没有等待中的事件，常驻注册随epoll一起关闭
+            fd_ctx->owner = nullptr;
+            fd_ctx->regId = 0;
+            fd_ctx->clearReady();
+        }
+    });
+}
+
+FdCtx* IOManager::getFdContext(int fd, bool auto_create) {
+    return FdMgr::GetInstance()->at(fd, auto_create);
+}
+
+bool IOManager::updateInterest(FdContext* fd_ctx, Event old_events, Event new_events) {
+    if (fd_ctx->regId) {
+        // 常驻注册一直关注读写，事件只记录在fd_ctx->events里
+        return true;
+    }
+    if (!m_uring) {
+        ++m_epollCtls;
+        int op = old_events ? (new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL) : EPOLL_CTL_ADD;
+        epoll_event epevent;
+        epevent.events = EPOLLET | new_events;
+        epevent.data.ptr = fd_ctx;
+
+        int rt = epoll_ctl(m_epfd, op, fd_ctx->fd, &epevent);
+        if (rt) {
+            SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
+                                      << (EpollCtlOp)op << ", " << fd_ctx->fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
+                                      << rt << " (" << errno << ") (" << strerror(errno) << ") fd_ctx->events="
+                                      << (EPOLL_EVENTS)old_events;
+            return false;
+        }
+        return true;
+    }
+
+    // io_uring的poll是一次性的，读写事件各用一个poll请求，序号区分同一个fd上先后添加的事件
+    {
+        Mutex::Lock lock(m_sqMutex);
+        for (int i = 0; i < 2; ++i) {
+            Event event = i ? WRITE : READ;
+            UringTag tag = i ? TAG_POLL_WRITE : TAG_POLL_READ;
+            if ((new_events & event) && !(old_events & event)) {
+                ++fd_ctx->pollSeq[i];
+                io_uring_sqe* sqe = getSqe();
+                sqe->opcode = IORING_OP_POLL_ADD;
+                sqe->fd = fd_ctx->fd;
+                sqe->poll32_events = i ? POLLOUT : POLLIN;
+                sqe->user_data = MakeUserData(fd_ctx, tag, fd_ctx->pollSeq[i]);
+            } else if (!(new_events & event) && (old_events & event)) {
+                io_uring_sqe* sqe = getSqe();
+                sqe->opcode = IORING_OP_POLL_REMOVE;
+                sqe->fd = -1;
+                sqe->addr = MakeUserData(fd_ctx, tag, fd_ctx->pollSeq[i]);
+            }
+        }
+        m_uring->publish();
+    }
+    flushSubmissions(false);
+    return true;
+}
+
+io_uring_sqe* IOManager::getSqe() {
+    io_uring_sqe* sqe = m_uring->getSqe();
+    while (SYLAR_UNLIKELY(!sqe)) {
+        // 提交队列满了，先把已经publish的请求交给内核
+        int rt = m_uring->submit();
+        if (rt < 0 && rt != -EINTR && rt != -EAGAIN && rt != -EBUSY) {
+            SYLAR_LOG_ERROR(g_logger) << "io_uring submit error " << -rt << " " << strerror(-rt);
         }
+        sqe = m_uring->getSqe();
     }
+    return sqe;
 }
 
-int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
-    //找到fd对应的FdContext,如果不存在，那就分配一个
-    FdContext *fd_ctx = nullptr;
-    RWMutexType::ReadLock lock(m_mutex);
-    if((int) m_fdContexts.size() > fd) {
-        fd_ctx = m_fdContexts[fd];
-        lock.unlock();
-    } else {
-        lock.unlock();
-        RWMutexType::WriteLock lock2(m_mutex);
-        contextResize(fd*1.5);
-        fd_ctx = m_fdContexts[fd];
+void IOManager::flushSubmissions(bool force) {
+    // 调度线程上的请求等到beforeDispatch一起提交
+    if (!force && isWorkerThread()) {
+        return;
+    }
+    int rt = m_uring->submit();
+    if (rt < 0 && rt != -EINTR && rt != -EAGAIN && rt != -EBUSY) {
+        SYLAR_LOG_ERROR(g_logger) << "io_uring submit error " << -rt << " " << strerror(-rt);
+    }
+}
+
+void IOManager::beforeDispatch() {
+    if (!m_uring) {
+        return;
+    }
+    uint32_t pending = m_uring->getPendingSubmit();
+    if (!pending) {
+        t_deferred_submits = 0;
+        return;
+    }
+    if (!hasPendingWork() || pending >= 16 || ++t_deferred_submits >= 16) {
+        t_deferred_submits = 0;
+        flushSubmissions(true);
+    }
+}
+
+void IOManager::armTickle() {
+    Mutex::Lock lock(m_sqMutex);
+    io_uring_sqe* sqe = getSqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = m_tickleFds[0];
+    sqe->poll32_events = POLLIN;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = TAG_TICKLE;
+    m_uring->publish();
+}
+
+int IOManager::submitIo(int fd, const std::function<void(io_uring_sqe*)>& prep, uint64_t timeout_ms) {
+    SYLAR_ASSERT(m_uring);
+    FdContext* fd_ctx = getFdContext(fd, true);
+    if (!fd_ctx) {
+        return -EBADF;
+    }
+    io_uring_sqe op;
+    memset(&op, 0, sizeof(op));
+    prep(&op);
+    op.fd = fd;
+    if (op.opcode == IORING_OP_ACCEPT) {
+        return acceptMultishot(fd_ctx, (sockaddr*)(uintptr_t)op.addr,
+                               (socklen_t*)(uintptr_t)op.addr2, timeout_ms);
+    }
+
+    IoRequest req;
+    req.fiber = Fiber::GetThis();
+    req.scheduler = Scheduler::GetThis();
+    req.thread = GetThreadId();
+    uint64_t begin = GetElapsedUS();
+    uint32_t cancel_seq = fd_ctx->cancelSeq;
+    ++fd_ctx->inflightIo;
+    ++m_pendingEventCount;
+    {
+        Mutex::Lock lock(m_sqMutex);
+        io_uring_sqe* sqe = getSqe();
+        *sqe = op;
+        sqe->user_data = MakeUserData(&req, TAG_IO);
+        if (timeout_ms != ~0ull) {
+            // 超时后请求以-ECANCELED完成，超时请求本身的完成项不需要处理
+            req.ts.tv_sec = timeout_ms / 1000;
+            req.ts.tv_nsec = (timeout_ms % 1000) * 1000000;
+            sqe->flags |= IOSQE_IO_LINK;
+            io_uring_sqe* timeout_sqe = getSqe();
+            timeout_sqe->opcode = IORING_OP_LINK_TIMEOUT;
+            timeout_sqe->fd = -1;
+            timeout_sqe->addr = (uint64_t)(uintptr_t)&req.ts;
+            timeout_sqe->len = 1;
+        }
+        m_uring->publish();
+    }
+    flushSubmissions(false);
+    // 完成项把协程调度回当前线程，yield之前不会被取走
+    Fiber::GetThis()->yield();
+    --fd_ctx->inflightIo;
+
+    int res = req.res;
+    if (res == -ECANCELED) {
+        if (fd_ctx->cancelSeq != cancel_seq) {
+            res = -EBADF;
+        } else if (timeout_ms != ~0ull && GetElapsedUS() - begin + 1000 >= timeout_ms * 1000) {
+            res = -ETIMEDOUT;
+        }
+    }
+    return res;
+}
+
+int IOManager::acceptMultishot(FdContext* fd_ctx, sockaddr* addr, socklen_t* addrlen, uint64_t timeout_ms) {
+    {
+        FdContext::MutexType::Lock lock(fd_ctx->mutex);
+        if (!fd_ctx->acceptQueue) {
+            fd_ctx->acceptQueue = new AcceptQueue;
+            fd_ctx->acceptQueue->iom = this;
+        }
     }
+    AcceptQueue* q = fd_ctx->acceptQueue;
+    uint64_t deadline = timeout_ms == ~0ull ? ~0ull : GetElapsedMS() + timeout_ms;
+    uint16_t gen = 0;
+    {
+        Mutex::Lock lock(q->mutex);
+        gen = q->gen;
+    }
+    while (true) {
+        FiberWaiter::ptr waiter;
+        {
+            Mutex::Lock lock(q->mutex);
+            if (q->gen != gen) {
+                // 等待期间fd被关闭了
+                return -EBADF;
+            }
+            if (!q->fds.empty()) {
+                int fd = q->fds.front();
+                q->fds.pop_front();
+                lock.unlock();
+                if (addr && addrlen) {
+                    getpeername(fd, addr, addrlen);
+                }
+                return fd;
+            }
+            if (q->error) {
+                int error = q->error;
+                q->error = 0;
+                return -error;
+            }
+            if (!q->armed) {
+                armAccept(fd_ctx);
+            }
+            waiter.reset(new FiberWaiter);
+            q->waiters.push_back(waiter);
+        }
+        flushSubmissions(false);
+
+        uint64_t wait_ms = ~0ull;
+        if (deadline != ~0ull) {
+            uint64_t now = GetElapsedMS();
+            wait_ms = deadline > now ? deadline - now : 0;
+        }
+        ++m_pendingEventCount;
+        bool notified = waiter->wait(wait_ms);
+        --m_pendingEventCount;
+        if (!notified) {
+            Mutex::Lock lock(q->mutex);
+            q->waiters.remove(waiter);
+            return -ETIMEDOUT;
+        }
+    }
+}
+
+void IOManager::armAccept(FdContext* fd_ctx) {
+    AcceptQueue* q = fd_ctx->acceptQueue;
+    Mutex::Lock lock(m_sqMutex);
+    io_uring_sqe* sqe = getSqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd_ctx->fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = MakeUserData(fd_ctx, TAG_ACCEPT, q->gen);
+    m_uring->publish();
+    q->armed = true;
+}
 
-    //同一个fd不允许重复添加相同的事件
-    FdContext::MutexType::Lock lock2(fd_ctx->mutex);
-    if(SYLAR_UNLIKELY(fd_ctx->events & event)) {
-        SYLAR_LOG_ERROR(g_logger) << "addEvent assert fd=" << fd
-                                  << " event=" << (EPOLL_EVENTS)event
-                                  << " fd_ctx.event=" << (EPOLL_EVENTS)fd_ctx->events;
-        SYLAR_ASSERT(!(fd_ctx->events & event));
+void IOManager::cancelAccept(FdContext* fd_ctx) {
+    AcceptQueue* q = fd_ctx->acceptQueue;
+    Mutex::Lock lock(m_sqMutex);
+    io_uring_sqe* sqe = getSqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = MakeUserData(fd_ctx, TAG_ACCEPT, q->gen);
+    m_uring->publish();
+    q->cancelling = true;
+}
+
+void IOManager::cancelCompletions(FdContext* fd_ctx) {
+    ++fd_ctx->cancelSeq;
+    bool cancel = fd_ctx->inflightIo > 0;
+    std::deque<int> fds;
+    std::list<FiberWaiter::ptr> waiters;
+    if (fd_ctx->acceptQueue) {
+        AcceptQueue* q = fd_ctx->acceptQueue;
+        Mutex::Lock lock(q->mutex);
+        cancel |= q->armed;
+        ++q->gen;
+        q->armed = false;
+        q->cancelling = false;
+        q->error = 0;
+        fds.swap(q->fds);
+        waiters.swap(q->waiters);
     }
+    if (cancel) {
+        {
+            Mutex::Lock lock(m_sqMutex);
+            io_uring_sqe* sqe = getSqe();
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->fd = fd_ctx->fd;
+            sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+            m_uring->publish();
+        }
+        // fd马上就要关闭，不等本轮调度结束
+        flushSubmissions(true);
+    }
+    for (int fd : fds) {
+        close(fd);
+    }
+    for (auto& i : waiters) {
+        i->notify();
+    }
+}
 
-    // 将新的事件加入epoll_wait，使用epoll_event的私有指针存储FdContext的位置
-    int op = fd_ctx->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+bool IOManager::registerPersistent(FdContext* fd_ctx, uint64_t reg_id) {
+    if (!reg_id) {
+        // 同一个fd号之前的socket关闭时没有删除常驻注册，现在不是受管理的socket
+        fd_ctx->regId = 0;
+        return true;
+    }
     epoll_event epevent;
-    epevent.events = EPOLLET | fd_ctx->events | event;
+    epevent.events = EPOLLET | EPOLLIN | EPOLLOUT | EPOLLRDHUP;
     epevent.data.ptr = fd_ctx;
+    // 之前的socket没有删除注册，或者这个socket按一次性方式注册过，改为常驻注册
+    int op = (fd_ctx->regId || fd_ctx->events) ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    ++m_epollCtls;
+    int rt = epoll_ctl(m_epfd, op, fd_ctx->fd, &epevent);
+    if (rt) {
+        op = op == EPOLL_CTL_ADD ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+        ++m_epollCtls;
+        rt = epoll_ctl(m_epfd, op, fd_ctx->fd, &epevent);
+    }
+    if (rt) {
+        SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
+                                  << (EpollCtlOp)op << ", " << fd_ctx->fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
+                                  << rt << " (" << errno << ") (" << strerror(errno) << ")";
+        fd_ctx->regId = 0;
+        return false;
+    }
+    fd_ctx->events = NONE;
+    fd_ctx->regId = reg_id;
+    return true;
+}
+
+void IOManager::unregisterFd(int fd) {
+    FdContext* fd_ctx = getFdContext(fd, false);
+    if (!fd_ctx) {
+        return;
+    }
+    FdContext::MutexType::Lock lock(fd_ctx->mutex);
+    if (!fd_ctx->regId) {
+        return;
+    }
+    // 注册在哪个IOManager的epoll上就从哪个删除
+    IOManager* iom = fd_ctx->owner;
+    ++iom->m_epollCtls;
+    epoll_ctl(iom->m_epfd, EPOLL_CTL_DEL, fd, nullptr);
+    fd_ctx->regId = 0;
+    fd_ctx->clearReady();
+}
 
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-    if(rt) {
-        SYLAR_LOG_ERROR(g_logger) << " epoll_ctl(" << m_epfd << ","
-                                << (EpollCtlOp)op << "," << fd << "," 
-                                << (EPOLL_EVENTS)epevent.events << "):"
-                                << rt << " (" << errno << ") (" 
-                                << strerror(errno) << ") fd_ctx->events="
-                                << (EPOLL_EVENTS)fd_ctx->events;
+void IOManager::removeInterest(FdContext* fd_ctx, Event events) {
+    FdContext::MutexType::Lock lock(fd_ctx->mutex);
+    if (fd_ctx->regId || !(fd_ctx->events & events)) {
+        return;
+    }
+    Event new_events = (Event)(fd_ctx->events & ~events);
+    if (updateInterest(fd_ctx, fd_ctx->events, new_events)) {
+        fd_ctx->events = new_events;
+    }
+}
+
+int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
+    //找到fd对应的记录,如果所在的块不存在，那就分配一个
+    FdCtx* ctx = getFdContext(fd, true);
+    if (SYLAR_UNLIKELY(!ctx)) {
+        SYLAR_LOG_ERROR(g_logger) << "addEvent fd=" << fd << " out of range";
         return -1;
     }
+    return addEvent(ctx, event, std::move(cb));
+}
+
+int IOManager::addEvent(FdCtx* ctx, Event event, std::function<void()> cb) {
+    FdContext* fd_ctx = ctx;
+    int fd = fd_ctx->fd;
+    //常驻注册以记录的id区分同一个fd号先后打开的socket，不受管理的句柄不常驻注册
+    uint64_t reg_id = 0;
+    if (m_persistent && ctx->isSocket() && !ctx->isClose()) {
+        reg_id = ctx->getId();
+    }
+
+    //先独占这个方向的事件上下文，同一个fd不允许重复添加相同的事件
+    std::atomic<uint8_t>& state = fd_ctx->states[FdContext::EventIndex(event)];
+    uint8_t s = state.load(std::memory_order_acquire);
+    uint32_t spins = 0;
+    while (true) {
+        if (s == FdContext::IDLE || s == FdContext::READY) {
+            if (state.compare_exchange_weak(s, FdContext::CLAIMED, std::memory_order_acquire)) {
+                break;
+            }
+            continue;
+        }
+        if (SYLAR_UNLIKELY(s == FdContext::WAITING)) {
+            SYLAR_LOG_ERROR(g_logger) << "addEvent assert fd=" << fd
+                                      << " event=" << (EPOLL_EVENTS)event
+                                      << " state=" << (int)s;
+            SYLAR_ASSERT(s != FdContext::WAITING);
+        }
+        //上一个等待者正在被触发或取消
+        SpinWait(spins);
+        s = state.load(std::memory_order_acquire);
+    }
+    //缓存的就绪状态说明没有等待者时已经就绪
+    bool ready = (s == FdContext::READY);
+
+    //常驻注册之后添加事件不加锁；所属的IOManager、常驻注册变化以及一次性注册时加锁修改内核里的注册
+    if (!reg_id || fd_ctx->owner.load(std::memory_order_acquire) != this || fd_ctx->regId != reg_id) {
+        FdContext::MutexType::Lock lock(fd_ctx->mutex);
+        IOManager* owner = fd_ctx->owner;
+        //事件上下文由所有IOManager共用，fd上还有事件等在别的IOManager上时不能再添加
+        if (SYLAR_UNLIKELY(owner != this)) {
+            Event other = event == READ ? WRITE : READ;
+            if (owner && fd_ctx->hasWaiter(other)) {
+                SYLAR_LOG_ERROR(g_logger) << "addEvent fd=" << fd << " has event "
+                                          << (EPOLL_EVENTS)other << " in IOManager "
+                                          << owner->getName();
+                lock.unlock();
+                fd_ctx->releaseClaim(event);
+                return -1;
+            }
+            if (fd_ctx->regId) {
+                // 常驻注册在之前的IOManager上，先删除
+                ++owner->m_epollCtls;
+                epoll_ctl(owner->m_epfd, EPOLL_CTL_DEL, fd, nullptr);
+                fd_ctx->regId = 0;
+            }
+            fd_ctx->owner = this;
+            ready = false;
+            fd_ctx->clearReady();
+        }
+
+        if (m_persistent && fd_ctx->regId != reg_id) {
+            // 缓存的就绪状态属于之前的注册
+            ready = false;
+            fd_ctx->clearReady();
+            if (!registerPersistent(fd_ctx, reg_id)) {
+                lock.unlock();
+                fd_ctx->releaseClaim(event);
+                return -1;
+            }
+        }
+
+        // 将新的事件加入epoll_wait，使用epoll_event的私有指针存储FdContext的位置
+        if (!fd_ctx->regId && !ready) {
+            if (!updateInterest(fd_ctx, fd_ctx->events, (Event)(fd_ctx->events | event))) {
+                lock.unlock();
+                fd_ctx->releaseClaim(event);
+                return -1;
+            }
+            fd_ctx->events = (Event)(fd_ctx->events | event);
+        }
+    }
+
+    if (SYLAR_UNLIKELY(ready)) {
+        //已经就绪，不等epoll_wait，直接触发。当前协程还没有yield，调度器等它切出之后才放入队列
+        fd_ctx->releaseClaim(event);
+        if (cb) {
+            Scheduler::GetThis()->schedule(cb, -1, 0, Scheduler::HIGH);
+        } else {
+            Scheduler::GetThis()->schedule(Fiber::GetThis(), -1, 0, Scheduler::HIGH);
+        }
+        return 0;
+    }
 
     //待执行IO事件数加1
     ++m_pendingEventCount;
 
     //找到这个fd的event事件对应的EventContext，对其中的scheduler, cb, fiber进行赋值
-    fd_ctx->events = (Event)(fd_ctx->events | event);
     FdContext::EventContext& event_ctx = fd_ctx->getEventContext(event);
     //协程，回调函数和调度器三者此时都应该没有
     SYLAR_ASSERT(!event_ctx.scheduler && !event_ctx.fiber && !event_ctx.cb);
@@ -202,123 +941,93 @@ int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
         event_ctx.fiber = Fiber::GetThis();
         SYLAR_ASSERT2(event_ctx.fiber->getState() == Fiber::RUNNING, "state=" << event_ctx.fiber->getState());
     }
+
+    //发布等待者，独占期间已经就绪时自己触发
+    if (SYLAR_UNLIKELY(!fd_ctx->publishWaiter(event))) {
+        fd_ctx->triggerEvent(event);
+        --m_pendingEventCount;
+    }
     return 0;
 }
 
 bool IOManager::delEvent(int fd, Event event) {
     //找到fd对应的FdContex
-    RWMutexType::ReadLock lock(m_mutex);
-    if((int) m_fdContexts.size() <= fd) {
+    FdContext *fd_ctx = getFdContext(fd, false);
+    if (!fd_ctx) {
         return false;
     }
 
-    FdContext *fd_ctx = m_fdContexts[fd];
-    lock.unlock();
-
-    FdContext::MutexType::Lock lock2(fd_ctx->mutex);
-    if (SYLAR_UNLIKELY(!(fd_ctx->events & event))) {
+    //独占等待者，没有等待者说明事件已经触发或者没有添加过
+    if (SYLAR_UNLIKELY(!fd_ctx->claimWaiter(event))) {
         return false;
     }
 
-    //清除指定的事件，表示不关心这个事件了，如果清除之后结果为0，则从epoll_wait中删除该文件描述符
-    Event new_events = (Event)(fd_ctx->events & ~event);
-    int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-    epoll_event epevent;
-    epevent.events = EPOLLET | new_events;
-    epevent.data.ptr = fd_ctx;
-
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-    if(rt){
-        SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
-                                  << (EpollCtlOp)op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
-                                  << rt << " (" << errno << ") (" << strerror(errno) << ")";
-        return false;
-    }
+    //事件注册在owner上，由owner删除
+    IOManager* iom = fd_ctx->owner;
+    iom->removeInterest(fd_ctx, event);
 
     // 待执行事件数减1
-    --m_pendingEventCount;
+    --iom->m_pendingEventCount;
     // 重置该fd对应的event事件上下文
-    fd_ctx->events = new_events;
     FdContext::EventContext &event_ctx = fd_ctx->getEventContext(event);
     fd_ctx->resetEventContext(event_ctx);
+    fd_ctx->releaseClaim(event);
     return true;
 }
 
 bool IOManager::cancelEvent(int fd, Event event) {
     // 找到fd对应的FdContext
-    RWMutexType::ReadLock lock(m_mutex);
-    if ((int)m_fdContexts.size() <= fd) {
+    FdContext *fd_ctx = getFdContext(fd, false);
+    if (!fd_ctx) {
         return false;
     }
-    FdContext *fd_ctx = m_fdContexts[fd];
-    lock.unlock();
 
-    FdContext::MutexType::Lock lock2(fd_ctx->mutex);
-    if (SYLAR_UNLIKELY(!(fd_ctx->events & event))) {
+    if (SYLAR_UNLIKELY(!fd_ctx->claimWaiter(event))) {
         return false;
     }
 
     // 删除事件
-    Event new_events = (Event)(fd_ctx->events & ~event);
-    int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-    epoll_event epevent;
-    epevent.events   = EPOLLET | new_events;
-    epevent.data.ptr = fd_ctx;
-
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-    if (rt) {
-        SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
-                                  << (EpollCtlOp)op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
-                                  << rt << " (" << errno << ") (" << strerror(errno) << ")";
-        return false;
-    }
+    IOManager* iom = fd_ctx->owner;
+    iom->removeInterest(fd_ctx, event);
 
     // 删除之前触发一次事件
     fd_ctx->triggerEvent(event);
     // 活跃事件数减1
-    --m_pendingEventCount;
+    --iom->m_pendingEventCount;
     return true;
 }
 
 bool IOManager::cancelAll(int fd) {
     // 找到fd对应的FdContext
-    RWMutexType::ReadLock lock(m_mutex);
-    if ((int)m_fdContexts.size() <= fd) {
+    FdContext *fd_ctx = getFdContext(fd, false);
+    if (!fd_ctx) {
         return false;
     }
-    FdContext *fd_ctx = m_fdContexts[fd];
-    lock.unlock();
 
-    FdContext::MutexType::Lock lock2(fd_ctx->mutex);
-    if (!fd_ctx->events) {
+    if (m_uring) {
+        // 完成式IO和multishot accept不登记在事件状态里，单独取消
+        FdContext::MutexType::Lock lock(fd_ctx->mutex);
+        cancelCompletions(fd_ctx);
+    }
+    bool read = fd_ctx->claimWaiter(READ);
+    bool write = fd_ctx->claimWaiter(WRITE);
+    if (!read && !write) {
         return false;
     }
 
     // 删除全部事件,就读和写事件
-    int op = EPOLL_CTL_DEL;
-    epoll_event epevent;
-    epevent.events   = 0;
-    epevent.data.ptr = fd_ctx;
-
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-    if (rt) {
-        SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
-                                  << (EpollCtlOp)op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
-                                  << rt << " (" << errno << ") (" << strerror(errno) << ")";
-        return false;
-    }
+    IOManager* iom = fd_ctx->owner;
+    iom->removeInterest(fd_ctx, (Event)((read ? READ : NONE) | (write ? WRITE : NONE)));
 
     // 触发全部已注册的事件
-    if (fd_ctx->events & READ) {
+    if (read) {
         fd_ctx->triggerEvent(READ);
-        --m_pendingEventCount;
+        --iom->m_pendingEventCount;
     }
-    if (fd_ctx->events & WRITE) {
+    if (write) {
         fd_ctx->triggerEvent(WRITE);
-        --m_pendingEventCount;
+        --iom->m_pendingEventCount;
     }
-
-    SYLAR_ASSERT(fd_ctx->events == 0);
     return true;
 }
 
@@ -333,11 +1042,77 @@ IOManager *IOManager::GetThis() {
  */
 void IOManager::tickle() {
     SYLAR_LOG_DEBUG(g_logger) << "tickle";
-    if(!hasIdleThreads()) {
+    //有线程正在自旋，它会自己发现新任务，不用写pipe
+    if(!hasIdleThreads() || hasSpinningThreads()) {
         return;
     }
-    int rt = write(m_tickleFds[1], "T", 1);//只写一个字节，由空变为不空,触发就绪事件
+    //内部管道不走hook，不计入阻塞调用统计，也不会被交给阻塞调用线程池
+    int rt = write_f(m_tickleFds[1], "T", 1);//只写一个字节，由空变为不空,触发就绪事件
     SYLAR_ASSERT(rt == 1);
+    recordTickle();
+}
+
+bool IOManager::spinPoll(epoll_event* events, int max_events, const sigset_t* wait_mask,
+                         int& rt, bool& spun) {
+    uint64_t budget = 0;
+    spun = beginSpin(budget);
+    if(!spun) {
+        return false;
+    }
+    uint64_t begin = GetElapsedUS();
+    uint64_t spent = 0;
+    bool hit = false;
+    for(uint32_t i = 1; ; ++i) {
+        if(hasRunnableWork()) {
+            hit = true;
+            break;
+        }
+        //每轮询16次任务队列检查一次IO事件和自旋时间
+        if((i & 15) == 0) {
+            if(m_uring) {
+                rt = m_uring->hasCompletions() ? 1 : 0;
+            } else {
+                rt = epoll_pwait(m_epfd, events, max_events, 0, wait_mask);
+            }
+            if(rt > 0) {
+                hit = true;
+                break;
+            }
+            rt = 0;
+            spent = GetElapsedUS() - begin;
+            if(spent >= budget) {
+                break;
+            }
+        }
+        CpuRelax();
+    }
+    if(hit) {
+        spent = GetElapsedUS() - begin;
+    }
+    endSpin(hit, spent);
+    //结束自旋之后再检查一次，自旋期间入队的任务跳过了唤醒
+    if(!hit && hasRunnableWork()) {
+        hit = true;
+    }
+    return hit;
+}
+
+void IOManager::wakeWorker(pthread_t handle) {
+    SYLAR_LOG_DEBUG(g_logger) << "wakeWorker";
+    int sig = GetWakeSignal();
+    if(!sig) {
+        //没有可用的唤醒信号，只能通过pipe唤醒任意一个空闲线程，目标线程最迟在epoll超时后检查收件箱
+        tickle();
+        return;
+    }
+    pthread_kill(handle, sig);
+    recordTickle();
+}
+
+void IOManager::getStats(Stats& stats) {
+    Scheduler::getStats(stats);
+    stats.pendingEvents = m_pendingEventCount;
+    stats.epollCtls = m_epollCtls;
 }
 
 bool IOManager::stopping() {
@@ -359,12 +1134,20 @@ bool IOManager::stopping(uint64_t &timeout) {
  */
 void IOManager::idle() {
     SYLAR_LOG_DEBUG(g_logger) << "idle";
+    if(m_uring) {
+        idleUring();
+        return;
+    }
 
     //一次epoll_wait最多检测出256个就绪事件，如果就绪事件超过了这个数，就会在下轮epoll_wait继续处理
     const uint64_t MAX_EVENTS = 256;
     epoll_event *events = new epoll_event[MAX_EVENTS]();
     std::shared_ptr<epoll_event> shared_events(events, [](epoll_event* ptr) { delete[] ptr;});
 
+    sigset_t old_mask;
+    sigset_t wait_mask;
+    BlockWakeSignal(&old_mask, &wait_mask);
+
     while(true) {
         //获取下一个定时器的超时时间，顺便判断调度器是否停止
         uint64_t next_timeout = 0;
@@ -372,10 +1155,28 @@ void IOManager::idle() {
             SYLAR_LOG_DEBUG(g_logger) << "name=" << getName() << "idle stopping exit";
             break;
         }
+        //弹性增加的线程空闲太久，退出
+        uint64_t retire_ms = ~0ull;
+        if(SYLAR_UNLIKELY(shouldRetire(&retire_ms))) {
+            SYLAR_LOG_DEBUG(g_logger) << "name=" << getName() << "idle retire exit";
+            break;
+        }
 
-        //阻塞在epoll_wait上，等待事件发生或定时器超时
+        //阻塞之前先自旋一会儿，期间来了任务或IO事件就不用阻塞，省掉tickle和跨核唤醒
         int rt = 0;
-        do{
+        bool woke = false;
+        if(next_timeout != 0 && !hasPendingWork()) {
+            bool spun = false;
+            woke = spinPoll(events, MAX_EVENTS, &wait_mask, rt, spun);
+            //自旋期间可能插入了更早的定时器，或者调度器开始停止了，重新检查
+            if(spun && !woke && SYLAR_UNLIKELY(stopping(next_timeout))) {
+                SYLAR_LOG_DEBUG(g_logger) << "name=" << getName() << "idle stopping exit";
+                break;
+            }
+        }
+
+        //阻塞在epoll_wait上，等待事件发生或定时器超时
+        if(!woke) do{
             //默认超时时间5秒，如果下一个定时器的超时时间大于5秒，仍以5秒来计算超时，避免定时器超时时间太大时，epoll_wait一直阻塞
             static const int MAX_TIMEOUT = 5000;
             if(next_timeout != ~0ull) {
@@ -383,23 +1184,34 @@ void IOManager::idle() {
             } else {
                 next_timeout = MAX_TIMEOUT;
             }
-            rt = epoll_wait(m_epfd, events, MAX_EVENTS, (int)next_timeout);
-            if(rt < 0 && errno == EINTR) {//中断也继续
-                continue;
-            } else {
-                break;
+            //到了退出时间要醒来检查一次
+            next_timeout = std::min(next_timeout, retire_ms);
+            //进入idle之前收件箱里已经有任务了，不阻塞
+            if(hasPendingWork()) {
+                next_timeout = 0;
+            }
+            rt = epoll_pwait(m_epfd, events, MAX_EVENTS, (int)next_timeout, &wait_mask);
+            if(rt < 0 && errno == EINTR) {//被唤醒信号中断，回到调度协程检查收件箱
+                rt = 0;
             }
+            break;
         } while(true);
+        //自旋期间因为有任务返回的不算一次epoll返回
+        if(!woke || rt > 0) {
+            recordPoll(rt);
+        }
 
         //收集所有已超时的定时器，执行回调函数
         std::vector<std::function<void()>> cbs;
-        listExpiredCb(cbs);
-        if(!cbs.empty()) {
-            for(const auto &cb : cbs) {
-                schedule(cb);
-            }
-            cbs.clear();
-        }
+        std::vector<std::function<void()>> inline_cbs;
+        listExpiredCb(cbs, &inline_cbs);
+        //不会阻塞的定时器回调不单独创建协程，在调度协程上直接执行
+        scheduleInlineBatch(inline_cbs);
+
+        //就绪事件的回调协程和回调函数先收集起来，和超时定时器的回调一起批量调度，每轮只加一次锁
+        std::vector<Fiber::ptr> fibers;
+        std::vector<std::function<void()>> event_cbs;
+        size_t triggered = 0;
 
         //遍历所有发生的事件，根据epoll_event的私有指针找到对应的FdContext，进行事件处理
         for(int i = 0; i < rt; ++i) {
@@ -407,54 +1219,82 @@ void IOManager::idle() {
             if(event.data.fd == m_tickleFds[0]) {
                 //ticklefd[0]用于通知协程调度，这时只需要把管道里的内容读完即可
                 uint8_t dummy[256];
-                while (read(m_tickleFds[0], dummy, sizeof(dummy)) > 0);
+                while (read_f(m_tickleFds[0], dummy, sizeof(dummy)) > 0);
                 continue;
             }
             FdContext *fd_ctx = (FdContext*) event.data.ptr;
-            FdContext::MutexType::Lock lock(fd_ctx->mutex);
 
-            /**
-             * EPOLLERR: 出错，比如写读端已经关闭的pipe
-             * EPOLLHUP: 套接字对端关闭
-             * 出现这两种事件，应该同时触发fd的读和写事件，否则有可能出现注册的事件永远执行不到的情况
-             */ 
-            if(event.events & (EPOLLERR | EPOLLHUP)) {
-                event.events |= (EPOLLIN | EPOLLOUT) & fd_ctx->events;
-            }
-            int real_events = NONE;
-            if (event.events & EPOLLIN) {
-                real_events |= READ;
-            }
-            if (event.events & EPOLLOUT) {
-                real_events |= WRITE;
-            }
+            //常驻注册：不加锁也不调用epoll_ctl，有等待者的事件直接触发，没有等待者的事件记为就绪
+            bool persistent = fd_ctx->regId != 0;
+            int fired = NONE;
+            if (!persistent) {
+                //一次性注册：在锁内把已经发生的事件从内核里删除，锁外触发
+                FdContext::MutexType::Lock lock(fd_ctx->mutex);
+                //加锁之前addEvent刚把fd加入epoll还没有记下regId，事件属于常驻注册
+                persistent = fd_ctx->regId != 0;
+                if (!persistent) {
+                    /**
+                     * EPOLLERR: 出错，比如写读端已经关闭的pipe
+                     * EPOLLHUP: 套接字对端关闭
+                     * 出现这两种事件，应该同时触发fd的读和写事件，否则有可能出现注册的事件永远执行不到的情况
+                     */ 
+                    if(event.events & (EPOLLERR | EPOLLHUP)) {
+                        event.events |= (EPOLLIN | EPOLLOUT) & fd_ctx->events;
+                    }
+                    int real_events = NONE;
+                    if (event.events & EPOLLIN) {
+                        real_events |= READ;
+                    }
+                    if (event.events & EPOLLOUT) {
+                        real_events |= WRITE;
+                    }
 
-            if ((fd_ctx->events & real_events) == NONE) {
-                continue;
-            }
+                    if ((fd_ctx->events & real_events) == NONE) {
+                        continue;
+                    }
 
-            // 剔除已经发生的事件，将剩下的事件重新加入epoll_wait
-            int left_events = (fd_ctx->events & ~real_events);
-            int op = left_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-            event.events = EPOLLET | left_events;
+                    // 剔除已经发生的事件，将剩下的事件重新加入epoll_wait
+                    int left_events = (fd_ctx->events & ~real_events);
+                    int op = left_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+                    event.events = EPOLLET | left_events;
 
-            int rt2 = epoll_ctl(m_epfd, op, fd_ctx->fd, &event);
-            if (rt2) {
-                SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
-                                          << (EpollCtlOp)op << ", " << fd_ctx->fd << ", " << (EPOLL_EVENTS)event.events << "):"
-                                          << rt2 << " (" << errno << ") (" << strerror(errno) << ")";
-                continue;
+                    ++m_epollCtls;
+                    int rt2 = epoll_ctl(m_epfd, op, fd_ctx->fd, &event);
+                    if (rt2) {
+                        SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
+                                                  << (EpollCtlOp)op << ", " << fd_ctx->fd << ", " << (EPOLL_EVENTS)event.events << "):"
+                                                  << rt2 << " (" << errno << ") (" << strerror(errno) << ")";
+                        continue;
+                    }
+                    fired = fd_ctx->events & real_events;
+                    fd_ctx->events = (Event)left_events;
+                }
+            }
+            if (persistent) {
+                if (event.events & (EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLHUP)) {
+                    fired |= READ;
+                }
+                if (event.events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) {
+                    fired |= WRITE;
+                }
             }
             // 处理已经发生的事件，也就是让调度器调度指定的函数或协程,将任务加到队列
-            if (real_events & READ) {
-                fd_ctx->triggerEvent(READ);
-                --m_pendingEventCount;
+            // 等待者正在被添加或删除时留给独占的一方处理
+            if ((fired & READ) && fd_ctx->markReady(READ, persistent)) {
+                fd_ctx->triggerEvent(READ, this, fibers, event_cbs);
+                ++triggered;
             }
-            if (real_events & WRITE) {
-                fd_ctx->triggerEvent(WRITE);
-                --m_pendingEventCount;
+            if ((fired & WRITE) && fd_ctx->markReady(WRITE, persistent)) {
+                fd_ctx->triggerEvent(WRITE, this, fibers, event_cbs);
+                ++triggered;
             }
         }
+        //IO事件唤醒的协程对延迟敏感，使用高优先级；定时器回调使用普通优先级
+        scheduleBatch(fibers.begin(), fibers.end(), -1, HIGH);
+        scheduleBatch(event_cbs.begin(), event_cbs.end(), -1, HIGH);
+        scheduleBatch(cbs.begin(), cbs.end());
+        //任务入队之后再减少待执行的IO事件数，stopping()不会在任务入队之前误判
+        m_pendingEventCount -= triggered;
 
         /**
          * 一旦处理完所有的事件，idle协程yield，这样可以让调度协程(Scheduler::run)重新检查是否有新任务要调度
@@ -466,6 +1306,191 @@ void IOManager::idle() {
 
         raw_ptr->yield();
     }
+    pthread_sigmask(SIG_SETMASK, &old_mask, nullptr);
+}
+
+void IOManager::idleUring() {
+    //一次最多取256个完成项，剩下的下一轮再处理
+    const uint32_t MAX_EVENTS = 256;
+    io_uring_cqe *cqes = new io_uring_cqe[MAX_EVENTS]();
+    std::shared_ptr<io_uring_cqe> shared_cqes(cqes, [](io_uring_cqe* ptr) { delete[] ptr;});
+
+    sigset_t old_mask;
+    sigset_t wait_mask;
+    BlockWakeSignal(&old_mask, &wait_mask);
+
+    while(true) {
+        uint64_t next_timeout = 0;
+        if(SYLAR_UNLIKELY(stopping(next_timeout))) {
+            SYLAR_LOG_DEBUG(g_logger) << "name=" << getName() << "idle stopping exit";
+            break;
+        }
+        uint64_t retire_ms = ~0ull;
+        if(SYLAR_UNLIKELY(shouldRetire(&retire_ms))) {
+            SYLAR_LOG_DEBUG(g_logger) << "name=" << getName() << "idle retire exit";
+            break;
+        }
+
+        int rt = 0;
+        bool woke = false;
+        if(next_timeout != 0 && !hasPendingWork()) {
+            bool spun = false;
+            woke = spinPoll(nullptr, 0, &wait_mask, rt, spun);
+            if(spun && !woke && SYLAR_UNLIKELY(stopping(next_timeout))) {
+                SYLAR_LOG_DEBUG(g_logger) << "name=" << getName() << "idle stopping exit";
+                break;
+            }
+        }
+
+        //提交积攒的请求，同时等待完成项或定时器超时
+        if(!woke && !m_uring->hasCompletions()) {
+            static const uint64_t MAX_TIMEOUT = 5000;
+            next_timeout = std::min(next_timeout, MAX_TIMEOUT);
+            next_timeout = std::min(next_timeout, retire_ms);
+            if(hasPendingWork()) {
+                next_timeout = 0;
+            }
+            int rt2 = m_uring->submitAndWait(next_timeout, &wait_mask);
+            if(rt2 < 0 && rt2 != -ETIME && rt2 != -EINTR && rt2 != -EBUSY && rt2 != -EAGAIN) {
+                SYLAR_LOG_ERROR(g_logger) << "io_uring_enter error " << -rt2 << " " << strerror(-rt2);
+            }
+        }
+        uint32_t n = 0;
+        {
+            Mutex::Lock lock(m_cqMutex);
+            n = m_uring->reap(cqes, MAX_EVENTS);
+        }
+        if(!woke || n > 0) {
+            recordPoll(n);
+        }
+
+        std::vector<std::function<void()>> cbs;
+        std::vector<std::function<void()>> inline_cbs;
+        listExpiredCb(cbs, &inline_cbs);
+        scheduleInlineBatch(inline_cbs);
+
+        std::vector<Fiber::ptr> fibers;
+        std::vector<std::function<void()>> event_cbs;
+        size_t triggered = 0;
+        for(uint32_t i = 0; i < n; ++i) {
+            if(handleCompletion(cqes[i], fibers, event_cbs)) {
+                ++triggered;
+            }
+        }
+        scheduleBatch(fibers.begin(), fibers.end(), -1, HIGH);
+        scheduleBatch(event_cbs.begin(), event_cbs.end(), -1, HIGH);
+        scheduleBatch(cbs.begin(), cbs.end());
+        m_pendingEventCount -= triggered;
+
+        Fiber::ptr cur = Fiber::GetThis();
+        auto raw_ptr = cur.get();
+        cur.reset();
+
+        raw_ptr->yield();
+    }
+    pthread_sigmask(SIG_SETMASK, &old_mask, nullptr);
+}
+
+bool IOManager::handleCompletion(const io_uring_cqe& cqe, std::vector<Fiber::ptr>& fibers,
+                                 std::vector<std::function<void()> >& cbs) {
+    UringTag tag = (UringTag)(cqe.user_data & s_tag_mask);
+    switch(tag) {
+        case TAG_TICKLE: {
+            uint8_t dummy[256];
+            while (read_f(m_tickleFds[0], dummy, sizeof(dummy)) > 0);
+            if(!(cqe.flags & IORING_CQE_F_MORE)) {
+                armTickle();
+                flushSubmissions(true);
+            }
+            return false;
+        }
+        case TAG_POLL_READ:
+        case TAG_POLL_WRITE: {
+            FdContext* fd_ctx = (FdContext*)UserDataPtr(cqe.user_data);
+            int idx = tag == TAG_POLL_WRITE ? 1 : 0;
+            Event event = idx ? WRITE : READ;
+            {
+                FdContext::MutexType::Lock lock(fd_ctx->mutex);
+                //事件已经删除，或者删除之后又重新添加了，这是之前那个poll的结果
+                if(!(fd_ctx->events & event) || fd_ctx->pollSeq[idx] != UserDataSeq(cqe.user_data)) {
+                    return false;
+                }
+                if(cqe.res == -ECANCELED) {
+                    //提交请求的线程退出时内核会取消它的请求，事件还在就重新poll
+                    Mutex::Lock lock2(m_sqMutex);
+                    io_uring_sqe* sqe = getSqe();
+                    sqe->opcode = IORING_OP_POLL_ADD;
+                    sqe->fd = fd_ctx->fd;
+                    sqe->poll32_events = idx ? POLLOUT : POLLIN;
+                    sqe->user_data = cqe.user_data;
+                    m_uring->publish();
+                    return false;
+                }
+                fd_ctx->events = (Event)(fd_ctx->events & ~event);
+            }
+            if(!fd_ctx->markReady(event, false)) {
+                return false;
+            }
+            fd_ctx->triggerEvent(event, this, fibers, cbs);
+            return true;
+        }
+        case TAG_IO: {
+            IoRequest* req = (IoRequest*)UserDataPtr(cqe.user_data);
+            //写入结果之后请求所在的协程栈随时可能失效，先取出需要的字段
+            Fiber::ptr fiber;
+            fiber.swap(req->fiber);
+            Scheduler* scheduler = req->scheduler;
+            int thread = req->thread;
+            req->res = cqe.res;
+            scheduler->schedule(fiber, thread, 0, HIGH);
+            return true;
+        }
+        case TAG_ACCEPT: {
+            FdContext* fd_ctx = (FdContext*)UserDataPtr(cqe.user_data);
+            AcceptQueue* q = fd_ctx->acceptQueue;
+            Mutex::Lock lock(q->mutex);
+            if(q->gen != UserDataSeq(cqe.user_data)) {
+                //fd已经关闭，之前的accept请求收到的连接没有人要了
+                lock.unlock();
+                if(cqe.res >= 0) {
+                    close(cqe.res);
+                }
+                return false;
+            }
+            if(!(cqe.flags & IORING_CQE_F_MORE)) {
+                q->armed = false;
+                q->cancelling = false;
+            }
+            if(cqe.res >= 0) {
+                q->fds.push_back(cqe.res);
+            } else if(cqe.res != -ECANCELED) {
+                q->error = -cqe.res;
+            }
+            //没有人取的连接太多时取消multishot accept，之后的连接留在listen的backlog里，
+            //队列取空之后acceptMultishot再注册
+            if(q->armed && !q->cancelling && q->fds.size() >= m_acceptQueueMax) {
+                cancelAccept(fd_ctx);
+            }
+            //multishot accept结束了还有协程在等，重新注册；出错时交给等待的协程返回错误，不重新注册
+            if(!q->armed && !q->waiters.empty() && !q->error) {
+                armAccept(fd_ctx);
+            }
+            //唤醒一个还在等待的协程，超时的协程唤醒会失败
+            while(!q->waiters.empty() && (!q->fds.empty() || q->error)) {
+                FiberWaiter::ptr waiter = q->waiters.front();
+                q->waiters.pop_front();
+                if(waiter->notify()) {
+                    break;
+                }
+            }
+            lock.unlock();
+            flushSubmissions(false);
+            return false;
+        }
+        default:
+            //超时、取消和poll remove请求的完成项
+            return false;
+    }
 }
 
 void IOManager::onTimerInsertedAtFront() {
@@ -1,11 +1,17 @@
 #ifndef __SYLAR_IOMANAGER_H__
 #define __SYLAR_IOMANAGER_H__
 
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
 #include "scheduler.h"
 #include "timer.h"
+#include "io_uring.h"
 
 namespace sylar {
 
+class FdCtx;
+
 class IOManager: public Scheduler, public TimerManager {
 public:
     typedef std::shared_ptr<IOManager> ptr;
@@ -24,12 +30,35 @@ public:
         WRITE = 0x4,
     };
 private:
+    struct AcceptQueue;
+    friend class FdCtx;
+
     /**
      * @brief socket fd上下文类
-     * @details 每个socket fd都对应一个FdContext，包括fd的值，fd上的事件，以及fd的读写事件上下文
+     * @details 每个socket fd都对应一个FdContext，包括fd的值，fd上的事件，以及fd的读写事件上下文。
+     *          FdContext是FdCtx的一部分，和句柄属性放在同一条记录里，所有IOManager共用FdManager的表。
+     *          读写两个方向各有一个状态字，添加、触发、删除、取消事件都用CAS修改状态，不加锁；
+     *          只有修改内核里的注册(epoll_ctl、io_uring poll)和所属的IOManager时才加mutex
      */
     struct FdContext {
         typedef Mutex MutexType;
+
+        /**
+         * @brief 单个方向的事件状态
+         */
+        enum EventState {
+            /// 没有等待者
+            IDLE = 0,
+            /// 有等待者，事件上下文已经填好
+            WAITING = 1,
+            /// 没有等待者时已经就绪，下次添加事件时直接触发
+            READY = 2,
+            /// 事件上下文被一个线程独占，正在添加、触发、删除或取消等待者
+            CLAIMED = 3,
+            /// 独占期间又就绪了，由独占的线程结束独占时处理
+            CLAIMED_READY = 4,
+        };
+
         /**
          * @brief 事件上下文类
          * @details fd的每个事件都有一个事件上下文，保存这个事件的回调函数以及执行回调函数的调度器
@@ -58,22 +87,87 @@ private:
         void resetEventContext(EventContext &ctx);
 
         /**
-         * @brief 触发事件
-         * @details 根据事件类型调用对应上下文结构中的调度器去调度回调协程或回调函数
+         * @brief 事件在states里的下标，读0写1
+         */
+        static int EventIndex(Event event) { return event == WRITE ? 1 : 0;}
+
+        /**
+         * @brief 独占event方向上的等待者，状态从WAITING改为CLAIMED
+         * @details 其他线程正在独占时等它结束
+         * @return 没有等待者返回false
+         */
+        bool claimWaiter(Event event);
+
+        /**
+         * @brief 添加事件时填好事件上下文之后发布等待者，状态从CLAIMED改为WAITING
+         * @return 独占期间已经就绪返回false，仍然独占着，调用方触发事件
+         */
+        bool publishWaiter(Event event);
+
+        /**
+         * @brief 结束独占，等待者已经取走或者删除，独占期间就绪过的改为READY
+         */
+        void releaseClaim(Event event);
+
+        /**
+         * @brief event方向就绪
+         * @details 有等待者时独占它；正在被独占时留给独占的线程处理；没有等待者时cache为true则记为READY
+         * @return 独占了等待者返回true，调用方触发事件
+         */
+        bool markReady(Event event, bool cache);
+
+        /**
+         * @brief 丢弃缓存的就绪状态，常驻注册变化时调用
+         */
+        void clearReady();
+
+        /**
+         * @brief event方向上是否有等待中或者正在添加、触发的事件
+         */
+        bool hasWaiter(Event event) const;
+
+        /**
+         * @brief 触发事件，调用方已经独占了等待者
+         * @details 取走事件上下文、结束独占之后，由对应的调度器调度回调协程或回调函数，使用高优先级
          * @param[in] event 事件类型
          */
         void triggerEvent(Event event);
 
+        /**
+         * @brief 触发事件，由batch_sc调度的回调协程或回调函数不立即调度，放入fibers/cbs由调用方批量调度
+         * @details 调用方已经独占了等待者
+         * @param[in] event 事件类型
+         * @param[in] batch_sc 批量调度的调度器
+         * @param[out] fibers 待批量调度的回调协程
+         * @param[out] cbs 待批量调度的回调函数
+         */
+        void triggerEvent(Event event, Scheduler* batch_sc, std::vector<Fiber::ptr>& fibers,
+                          std::vector<std::function<void()> >& cbs);
+
         /// 读事件上下文
         EventContext read;
         /// 写事件上下文
         EventContext write;
         /// 事件关联的句柄
         int fd = 0;
-        /// 该fd添加了哪些事件的回调函数，或者说该fd关心哪些事件
+        /// 读写两个方向的状态，取值是EventState
+        std::atomic<uint8_t> states[2] = {{IDLE}, {IDLE}};
+        /// 一次性注册时内核里关注的事件，修改时持有mutex；常驻注册时一直关注读写，不使用
         Event events = NONE;
-        /// 事件的Mutex
+        /// 事件注册在哪个IOManager的epoll或io_uring上，同一时间只属于一个IOManager，修改时持有mutex
+        std::atomic<IOManager*> owner{nullptr};
+        /// 常驻注册时socket的FdCtx id，0表示没有常驻注册，修改时持有mutex
+        std::atomic<uint64_t> regId{0};
+        /// 修改内核里的注册、owner和accept队列时的锁，常驻注册之后添加和触发事件都不用
         MutexType mutex;
+        /// io_uring后端读写事件poll请求的序号，序号不匹配的poll结果属于已经删除的事件
+        uint16_t pollSeq[2] = {0, 0};
+        /// io_uring后端正在执行的完成式IO数
+        std::atomic<int> inflightIo{0};
+        /// io_uring后端cancelAll的次数，完成式IO据此区分fd关闭和其他原因的取消
+        std::atomic<uint32_t> cancelSeq{0};
+        /// io_uring后端multishot accept的连接队列，第一次accept时创建
+        AcceptQueue* acceptQueue = nullptr;
     };
 
 public:
@@ -84,6 +178,15 @@ public:
      * @param[in] name 调度器的名称
      */
     IOManager(size_t threads = 1,  bool use_caller = true, const std::string &name = "IOManager");
+
+    /**
+     * @brief 构造函数，调度线程绑定到指定的CPU
+     * @param[in] threads 线程数量
+     * @param[in] use_caller 是否将调用线程包含进去
+     * @param[in] name 调度器的名称
+     * @param[in] cpus 调度线程可以运行的CPU，为空时按scheduler.affinity放置
+     */
+    IOManager(size_t threads, bool use_caller, const std::string &name, const std::vector<int>& cpus);
     /**
      * @brief 析构函数
      */
@@ -99,6 +202,15 @@ public:
      */
     int addEvent(int fd, Event event, std::function<void()> cb = nullptr);
 
+    /**
+     * @brief 添加事件，调用方已经拿到了fd的记录，不再查表
+     * @param[in] ctx fd的记录
+     * @param[in] event 事件类型
+     * @param[in] cb 事件回调函数，如果为空，则默认把当前协程作为回调执行体
+     * @return 添加成功返回0,失败返回-1
+     */
+    int addEvent(FdCtx* ctx, Event event, std::function<void()> cb = nullptr);
+
     /**
      * @brief 删除事件
      * @param[in] fd socket句柄
@@ -125,11 +237,46 @@ public:
      */
     bool cancelAll(int fd);
 
+    /**
+     * @brief 删除fd的常驻注册，关闭fd之前调用
+     * @details iomanager.persistent_epoll开启时，socket第一次添加事件时以边缘触发同时关注读写加入epoll，
+     *          之后添加、删除事件和事件触发都不再调用epoll_ctl，直到关闭
+     * @param[in] fd socket句柄
+     */
+    void unregisterFd(int fd);
+
     /**
      * @brief 返回当前的IOManager
      */
     static IOManager *GetThis();
 
+    /**
+     * @brief 等待触发的IO事件数
+     */
+    size_t getPendingEventCount() const { return m_pendingEventCount;}
+
+    /**
+     * @brief 获取运行时统计，在Scheduler的基础上加上epoll_wait和IO事件的统计
+     */
+    void getStats(Stats& stats) override;
+
+    /**
+     * @brief 是否使用io_uring后端，可以提交完成式IO
+     */
+    bool canSubmitIo() const { return m_uring != nullptr;}
+
+    /**
+     * @brief 提交一个完成式IO请求，挂起当前协程直到完成
+     * @details 只能在调度器中运行、不使用共享栈的协程里调用。prep填写提交项的操作码和参数，
+     *          IORING_OP_ACCEPT会转成fd上共享的multishot accept。请求在本轮调度结束时和其他请求一起提交
+     * @param[in] fd 操作的句柄
+     * @param[in] prep 填写提交项
+     * @param[in] timeout_ms 超时时间(毫秒)，~0ull表示不超时
+     * @return 成功返回操作的结果，失败返回-errno，超时返回-ETIMEDOUT，被cancelAll取消返回-EBADF，
+     *         因为其他原因被内核取消(比如提交请求的线程退出)返回-ECANCELED，调用方可以重试
+     */
+    int submitIo(int fd, const std::function<void(io_uring_sqe*)>& prep, uint64_t timeout_ms = ~0ull);
+
 protected:
     /**
      * @brief 通知调度器有任务要调度
@@ -137,6 +284,14 @@ protected:
      */
     void tickle() override;
 
+    /**
+     * @brief 只唤醒指定的调度线程
+     * @details 向目标线程发送唤醒信号，该信号只在idle协程的epoll_pwait期间解除屏蔽，
+     *          epoll_pwait被中断返回后调度线程就会检查收件箱。信号在其他时间到达会一直挂起，
+     *          下次进入epoll_pwait时立即返回，不会丢失
+     */
+    void wakeWorker(pthread_t handle) override;
+
     /**
      * @brief 判断是否可以停止
      * @details 判断条件是Scheduler::stopping()外加IOManager的m_pendingEventCount为0，表示没有IO事件可调度了
@@ -149,6 +304,31 @@ protected:
      */
     void idle() override;
 
+    /**
+     * @brief io_uring后端的idle协程
+     * @details 提交积攒的请求并等待完成项，完成项按user_data低位的标记分发给事件、完成式IO和accept队列
+     */
+    void idleUring();
+
+    /**
+     * @brief 每次取任务之前提交积攒的io_uring请求
+     * @details 当前线程没有待执行的任务，或者积攒了16个请求，或者已经推迟了16次时提交，
+     *          一轮调度中发起的请求合并成一次io_uring_enter
+     */
+    void beforeDispatch() override;
+
+    /**
+     * @brief 阻塞之前自旋等待新任务或IO事件
+     * @details 轮询任务队列，并且定期做一次超时为0的epoll_pwait(io_uring后端检查完成队列)，自旋时间由Scheduler按最近的命中率调整
+     * @param[out] events epoll事件数组
+     * @param[in] max_events epoll事件数组大小
+     * @param[in] wait_mask epoll_pwait期间的信号屏蔽字
+     * @param[out] rt 自旋期间epoll返回的事件数
+     * @param[out] spun 是否进行了自旋
+     * @return 等到了任务或IO事件返回true，需要阻塞等待返回false
+     */
+    bool spinPoll(epoll_event* events, int max_events, const sigset_t* wait_mask, int& rt, bool& spun);
+
     /**
      * @brief 判断是否可以停止，同时获取最近一个定时器的超时时间
      * @param[out] timeout 最近一个定时器的超时时间，用于idle协程的epoll_wait
@@ -161,23 +341,96 @@ protected:
      */
     void onTimerInsertedAtFront() override;
 
+private:
     /**
-     * @brief 重置socket句柄上下文的容器大小
-     * @param[in] size 容量大小
+     * @brief 获取fd对应的FdContext，查FdManager的表，不加锁
+     * @param[in] auto_create 记录所在的块不存在时是否分配
      */
-    void contextResize(size_t size);
-    
+    static FdCtx* getFdContext(int fd, bool auto_create);
+
+    /**
+     * @brief 把fd在内核里关注的事件从old_events改成new_events，调用方持有fd_ctx->mutex
+     * @details epoll后端调用epoll_ctl；io_uring后端为新增的事件提交一次性poll，为删除的事件提交poll remove
+     */
+    bool updateInterest(FdContext* fd_ctx, Event old_events, Event new_events);
+
+    /**
+     * @brief 一次性注册时从内核里删除fd上的events事件，常驻注册时什么都不做
+     * @details 调用方已经独占了这些事件的等待者，epoll_ctl失败时只记录日志，之后触发的事件没有等待者会被忽略
+     */
+    void removeInterest(FdContext* fd_ctx, Event events);
+
+    /**
+     * @brief 取一个提交项，提交队列满时先提交，调用方持有m_sqMutex
+     */
+    io_uring_sqe* getSqe();
+
+    /**
+     * @brief 提交积攒的请求，调度线程之外提交的请求立即提交
+     * @param[in] force 是否立即提交
+     */
+    void flushSubmissions(bool force);
+
+    /**
+     * @brief 在tickle管道上注册multishot poll
+     */
+    void armTickle();
+
+    /**
+     * @brief 处理一个完成项
+     * @param[out] fibers 待批量调度的事件协程
+     * @param[out] cbs 待批量调度的事件回调
+     * @return 是否触发了一个等待中的事件或完成式IO
+     */
+    bool handleCompletion(const io_uring_cqe& cqe, std::vector<Fiber::ptr>& fibers,
+                          std::vector<std::function<void()> >& cbs);
+
+    /**
+     * @brief 从fd的multishot accept队列取一个连接
+     */
+    int acceptMultishot(FdContext* fd_ctx, sockaddr* addr, socklen_t* addrlen, uint64_t timeout_ms);
+
+    /**
+     * @brief 在fd的multishot accept上注册，调用方持有队列的锁
+     */
+    void armAccept(FdContext* fd_ctx);
+
+    /**
+     * @brief 取消fd上的multishot accept，不影响fd上的其他请求，调用方持有队列的锁
+     */
+    void cancelAccept(FdContext* fd_ctx);
+
+    /**
+     * @brief 取消fd上的完成式IO和multishot accept，调用方持有fd_ctx->mutex
+     */
+    void cancelCompletions(FdContext* fd_ctx);
+
+    /**
+     * @brief 把socket常驻注册到epoll，边缘触发同时关注读写，调用方持有fd_ctx->mutex
+     * @param[in] reg_id socket的FdCtx id，0表示fd不是socket，只清除之前的常驻注册
+     * @return 是否成功
+     */
+    bool registerPersistent(FdContext* fd_ctx, uint64_t reg_id);
+
 private:
-    /// epoll 文件句柄
-    int m_epfd = 0;
+    /// epoll 文件句柄，io_uring后端为-1
+    int m_epfd = -1;
     /// pipe 文件句柄，fd[0]读端，fd[1]写端
     int m_tickleFds[2];
     /// 当前等待执行的IO事件数量
     std::atomic<size_t> m_pendingEventCount = {0};
-    /// IOManager的Mutex
-    RWMutexType m_mutex;
-    /// socket事件上下文的容器
-    std::vector<FdContext *> m_fdContexts;
+    /// socket是否常驻注册到epoll，构造时读取iomanager.persistent_epoll
+    bool m_persistent = false;
+    /// multishot accept队列的长度上限，构造时读取iomanager.accept_queue_max
+    size_t m_acceptQueueMax = 0;
+    /// epoll_ctl调用次数
+    std::atomic<uint64_t> m_epollCtls = {0};
+    /// io_uring实例，epoll后端为空
+    std::unique_ptr<IoUring> m_uring;
+    /// 提交队列的锁
+    Mutex m_sqMutex;
+    /// 完成队列的锁
+    Mutex m_cqMutex;
 };
 }
 
@@ -0,0 +1,64 @@
+#include "iomanager_group.h"
+#include "affinity.h"
+#include "log.h"
+#include "macro.h"
+
+namespace sylar {
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+IOManagerGroup::IOManagerGroup(size_t shards, const std::string& name)
+    :m_name(name) {
+    if(!shards) {
+        shards = std::max<size_t>(CpuTopologyMgr::GetInstance()->getCpus().size(), 1);
+    }
+    // 每核一个线程才能做到不共享，没有单独配置时按核心放置
+    AffinityPolicy policy = AffinityPolicy::ForScheduler(name);
+    if(policy.getType() == AffinityPolicy::NONE) {
+        policy = AffinityPolicy("core");
+    }
+    for(size_t i = 0; i < shards; ++i) {
+        IOManager* iom = new IOManager(1, false, name + "_" + std::to_string(i), policy.getThreadCpus(i));
+        iom->setThreadRange(1, 1);
+        m_shards.emplace_back(iom);
+    }
+    SYLAR_LOG_INFO(g_logger) << "iomanager group " << m_name << " shards=" << shards
+                             << " affinity=" << policy.toString();
+}
+
+IOManagerGroup::~IOManagerGroup() {
+    stop();
+}
+
+IOManager* IOManagerGroup::next() {
+    return getShard(m_next.fetch_add(1, std::memory_order_relaxed));
+}
+
+int IOManagerGroup::indexOf(const Scheduler* sc) const {
+    for(size_t i = 0; i < m_shards.size(); ++i) {
+        if(m_shards[i].get() == sc) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void IOManagerGroup::post(size_t idx, std::function<void()> cb) {
+    getShard(idx)->schedule(std::move(cb));
+}
+
+void IOManagerGroup::broadcast(const std::function<void()>& cb) {
+    for(auto& i : m_shards) {
+        i->schedule(cb);
+    }
+}
+
+void IOManagerGroup::stop() {
+    // 不能在分片上调用，分片不能停止自己
+    SYLAR_ASSERT(getLocalIndex() < 0);
+    for(auto& i : m_shards) {
+        i->stop();
+    }
+}
+
+}
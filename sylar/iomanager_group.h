@@ -0,0 +1,102 @@
+/**
+ * @file iomanager_group.h
+ * @brief 每核一个线程、互不共享的IOManager组
+ * @details 组里的每个分片是一个单线程的IOManager，有自己的epoll、定时器、fd上下文表和任务队列，
+ *          线程按scheduler.affinity中组名对应的策略绑定CPU，没有配置时每个线程绑定一个核心。
+ *          分片上运行的协程里IOManager::GetThis()返回本分片，交给某个分片的连接和定时器一直留在该分片。
+ *          分片之间不共享状态，需要访问其它分片的数据时用post把任务投递过去，需要结果时用async
+ * @version 0.1
+ */
+#ifndef __SYLAR_IOMANAGER_GROUP_H__
+#define __SYLAR_IOMANAGER_GROUP_H__
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <functional>
+#include "iomanager.h"
+#include "noncopyable.h"
+
+namespace sylar {
+
+/**
+ * @brief 单线程IOManager分片组
+ * @details 分片的线程数固定为1，不要给分片的名称(组名_序号)配置scheduler.thread_range
+ */
+class IOManagerGroup : Noncopyable {
+public:
+    typedef std::shared_ptr<IOManagerGroup> ptr;
+
+    /**
+     * @brief 构造函数，创建并启动所有分片
+     * @param[in] shards 分片数，0表示每个允许使用的CPU一个分片
+     * @param[in] name 组名称，分片名称为name_序号
+     */
+    IOManagerGroup(size_t shards = 0, const std::string& name = "reactor");
+
+    /**
+     * @brief 析构函数，停止所有分片
+     */
+    ~IOManagerGroup();
+
+    const std::string& getName() const { return m_name;}
+
+    /**
+     * @brief 分片数
+     */
+    size_t size() const { return m_shards.size();}
+
+    /**
+     * @brief 第idx个分片
+     */
+    IOManager* getShard(size_t idx) const { return m_shards[idx % m_shards.size()].get();}
+
+    /**
+     * @brief 按轮转选择一个分片，用于分配新连接
+     */
+    IOManager* next();
+
+    /**
+     * @brief 按key选择分片，相同的key总是落在同一个分片
+     */
+    IOManager* getShardByKey(uint64_t key) const { return getShard(key % m_shards.size());}
+
+    /**
+     * @brief 分片在组里的序号，不是本组的分片返回-1
+     */
+    int indexOf(const Scheduler* sc) const;
+
+    /**
+     * @brief 当前线程所在分片的序号，不在本组的分片上返回-1
+     */
+    int getLocalIndex() const { return indexOf(Scheduler::GetThis());}
+
+    /**
+     * @brief 把任务投递到第idx个分片执行
+     * @details 这是分片之间唯一的通信方式，任务在目标分片的线程上运行，可以直接访问该分片的数据
+     */
+    void post(size_t idx, std::function<void()> cb);
+
+    /**
+     * @brief 把任务投递到每个分片各执行一次
+     */
+    void broadcast(const std::function<void()>& cb);
+
+    /**
+     * @brief 依次停止所有分片，等待分片上的任务执行完
+     * @details 已经停止的分片不再执行投递给它的任务，停止前要先结束分片之间的通信
+     */
+    void stop();
+private:
+    /// 组名称
+    std::string m_name;
+    /// 分片
+    std::vector<std::unique_ptr<IOManager> > m_shards;
+    /// 轮转选择的下一个分片
+    std::atomic<size_t> m_next = {0};
+};
+
+}
+
+#endif
@@ -0,0 +1,79 @@
+#include "metrics.h"
+#include <algorithm>
+#include "config.h"
+#include "log.h"
+
+namespace sylar {
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+/// 输出调度器统计的间隔
+static ConfigVar<uint32_t>::ptr g_metrics_dump_interval_ms =
+    Config::Lookup<uint32_t>("metrics.dump_interval_ms", 0, "log scheduler runtime stats every this many milliseconds, 0 disables dumping");
+
+static std::atomic<uint32_t> s_dump_interval_ms{0};
+
+struct _MetricsIniter {
+    _MetricsIniter() {
+        s_dump_interval_ms = g_metrics_dump_interval_ms->getValue();
+        g_metrics_dump_interval_ms->addListener([](const uint32_t& old_value, const uint32_t& new_value) {
+            s_dump_interval_ms = new_value;
+            if (new_value) {
+                MetricsReporterMgr::GetInstance()->start();
+            } else {
+                MetricsReporterMgr::GetInstance()->stop();
+            }
+        });
+        if (s_dump_interval_ms) {
+            MetricsReporterMgr::GetInstance()->start();
+        }
+    }
+};
+
+static _MetricsIniter s_metrics_initer;
+
+MetricsReporter::MetricsReporter()
+    : m_thread("metrics", std::bind(&MetricsReporter::run, this)) {
+    // dump用到的调度器列表要先于输出线程构造，见PeriodicThread
+    std::vector<Scheduler::Stats> stats;
+    Scheduler::GetAllStats(stats);
+}
+
+MetricsReporter::~MetricsReporter() {
+    stop();
+}
+
+void MetricsReporter::start() {
+    if (m_thread.start()) {
+        SYLAR_LOG_INFO(g_logger) << "metrics reporter start, interval_ms=" << s_dump_interval_ms;
+    }
+}
+
+void MetricsReporter::stop() {
+    m_thread.stop();
+}
+
+uint64_t MetricsReporter::run() {
+    // 第一次只记录基准，之后输出每个间隔内的统计
+    dump();
+    return std::max<uint64_t>(s_dump_interval_ms, 10);
+}
+
+void MetricsReporter::dump() {
+    std::vector<Scheduler::Stats> stats;
+    Scheduler::GetAllStats(stats);
+    Mutex::Lock lock(m_dumpMutex);
+    std::map<uint64_t, Scheduler::Stats> last;
+    for (auto& s : stats) {
+        Scheduler::Stats cur = s;
+        auto it = m_last.find(s.id);
+        if (it != m_last.end()) {
+            cur.subtract(it->second);
+            SYLAR_LOG_INFO(g_logger) << "stats " << cur.toString();
+        }
+        last[s.id] = s;
+    }
+    m_last.swap(last);
+}
+
+}
@@ -0,0 +1,61 @@
+/**
+ * @file metrics.h
+ * @brief 调度器运行时统计的定期输出
+ * @version 0.1
+ */
+#ifndef __SYLAR_METRICS_H__
+#define __SYLAR_METRICS_H__
+
+#include <map>
+#include "mutex.h"
+#include "thread.h"
+#include "scheduler.h"
+#include "singleton.h"
+
+namespace sylar {
+
+/**
+ * @brief 定期把所有调度器的统计输出到system日志
+ * @details metrics.dump_interval_ms大于0时自动启动，改成0时停止。输出的是两次输出之间的统计
+ */
+class MetricsReporter : Noncopyable {
+public:
+    MetricsReporter();
+
+    ~MetricsReporter();
+
+    /**
+     * @brief 启动后台线程，已经启动时什么也不做
+     */
+    void start();
+
+    /**
+     * @brief 停止后台线程
+     */
+    void stop();
+
+    /**
+     * @brief 立即输出一次，输出的是和上一次之间的统计，第一次见到的调度器只记录基准
+     */
+    void dump();
+private:
+    /**
+     * @brief 后台线程输出一次
+     * @return 到下一次输出之前等待的毫秒数
+     */
+    uint64_t run();
+private:
+    /// 保护m_last，dump可能在后台线程以外调用
+    Mutex m_dumpMutex;
+    /// 后台线程
+    PeriodicThread m_thread;
+    /// 上一次输出时每个调度器的累计统计，按调度器id
+    std::map<uint64_t, Scheduler::Stats> m_last;
+};
+
+/// 统计输出单例
+typedef Singleton<MetricsReporter> MetricsReporterMgr;
+
+}
+
+#endif
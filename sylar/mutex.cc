@@ -1,5 +1,10 @@
 #include "mutex.h"
 #include <stdexcept>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 namespace sylar {
 
@@ -25,4 +30,37 @@ void Semaphore::wait(){
     }
 }
 
+bool Parker::park(int64_t timeout_ms) {
+    // NOTIFIED -> EMPTY，消费掉已经到达的唤醒
+    if(m_state.fetch_sub(1) == NOTIFIED) {
+        return true;
+    }
+    struct timespec ts;
+    struct timespec* pts = nullptr;
+    if(timeout_ms >= 0) {
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = (timeout_ms % 1000) * 1000000;
+        pts = &ts;
+    }
+    while(true) {
+        //状态已经不是PARKED时立即返回，不会错过unpark
+        long rt = syscall(SYS_futex, (int*)&m_state, FUTEX_WAIT_PRIVATE, PARKED, pts, nullptr, 0);
+        int expected = NOTIFIED;
+        if(m_state.compare_exchange_strong(expected, EMPTY)) {
+            return true;
+        }
+        if(rt == -1 && errno == ETIMEDOUT) {
+            //超时和unpark同时发生时算作被唤醒
+            return m_state.exchange(EMPTY) == NOTIFIED;
+        }
+        //被信号中断或者虚假唤醒，继续等待。超时时间从头算，调用方只把超时当作兜底
+    }
+}
+
+void Parker::unpark() {
+    if(m_state.exchange(NOTIFIED) == PARKED) {
+        syscall(SYS_futex, (int*)&m_state, FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+    }
+}
+
 }
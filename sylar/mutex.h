@@ -43,6 +43,36 @@ private:
     sem_t m_semaphore;
 };
 
+/**
+ * @brief 线程停车位，基于futex，一个停车位只能由一个线程park
+ * @details park()阻塞到unpark()或者超时。unpark()发生在park()之前时，下一次park()立即返回，
+ *          所以先检查条件再park，另一个线程先改条件再unpark，唤醒不会丢失。多次unpark只保留一次
+ */
+class Parker : Noncopyable {
+public:
+    /**
+     * @brief 阻塞当前线程
+     * @param[in] timeout_ms 超时时间(毫秒)，-1表示不超时
+     * @return 被unpark唤醒返回true，超时返回false
+     */
+    bool park(int64_t timeout_ms = -1);
+
+    /**
+     * @brief 唤醒park的线程，还没有park时让下一次park立即返回
+     */
+    void unpark();
+private:
+    enum State {
+        /// 阻塞中
+        PARKED = -1,
+        /// 没有线程阻塞，也没有未消费的唤醒
+        EMPTY = 0,
+        /// 有一次未消费的唤醒
+        NOTIFIED = 1
+    };
+    std::atomic<int> m_state{EMPTY};
+};
+
 //局部锁
 template<class T>
 struct ScopedLockImpl {
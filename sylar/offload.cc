@@ -0,0 +1,151 @@
+#include "offload.h"
+#include <algorithm>
+#include "config.h"
+#include "log.h"
+
+namespace sylar {
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+/// 阻塞调用线程池的最大线程数
+static ConfigVar<uint32_t>::ptr g_offload_threads =
+    Config::Lookup<uint32_t>("offload.threads", 8, "max threads of the blocking-call offload pool");
+/// 排队和正在执行的任务总数上限
+static ConfigVar<uint32_t>::ptr g_offload_max_pending =
+    Config::Lookup<uint32_t>("offload.max_pending", 1024, "max queued and running tasks of the offload pool, submitters wait beyond it");
+
+struct _OffloadIniter {
+    _OffloadIniter() {
+        g_offload_threads->addListener([](const uint32_t& old_value, const uint32_t& new_value) {
+            SYLAR_LOG_INFO(g_logger) << "offload threads changed from " << old_value << " to " << new_value;
+            OffloadPoolMgr::GetInstance()->setMaxThreads(new_value);
+        });
+    }
+};
+
+static _OffloadIniter s_offload_initer;
+
+OffloadPool::OffloadPool(size_t max_threads, size_t max_pending, const std::string& name)
+    :m_slots(max_pending ? max_pending : std::max<uint32_t>(g_offload_max_pending->getValue(), 1))
+    ,m_name(name)
+    ,m_maxThreads(max_threads ? max_threads : std::max<uint32_t>(g_offload_threads->getValue(), 1)) {
+}
+
+OffloadPool::~OffloadPool() {
+    stop();
+}
+
+bool OffloadPool::submit(std::function<void()> cb, uint64_t timeout_ms) {
+    if(!m_slots.wait(timeout_ms)) {
+        return false;
+    }
+    {
+        Mutex::Lock lock(m_mutex);
+        if(m_stopping) {
+            lock.unlock();
+            m_slots.notify();
+            return false;
+        }
+        ++m_pending;
+        m_tasks.push_back(std::move(cb));
+        // 空闲线程不够分时才加线程，线程只在需要时创建
+        if(m_tasks.size() > m_idleThreads
+                && m_threads.size() - m_exitedThreads.size() < m_maxThreads) {
+            addThread();
+        }
+    }
+    m_sem.notify();
+    return true;
+}
+
+void OffloadPool::addThread() {
+    // 缩容退出的线程留在m_threads里，反复调整线程数时m_threads会一直变长
+    reapThreads();
+    // Thread的构造函数等新线程开始运行才返回，新线程在那之后才会加锁，这里持有m_mutex不会死锁
+    m_threads.push_back(Thread::ptr(new Thread(std::bind(&OffloadPool::run, this),
+                                               m_name + "_" + std::to_string(m_nextId++))));
+}
+
+void OffloadPool::reapThreads() {
+    for(auto t : m_exitedThreads) {
+        auto it = std::find_if(m_threads.begin(), m_threads.end(),
+                [t](const Thread::ptr& i) { return i.get() == t; });
+        if(it == m_threads.end()) {
+            continue;
+        }
+        // 退出的线程记录自己之后就释放了m_mutex，持有m_mutex时join只是等它返回
+        (*it)->join();
+        m_threads.erase(it);
+    }
+    m_exitedThreads.clear();
+}
+
+void OffloadPool::stop() {
+    std::vector<Thread::ptr> thrs;
+    {
+        Mutex::Lock lock(m_mutex);
+        if(m_stopping) {
+            return;
+        }
+        m_stopping = true;
+        thrs.swap(m_threads);
+        // 已经退出的线程不再消耗信号量
+        for(size_t i = m_exitedThreads.size(); i < thrs.size(); ++i) {
+            m_sem.notify();
+        }
+    }
+    for(auto& i : thrs) {
+        i->join();
+    }
+    Mutex::Lock lock(m_mutex);
+    m_exitedThreads.clear();
+}
+
+void OffloadPool::setMaxThreads(size_t v) {
+    v = std::max<size_t>(v, 1);
+    Mutex::Lock lock(m_mutex);
+    size_t live = m_threads.size() - m_exitedThreads.size();
+    m_maxThreads = v;
+    // 唤醒多出的线程，它们发现队列为空并且线程数超过上限就退出
+    for(size_t i = v; i < live; ++i) {
+        m_sem.notify();
+    }
+}
+
+size_t OffloadPool::getThreadCount() {
+    Mutex::Lock lock(m_mutex);
+    return m_threads.size() - m_exitedThreads.size();
+}
+
+void OffloadPool::run() {
+    SYLAR_LOG_DEBUG(g_logger) << m_name << " thread start";
+    Mutex::Lock lock(m_mutex);
+    while(true) {
+        ++m_idleThreads;
+        lock.unlock();
+        m_sem.wait();
+        lock.lock();
+        --m_idleThreads;
+        if(m_tasks.empty()) {
+            // 没有任务的唤醒来自停止或者减少线程数
+            if(m_stopping || m_threads.size() - m_exitedThreads.size() > m_maxThreads) {
+                m_exitedThreads.push_back(Thread::GetThis());
+                break;
+            }
+            continue;
+        }
+        std::function<void()> cb;
+        cb.swap(m_tasks.front());
+        m_tasks.pop_front();
+        lock.unlock();
+
+        cb();
+        cb = nullptr;
+        --m_pending;
+        m_slots.notify();
+        lock.lock();
+    }
+    SYLAR_LOG_DEBUG(g_logger) << m_name << " thread exit";
+}
+
+}
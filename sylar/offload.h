@@ -0,0 +1,214 @@
+/**
+ * @file offload.h
+ * @brief 阻塞调用卸载线程池
+ * @details 普通文件IO、getaddrinfo、压缩以及第三方客户端库的阻塞调用不能改成非阻塞，直接在调度线程上执行会让
+ *          整个调度线程上的协程都得不到调度。offload把这类调用交给专门的有界线程池执行，调用方协程挂起，
+ *          调用完成后回到挂起时的调度线程继续运行
+ * @version 0.1
+ */
+#ifndef __SYLAR_OFFLOAD_H__
+#define __SYLAR_OFFLOAD_H__
+
+#include <errno.h>
+#include <deque>
+#include <memory>
+#include <vector>
+#include <atomic>
+#include <string>
+#include <functional>
+#include <stdexcept>
+#include "future.h"
+#include "fiber_sync.h"
+#include "mutex.h"
+#include "thread.h"
+#include "singleton.h"
+#include "util.h"
+
+namespace sylar {
+
+/**
+ * @brief 阻塞调用线程池
+ * @details 线程按需创建，同时执行的任务超过空闲线程数时增加线程，不超过最大线程数。
+ *          排队和正在执行的任务总数有上限，达到上限时提交方协程挂起等待，不会阻塞调度线程
+ */
+class OffloadPool : Noncopyable {
+public:
+    /**
+     * @brief 构造函数
+     * @param[in] max_threads 最大线程数，0表示使用offload.threads配置
+     * @param[in] max_pending 排队和正在执行的任务总数上限，0表示使用offload.max_pending配置
+     * @param[in] name 线程池名称，线程名为name_序号
+     */
+    OffloadPool(size_t max_threads = 0, size_t max_pending = 0, const std::string& name = "offload");
+
+    /**
+     * @brief 析构函数，执行完已经提交的任务后停止所有线程
+     */
+    ~OffloadPool();
+
+    /**
+     * @brief 提交任务
+     * @param[in] cb 在线程池中执行的任务，不能抛出异常
+     * @param[in] timeout_ms 任务数达到上限时等待的超时时间(毫秒)，~0ull表示不超时
+     * @return 提交成功返回true，等待超时或者线程池已经停止返回false
+     */
+    bool submit(std::function<void()> cb, uint64_t timeout_ms = ~0ull);
+
+    /**
+     * @brief 停止线程池，等待已经提交的任务执行完
+     */
+    void stop();
+
+    /**
+     * @brief 设置最大线程数，减少时多出的线程在空闲时退出
+     */
+    void setMaxThreads(size_t v);
+
+    size_t getMaxThreads() const { return m_maxThreads;}
+
+    /**
+     * @brief 返回当前线程数
+     */
+    size_t getThreadCount();
+
+    /**
+     * @brief 返回排队和正在执行的任务数
+     */
+    size_t getPendingCount() const { return m_pending;}
+private:
+    /**
+     * @brief 线程主函数
+     */
+    void run();
+
+    /**
+     * @brief 增加一个线程，调用时持有m_mutex
+     */
+    void addThread();
+
+    /**
+     * @brief join已经退出的线程并从m_threads中移除，调用时持有m_mutex
+     */
+    void reapThreads();
+private:
+    /// 保护任务队列和线程列表
+    Mutex m_mutex;
+    /// 任务队列
+    std::deque<std::function<void()> > m_tasks;
+    /// 每个任务notify一次，停止时每个线程notify一次
+    Semaphore m_sem;
+    /// 限制排队和正在执行的任务总数
+    FiberSemaphore m_slots;
+    /// 线程
+    std::vector<Thread::ptr> m_threads;
+    /// 线程池名称
+    std::string m_name;
+    /// 最大线程数
+    std::atomic<size_t> m_maxThreads{0};
+    /// 排队和正在执行的任务数
+    std::atomic<size_t> m_pending{0};
+    /// 等待任务的线程数，在m_mutex下修改
+    size_t m_idleThreads = 0;
+    /// 已经退出还没有join的线程，在m_mutex下修改
+    std::vector<Thread*> m_exitedThreads;
+    /// 线程编号
+    size_t m_nextId = 0;
+    /// 是否已经停止
+    bool m_stopping = false;
+};
+
+/// 全局阻塞调用线程池
+typedef Singleton<OffloadPool> OffloadPoolMgr;
+
+/**
+ * @brief offload超时
+ */
+class OffloadTimeout : public std::runtime_error {
+public:
+    OffloadTimeout(const std::string& what)
+        :std::runtime_error(what) {
+    }
+};
+
+/**
+ * @brief 在线程池中执行函数，把返回值或异常以及执行之后的errno设置到Promise
+ */
+template<class T>
+struct OffloadRunner {
+    template<class Fn>
+    static void Run(Promise<T>& p, int& error, Fn& fn) {
+        try {
+            errno = 0;
+            T v = fn();
+            error = errno;
+            p.setValue(v);
+        } catch(...) {
+            error = errno;
+            p.setException(std::current_exception());
+        }
+    }
+};
+
+template<>
+struct OffloadRunner<void> {
+    template<class Fn>
+    static void Run(Promise<void>& p, int& error, Fn& fn) {
+        try {
+            errno = 0;
+            fn();
+            error = errno;
+            p.setValue();
+        } catch(...) {
+            error = errno;
+            p.setException(std::current_exception());
+        }
+    }
+};
+
+/**
+ * @brief 在阻塞调用线程池中执行fn，当前协程挂起直到fn完成
+ * @details fn完成后协程回到挂起时的调度线程继续运行，fn的返回值原样返回，fn抛出的异常重新抛出，
+ *          errno设置为fn返回时的值。不在调度器中时直接在当前线程执行fn。
+ *          fn在其他线程执行，不能引用共享栈协程栈上的变量；设置了超时时fn可能在offload返回之后才执行完，
+ *          也不能引用调用方栈上的变量
+ * @param[in] fn 阻塞调用
+ * @param[in] timeout_ms 超时时间(毫秒)，包括排队等待的时间，~0ull表示不超时。协程中使用超时需要运行在IOManager上
+ * @exception OffloadTimeout 超时，errno为ETIMEDOUT，fn仍然会在线程池中执行完，结果被丢弃
+ */
+template<class Fn>
+typename std::result_of<Fn()>::type offload(Fn fn, uint64_t timeout_ms = ~0ull) {
+    typedef typename std::result_of<Fn()>::type R;
+    if(!Scheduler::GetThis()) {
+        return fn();
+    }
+    uint64_t begin = timeout_ms == ~0ull ? 0 : GetElapsedMS();
+    Future<R> f;
+    std::shared_ptr<int> error(new int(0));
+    bool submitted = false;
+    {
+        // 只让任务持有Promise，任务没有执行就被销毁时，等待的一方会收到broken_promise异常
+        Promise<R> p;
+        f = p.getFuture();
+        submitted = OffloadPoolMgr::GetInstance()->submit([p, error, fn]() mutable {
+            OffloadRunner<R>::Run(p, *error, fn);
+        }, timeout_ms);
+    }
+    if(!submitted) {
+        errno = ETIMEDOUT;
+        throw OffloadTimeout("offload: no free slot");
+    }
+    if(timeout_ms != ~0ull) {
+        uint64_t used = GetElapsedMS() - begin;
+        timeout_ms = timeout_ms > used ? timeout_ms - used : 0;
+    }
+    if(!f.wait(timeout_ms)) {
+        errno = ETIMEDOUT;
+        throw OffloadTimeout("offload: timed out");
+    }
+    errno = *error;
+    return f.get();
+}
+
+}
+
+#endif
@@ -2,18 +2,145 @@
 #include "log.h"
 #include "macro.h"
 #include "hook.h"
+#include "config.h"
+#include "affinity.h"
+#include <sstream>
 
 namespace sylar{
 static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
 
+/// 每个调度线程最多缓存的已结束回调协程数量
+static ConfigVar<uint32_t>::ptr g_scheduler_fiber_cache_size =
+    Config::Lookup<uint32_t>("scheduler.fiber_cache_size", 64, "max terminated callback fibers cached per scheduler thread");
+/// 每个调度线程本地任务队列的容量，满了之后的任务放入全局队列
+static ConfigVar<uint32_t>::ptr g_scheduler_local_queue_size =
+    Config::Lookup<uint32_t>("scheduler.local_queue_size", 256, "per scheduler thread local run queue capacity");
+/// 调度线程阻塞之前最多自旋等待新任务的时间
+static ConfigVar<uint32_t>::ptr g_scheduler_spin_us =
+    Config::Lookup<uint32_t>("scheduler.spin_us", 20, "max microseconds an idle scheduler thread spins for new work before parking, 0 disables spinning");
+
+/// 任务的等待时间超过这个值时增加调度线程
+static ConfigVar<uint32_t>::ptr g_scheduler_grow_wait_us =
+    Config::Lookup<uint32_t>("scheduler.grow_wait_us", 10000, "add a scheduler thread when a task waited longer than this many microseconds, up to the max of scheduler.thread_range, 0 disables growing");
+/// 弹性增加的调度线程空闲多久之后退出
+static ConfigVar<uint32_t>::ptr g_scheduler_retire_idle_ms =
+    Config::Lookup<uint32_t>("scheduler.retire_idle_ms", 30000, "retire an elastic scheduler thread after it has been idle this many milliseconds, 0 never retires");
+/// 调度器名称到线程数范围的映射，"*"对应没有单独配置的调度器
+static ConfigVar<std::map<std::string, std::string> >::ptr g_scheduler_thread_range =
+    Config::Lookup("scheduler.thread_range", std::map<std::string, std::string>(),
+                   "scheduler thread count range by scheduler name, min-max or n");
+
+//自旋时间每次进入idle都要读取，缓存一份避免每次都去拿ConfigVar的读锁
+static std::atomic<uint32_t> s_spin_us{20};
+//每个任务出队时都要检查等待时间，同样缓存一份
+static std::atomic<uint32_t> s_grow_wait_us{10000};
+static std::atomic<uint32_t> s_retire_idle_ms{30000};
+
+/// 调度线程上下文的最大数量
+static const size_t s_max_workers = 256;
+
+/// 下一个调度器id
+static std::atomic<uint64_t> s_next_scheduler_id = {1};
+
+/// 所有存活的调度器，scheduler.thread_range修改时重新设置线程数范围
+static Mutex& GetSchedulersMutex() {
+    static Mutex s_mutex;
+    return s_mutex;
+}
+
+static std::set<Scheduler*>& GetSchedulers() {
+    static std::set<Scheduler*> s_schedulers;
+    return s_schedulers;
+}
+
+/**
+ * @brief 查找调度器的线程数范围，格式是"min-max"或"n"
+ * @return 没有配置或格式错误返回false
+ */
+static bool LookupThreadRange(const std::map<std::string, std::string>& ranges, const std::string& name,
+                              size_t& min, size_t& max) {
+    auto it = ranges.find(name);
+    if (it == ranges.end()) {
+        it = ranges.find("*");
+    }
+    if (it == ranges.end()) {
+        return false;
+    }
+    const std::string& str = it->second;
+    size_t pos = str.find('-');
+    min = atoi(str.c_str());
+    max = pos == std::string::npos ? min : atoi(str.c_str() + pos + 1);
+    if (min == 0 || max < min) {
+        SYLAR_LOG_ERROR(g_logger) << "invalid thread range " << str << " for scheduler " << name;
+        return false;
+    }
+    return true;
+}
+
+struct _SchedulerIniter {
+    _SchedulerIniter() {
+        s_spin_us = g_scheduler_spin_us->getValue();
+        g_scheduler_spin_us->addListener([](const uint32_t& old_value, const uint32_t& new_value) {
+            s_spin_us = new_value;
+        });
+        s_grow_wait_us = g_scheduler_grow_wait_us->getValue();
+        g_scheduler_grow_wait_us->addListener([](const uint32_t& old_value, const uint32_t& new_value) {
+            s_grow_wait_us = new_value;
+        });
+        s_retire_idle_ms = g_scheduler_retire_idle_ms->getValue();
+        g_scheduler_retire_idle_ms->addListener([](const uint32_t& old_value, const uint32_t& new_value) {
+            s_retire_idle_ms = new_value;
+        });
+        g_scheduler_thread_range->addListener([](const std::map<std::string, std::string>& old_value,
+                                                 const std::map<std::string, std::string>& new_value) {
+            Mutex::Lock lock(GetSchedulersMutex());
+            for (auto i : GetSchedulers()) {
+                size_t min = 0;
+                size_t max = 0;
+                if (LookupThreadRange(new_value, i->getName(), min, max)) {
+                    i->setThreadRange(min, max);
+                }
+            }
+        });
+    }
+};
+
+static _SchedulerIniter s_scheduler_initer;
+
+/// 本地队列一直有任务时，每调度这么多次任务检查一次全局队列，避免全局队列里的任务饿死
+static const uint32_t s_global_queue_interval = 61;
+/// 每调度这么多次任务，普通优先级的车道先于高优先级的车道检查一次
+static const uint32_t s_normal_boost_interval = 8;
+/// 每调度这么多次任务，后台优先级的车道最先检查一次
+static const uint32_t s_background_boost_interval = 32;
+/// 车道的检查顺序：默认严格按优先级，以及两种让低优先级车道先取的顺序
+static const Scheduler::Priority s_lane_orders[3][Scheduler::PRIORITY_COUNT] = {
+    {Scheduler::HIGH, Scheduler::NORMAL, Scheduler::BACKGROUND},
+    {Scheduler::NORMAL, Scheduler::HIGH, Scheduler::BACKGROUND},
+    {Scheduler::BACKGROUND, Scheduler::HIGH, Scheduler::NORMAL}
+};
+/// 协程正在调度线程上运行的标记，存放在Fiber::m_pendingWake里
+static char s_fiber_on_cpu;
+
 //当前线程的调度器，同一个调度器下的所有线程共享同一个实例
 static thread_local Scheduler* t_scheduler = nullptr;
 //当前线程的调度协程，每个线程都独有一份
 static thread_local Fiber* t_scheduler_fiber = nullptr;
+//当前线程是否正在调度协程上直接执行inline任务
+static thread_local bool t_inline_task = false;
+//当前线程是否正在运行idle协程
+static thread_local bool t_in_idle = false;
+
+thread_local Scheduler::WorkerContext* Scheduler::t_worker = nullptr;
 
 Scheduler::Scheduler(size_t threads, bool use_caller, const std::string& name)
-    :m_name(name),m_useCaller(use_caller) {
+    :Scheduler(threads, use_caller, name, std::vector<int>()) {
+}
+
+Scheduler::Scheduler(size_t threads, bool use_caller, const std::string& name, const std::vector<int>& cpus)
+    :m_name(name),m_cpus(cpus),m_useCaller(use_caller) {
     SYLAR_ASSERT(threads > 0);
+    m_id = s_next_scheduler_id++;
     if(use_caller) {
         sylar::Fiber::GetThis();
         --threads;//使用当前线程作为调度线程,可用线程减一
@@ -37,6 +164,30 @@ Scheduler::Scheduler(size_t threads, bool use_caller, const std::string& name)
         m_rootThread = -1;
     }
     m_threadCount = threads;
+    for (int i = 0; i < PRIORITY_COUNT; i++) {
+        m_globalTaskCount[i] = 0;
+        m_laneTaskCount[i] = 0;
+    }
+
+    size_t queue_size = g_scheduler_local_queue_size->getValue();
+    size_t workers = threads + (use_caller ? 1 : 0);
+    // 上下文的数组大小固定，增加线程时不会重新分配，其他线程可以不加锁遍历
+    m_workers.resize(std::max(workers, s_max_workers));
+    for (size_t i = 0; i < workers; i++) {
+        m_workers[i].reset(new WorkerContext(i, queue_size));
+    }
+    m_workerCount = workers;
+    m_liveWorkers = workers;
+    m_minThreads = workers;
+    m_maxThreads = workers;
+    size_t min = 0;
+    size_t max = 0;
+    if (LookupThreadRange(g_scheduler_thread_range->getValue(), m_name, min, max)) {
+        setThreadRange(min, max);
+    }
+
+    Mutex::Lock lock(GetSchedulersMutex());
+    GetSchedulers().insert(this);
 }
 
 Scheduler* Scheduler::GetThis() {
@@ -54,40 +205,343 @@ Fiber* Scheduler::GetMainFiber() {
 Scheduler::~Scheduler() {
     SYLAR_LOG_DEBUG(g_logger) << "Scheduler::~Scheduler()";
     SYLAR_ASSERT(m_stopping);
+    {
+        Mutex::Lock lock(GetSchedulersMutex());
+        GetSchedulers().erase(this);
+    }
     if (GetThis() == this) {
         t_scheduler = nullptr;
     }
+    size_t n = m_workerCount;
+    for (int p = 0; p < PRIORITY_COUNT; p++) {
+        for (auto i : m_tasks[p]) {
+            delete i;
+        }
+        for (size_t i = 0; i < n; i++) {
+            WorkerContext* worker = m_workers[i].get();
+            while (ScheduleTask* task = worker->queues[p]->steal()) {
+                delete task;
+            }
+            for (auto task : worker->inbox[p]) {
+                delete task;
+            }
+        }
+    }
 }
 
 void Scheduler::start(){
     SYLAR_LOG_DEBUG(g_logger) << "start";
-    MutexType::Lock lock(m_mutex);
-    if(m_stopping){
-        SYLAR_LOG_ERROR(g_logger) << "Scheduler is stopped";
+    {
+        MutexType::Lock lock(m_threadMutex);
+        if(m_stopping){
+            SYLAR_LOG_ERROR(g_logger) << "Scheduler is stopped";
+            return;
+        }
+        SYLAR_ASSERT(m_threads.empty());
+        m_threads.resize(m_threadCount);
+        //按scheduler.affinity中的策略放置调度线程，use_caller的线程不改变亲和性
+        m_affinity = m_cpus.empty() ? AffinityPolicy::ForScheduler(m_name)
+                                    : AffinityPolicy("cpus:" + CpuTopology::FormatCpuList(m_cpus));
+        for (size_t i = 0; i < m_threadCount; i++) {
+            //每个线程都要执行协程调度器的run,处理一个任务,new的时候就开始执行run了
+            m_threads[i].reset(new Thread(std::bind(&Scheduler::run, this),
+                                          m_name + "_" + std::to_string(i),
+                                          m_affinity.getThreadCpus(i)));
+            m_threadIds.push_back(m_threads[i]->getId());
+        }
+        if (m_affinity.getType() != AffinityPolicy::NONE) {
+            std::stringstream ss;
+            for (auto& i : m_threads) {
+                ss << " " << i->getName() << "=[" << CpuTopology::FormatCpuList(i->getCpus()) << "]";
+            }
+            SYLAR_LOG_INFO(g_logger) << "scheduler " << m_name << " affinity=" << m_affinity.toString()
+                                     << " threads:" << ss.str();
+        }
+        m_started = true;
+    }
+    //最小线程数多于构造时的线程数，立即补足
+    while (m_liveWorkers < m_minThreads && addWorker()) {
+    }
+}
+
+void Scheduler::setThreadRange(size_t min, size_t max) {
+    min = std::max<size_t>(min, 1);
+    max = std::min(std::max(max, min), m_workers.size());
+    m_minThreads = min;
+    m_maxThreads = max;
+    SYLAR_LOG_INFO(g_logger) << "scheduler " << m_name << " thread range=" << min << "-" << max;
+    bool started = false;
+    {
+        MutexType::Lock lock(m_threadMutex);
+        started = m_started;
+    }
+    while (started && m_liveWorkers < m_minThreads && addWorker()) {
+    }
+}
+
+bool Scheduler::addWorker() {
+    std::vector<Thread::ptr> retired;
+    {
+        MutexType::Lock lock(m_threadMutex);
+        if (m_stopping || !m_started || m_liveWorkers >= m_maxThreads) {
+            return false;
+        }
+        WorkerContext* worker = nullptr;
+        if (!m_freeWorkers.empty()) {
+            worker = m_workers[m_freeWorkers.back()].get();
+            m_freeWorkers.pop_back();
+            Spinlock::Lock inbox_lock(worker->inboxMutex);
+            worker->retired = false;
+        } else if (m_workerCount < m_workers.size()) {
+            size_t idx = m_workerCount;
+            m_workers[idx].reset(new WorkerContext(idx, g_scheduler_local_queue_size->getValue()));
+            worker = m_workers[idx].get();
+            // 上下文创建完之后再增加数量，其他线程遍历时看到的都是完整的上下文
+            ++m_workerCount;
+        } else {
+            return false;
+        }
+        worker->elastic = true;
+        worker->retiring = false;
+        worker->lastTaskUs = GetElapsedUS();
+        ++m_liveWorkers;
+        Thread::ptr thr(new Thread(std::bind(&Scheduler::runWorker, this, worker),
+                                   m_name + "_" + std::to_string(worker->index),
+                                   m_affinity.getThreadCpus(worker->index)));
+        m_threads.push_back(thr);
+        retired.swap(m_retiredThreads);
+        SYLAR_LOG_INFO(g_logger) << "scheduler " << m_name << " add thread " << thr->getName()
+                                 << " threads=" << m_liveWorkers;
+    }
+    // 已经退出的线程在放入m_retiredThreads之后就不再访问调度器，join很快返回
+    for (auto& i : retired) {
+        i->join();
+    }
+    return true;
+}
+
+void Scheduler::maybeGrow(uint64_t now) {
+    // 有空闲线程会来取任务，不需要增加；队列里没有其他任务了，增加线程也没用
+    if (m_idleThreadCount > 0 || m_taskCount == 0) {
         return;
     }
-    SYLAR_ASSERT(m_threads.empty());
-    m_threads.resize(m_threadCount);
-    for (size_t i = 0; i < m_threadCount; i++) {
-        //每个线程都要执行协程调度器的run,处理一个任务,new的时候就开始执行run了
-        m_threads[i].reset(new Thread(std::bind(&Scheduler::run, this),
-                                      m_name + "_" + std::to_string(i)));
-        m_threadIds.push_back(m_threads[i]->getId());
+    // 每个等待阈值的时间内最多增加一个线程，给新线程一点时间消化积压的任务
+    uint64_t last = m_lastGrowUs;
+    if (now - last < s_grow_wait_us || !m_lastGrowUs.compare_exchange_strong(last, now)) {
+        return;
+    }
+    addWorker();
+}
+
+bool Scheduler::shouldRetire(uint64_t* wait_ms) {
+    WorkerContext* worker = t_worker;
+    if (!worker || worker->scheduler != this || !worker->elastic || m_stopping) {
+        return false;
+    }
+    if (worker->retiring) {
+        return true;
+    }
+    uint64_t idle_ms = s_retire_idle_ms;
+    if (idle_ms == 0) {
+        return false;
+    }
+    uint64_t idle_us = GetElapsedUS() - worker->lastTaskUs;
+    if (idle_us < idle_ms * 1000) {
+        if (wait_ms) {
+            *wait_ms = (idle_ms * 1000 - idle_us + 999) / 1000;
+        }
+        return false;
+    }
+    // 绑定在本线程共享栈上的协程只能回到本线程运行
+    if (Fiber::HasThreadSharedStacks() || hasPendingWork()) {
+        return false;
+    }
+    size_t live = m_liveWorkers;
+    while (live > m_minThreads) {
+        if (m_liveWorkers.compare_exchange_weak(live, live - 1)) {
+            worker->retiring = true;
+            return true;
+        }
+    }
+    return false;
+}
+
+void Scheduler::retire(WorkerContext* worker) {
+    int thread = worker->thread;
+    // 先让findWorker找不到这个线程，再关闭收件箱，之后指定这个线程的任务都会进入全局队列
+    worker->thread = -1;
+    std::vector<ScheduleTask*> tasks;
+    {
+        Spinlock::Lock lock(worker->inboxMutex);
+        worker->retired = true;
+        for (int p = 0; p < PRIORITY_COUNT; p++) {
+            tasks.insert(tasks.end(), worker->inbox[p].begin(), worker->inbox[p].end());
+            worker->inbox[p].clear();
+        }
+        worker->inboxSize = 0;
+    }
+    for (int p = 0; p < PRIORITY_COUNT; p++) {
+        while (ScheduleTask* task = worker->queues[p]->steal()) {
+            tasks.push_back(task);
+        }
     }
+    {
+        MutexType::Lock lock(m_mutex);
+        m_retiredThreadIds.insert(thread);
+        // 已经在全局队列里、指定了这个线程的任务改为任意线程执行
+        for (int p = 0; p < PRIORITY_COUNT; p++) {
+            for (auto task : m_tasks[p]) {
+                if (task->thread == thread) {
+                    task->thread = -1;
+                }
+            }
+        }
+        for (auto task : tasks) {
+            pushGlobalLocked(task);
+        }
+    }
+    if (!tasks.empty()) {
+        tickle();
+    }
+
+    MutexType::Lock lock(m_threadMutex);
+    for (auto it = m_threads.begin(); it != m_threads.end(); ++it) {
+        if (it->get() == Thread::GetThis()) {
+            m_retiredThreads.push_back(*it);
+            m_threads.erase(it);
+            break;
+        }
+    }
+    // 归还上下文之后这个线程不再访问它
+    m_freeWorkers.push_back(worker->index);
+    SYLAR_LOG_INFO(g_logger) << "scheduler " << m_name << " retire thread " << Thread::GetName()
+                             << " threads=" << m_liveWorkers;
 }
-//读取的时候也加锁，防止有其他线程修改m_stopping，m_tasks，m_activeThreadCount
+//任务取出时先增加活跃线程数再减少任务数，所以先读任务数再读活跃线程数不会漏掉正在转移的任务
 bool Scheduler::stopping() {
-    MutexType::Lock lock(m_mutex);
-    return m_stopping && m_tasks.empty() && m_activeThreadCount == 0;
+    return m_stopping && m_taskCount == 0 && m_activeThreadCount == 0;
 }
 
 void Scheduler::tickle() { 
     SYLAR_LOG_DEBUG(g_logger) << "ticlke"; 
+    wakeIdleWorkers(1);
+}
+
+void Scheduler::wakeWorker(pthread_t handle) {
+    size_t n = m_workerCount;
+    for (size_t i = 0; i < n; i++) {
+        WorkerContext* worker = m_workers[i].get();
+        if (worker->thread != -1 && pthread_equal(worker->handle, handle)) {
+            worker->parker.unpark();
+            recordTickle();
+            return;
+        }
+    }
+}
+
+bool Scheduler::beginSpin(uint64_t& budget_us) {
+    WorkerContext* worker = t_worker;
+    uint32_t max_us = s_spin_us;
+    if (!worker || worker->scheduler != this || max_us == 0 || m_stopping) {
+        if (worker && worker->scheduler == this) {
+            ++worker->parks;
+        }
+        return false;
+    }
+    size_t max_spinning = std::max<size_t>(1, m_liveWorkers / 2);
+    if (m_spinningCount.fetch_add(1) >= max_spinning) {
+        --m_spinningCount;
+        ++worker->parks;
+        return false;
+    }
+    worker->spinning = true;
+    budget_us = worker->spinBudgetUs;
+    if (budget_us == 0 || budget_us > max_us) {
+        budget_us = max_us;
+    }
+    return true;
+}
+
+void Scheduler::endSpin(bool hit, uint64_t spent_us) {
+    WorkerContext* worker = t_worker;
+    // 先清除自旋标记，调用方再检查一次任务，和入队之后检查自旋标记配对
+    worker->spinning = false;
+    --m_spinningCount;
+
+    uint64_t max_us = s_spin_us;
+    uint64_t min_us = std::max<uint64_t>(1, max_us / 16);
+    uint64_t budget = worker->spinBudgetUs;
+    if (budget == 0 || budget > max_us) {
+        budget = max_us;
+    }
+    // 最近自旋能等到任务就多自旋一会儿，等不到就少自旋，减少空转的CPU
+    budget = hit ? std::min(max_us, budget * 2) : std::max(min_us, budget / 2);
+    worker->spinBudgetUs = budget;
+
+    ++worker->spins;
+    worker->spinUs += spent_us;
+    if (hit) {
+        ++worker->spinHits;
+    } else {
+        ++worker->parks;
+    }
+}
+
+bool Scheduler::hasRunnableWork() const {
+    WorkerContext* worker = t_worker;
+    if (!worker || worker->scheduler != this) {
+        return false;
+    }
+    if (worker->inboxSize > 0 || !worker->localEmpty()) {
+        return true;
+    }
+    for (int i = 0; i < PRIORITY_COUNT; i++) {
+        if (m_globalTaskCount[i] > 0) {
+            return true;
+        }
+    }
+    size_t n = m_workerCount;
+    for (size_t i = 0; i < n; i++) {
+        if (!m_workers[i]->localEmpty()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Scheduler::hasPendingWork() const {
+    WorkerContext* worker = t_worker;
+    return worker && worker->scheduler == this
+        && (worker->inboxSize > 0 || !worker->localEmpty());
 }
 
 void Scheduler::idle() {
     SYLAR_LOG_DEBUG(g_logger) << "idle";
+    WorkerContext* worker = t_worker;
+    // 上次检查到有任务时的取任务时间，用来判断yield回去之后有没有取到任务
+    uint64_t checked_task_us = 0;
+    bool checked = false;
     while (!stopping()) {
+        uint64_t timeout_ms = ~0ull;
+        if (shouldRetire(&timeout_ms)) {
+            break;
+        }
+        if (worker && worker->scheduler == this) {
+            // run中先标记了idle再进入这里，阻塞之前再检查一次任务，和入队之后检查idle再唤醒配对，唤醒不会丢失
+            bool runnable = hasRunnableWork();
+            if (runnable && !(checked && worker->lastTaskUs == checked_task_us)) {
+                checked = true;
+                checked_task_us = worker->lastTaskUs;
+            } else {
+                // 有任务却取不到，比如全局队列里只有指定了其他线程的任务，或者协程还没有yield，
+                // 短暂阻塞之后再看，避免空转
+                if (runnable) {
+                    timeout_ms = std::min<uint64_t>(timeout_ms, 1);
+                }
+                checked = false;
+                worker->parker.park(timeout_ms == ~0ull ? -1 : (int64_t)timeout_ms);
+            }
+        }
         sylar::Fiber::GetThis()->yield();//从正在运行的协程切换到当前线程的主协程,如果协程参与调度器调度，那么切换到调度器的主协程
     }
 }
@@ -115,6 +569,8 @@ void Scheduler::stop(){
     if (m_rootFiber) {
         tickle();
     }
+    //多个线程等在同一个tickle上时可能只有一个被唤醒，已经在idle的线程再逐个唤醒
+    wakeIdleWorkers();
 
     //在use caller情况下，调度器协程结束时，应该返回caller协程
     if (m_rootFiber) {
@@ -125,13 +581,18 @@ void Scheduler::stop(){
     //把Thread::ptr交换出来，确定shared_ptr的析构时间，否则要等Scheduler析构调用智能指针析构函数
     std::vector<Thread::ptr> thrs;
     {
-        MutexType::Lock lock(m_mutex);
+        MutexType::Lock lock(m_threadMutex);
         thrs.swap(m_threads);
+        thrs.insert(thrs.end(), m_retiredThreads.begin(), m_retiredThreads.end());
+        m_retiredThreads.clear();
     }
     for (auto &i : thrs) {
         i->join();
     }
 
+    //已经停止的调度器不再出现在统计和运行任务的检查中，子类析构期间也不会再被访问
+    Mutex::Lock lock(GetSchedulersMutex());
+    GetSchedulers().erase(this);
 }
 
 void Scheduler::run() {
@@ -142,63 +603,118 @@ void Scheduler::run() {
     if(sylar::GetThreadId() != m_rootThread){
         t_scheduler_fiber = sylar::Fiber::GetThis().get();
     }
+
+    // 构造时创建的常驻线程按进入run的顺序领取上下文
+    size_t idx = m_nextWorker++;
+    SYLAR_ASSERT(idx < m_threadCount + (m_useCaller ? 1 : 0));
+    runWorker(m_workers[idx].get());
+}
+
+void Scheduler::runWorker(WorkerContext* worker) {
+    if (worker->elastic) {
+        // 弹性增加的线程不经过run，在这里初始化
+        set_hook_enable(true);
+        setThis();
+        t_scheduler_fiber = sylar::Fiber::GetThis().get();
+        // 线程id可能被复用，新线程不再当作已退出的线程
+        MutexType::Lock lock(m_mutex);
+        m_retiredThreadIds.erase(sylar::GetThreadId());
+    }
+    worker->handle = pthread_self();
+    worker->scheduler = this;
+    worker->thread = sylar::GetThreadId();
+    t_worker = worker;
+    const size_t fiber_cache_size = g_scheduler_fiber_cache_size->getValue();
+
     //空闲协程会yeild切换到当前线程的主协程,一直resume一个空闲协程，然后yeild回来
     Fiber::ptr idle_fiber(new Fiber(std::bind(&Scheduler::idle, this)));
     Fiber::ptr cb_fiber;
 
-    ScheduleTask task;
+    uint32_t tick = 0;
     while(true){
-        task.reset();
+        beforeDispatch();
         bool tickle_me = false;// 是否tickle其他线程进行任务调度
-        {
-            MutexType::Lock lock(m_mutex);
-            auto it = m_tasks.begin();
-            //遍历所有调度任务
-            while(it != m_tasks.end()){
-                if(it->thread != -1 && it->thread != sylar::GetThreadId()){
-                    // 指定了调度线程，但不是在当前线程上调度，标记一下需要通知其他线程进行调度，然后跳过这个任务，继续下一个
-                    ++it;
-                    tickle_me = true;
-                    continue;
-                }
-                // 找到一个未指定线程，或是指定了当前线程的任务
-                SYLAR_ASSERT(it->fiber || it->cb);
-
-                // [BUG FIX]: hook IO相关的系统调用时，在检测到IO未就绪的情况下，会先添加对应的读写事件，再yield当前协程，等IO就绪后再resume当前协程
-                // 多线程高并发情境下，有可能发生刚添加事件就被触发的情况，如果此时当前协程还未来得及yield，则这里就有可能出现协程状态仍为RUNNING的情况
-                // 这里简单地跳过这种情况，以损失一点性能为代价，否则整个协程框架都要大改
-                //比如对于主动yield的协程，要先把当前协程放入任务队列，再yield,这两个动作之间任务又被执行了
-                if(it->fiber && it->fiber->getState() == Fiber::RUNNING) {
-                    ++it;
-                    continue;
-                }
-                // 当前调度线程找到一个任务，准备开始调度，将其从任务队列中剔除，活动线程数加1
-                task = *it;
-                m_tasks.erase(it++);
-                ++m_activeThreadCount;
-                break;
-            }
-            // 当前线程拿完一个任务后，发现任务队列还有剩余，那么tickle一下其他线程
-            tickle_me |= (it != m_tasks.end());
-        }
+        ScheduleTask* ptask = nextTask(worker, ++tick, tickle_me);
+        // 本地队列还有任务，空闲线程可以来窃取
+        tickle_me |= !worker->localEmpty();
 
         if (tickle_me) {
             tickle();
         }
-        if (task.fiber) {
+
+        ScheduleTask task;
+        if (!ptask && m_stopping && stopping()) {
+            // 最后一个任务执行完了，其他还在idle中等待的线程也要退出
+            wakeIdleWorkers();
+        }
+        if (ptask) {
+            // 当前调度线程拿到一个任务，先增加活跃线程数再减少任务数，stopping()不会误判
+            ++m_activeThreadCount;
+            --m_taskCount;
+            --m_laneTaskCount[ptask->priority];
+            uint64_t now = GetElapsedUS();
+            uint64_t wait = now > ptask->enqueueUs ? now - ptask->enqueueUs : 0;
+            worker->recordWait(ptask->priority, wait);
+            worker->lastTaskUs = now;
+            task = std::move(*ptask);
+            delete ptask;
+            uint32_t grow_us = s_grow_wait_us;
+            if (grow_us && wait >= grow_us && m_liveWorkers < m_maxThreads) {
+                maybeGrow(now);
+            }
+        }
+
+        if (task.cb && task.inlined) {
+            // inline任务直接在调度协程上执行，不创建协程，也没有协程切换
+            std::function<void()> cb;
+            cb.swap(task.cb);
+            task.reset();
+            t_inline_task = true;
+            worker->beginTask(0);
+            cb();
+            worker->endTask();
+            t_inline_task = false;
+            --m_activeThreadCount;
+        } else if (task.fiber) {
             // resume协程，resume返回时，协程要么执行完了，要么半路yield了，总之这个任务就算完成了，活跃线程数减一
-            task.fiber->resume();
+            worker->beginTask(task.fiber->getId());
+            RunFiber(task.fiber.get());
+            worker->endTask();
             --m_activeThreadCount;
             task.reset();
         } else if (task.cb) {
+            // 优先复用本线程已结束、栈大小和共享栈模式都相同的回调协程，省掉一次栈分配
+            size_t stacksize = m_sharedStack ? 0
+                : (task.stacksize ? task.stacksize : Fiber::GetDefaultStackSize());
+            for (size_t i = worker->freeFibers.size(); i > 0; --i) {
+                Fiber::ptr& f = worker->freeFibers[i - 1];
+                if (f->isSharedStack() == m_sharedStack && f->getStackSize() == stacksize) {
+                    cb_fiber.swap(f);
+                    worker->freeFibers.erase(worker->freeFibers.begin() + (i - 1));
+                    break;
+                }
+            }
             if (cb_fiber) {
                 cb_fiber->reset(task.cb);
+                ++worker->reusedFibers;
             } else {
-                cb_fiber.reset(new Fiber(task.cb));
+                cb_fiber.reset(new Fiber(task.cb, stacksize, true, m_sharedStack));
+                ++worker->allocatedFibers;
             }
             task.reset();
-            cb_fiber->resume();
+            worker->beginTask(cb_fiber->getId());
+            RunFiber(cb_fiber.get());
+            worker->endTask();
             --m_activeThreadCount;
+            // 回调执行完且没有其他地方持有这个协程，放回空闲列表；如果回调中途yield了，协程由等待事件的一方持有，这里只释放引用
+            if (cb_fiber->getState() == Fiber::TERM && cb_fiber.use_count() == 1
+                    && fiber_cache_size > 0) {
+                if (worker->freeFibers.size() >= fiber_cache_size) {
+                    // 空闲列表满了，丢掉最早放入的，这样栈大小不常用的协程不会一直占着空闲列表
+                    worker->freeFibers.erase(worker->freeFibers.begin());
+                }
+                worker->freeFibers.push_back(cb_fiber);
+            }
             cb_fiber.reset();
         } else {
             // 进到这个分支情况一定是任务队列空了，调度idle协程即可
@@ -207,13 +723,524 @@ void Scheduler::run() {
                 SYLAR_LOG_DEBUG(g_logger) << "idle fiber term";
                 break;
             }
+            // 先标记idle再在idle中检查收件箱，和enqueue中先放入收件箱再检查idle配对，唤醒不会丢失
+            worker->idle = true;
             ++m_idleThreadCount;
+            uint64_t idle_begin = GetElapsedUS();
+            worker->idleSinceUs.store(idle_begin, std::memory_order_relaxed);
+            t_in_idle = true;
             idle_fiber->resume();
+            t_in_idle = false;
+            worker->idleSinceUs.store(0, std::memory_order_relaxed);
+            worker->idleUs.store(worker->idleUs.load(std::memory_order_relaxed)
+                                 + GetElapsedUS() - idle_begin, std::memory_order_relaxed);
             --m_idleThreadCount;
+            worker->idle = false;
         }
         
     }
+    worker->freeFibers.clear();
+    t_worker = nullptr;
+    if (worker->retiring) {
+        retire(worker);
+    }
     SYLAR_LOG_DEBUG(g_logger) << "Scheduler::run() exit";
 }
 
+void Scheduler::RunFiber(Fiber* fiber) {
+    fiber->m_pendingWake.store(&s_fiber_on_cpu, std::memory_order_release);
+    fiber->resume();
+    // resume返回时协程的上下文已经保存好，运行期间收到的唤醒现在可以入队了
+    void* wake = fiber->m_pendingWake.exchange(nullptr, std::memory_order_acq_rel);
+    if (wake != &s_fiber_on_cpu) {
+        Scheduler* sc = fiber->m_wakeScheduler;
+        if (sc->enqueue((ScheduleTask*)wake)) {
+            sc->tickle();
+        }
+    }
+}
+
+bool Scheduler::deferWake(ScheduleTask* task) {
+    Fiber* fiber = task->fiber.get();
+    if (!fiber || fiber->m_pendingWake.load(std::memory_order_acquire) != &s_fiber_on_cpu) {
+        return false;
+    }
+    // 一次挂起只有一个唤醒方，m_wakeScheduler由下面的CAS发布给RunFiber
+    fiber->m_wakeScheduler = this;
+    void* expected = &s_fiber_on_cpu;
+    return fiber->m_pendingWake.compare_exchange_strong(expected, task, std::memory_order_acq_rel);
+}
+
+bool Scheduler::enqueue(ScheduleTask* task) {
+    if (deferWake(task)) {
+        return false;
+    }
+    ++m_taskCount;
+    ++m_laneTaskCount[task->priority];
+    task->enqueueUs = GetElapsedUS();
+    WorkerContext* worker = t_worker;
+    if (task->thread == -1 && worker && worker->scheduler == this) {
+        WorkStealingQueue<ScheduleTask>* queue = worker->queues[task->priority].get();
+        bool was_empty = queue->empty();
+        if (queue->push(task)) {
+            return was_empty;
+        }
+        ++worker->overflowed;
+    } else if (task->thread != -1) {
+        WorkerContext* target = findWorker(task->thread);
+        if (target && pushInbox(target, task)) {
+            // 目标线程不在idle或者正在自旋时，自己会检查收件箱，不需要唤醒
+            if (target != worker && target->idle && !target->spinning) {
+                wakeWorker(target->handle);
+            }
+            return false;
+        }
+        // 目标线程还没有进入run，放入全局队列，由takeGlobal按线程id挑选；目标线程已经退出时改为任意线程执行
+    }
+    MutexType::Lock lock(m_mutex);
+    bool need_tickle = m_tasks[task->priority].empty();
+    pushGlobalLocked(task);
+    return need_tickle;
+}
+
+void Scheduler::pushGlobalLocked(ScheduleTask* task) {
+    if (task->thread != -1 && !m_retiredThreadIds.empty()
+            && m_retiredThreadIds.count(task->thread)) {
+        task->thread = -1;
+    }
+    m_tasks[task->priority].push_back(task);
+    ++m_globalTaskCount[task->priority];
+}
+
+size_t Scheduler::wakeIdleWorkers(size_t max) {
+    WorkerContext* self = t_worker;
+    size_t n = m_workerCount;
+    // 从当前线程的下一个开始，避免总是唤醒同一个线程
+    size_t start = (self && self->scheduler == this) ? self->index + 1 : 0;
+    size_t woken = 0;
+    for (size_t i = 0; i < n && woken < max; i++) {
+        WorkerContext* worker = m_workers[(start + i) % n].get();
+        if (worker != self && worker->thread != -1 && worker->idle) {
+            // 正在自旋的线程自己会发现新任务，不用唤醒
+            if (!worker->spinning) {
+                wakeWorker(worker->handle);
+            }
+            ++woken;
+        }
+    }
+    return woken;
+}
+
+void Scheduler::enqueueBatch(std::vector<ScheduleTask*>& tasks) {
+    // 还在调度线程上运行的协程等它切出之后再入队
+    size_t kept = 0;
+    for (auto task : tasks) {
+        if (!deferWake(task)) {
+            tasks[kept++] = task;
+        }
+    }
+    tasks.resize(kept);
+    if (tasks.empty()) {
+        return;
+    }
+    m_taskCount += tasks.size();
+    uint64_t now = GetElapsedUS();
+    WorkerContext* worker = t_worker;
+    bool is_worker = worker && worker->scheduler == this;
+    std::vector<ScheduleTask*> global;
+    // 按目标线程分组的指定了线程的任务
+    std::vector<std::pair<WorkerContext*, std::vector<ScheduleTask*> > > pinned;
+    size_t unpinned = 0;
+    for (auto task : tasks) {
+        ++m_laneTaskCount[task->priority];
+        task->enqueueUs = now;
+        if (task->thread == -1) {
+            ++unpinned;
+            if (is_worker) {
+                if (worker->queues[task->priority]->push(task)) {
+                    continue;
+                }
+                ++worker->overflowed;
+            }
+            global.push_back(task);
+            continue;
+        }
+        WorkerContext* target = findWorker(task->thread);
+        if (!target) {
+            global.push_back(task);
+            continue;
+        }
+        size_t i = 0;
+        while (i < pinned.size() && pinned[i].first != target) {
+            ++i;
+        }
+        if (i == pinned.size()) {
+            pinned.push_back(std::make_pair(target, std::vector<ScheduleTask*>()));
+        }
+        pinned[i].second.push_back(task);
+    }
+    tasks.clear();
+
+    for (auto& i : pinned) {
+        WorkerContext* target = i.first;
+        {
+            Spinlock::Lock lock(target->inboxMutex);
+            if (target->retired) {
+                global.insert(global.end(), i.second.begin(), i.second.end());
+                continue;
+            }
+            for (auto task : i.second) {
+                target->inbox[task->priority].push_back(task);
+            }
+            target->inboxSize += i.second.size();
+        }
+        if (target != worker && target->idle && !target->spinning) {
+            wakeWorker(target->handle);
+        }
+    }
+    if (!global.empty()) {
+        MutexType::Lock lock(m_mutex);
+        for (auto task : global) {
+            pushGlobalLocked(task);
+        }
+    }
+    if (unpinned > 0) {
+        // 当前调度线程自己会处理一个，其余的最多唤醒同样数量的空闲线程
+        size_t n = is_worker ? unpinned - 1 : unpinned;
+        if (n > 0 && wakeIdleWorkers(n) == 0 && !is_worker) {
+            tickle();
+        }
+    }
+}
+
+Scheduler::WorkerContext* Scheduler::findWorker(int thread) const {
+    // 调度线程数不多，顺序查找比加锁查表更快
+    size_t n = m_workerCount;
+    for (size_t i = 0; i < n; i++) {
+        if (m_workers[i]->thread == thread) {
+            return m_workers[i].get();
+        }
+    }
+    return nullptr;
+}
+
+Scheduler::ScheduleTask* Scheduler::nextTask(WorkerContext* worker, uint32_t tick, bool& tickle_me) {
+    // 默认严格按优先级取任务，隔一段时间让低优先级的车道先取一次，不会被高优先级的任务饿死
+    const Priority* order = s_lane_orders[0];
+    if (tick % s_background_boost_interval == 0) {
+        order = s_lane_orders[2];
+    } else if (tick % s_normal_boost_interval == 0) {
+        order = s_lane_orders[1];
+    }
+    // 本地队列一直有任务时，隔一段时间先看一下全局队列
+    bool global_first = (tick % s_global_queue_interval == 0);
+    for (int i = 0; i < PRIORITY_COUNT; i++) {
+        Priority priority = order[i];
+        ScheduleTask* task = nullptr;
+        if (global_first) {
+            task = takeGlobal(priority, tickle_me);
+        }
+        // 指定了本线程的任务只能由本线程执行，优先于本地队列
+        if (!task) {
+            task = takeInbox(worker, priority);
+        }
+        if (!task) {
+            task = takeLocal(worker, priority);
+        }
+        if (!task && !global_first) {
+            task = takeGlobal(priority, tickle_me);
+        }
+        if (!task) {
+            task = steal(worker, priority);
+        }
+        if (task) {
+            return task;
+        }
+    }
+    return nullptr;
+}
+
+bool Scheduler::pushInbox(WorkerContext* target, ScheduleTask* task) {
+    Spinlock::Lock lock(target->inboxMutex);
+    if (target->retired) {
+        return false;
+    }
+    target->inbox[task->priority].push_back(task);
+    ++target->inboxSize;
+    return true;
+}
+
+Scheduler::ScheduleTask* Scheduler::takeLocal(WorkerContext* worker, Priority priority) {
+    return worker->queues[priority]->steal();
+}
+
+Scheduler::ScheduleTask* Scheduler::takeInbox(WorkerContext* worker, Priority priority) {
+    if (worker->inboxSize == 0) {
+        return nullptr;
+    }
+    ScheduleTask* task = nullptr;
+    {
+        Spinlock::Lock lock(worker->inboxMutex);
+        std::deque<ScheduleTask*>& inbox = worker->inbox[priority];
+        if (inbox.empty()) {
+            return nullptr;
+        }
+        task = inbox.front();
+        inbox.pop_front();
+        --worker->inboxSize;
+    }
+    ++worker->pinned;
+    return task;
+}
+
+Scheduler::ScheduleTask* Scheduler::takeGlobal(Priority priority, bool& tickle_me) {
+    if (m_globalTaskCount[priority] == 0) {
+        return nullptr;
+    }
+    MutexType::Lock lock(m_mutex);
+    std::list<ScheduleTask*>& tasks = m_tasks[priority];
+    auto it = tasks.begin();
+    //遍历所有调度任务
+    while(it != tasks.end()){
+        ScheduleTask* task = *it;
+        if(task->thread != -1 && task->thread != sylar::GetThreadId()){
+            // 指定了调度线程，但不是在当前线程上调度，标记一下需要通知其他线程进行调度，然后跳过这个任务，继续下一个
+            ++it;
+            tickle_me = true;
+            continue;
+        }
+        // 找到一个未指定线程，或是指定了当前线程的任务
+        SYLAR_ASSERT(task->fiber || task->cb);
+        // 协程在yield之前就被唤醒(比如刚添加事件就触发了)时，任务由RunFiber在它切出之后才入队，这里取到的协程一定已经切出
+        tasks.erase(it++);
+        --m_globalTaskCount[priority];
+        // 当前线程拿完一个任务后，发现任务队列还有剩余，那么tickle一下其他线程
+        tickle_me |= (it != tasks.end());
+        return task;
+    }
+    return nullptr;
+}
+
+Scheduler::ScheduleTask* Scheduler::steal(WorkerContext* worker, Priority priority) {
+    size_t n = m_workerCount;
+    for (size_t i = 1; i < n; i++) {
+        WorkerContext* victim = m_workers[(worker->index + i) % n].get();
+        WorkStealingQueue<ScheduleTask>* queue = victim->queues[priority].get();
+        if (queue->empty()) {
+            continue;
+        }
+        ScheduleTask* task = queue->steal();
+        if (!task) {
+            continue;
+        }
+        ++worker->stolen;
+        return task;
+    }
+    return nullptr;
+}
+
+bool Scheduler::InInlineTask() {
+    return t_inline_task;
+}
+
+bool Scheduler::InSchedulerContext() {
+    return t_inline_task || t_in_idle
+        || (t_scheduler_fiber && Fiber::GetThis().get() == t_scheduler_fiber);
+}
+
+void Scheduler::scheduleInline(std::function<void()> cb, int thread) {
+    if (!cb) {
+        return;
+    }
+    ScheduleTask* task = new ScheduleTask(cb, thread);
+    task->inlined = true;
+    if (enqueue(task)) {
+        tickle();
+    }
+}
+
+void Scheduler::scheduleInlineBatch(const std::vector<std::function<void()> >& cbs, int thread) {
+    std::vector<ScheduleTask*> tasks;
+    tasks.reserve(cbs.size());
+    for (auto& i : cbs) {
+        ScheduleTask* task = NewTask(i, thread, 0, NORMAL);
+        if (task) {
+            task->inlined = true;
+            tasks.push_back(task);
+        }
+    }
+    enqueueBatch(tasks);
+}
+
+const char* Scheduler::PriorityToString(Priority priority) {
+    switch (priority) {
+        case HIGH:
+            return "high";
+        case NORMAL:
+            return "normal";
+        case BACKGROUND:
+            return "background";
+        default:
+            return "unknown";
+    }
+}
+
+void Scheduler::getLaneStats(std::vector<LaneStats>& stats) {
+    stats.clear();
+    for (int p = 0; p < PRIORITY_COUNT; p++) {
+        LaneStats s;
+        s.priority = (Priority)p;
+        s.depth = m_laneTaskCount[p];
+        HistogramSnapshot hist;
+        size_t n = m_workerCount;
+        for (size_t w = 0; w < n; w++) {
+            m_workers[w]->waitHist[p].snapshot(hist);
+        }
+        s.dequeued = hist.count;
+        s.avgWaitUs = hist.mean();
+        s.maxWaitUs = hist.max;
+        s.p50WaitUs = hist.percentile(0.5);
+        s.p99WaitUs = hist.percentile(0.99);
+        stats.push_back(s);
+    }
+}
+
+bool Scheduler::isWorkerThread() const {
+    WorkerContext* worker = t_worker;
+    return worker && worker->scheduler == this;
+}
+
+void Scheduler::recordTickle() {
+    WorkerContext* worker = t_worker;
+    if (worker && worker->scheduler == this) {
+        worker->tickles.store(worker->tickles.load(std::memory_order_relaxed) + 1,
+                              std::memory_order_relaxed);
+    } else {
+        ++m_externalTickles;
+    }
+}
+
+void Scheduler::recordPoll(int events) {
+    WorkerContext* worker = t_worker;
+    if (worker && worker->scheduler == this) {
+        worker->pollHist.record(events > 0 ? events : 0);
+    }
+}
+
+void Scheduler::getStats(Stats& stats) {
+    stats = Stats();
+    stats.id = m_id;
+    stats.name = m_name;
+    stats.threads = m_liveWorkers;
+    stats.idleThreads = m_idleThreadCount;
+    stats.queueDepth = m_taskCount;
+    stats.tickles = m_externalTickles;
+    uint64_t now = GetElapsedUS();
+    size_t n = m_workerCount;
+    for (size_t w = 0; w < n; w++) {
+        // 退出的弹性线程的上下文保留着，它的累计值仍然计入
+        WorkerContext* i = m_workers[w].get();
+        for (int p = 0; p < PRIORITY_COUNT; p++) {
+            i->waitHist[p].snapshot(stats.waitUs);
+        }
+        i->runHist.snapshot(stats.runUs);
+        i->pollHist.snapshot(stats.pollEvents);
+        stats.idleUs += i->idleUs.load(std::memory_order_relaxed);
+        // 正在idle的线程加上这次已经idle的时间
+        uint64_t since = i->idleSinceUs.load(std::memory_order_relaxed);
+        if (since && now > since) {
+            stats.idleUs += now - since;
+        }
+        stats.tickles += i->tickles.load(std::memory_order_relaxed);
+    }
+}
+
+void Scheduler::GetAllStats(std::vector<Stats>& stats) {
+    stats.clear();
+    Mutex::Lock lock(GetSchedulersMutex());
+    for (auto sc : GetSchedulers()) {
+        stats.push_back(Stats());
+        sc->getStats(stats.back());
+    }
+}
+
+double Scheduler::Stats::idleRatio() const {
+    uint64_t total = idleUs + runUs.sum;
+    return total ? (double)idleUs / total : 1.0;
+}
+
+void Scheduler::Stats::subtract(const Stats& prev) {
+    tickles = tickles > prev.tickles ? tickles - prev.tickles : 0;
+    idleUs = idleUs > prev.idleUs ? idleUs - prev.idleUs : 0;
+    waitUs.subtract(prev.waitUs);
+    runUs.subtract(prev.runUs);
+    pollEvents.subtract(prev.pollEvents);
+    epollCtls = epollCtls > prev.epollCtls ? epollCtls - prev.epollCtls : 0;
+}
+
+std::string Scheduler::Stats::toString() const {
+    std::stringstream ss;
+    ss << "scheduler=" << name << " threads=" << threads << " idle_threads=" << idleThreads
+       << " queue=" << queueDepth << " idle_ratio=" << (int)(idleRatio() * 1000) / 10.0 << "%"
+       << " tickles=" << tickles
+       << " wait_us{" << waitUs.toString() << "}"
+       << " run_us{" << runUs.toString() << "}";
+    if (pollEvents.count) {
+        ss << " polls=" << pollEvents.count << " events_per_poll{" << pollEvents.toString() << "}";
+    }
+    if (epollCtls) {
+        ss << " epoll_ctls=" << epollCtls;
+    }
+    ss << " pending_events=" << pendingEvents;
+    return ss.str();
+}
+
+void Scheduler::GetRunningTasks(std::vector<RunningTask>& tasks) {
+    tasks.clear();
+    Mutex::Lock lock(GetSchedulersMutex());
+    for (auto sc : GetSchedulers()) {
+        size_t n = sc->m_workerCount;
+        for (size_t i = 0; i < n; i++) {
+            WorkerContext* worker = sc->m_workers[i].get();
+            // 先读开始时间，为0说明没有在执行任务
+            uint64_t start_us = worker->taskStartUs.load(std::memory_order_acquire);
+            int thread = worker->thread;
+            if (!start_us || thread == -1) {
+                continue;
+            }
+            RunningTask task;
+            task.scheduler = sc->m_name;
+            task.thread = thread;
+            task.fiberId = worker->taskFiberId.load(std::memory_order_relaxed);
+            task.startUs = start_us;
+            tasks.push_back(task);
+        }
+    }
+}
+
+void Scheduler::getWorkerStats(std::vector<WorkerStats>& stats) {
+    stats.clear();
+    size_t n = m_workerCount;
+    for (size_t w = 0; w < n; w++) {
+        WorkerContext* i = m_workers[w].get();
+        // 还没有进入run或者已经退出的线程
+        if (!i->scheduler || i->thread == -1) {
+            continue;
+        }
+        WorkerStats s;
+        s.thread = i->thread;
+        s.reused = i->reusedFibers;
+        s.allocated = i->allocatedFibers;
+        s.stolen = i->stolen;
+        s.overflowed = i->overflowed;
+        s.pinned = i->pinned;
+        s.spins = i->spins;
+        s.spinHits = i->spinHits;
+        s.parks = i->parks;
+        s.spinUs = i->spinUs;
+        s.spinBudgetUs = i->spinBudgetUs;
+        stats.push_back(s);
+    }
+}
+
 }
\ No newline at end of file
@@ -5,22 +5,160 @@
 #include <list>
 #include <memory>
 #include <string>
+#include <vector>
+#include <deque>
+#include <set>
+#include <pthread.h>
+#include "affinity.h"
 #include "fiber.h"
+#include "histogram.h"
 #include "log.h"
+#include "mutex.h"
 #include "thread.h"
+#include "work_stealing_queue.h"
 
 namespace sylar{
 
 /**
  * @brief 协程调度器
  * @details 封装的是N-M的协程调度器
- *          内部有一个线程池,支持协程在线程池里面切换
+ *          内部有一个线程池,支持协程在线程池里面切换。
+ *          每个调度线程有一个本地任务队列，调度线程自己添加的任务放入本地队列，空闲的调度线程从其他线程的本地队列窃取任务；
+ *          指定了线程的任务放入该线程的收件箱，只唤醒该线程；其他线程添加的任务放入全局队列。
+ *          任务分为高、普通、后台三个优先级，每个队列按优先级分车道，调度时按优先级取任务。
+ *          线程数可以在[min, max]之间伸缩，任务等待太久时增加线程，增加的线程空闲一段时间后退出
  */
 class Scheduler{
 public:
     typedef std::shared_ptr<Scheduler> ptr;
     typedef Mutex MutexType;
 
+    /**
+     * @brief 任务优先级
+     * @details 调度时先取高优先级的任务，低优先级的车道隔一段时间优先一次，不会饿死
+     */
+    enum Priority {
+        /// 延迟敏感的任务，比如IO事件唤醒的协程
+        HIGH = 0,
+        /// 普通任务
+        NORMAL = 1,
+        /// 后台任务，比如日志刷盘、缓存刷新
+        BACKGROUND = 2,
+        /// 优先级数量
+        PRIORITY_COUNT = 3
+    };
+
+    /**
+     * @brief 单个优先级车道的统计
+     * @details 等待时间是任务从入队到开始执行的时间，分位数由LatencyHistogram统计：
+     *          每个2的幂区间再分8个子桶，相对误差不超过1/8
+     */
+    struct LaneStats {
+        /// 优先级
+        Priority priority = NORMAL;
+        /// 当前排队的任务数
+        size_t depth = 0;
+        /// 已经开始执行的任务数
+        uint64_t dequeued = 0;
+        /// 平均等待时间(微秒)
+        uint64_t avgWaitUs = 0;
+        /// 最大等待时间(微秒)
+        uint64_t maxWaitUs = 0;
+        /// 等待时间的p50(微秒)
+        uint64_t p50WaitUs = 0;
+        /// 等待时间的p99(微秒)
+        uint64_t p99WaitUs = 0;
+    };
+
+    /**
+     * @brief 单个调度线程的统计
+     */
+    struct WorkerStats {
+        /// 线程id
+        int thread = -1;
+        /// 复用已结束的协程执行回调任务的次数
+        uint64_t reused = 0;
+        /// 新创建协程执行回调任务的次数
+        uint64_t allocated = 0;
+        /// 从其他线程的本地队列窃取的任务数
+        uint64_t stolen = 0;
+        /// 本地队列满了，放入全局队列的任务数
+        uint64_t overflowed = 0;
+        /// 从收件箱取出的指定了本线程的任务数
+        uint64_t pinned = 0;
+        /// 进入idle后自旋等待任务的次数
+        uint64_t spins = 0;
+        /// 自旋期间等到了任务或IO事件的次数
+        uint64_t spinHits = 0;
+        /// 阻塞等待的次数
+        uint64_t parks = 0;
+        /// 自旋的总时间(微秒)
+        uint64_t spinUs = 0;
+        /// 当前的自旋时间预算(微秒)
+        uint64_t spinBudgetUs = 0;
+    };
+
+    /**
+     * @brief 调度线程上正在执行的任务
+     */
+    struct RunningTask {
+        /// 调度器名称
+        std::string scheduler;
+        /// 线程id
+        int thread = -1;
+        /// 执行任务的协程id，inline任务为0
+        uint64_t fiberId = 0;
+        /// 开始执行的时间(微秒)，GetElapsedUS的时间
+        uint64_t startUs = 0;
+    };
+
+    /**
+     * @brief 调度器的运行时统计
+     * @details 读取时汇总每个调度线程的计数器和直方图，计数器和直方图都是累计值，
+     *          两次读取之间的统计用subtract计算。时间单位都是微秒
+     */
+    struct Stats {
+        /// 调度器id，进程内唯一
+        uint64_t id = 0;
+        /// 调度器名称
+        std::string name;
+        /// 调度线程数
+        size_t threads = 0;
+        /// 处于idle的调度线程数
+        size_t idleThreads = 0;
+        /// 排队的任务数
+        size_t queueDepth = 0;
+        /// 发出的唤醒通知数，写pipe、发唤醒信号或unpark
+        uint64_t tickles = 0;
+        /// 调度线程处于idle的总时间
+        uint64_t idleUs = 0;
+        /// 任务从入队到开始执行的等待时间
+        HistogramSnapshot waitUs;
+        /// 任务每次执行(resume到yield或结束)的时间，count是执行次数，sum是忙碌的总时间
+        HistogramSnapshot runUs;
+        /// 每次从epoll_wait返回的事件数，count是epoll_wait返回的次数，只有IOManager有
+        HistogramSnapshot pollEvents;
+        /// 等待触发的IO事件数，只有IOManager有
+        size_t pendingEvents = 0;
+        /// epoll_ctl调用次数，只有epoll后端的IOManager有
+        uint64_t epollCtls = 0;
+
+        /**
+         * @brief 空闲时间占比，idle时间/(idle时间+执行任务的时间)
+         */
+        double idleRatio() const;
+
+        /**
+         * @brief 减去同一个调度器之前的统计，得到两次读取之间的统计，瞬时值保持不变
+         */
+        void subtract(const Stats& prev);
+
+        /**
+         * @brief 格式化为一行
+         */
+        std::string toString() const;
+    };
+
      /**
      * @brief 创建调度器
      * @param[in] threads 线程数
@@ -29,6 +167,15 @@ public:
      */
     Scheduler(size_t threads = 1, bool use_caller = true, const std::string& name = "Scheduler");
 
+    /**
+     * @brief 创建调度器，调度线程绑定到指定的CPU，不读取scheduler.affinity
+     * @param[in] threads 线程数
+     * @param[in] use_caller 是否将当前线程也作为调度线程
+     * @param[in] name 名称
+     * @param[in] cpus 调度线程可以运行的CPU，为空时按scheduler.affinity放置
+     */
+    Scheduler(size_t threads, bool use_caller, const std::string& name, const std::vector<int>& cpus);
+
     /**
      * @brief 析构函数
      */
@@ -39,6 +186,43 @@ public:
      */
     const std::string& getName() const { return m_name;}
 
+    /**
+     * @brief 设置线程数范围，线程数包含use_caller的线程
+     * @details 构造时创建的线程常驻，不会退出，指定这些线程的任务和use_caller的行为不变。
+     *          任务的等待时间超过scheduler.grow_wait_us时增加线程，最多到max；增加的线程空闲超过
+     *          scheduler.retire_idle_ms后退出，最少留min个，退出时指定了该线程的任务改为任意线程执行。
+     *          min大于当前线程数时，启动后立即补足。scheduler.thread_range修改时会重新设置
+     * @param[in] min 最小线程数
+     * @param[in] max 最大线程数
+     */
+    void setThreadRange(size_t min, size_t max);
+
+    /**
+     * @brief 最小线程数
+     */
+    size_t getMinThreads() const { return m_minThreads;}
+
+    /**
+     * @brief 最大线程数
+     */
+    size_t getMaxThreads() const { return m_maxThreads;}
+
+    /**
+     * @brief 当前的调度线程数，包含use_caller的线程
+     */
+    size_t getThreadCount() const { return m_liveWorkers;}
+
+    /**
+     * @brief 设置回调任务的协程是否运行在共享栈上
+     * @details 适合大量挂起等待IO的连接，共享栈协程一旦开始运行就固定在一个线程上调度
+     */
+    void setSharedStack(bool v) { m_sharedStack = v;}
+
+    /**
+     * @brief 回调任务的协程是否运行在共享栈上
+     */
+    bool isSharedStack() const { return m_sharedStack;}
+
     /**
      * @brief 获取当前线程调度器指针
      */
@@ -59,30 +243,185 @@ public:
      */
     void stop();
 
+    /**
+     * @brief 当前线程是否正在调度协程上直接执行inline任务
+     */
+    static bool InInlineTask();
+
+    /**
+     * @brief 当前是否运行在调度协程、idle协程或inline任务上，这些地方不能挂起等待
+     */
+    static bool InSchedulerContext();
+
+    /**
+     * @brief 获取每个调度线程的统计
+     * @param[out] stats 每个已经开始运行的调度线程一项
+     */
+    void getWorkerStats(std::vector<WorkerStats>& stats);
+
+    /**
+     * @brief 获取每个优先级车道的统计
+     * @param[out] stats 每个优先级一项，按优先级从高到低
+     */
+    void getLaneStats(std::vector<LaneStats>& stats);
+
+    /**
+     * @brief 获取运行时统计
+     * @details 每个调度线程的计数只由该线程写入，读取时汇总，不影响调度
+     */
+    virtual void getStats(Stats& stats);
+
+    /**
+     * @brief 获取所有存活的调度器的运行时统计
+     * @param[out] stats 每个调度器一项
+     */
+    static void GetAllStats(std::vector<Stats>& stats);
+
+    /**
+     * @brief 优先级的名称
+     */
+    static const char* PriorityToString(Priority priority);
+
+    /**
+     * @brief 获取所有存活的调度器中正在执行的任务，用于检查执行太久的协程
+     * @param[out] tasks 每个正在执行任务的调度线程一项
+     */
+    static void GetRunningTasks(std::vector<RunningTask>& tasks);
+
     /**
      * @brief 添加调度任务
      * @tparam FiberOrCb 调度任务类型，可以是协程对象或函数指针
      * @param[] fc 协程对象或指针
      * @param[] thread 指定运行该任务的线程号，-1表示任意线程
+     * @param[] stacksize 回调任务的协程栈大小，0表示使用fiber.stack_size，只对函数任务有效。
+     *                    调用很浅的回调可以指定16~32KB的小栈
+     * @param[] priority 优先级
      */
     template <class FiberOrCb>
-    void schedule(FiberOrCb fc, int thread = -1) {
-        bool need_tickle = false;
-        {
-            MutexType::Lock lock(m_mutex);
-            need_tickle = scheduleNoLock(fc, thread);
-        }
-        if(need_tickle){
+    void schedule(FiberOrCb fc, int thread = -1, size_t stacksize = 0, Priority priority = NORMAL) {
+        ScheduleTask* task = NewTask(fc, thread, stacksize, priority);
+        if (task && enqueue(task)) {
             tickle();
         }
     }
+
+    /**
+     * @brief 批量添加调度任务
+     * @details 全局队列和每个目标线程的收件箱各只加一次锁，按新任务数唤醒空闲线程，
+     *          适合一次epoll返回大量就绪事件或大量定时器同时超时的场景
+     * @param[] begin 协程对象或函数的迭代器起始
+     * @param[] end 迭代器结束
+     * @param[] thread 指定运行这些任务的线程号，-1表示任意线程
+     * @param[] priority 优先级
+     */
+    template <class InputIterator>
+    void scheduleBatch(InputIterator begin, InputIterator end, int thread = -1, Priority priority = NORMAL) {
+        std::vector<ScheduleTask*> tasks;
+        for (; begin != end; ++begin) {
+            ScheduleTask* task = NewTask(*begin, thread, 0, priority);
+            if (task) {
+                tasks.push_back(task);
+            }
+        }
+        enqueueBatch(tasks);
+    }
+
+    /**
+     * @brief 添加一个不会阻塞的回调任务，在调度协程上直接执行
+     * @details 不为回调创建协程，省掉协程的创建和两次切换，适合定时器回调这类很短的任务。
+     *          回调里不能yield，也不能调用会挂起协程的hook函数，debug模式下会断言
+     * @param[] cb 回调函数
+     * @param[] thread 指定运行该任务的线程号，-1表示任意线程
+     */
+    void scheduleInline(std::function<void()> cb, int thread = -1);
+
+    /**
+     * @brief 批量添加不会阻塞的回调任务，在调度协程上直接执行
+     * @param[] cbs 回调函数
+     * @param[] thread 指定运行这些任务的线程号，-1表示任意线程
+     */
+    void scheduleInlineBatch(const std::vector<std::function<void()> >& cbs, int thread = -1);
   
 protected:
     /**
      * @brief 通知协程调度器有任务了
+     * @details 默认实现唤醒一个阻塞在idle中的调度线程
      */
     virtual void tickle();
 
+    /**
+     * @brief 唤醒一个处于idle的调度线程
+     * @details 指定了线程的任务放入收件箱后调用，只通知目标线程。默认实现唤醒目标线程的停车位
+     * @param[in] handle 目标线程的pthread句柄
+     */
+    virtual void wakeWorker(pthread_t handle);
+
+    /**
+     * @brief 记录一次发出的唤醒通知
+     */
+    void recordTickle();
+
+    /**
+     * @brief 记录一次epoll_wait返回，只能在调度线程上调用
+     * @param[in] events 返回的事件数
+     */
+    void recordPoll(int events);
+
+    /**
+     * @brief 开始自旋等待新任务
+     * @details 子类的idle在阻塞之前调用。自旋的线程不会被tickle和wakeWorker唤醒，
+     *          同时自旋的线程不超过调度线程数的一半，scheduler.spin_us为0或者正在停止时不自旋
+     * @param[out] budget_us 本次自旋的时间预算(微秒)
+     * @return 是否可以自旋
+     */
+    bool beginSpin(uint64_t& budget_us);
+
+    /**
+     * @brief 结束自旋，按是否等到了任务调整下次的自旋预算
+     * @details 等到了预算翻倍，没等到预算减半，在scheduler.spin_us的1/16到1倍之间调整。
+     *          结束自旋之后调用方要再检查一次hasRunnableWork再阻塞，否则可能错过自旋期间跳过的唤醒
+     * @param[in] hit 自旋期间是否等到了任务或IO事件
+     * @param[in] spent_us 自旋的时间(微秒)
+     */
+    void endSpin(bool hit, uint64_t spent_us);
+
+    /**
+     * @brief 是否有当前线程可以执行的任务，自旋时检查
+     * @details 包括当前线程的收件箱和本地队列、全局队列，以及其他线程可以窃取的本地队列
+     */
+    bool hasRunnableWork() const;
+
+    /**
+     * @brief 是否有线程正在自旋等待任务
+     */
+    bool hasSpinningThreads() const { return m_spinningCount > 0;}
+
+    /**
+     * @brief 当前调度线程是否应该退出
+     * @details 子类的idle在每次阻塞之前检查，返回true时idle协程应该结束，调度线程随后退出。
+     *          只有弹性增加、没有用过共享栈的线程，空闲超过scheduler.retire_idle_ms，
+     *          并且线程数多于最小线程数时才会退出
+     * @param[out] wait_ms 不退出时，距离可以退出还有多少毫秒，子类阻塞的时间不应超过这个值
+     */
+    bool shouldRetire(uint64_t* wait_ms = nullptr);
+
+    /**
+     * @brief 当前调度线程的收件箱或本地队列里是否有任务
+     * @details 子类的idle在阻塞之前检查，避免入队和进入idle之间的唤醒丢失
+     */
+    bool hasPendingWork() const;
+
+    /**
+     * @brief 当前线程是否是本调度器的调度线程
+     */
+    bool isWorkerThread() const;
+
+    /**
+     * @brief 调度线程每次取任务之前调用
+     * @details 默认什么也不做，子类可以在这里批量提交上一个任务积攒的请求
+     */
+    virtual void beforeDispatch() {}
+
      /**
      * @brief 协程调度函数
      */
@@ -95,6 +434,7 @@ protected:
 
      /**
      * @brief 无任务调度时执行idle协程
+     * @details 默认实现阻塞在当前调度线程的停车位上，直到tickle/wakeWorker唤醒，空闲时不占用CPU
      */
     virtual void idle();
 
@@ -109,22 +449,6 @@ protected:
      */
     bool hasIdleThreads() { return m_idleThreadCount > 0;}
 
-private:
-     /**
-     * @brief 添加调度任务，无锁
-     * @tparam FiberOrCb 调度任务类型，可以是协程对象或函数指针
-     * @param[] fc 协程对象或指针
-     * @param[] thread 指定运行该任务的线程号，-1表示任意线程
-     */
-    template<class FiberOrCb>
-    bool scheduleNoLock(FiberOrCb fc, int thread) {
-        bool need_tickle = m_tasks.empty();
-        ScheduleTask task(fc, thread);
-        if (task.fiber || task.cb) {
-            m_tasks.push_back(task);
-        }
-        return need_tickle;
-    }
 private:
 
     /**
@@ -134,6 +458,14 @@ private:
         Fiber::ptr fiber;
         std::function<void()> cb;
         int thread;
+        /// 回调是否在调度协程上直接执行
+        bool inlined = false;
+        /// 回调任务的协程栈大小，0表示默认大小
+        size_t stacksize = 0;
+        /// 优先级
+        Priority priority = NORMAL;
+        /// 入队时间(微秒)
+        uint64_t enqueueUs = 0;
 
         ScheduleTask(Fiber::ptr f, int thr) {
             fiber  = f;
@@ -153,32 +485,326 @@ private:
             fiber = nullptr;
             cb = nullptr;
             thread = -1;
+            inlined = false;
+            stacksize = 0;
+            priority = NORMAL;
+            enqueueUs = 0;
         }
 
     };
 
+    /**
+     * @brief 调度线程上下文，每个执行run的线程一份
+     */
+    struct WorkerContext {
+        typedef std::shared_ptr<WorkerContext> ptr;
+
+        WorkerContext(size_t idx, size_t queue_size)
+            :index(idx) {
+            for (int i = 0; i < PRIORITY_COUNT; i++) {
+                queues[i].reset(new WorkStealingQueue<ScheduleTask>(queue_size));
+            }
+        }
+
+        /**
+         * @brief 本地队列是否都为空
+         */
+        bool localEmpty() const {
+            for (int i = 0; i < PRIORITY_COUNT; i++) {
+                if (!queues[i]->empty()) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        /**
+         * @brief 记录开始执行任务，只由所属线程调用
+         * @param[in] fiber_id 执行任务的协程id
+         */
+        void beginTask(uint64_t fiber_id) {
+            taskFiberId.store(fiber_id, std::memory_order_relaxed);
+            taskStartUs.store(lastTaskUs, std::memory_order_release);
+        }
+
+        /**
+         * @brief 记录任务执行完或者协程yield了，统计这次执行的时间
+         */
+        void endTask() {
+            taskStartUs.store(0, std::memory_order_relaxed);
+            uint64_t now = GetElapsedUS();
+            runHist.record(now > lastTaskUs ? now - lastTaskUs : 0);
+        }
+
+        /**
+         * @brief 记录一个任务的等待时间，只由所属线程调用
+         */
+        void recordWait(Priority priority, uint64_t us) {
+            waitHist[priority].record(us);
+        }
+
+        /// 在m_workers中的下标
+        size_t index;
+        /// 线程id，进入run之前为-1
+        std::atomic<int> thread{-1};
+        /// 线程句柄，用于唤醒指定线程
+        pthread_t handle;
+        /// 是否在idle协程中
+        std::atomic<bool> idle{false};
+        /// 基础调度器的idle协程在这里阻塞，tickle和wakeWorker唤醒
+        Parker parker;
+        /// 是否正在自旋等待任务
+        std::atomic<bool> spinning{false};
+        /// 是否是弹性增加的线程，只有这样的线程可以退出
+        bool elastic = false;
+        /// 是否已经决定退出
+        std::atomic<bool> retiring{false};
+        /// 是否已经退出，由inboxMutex保护，退出后不再接收收件箱任务
+        bool retired = false;
+        /// 最近一次取到任务的时间(微秒)，只由所属线程访问
+        uint64_t lastTaskUs = 0;
+        /// 正在执行的任务的开始时间(微秒)，没有执行任务时为0
+        std::atomic<uint64_t> taskStartUs{0};
+        /// 正在执行任务的协程id
+        std::atomic<uint64_t> taskFiberId{0};
+        /// 当前的自旋时间预算(微秒)，只由所属线程修改
+        std::atomic<uint64_t> spinBudgetUs{0};
+        /// 自旋次数
+        std::atomic<uint64_t> spins{0};
+        /// 自旋期间等到任务的次数
+        std::atomic<uint64_t> spinHits{0};
+        /// 阻塞等待的次数
+        std::atomic<uint64_t> parks{0};
+        /// 自旋的总时间(微秒)
+        std::atomic<uint64_t> spinUs{0};
+        /// 所属的调度器
+        Scheduler* scheduler = nullptr;
+        /// 每个优先级的本地任务队列
+        std::unique_ptr<WorkStealingQueue<ScheduleTask> > queues[PRIORITY_COUNT];
+        /// 保护收件箱
+        Spinlock inboxMutex;
+        /// 每个优先级的收件箱，指定了本线程的任务，任何线程都可以放入，只由所属线程取出
+        std::deque<ScheduleTask*> inbox[PRIORITY_COUNT];
+        /// 收件箱中所有优先级的任务数，为0时不需要加锁
+        std::atomic<size_t> inboxSize{0};
+        /// 从收件箱取出的任务数
+        std::atomic<uint64_t> pinned{0};
+        /// 从其他线程窃取的任务数
+        std::atomic<uint64_t> stolen{0};
+        /// 本地队列满了放入全局队列的任务数
+        std::atomic<uint64_t> overflowed{0};
+        /// 已结束、可以复用的回调协程，只由所属线程访问
+        std::vector<Fiber::ptr> freeFibers;
+        /// 复用协程执行回调任务的次数
+        std::atomic<uint64_t> reusedFibers{0};
+        /// 新创建协程执行回调任务的次数
+        std::atomic<uint64_t> allocatedFibers{0};
+        /// 每个优先级的等待时间直方图
+        LatencyHistogram waitHist[PRIORITY_COUNT];
+        /// 任务每次执行的时间直方图
+        LatencyHistogram runHist;
+        /// 每次epoll_wait返回的事件数直方图
+        LatencyHistogram pollHist;
+        /// 处于idle的总时间(微秒)，只由所属线程修改
+        std::atomic<uint64_t> idleUs{0};
+        /// 这次进入idle的时间(微秒)，不在idle时为0
+        std::atomic<uint64_t> idleSinceUs{0};
+        /// 这个线程发出的唤醒通知数，只由所属线程修改
+        std::atomic<uint64_t> tickles{0};
+    };
+
+    /**
+     * @brief 创建调度任务
+     * @return 协程和回调都为空时返回nullptr
+     */
+    template <class FiberOrCb>
+    static ScheduleTask* NewTask(FiberOrCb fc, int thread, size_t stacksize, Priority priority) {
+        ScheduleTask* task = new ScheduleTask(fc, thread);
+        if (!task->fiber && !task->cb) {
+            delete task;
+            return nullptr;
+        }
+        if (task->fiber && task->thread == -1) {
+            // 共享栈协程的栈内容在绑定的线程的共享栈上，只能回到那个线程运行
+            task->thread = task->fiber->getBoundThread();
+        }
+        task->stacksize = stacksize;
+        task->priority = priority;
+        return task;
+    }
+
+    /**
+     * @brief 添加任务到队列
+     * @details 调度线程自己添加的未指定线程的任务放入本地队列；指定了线程的任务放入该线程的收件箱，
+     *          并且只唤醒该线程；其他情况放入全局队列
+     * @return 是否需要tickle
+     */
+    bool enqueue(ScheduleTask* task);
+
+    /**
+     * @brief 批量添加任务到队列，放入的位置和enqueue相同
+     * @details 全局队列和每个收件箱各加一次锁，最多唤醒和新任务数一样多的空闲线程
+     */
+    void enqueueBatch(std::vector<ScheduleTask*>& tasks);
+
+    /**
+     * @brief 唤醒除当前线程外处于idle的调度线程
+     * @param[in] max 最多唤醒的线程数
+     * @return 唤醒的线程数
+     */
+    size_t wakeIdleWorkers(size_t max = (size_t)-1);
+
+    /**
+     * @brief 根据线程id查找已经进入run的调度线程
+     * @return 没有找到返回nullptr
+     */
+    WorkerContext* findWorker(int thread) const;
+
+    /**
+     * @brief 按优先级取出一个可以在当前线程运行的任务
+     * @param[in] tick 当前线程的调度次数，用于决定车道和队列的检查顺序
+     * @param[out] tickle_me 是否需要通知其他线程
+     */
+    ScheduleTask* nextTask(WorkerContext* worker, uint32_t tick, bool& tickle_me);
+
+    /**
+     * @brief 从当前线程的收件箱取出一个任务
+     */
+    ScheduleTask* takeInbox(WorkerContext* worker, Priority priority);
+
+    /**
+     * @brief 从当前线程的本地队列取出一个任务
+     */
+    ScheduleTask* takeLocal(WorkerContext* worker, Priority priority);
+
+    /**
+     * @brief 放入目标线程的收件箱
+     * @return 目标线程已经退出时返回false，任务没有放入
+     */
+    bool pushInbox(WorkerContext* target, ScheduleTask* task);
+
+    /**
+     * @brief 放入全局队列，调用方持有m_mutex
+     * @details 指定了已退出线程的任务改为任意线程执行
+     */
+    void pushGlobalLocked(ScheduleTask* task);
+
+    /**
+     * @brief 从全局队列中取出一个可以在当前线程运行的任务
+     * @details 指定了线程的任务只有在目标线程还没有进入run时才会放入全局队列
+     * @param[out] tickle_me 全局队列中是否还有其他任务需要通知其他线程
+     */
+    ScheduleTask* takeGlobal(Priority priority, bool& tickle_me);
+
+    /**
+     * @brief 从其他调度线程的本地队列窃取一个任务
+     */
+    ScheduleTask* steal(WorkerContext* worker, Priority priority);
+
+    /**
+     * @brief 在调度线程上运行一个协程
+     * @details 协程运行期间被唤醒的任务先记在协程上，resume返回、协程的上下文保存好之后再放入队列，
+     *          其他线程不会取到一个还没有切出的协程
+     */
+    static void RunFiber(Fiber* fiber);
+
+    /**
+     * @brief 协程还在调度线程上运行时，把唤醒它的任务推迟到它切出之后入队
+     * @return 推迟了返回true，任务由RunFiber放入队列
+     */
+    bool deferWake(ScheduleTask* task);
+
+    /**
+     * @brief 调度线程的主循环
+     * @param[in] worker 调度线程上下文
+     */
+    void runWorker(WorkerContext* worker);
+
+    /**
+     * @brief 任务等待太久时增加一个调度线程
+     * @details 有空闲线程或者队列中没有其他任务时不增加，每个scheduler.grow_wait_us的时间内最多增加一个
+     * @param[in] now 当前时间(微秒)
+     */
+    void maybeGrow(uint64_t now);
+
+    /**
+     * @brief 增加一个弹性调度线程
+     * @return 已经停止、线程数已达到上限或没有空闲的上下文时返回false
+     */
+    bool addWorker();
+
+    /**
+     * @brief 调度线程退出，把收件箱和本地队列里剩下的任务放回全局队列，并归还上下文
+     */
+    void retire(WorkerContext* worker);
+
 private:
+    /// 当前线程的调度线程上下文
+    static thread_local WorkerContext* t_worker;
+
     MutexType m_mutex;
     /// 线程池
     std::vector<Thread::ptr> m_threads;
-    /// 任务队列
-    std::list<ScheduleTask> m_tasks;
+    /// 每个优先级的全局任务队列
+    std::list<ScheduleTask*> m_tasks[PRIORITY_COUNT];
+    /// 每个优先级全局队列中的任务数，为0时不需要加锁检查全局队列
+    std::atomic<size_t> m_globalTaskCount[PRIORITY_COUNT];
+    /// 每个优先级所有队列中的任务数
+    std::atomic<size_t> m_laneTaskCount[PRIORITY_COUNT];
+    /// 所有队列中的任务总数
+    std::atomic<size_t> m_taskCount = {0};
     /// use_caller为true时有效, 调度协程
     Fiber::ptr m_rootFiber;
     /// 协程调度器名称
     std::string m_name;
     /// 线程池的线程ID数组
     std::vector<int> m_threadIds;
+    /// 调度线程上下文，大小固定，前m_workerCount个有效。常驻线程的上下文构造时创建，线程进入run时领取一个
+    std::vector<WorkerContext::ptr> m_workers;
+    /// 已经创建的调度线程上下文数量，只增不减，遍历m_workers时以此为准
+    std::atomic<size_t> m_workerCount = {0};
+    /// 弹性线程退出后可以复用的上下文下标，由m_threadMutex保护
+    std::vector<size_t> m_freeWorkers;
+    /// 保护线程池的创建、增加和回收
+    MutexType m_threadMutex;
+    /// 已经退出、等待join的弹性线程
+    std::vector<Thread::ptr> m_retiredThreads;
+    /// 已经退出的弹性线程id，由m_mutex保护
+    std::set<int> m_retiredThreadIds;
+    /// 最小线程数
+    std::atomic<size_t> m_minThreads = {0};
+    /// 最大线程数
+    std::atomic<size_t> m_maxThreads = {0};
+    /// 当前的调度线程数，包含use_caller的线程
+    std::atomic<size_t> m_liveWorkers = {0};
+    /// 最近一次增加线程的时间(微秒)
+    std::atomic<uint64_t> m_lastGrowUs = {0};
+    /// 是否已经启动，由m_threadMutex保护
+    bool m_started = false;
+    /// 调度线程的放置策略，启动时读取
+    AffinityPolicy m_affinity{""};
+    /// 构造时指定的调度线程CPU，不为空时代替scheduler.affinity
+    std::vector<int> m_cpus;
+    /// 下一个要领取的调度线程上下文
+    std::atomic<size_t> m_nextWorker = {0};
     /// 工作线程数量，不包含use_caller的主线程
     size_t m_threadCount = 0;
     /// 活跃线程数
     std::atomic<size_t> m_activeThreadCount = {0};
     /// 空闲线程数量
     std::atomic<size_t> m_idleThreadCount = {0};
+    /// 正在自旋等待任务的线程数量
+    std::atomic<size_t> m_spinningCount = {0};
+    /// 非调度线程发出的唤醒通知数
+    std::atomic<uint64_t> m_externalTickles = {0};
+    /// 调度器id
+    uint64_t m_id = 0;
     /// 是否use caller
     bool m_useCaller;
     /// 是否正在停止
-    bool m_stopping = false;
+    std::atomic<bool> m_stopping = {false};
+    /// 回调任务的协程是否运行在共享栈上
+    bool m_sharedStack = false;
     ///use_caller为true时，调度器所在线程的id
     int m_rootThread = 0;
 
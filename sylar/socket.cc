@@ -93,7 +93,7 @@ Socket::~Socket() {
 }
 
 int64_t Socket::getSendTimeout() {
-    FdCtx::ptr ctx = FdMgr::GetInstance()->get(m_sock);
+    FdCtx* ctx = FdMgr::GetInstance()->get(m_sock);
     if (ctx) {
         return ctx->getTimeout(SO_SNDTIMEO);
     }
@@ -108,7 +108,7 @@ void Socket::setSendTimeout(int64_t v) {
 }
 
 int64_t Socket::getRecvTimeout() {
-    FdCtx::ptr ctx = FdMgr::GetInstance()->get(m_sock);
+    FdCtx* ctx = FdMgr::GetInstance()->get(m_sock);
     if (ctx) {
         return ctx->getTimeout(SO_RCVTIMEO);
     }
@@ -160,7 +160,7 @@ Socket::ptr Socket::accept() {
 }
 
 bool Socket::init(int sock) {
-    FdCtx::ptr ctx = FdMgr::GetInstance()->get(sock);
+    FdCtx* ctx = FdMgr::GetInstance()->get(sock);
     if (ctx && ctx->isSocket() && !ctx->isClose()) {
         m_sock        = sock;
         m_isConnected = true;//是否连接套接字
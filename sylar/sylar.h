@@ -10,11 +10,21 @@
 #include "env.h"
 #include "config.h"
 #include "thread.h"
+#include "affinity.h"
 #include "fiber.h"
+#include "fiber_sync.h"
+#include "channel.h"
+#include "future.h"
 #include "scheduler.h"
 #include "iomanager.h"
+#include "iomanager_group.h"
+#include "io_uring.h"
 #include "fd_manager.h"
 #include "hook.h"
+#include "watchdog.h"
+#include "offload.h"
+#include "histogram.h"
+#include "metrics.h"
 #include "endian.h"
 #include "address.h"
 #include "socket.h"
@@ -74,7 +74,8 @@ void TcpServer::startAccept(Socket::ptr sock) {
         if(client) {
             //连接成功，添加协程任务打印日志
             client->setRecvTimeout(m_recvTimeout);
-            m_ioWorker->schedule(std::bind(&TcpServer::handleClient,
+            IOManager* worker = m_ioWorkerGroup ? m_ioWorkerGroup->next() : m_ioWorker;
+            worker->schedule(std::bind(&TcpServer::handleClient,
                         shared_from_this(), client));
         } else {
             SYLAR_LOG_ERROR(g_logger) << "accept errno=" << errno
@@ -117,7 +118,7 @@ std::string TcpServer::toString(const std::string& prefix) {
     std::stringstream ss;
     ss << prefix << "[type=" << m_type
        << " name=" << m_name
-       << " io_worker=" << (m_ioWorker ? m_ioWorker->getName() : "")
+       << " io_worker=" << (m_ioWorkerGroup ? m_ioWorkerGroup->getName() : (m_ioWorker ? m_ioWorker->getName() : ""))
        << " accept=" << (m_acceptWorker ? m_acceptWorker->getName() : "")
        << " recv_timeout=" << m_recvTimeout << "]" << std::endl;
     std::string pfx = prefix.empty() ? "    " : prefix;
@@ -5,6 +5,7 @@
 #include <functional>
 #include "address.h"
 #include "iomanager.h"
+#include "iomanager_group.h"
 #include "socket.h"
 #include "noncopyable.h"
 #include "config.h"
@@ -79,6 +80,12 @@ public:
      */
     virtual void setName(const std::string& v) { m_name = v;}
 
+    /**
+     * @brief 设置新连接工作的分片组，设置后新连接按轮转交给一个分片，连接的整个生命周期都在该分片上
+     * @pre 在start之前设置，组的生命周期要长于服务器
+     */
+    void setIOWorkerGroup(IOManagerGroup* v) { m_ioWorkerGroup = v;}
+
     /**
      * @brief 是否停止
      */
@@ -107,6 +114,8 @@ protected:
     IOManager* m_ioWorker;
     /// 服务器Socket接收连接的调度器
     IOManager* m_acceptWorker;
+    /// 新连接工作的分片组，为空时使用m_ioWorker
+    IOManagerGroup* m_ioWorkerGroup = nullptr;
     /// 接收超时时间(毫秒)
     uint64_t m_recvTimeout;
     /// 服务器名称
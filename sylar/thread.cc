@@ -1,12 +1,16 @@
 #include "thread.h"
+#include <errno.h>
 #include "log.h"
 #include "util.h"
+#include "affinity.h"
 
 namespace sylar{
 
 //thread_local每个线程都会有这个变量，线程名称和this
 static thread_local Thread* t_thread = nullptr;
 static thread_local std::string t_thread_name = "UNKNOW";
+//当前线程绑定的NUMA节点
+static thread_local int t_numa_node = -1;
 
 static sylar::Logger::ptr  g_logger = SYLAR_LOG_NAME("system");
 
@@ -34,15 +38,55 @@ Thread::Thread(std::function<void()> cb, const std::string& name)
     if(name.empty()) {
         m_name = "UNKNOW";
     }
-    int rt = pthread_create(&m_thread, nullptr, &Thread::run, this);//若线程创建成功，则返回0。若线程创建失败，则返回出错编号
+    create();
+}
+
+Thread::Thread(std::function<void()> cb, const std::string& name, const std::vector<int>& cpus)
+    :m_cb(cb),m_name(name),m_cpus(cpus){
+    if(name.empty()) {
+        m_name = "UNKNOW";
+    }
+    create();
+}
+
+void Thread::create() {
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    if(!m_cpus.empty()) {
+        //在创建时就绑定CPU，线程栈的第一次访问就发生在目标CPU上
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for(auto cpu : m_cpus) {
+            CPU_SET(cpu, &set);
+        }
+        int rt = pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+        if(rt) {
+            SYLAR_LOG_ERROR(g_logger) << "pthread_attr_setaffinity_np fail, rt=" << rt
+                << " name=" << m_name << " cpus=" << CpuTopology::FormatCpuList(m_cpus);
+            m_cpus.clear();
+        }
+    }
+    int rt = pthread_create(&m_thread, &attr, &Thread::run, this);//若线程创建成功，则返回0。若线程创建失败，则返回出错编号
+    pthread_attr_destroy(&attr);
+    if(rt == EINVAL && !m_cpus.empty()) {
+        //绑定的CPU不可用(比如被cgroup限制)，不绑定CPU再创建一次
+        SYLAR_LOG_ERROR(g_logger) << "pthread_create with cpus=" << CpuTopology::FormatCpuList(m_cpus)
+            << " fail, create without affinity, name=" << m_name;
+        m_cpus.clear();
+        rt = pthread_create(&m_thread, nullptr, &Thread::run, this);
+    }
     if(rt) {
         SYLAR_LOG_ERROR(g_logger) << "pthread_create thread fail, rt =" << rt 
-        << " name=" <<name;
+        << " name=" << m_name;
         throw std::logic_error("pthread_create error");
     }
     //确保线程创建成功之后就跑起来了
     m_semaphore.wait();
 }
+
+int Thread::GetNumaNode() {
+    return t_numa_node;
+}
 Thread::~Thread(){
     if(m_thread){
         //指定该状态，线程主动与主控线程断开关系。线程结束后（不会产生僵尸线程），
@@ -72,6 +116,9 @@ void* Thread::run(void* arg) {
     t_thread = thread;
     t_thread_name = thread->m_name;
     thread->m_id = sylar::GetThreadId();
+    if(!thread->m_cpus.empty()) {
+        t_numa_node = CpuTopologyMgr::GetInstance()->getNodeOf(thread->m_cpus);
+    }
      pthread_setname_np(pthread_self(), thread->m_name.substr(0, 15).c_str());
 
     std::function<void()> cb;
@@ -84,5 +131,45 @@ void* Thread::run(void* arg) {
 
 
 
+}
+
+PeriodicThread::PeriodicThread(const std::string& name, std::function<uint64_t()> cb)
+    :m_name(name), m_cb(cb) {
+}
+
+PeriodicThread::~PeriodicThread() {
+    stop();
+}
+
+bool PeriodicThread::start() {
+    Mutex::Lock lock(m_mutex);
+    if(m_thread) {
+        return false;
+    }
+    m_stopping = false;
+    m_thread.reset(new Thread(std::bind(&PeriodicThread::run, this), m_name));
+    return true;
+}
+
+void PeriodicThread::stop() {
+    //持有锁直到线程退出，并发的start()等停止完成之后再启动新线程
+    Mutex::Lock lock(m_mutex);
+    if(!m_thread) {
+        return;
+    }
+    m_stopping = true;
+    m_parker.unpark();
+    m_thread->join();
+    m_thread.reset();
+}
+
+void PeriodicThread::run() {
+    while(!m_stopping) {
+        uint64_t wait_ms = m_cb();
+        if(m_stopping) {
+            break;
+        }
+        m_parker.park(wait_ms);
+    }
 }
 }
\ No newline at end of file
@@ -2,6 +2,7 @@
 #define __SYLAR_THREAD_H__
 
 #include <string>
+#include <vector>
 #include "mutex.h"
 
 
@@ -22,6 +23,14 @@ public:
      */
     Thread(std::function<void()> cb, const std::string& name);
 
+    /**
+     * @brief 构造函数，线程创建时绑定到指定的CPU
+     * @param[in] cb 线程执行函数
+     * @param[in] name 线程名称
+     * @param[in] cpus 线程可以运行的CPU，为空时不绑定
+     */
+    Thread(std::function<void()> cb, const std::string& name, const std::vector<int>& cpus);
+
     /**
      * @brief 析构函数
      */
@@ -37,6 +46,11 @@ public:
      */
     const std::string &getName() const { return m_name; }
 
+    /**
+     * @brief 线程绑定的CPU，为空表示没有绑定
+     */
+    const std::vector<int>& getCpus() const { return m_cpus; }
+
     /**
      * @brief 等待线程执行完成
      */
@@ -58,10 +72,21 @@ public:
      */
     static void SetName(const std::string &name);
 
+    /**
+     * @brief 获取当前线程绑定的NUMA节点
+     * @details 线程绑定的CPU都在同一个节点上时返回该节点，否则返回-1。协程栈在这个节点上分配
+     */
+    static int GetNumaNode();
+
 private:
     ///线程执行函数，接收一个this
     static void* run(void* arg);
 
+    /**
+     * @brief 创建线程
+     */
+    void create();
+
      /// 线程id
     pid_t m_id = -1;
     /// 线程结构
@@ -70,8 +95,60 @@ private:
     std::function<void()> m_cb;
     /// 线程名称
     std::string m_name;
+    /// 绑定的CPU
+    std::vector<int> m_cpus;
     /// 信号量
     Semaphore m_semaphore;
 };
+
+/**
+ * @brief 定期执行任务的后台线程
+ * @details start()之后后台线程反复执行任务，两次之间阻塞任务返回的毫秒数，stop()唤醒阻塞并等待线程退出。
+ *          任务用到的静态对象要在持有者之前构造，程序退出时它们才会在线程停止之后析构
+ */
+class PeriodicThread : Noncopyable {
+public:
+    /**
+     * @brief 构造函数
+     * @param[in] name 线程名称
+     * @param[in] cb 执行一次任务，返回到下一次执行之前等待的毫秒数
+     */
+    PeriodicThread(const std::string& name, std::function<uint64_t()> cb);
+
+    /**
+     * @brief 析构函数，停止后台线程
+     */
+    ~PeriodicThread();
+
+    /**
+     * @brief 启动后台线程
+     * @return 已经启动时返回false
+     */
+    bool start();
+
+    /**
+     * @brief 停止后台线程，没有启动时什么也不做
+     * @details 和start()互斥，等后台线程退出之后才返回，不能在任务中调用
+     */
+    void stop();
+private:
+    /**
+     * @brief 后台线程
+     */
+    void run();
+private:
+    /// 线程名称
+    std::string m_name;
+    /// 每次执行的任务
+    std::function<uint64_t()> m_cb;
+    /// 串行化后台线程的启动停止，停止时一直持有到线程退出
+    Mutex m_mutex;
+    /// 后台线程
+    Thread::ptr m_thread;
+    /// 后台线程在两次执行之间阻塞，停止时唤醒
+    Parker m_parker;
+    /// 是否正在停止
+    std::atomic<bool> m_stopping{false};
+};
 }
 #endif
\ No newline at end of file
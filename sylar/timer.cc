@@ -18,8 +18,9 @@ bool Timer::Comparator::operator()(const Timer::ptr& lhs
     return lhs.get() < rhs.get();
 }
 
-Timer::Timer(uint64_t ms, std::function<void()> cb, bool recurring, TimerManager* manager) 
+Timer::Timer(uint64_t ms, std::function<void()> cb, bool recurring, TimerManager* manager, bool inlined) 
     :m_recurring(recurring)
+    ,m_inline(inlined)
     ,m_ms(ms)
     ,m_cb(cb)
     ,m_manager(manager) {
@@ -97,8 +98,8 @@ bool TimerManager::hasTimer() {
 }
 
 Timer::ptr TimerManager::addTimer(uint64_t ms, std::function<void()> cb
-                                  ,bool recurring) {
-    Timer::ptr timer(new Timer(ms, cb, recurring, this));
+                                  ,bool recurring, bool inlined) {
+    Timer::ptr timer(new Timer(ms, cb, recurring, this, inlined));
     RWMutexType::WriteLock lock(m_mutex);
     addTimer(timer, lock);
     return timer;
@@ -128,8 +129,8 @@ static void OnTimer(std::weak_ptr<void> weak_cond, std::function<void()> cb) {
 
 Timer::ptr TimerManager::addConditionTimer(uint64_t ms, std::function<void()> cb
                                         , std::weak_ptr<void> weak_cond
-                                        , bool recurring) {
-    return addTimer(ms, std::bind(&OnTimer, weak_cond, cb), recurring);
+                                        , bool recurring, bool inlined) {
+    return addTimer(ms, std::bind(&OnTimer, weak_cond, cb), recurring, inlined);
 }
 
 //最近一个定时器执行的时间间隔(毫秒)
@@ -152,16 +153,15 @@ uint64_t TimerManager::getNextTimer() {
 bool TimerManager::detectClockRollover(uint64_t now_ms) {
     bool rollover = false;
     //系统时间回滚了1个小时以上
-    if(now_ms < m_previouseTime &&
-            now_ms < (m_previouseTime - 60 * 60 * 1000)) {
+    if(now_ms + 60 * 60 * 1000 < m_previouseTime) {
         rollover = true;
     }
     m_previouseTime = now_ms;
     return rollover;
 }
 
-void TimerManager::listExpiredCb(std::vector<std::function<void()> >& cbs) {
-    uint64_t now_ms = sylar::GetElapsedMS();
+void TimerManager::listExpiredCb(std::vector<std::function<void()> >& cbs
+                                 ,std::vector<std::function<void()> >* inline_cbs) {
     std::vector<Timer::ptr> expired;
     {
         RWMutexType::ReadLock lock(m_mutex);
@@ -174,6 +174,8 @@ void TimerManager::listExpiredCb(std::vector<std::function<void()> >& cbs) {
     if(m_timers.empty()) {
         return;
     }
+    //在锁内取当前时间，多个线程同时取超时定时器时m_previouseTime才不会比now_ms新
+    uint64_t now_ms = sylar::GetElapsedMS();
     bool rollover = false;
     if(SYLAR_UNLIKELY(detectClockRollover(now_ms))) {
         // 使用clock_gettime(CLOCK_MONOTONIC_RAW)，应该不可能出现时间回退的问题
@@ -199,7 +201,11 @@ void TimerManager::listExpiredCb(std::vector<std::function<void()> >& cbs) {
     cbs.reserve(expired.size());
 
     for(auto& timer : expired) {
-        cbs.push_back(timer->m_cb);
+        if(timer->m_inline && inline_cbs) {
+            inline_cbs->push_back(timer->m_cb);
+        } else {
+            cbs.push_back(timer->m_cb);
+        }
         if(timer->m_recurring) {
             //循环定时器修改时间加入定时器集合
             timer->m_next = now_ms + timer->m_ms;
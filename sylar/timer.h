@@ -38,9 +38,10 @@ private:
      * @param[in] cb 回调函数
      * @param[in] recurring 是否循环
      * @param[in] manager 定时器管理器
+     * @param[in] inlined 回调是否可以在调度协程上直接执行
      */
     Timer(uint64_t ms, std::function<void()> cb,
-          bool recurring, TimerManager* manager);
+          bool recurring, TimerManager* manager, bool inlined = false);
     /**
      * @brief 构造函数
      * @param[in] next 执行的时间戳(毫秒)
@@ -50,6 +51,8 @@ private:
 private:
     /// 是否循环定时器
     bool m_recurring = false;
+    /// 回调不会阻塞，可以在调度协程上直接执行
+    bool m_inline = false;
     /// 执行周期
     uint64_t m_ms = 0;
     /// 精确的执行时间
@@ -96,9 +99,10 @@ public:
      * @param[in] ms 定时器执行间隔时间
      * @param[in] cb 定时器回调函数
      * @param[in] recurring 是否循环定时器
+     * @param[in] inlined 回调是否不会阻塞，为true时到期后在调度协程上直接执行，见Scheduler::scheduleInline
      */
     Timer::ptr addTimer(uint64_t ms, std::function<void()> cb
-                        ,bool recurring = false);
+                        ,bool recurring = false, bool inlined = false);
 
     /**
      * @brief 添加条件定时器
@@ -106,10 +110,11 @@ public:
      * @param[in] cb 定时器回调函数
      * @param[in] weak_cond 条件
      * @param[in] recurring 是否循环
+     * @param[in] inlined 回调是否不会阻塞，为true时到期后在调度协程上直接执行
      */
     Timer::ptr addConditionTimer(uint64_t ms, std::function<void()> cb
                         ,std::weak_ptr<void> weak_cond
-                        ,bool recurring = false);
+                        ,bool recurring = false, bool inlined = false);
     
     /**
      * @brief 到最近一个定时器执行的时间间隔(毫秒)
@@ -119,8 +124,10 @@ public:
     /**
      * @brief 获取需要执行的定时器的回调函数列表
      * @param[out] cbs 回调函数数组
+     * @param[out] inline_cbs 可以直接在调度协程上执行的回调函数数组，为空时全部放到cbs里
      */
-    void listExpiredCb(std::vector<std::function<void()> >& cbs);
+    void listExpiredCb(std::vector<std::function<void()> >& cbs
+                       ,std::vector<std::function<void()> >* inline_cbs = nullptr);
 
     /**
      * @brief 是否有定时器
@@ -31,6 +31,12 @@ uint64_t GetElapsedMS() {
     return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
 }
 
+uint64_t GetElapsedUS() {
+    struct timespec ts = {0};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 * 1000ul + ts.tv_nsec / 1000;
+}
+
 std::string GetThreadName() {
     char thread_name[16] = {0};
     pthread_getname_np(pthread_self(), thread_name, 16);
@@ -57,6 +63,7 @@ static std::string demangle(const char *str) {
         }
     }
     if (1 == sscanf(str, "%255s", &rt[0])) {
+        rt.resize(strlen(rt.c_str()));
         return rt;
     }
     return str;
@@ -69,20 +76,24 @@ void Backtrace(std::vector<std::string> &bt, int size, int skip) {
     //地址数，如果回溯大于size，则返回最近size个调用堆栈信息，为了获得完整的回溯，我们
     //必须确保缓冲区和大小足够大.返回值：返回获取到的调用堆栈信息的数量，该值不大于size。
     size_t s     = ::backtrace(array, size);
+    SymbolizeBacktrace(array, s, bt, skip);
+    free(array);
+}
+
+void SymbolizeBacktrace(void *const *frames, int size, std::vector<std::string> &bt, int skip) {
     //第一个参数是backtrace返回信息buffer，backtrace_symbols的功能将地址信息转换为
     //一个字符串数组，用于描述堆栈信息。size参数指定缓冲区中地址的数量
-    char **strings = backtrace_symbols(array, s);
+    char **strings = backtrace_symbols(frames, size);
     if (strings == NULL) {
         SYLAR_LOG_ERROR(g_logger) << "backtrace_synbols error";
         return;
     }
 
-    for (size_t i = skip; i < s; ++i) {
+    for (int i = skip; i < size; ++i) {
         bt.push_back(demangle(strings[i]));
     }
 
     free(strings);
-    free(array);
 }
 
 std::string BacktraceToString(int size, int skip, const std::string &prefix) {
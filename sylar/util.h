@@ -28,6 +28,11 @@ uint64_t GetFiberId();
  */
 uint64_t GetElapsedMS();
 
+/**
+ * @brief 获取当前启动的微秒数，使用CLOCK_MONOTONIC，用于统计耗时
+ */
+uint64_t GetElapsedUS();
+
 /**
  * @brief 获取线程名称，参考pthread_getname_np(3)
  */
@@ -47,6 +52,15 @@ void SetThreadName(const std::string &name);
  */
 void Backtrace(std::vector<std::string> &bt, int size = 64, int skip = 1);
 
+/**
+ * @brief 把backtrace()采集的返回地址转换成函数名
+ * @param[in] frames 返回地址
+ * @param[in] size 地址数量
+ * @param[out] bt 调用栈
+ * @param[in] skip 跳过栈顶的层数
+ */
+void SymbolizeBacktrace(void *const *frames, int size, std::vector<std::string> &bt, int skip = 0);
+
 /**
  * @brief 获取当前栈信息的字符串
  * @param[in] size 栈的最大层数
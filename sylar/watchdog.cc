@@ -0,0 +1,284 @@
+#include "watchdog.h"
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <execinfo.h>
+#include <algorithm>
+#include <sstream>
+#include "config.h"
+#include "log.h"
+#include "scheduler.h"
+#include "util.h"
+
+namespace sylar {
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+/// 任务执行超过这个时间没有让出就报告一次
+static ConfigVar<uint32_t>::ptr g_watchdog_stall_ms =
+    Config::Lookup<uint32_t>("watchdog.stall_ms", 0, "report fibers that run longer than this many milliseconds without yielding, 0 disables the watchdog");
+/// 报告卡顿时采集的调用栈层数，默认不采集。
+/// 采集要向卡住的线程发信号，线程卡在没有hook的nanosleep/poll/epoll_wait/connect或者带超时的socket调用里时，
+/// 这些调用不受SA_RESTART影响，会提前返回EINTR，被观察的代码行为会改变，只建议在排查问题时开启
+static ConfigVar<uint32_t>::ptr g_watchdog_backtrace_frames =
+    Config::Lookup<uint32_t>("watchdog.backtrace_frames", 0, "backtrace frames captured from a stalled scheduler thread by signalling it, 0 disables capturing; the signal makes unrestartable blocking calls (nanosleep, poll, connect, socket calls with timeouts) in the stalled thread return EINTR early");
+
+static std::atomic<uint32_t> s_stall_ms{0};
+static std::atomic<uint32_t> s_backtrace_frames{0};
+
+/// 调用点取栈顶的层数，不算系统库
+static const size_t s_site_frames = 3;
+/// 信号处理函数最多采集的层数
+static const int s_max_frames = 64;
+/// 信号处理函数自己和信号返回的跳板两层
+static const int s_handler_frames = 2;
+
+/// 信号处理函数采集的返回地址，同一时间只采集一个线程
+static void* s_frames[s_max_frames];
+/// 采集到的层数，-1表示还没有采集完
+static std::atomic<int> s_frame_count{-1};
+/// 要采集的线程id，信号处理函数确认是自己之后清零，晚到的信号不会写入
+static std::atomic<int> s_capture_tid{0};
+
+/**
+ * @brief 是否是系统库的栈帧，调用点跳过这些栈帧，落在调用它们的代码上
+ */
+static bool IsSystemFrame(const std::string& frame) {
+    static const char* s_libs[] = {"linux-vdso", "/libc.so", "/libc-", "/libpthread", "/ld-linux"};
+    for (auto lib : s_libs) {
+        if (frame.find(lib) != std::string::npos) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief 线程是否还在执行同一个任务
+ * @details 采集调用栈期间任务可能已经结束，这时采集到的是下一个任务的调用栈
+ */
+static bool IsSameTask(const Scheduler::RunningTask& task) {
+    std::vector<Scheduler::RunningTask> tasks;
+    Scheduler::GetRunningTasks(tasks);
+    for (auto& i : tasks) {
+        if (i.thread == task.thread) {
+            return i.startUs == task.startUs && i.fiberId == task.fiberId;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief 由调用栈生成调用点，跳过栈顶的系统库栈帧，去掉偏移
+ */
+static std::string MakeSite(const std::vector<std::string>& bt) {
+    size_t begin = 0;
+    while (begin < bt.size() && IsSystemFrame(bt[begin])) {
+        ++begin;
+    }
+    if (begin == bt.size()) {
+        begin = 0;
+    }
+    std::stringstream ss;
+    for (size_t i = begin; i < bt.size() && i < begin + s_site_frames; ++i) {
+        // 没有解析出C++函数名的栈帧形如module(func+0x1a)，偏移每次都不一样
+        std::string frame = bt[i];
+        size_t pos = frame.find('+');
+        if (pos != std::string::npos && frame.find('(') < pos) {
+            frame = frame.substr(0, pos) + ")";
+        }
+        ss << (i > begin ? " <- " : "") << frame;
+    }
+    return ss.str();
+}
+
+static int GetCaptureSignal() {
+    // SIGRTMIN默认用于唤醒IOManager的调度线程(iomanager.wake_signal)
+    return SIGRTMIN + 1;
+}
+
+static void OnCaptureSignal(int) {
+    int saved_errno = errno;
+    int tid = syscall(SYS_gettid);
+    if (s_capture_tid.compare_exchange_strong(tid, 0)) {
+        s_frame_count = ::backtrace(s_frames, s_max_frames);
+    }
+    errno = saved_errno;
+}
+
+static bool InstallCaptureSignal() {
+    int sig = GetCaptureSignal();
+    struct sigaction old;
+    if (sigaction(sig, nullptr, &old)) {
+        return false;
+    }
+    if ((old.sa_flags & SA_SIGINFO) || old.sa_handler != SIG_DFL) {
+        // 不覆盖应用程序自己的处理函数
+        SYLAR_LOG_WARN(g_logger) << "signal " << sig << " already has a handler,"
+                                 << " watchdog.backtrace_frames is ignored";
+        return false;
+    }
+    // 第一次调用backtrace会加载libgcc_s，不能放在信号处理函数里
+    void* frames[1];
+    ::backtrace(frames, 1);
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = OnCaptureSignal;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    return sigaction(sig, &sa, nullptr) == 0;
+}
+
+/// 采集调用栈的信号处理函数是否可用，第一次要采集调用栈时才安装
+static bool CaptureSignalInstalled() {
+    static bool s_installed = InstallCaptureSignal();
+    return s_installed;
+}
+
+struct _WatchdogIniter {
+    _WatchdogIniter() {
+        s_stall_ms = g_watchdog_stall_ms->getValue();
+        s_backtrace_frames = g_watchdog_backtrace_frames->getValue();
+        g_watchdog_backtrace_frames->addListener([](const uint32_t& old_value, const uint32_t& new_value) {
+            s_backtrace_frames = new_value;
+        });
+        g_watchdog_stall_ms->addListener([](const uint32_t& old_value, const uint32_t& new_value) {
+            s_stall_ms = new_value;
+            if (new_value) {
+                WatchdogMgr::GetInstance()->start();
+            } else {
+                WatchdogMgr::GetInstance()->stop();
+            }
+        });
+        if (s_stall_ms) {
+            WatchdogMgr::GetInstance()->start();
+        }
+    }
+};
+
+static _WatchdogIniter s_watchdog_initer;
+
+Watchdog::Watchdog()
+    : m_thread("watchdog", std::bind(&Watchdog::run, this)) {
+    // check用到的调度器列表要先于看门狗构造，见PeriodicThread
+    std::vector<Scheduler::RunningTask> tasks;
+    Scheduler::GetRunningTasks(tasks);
+}
+
+Watchdog::~Watchdog() {
+    stop();
+}
+
+void Watchdog::start() {
+    if (m_thread.start()) {
+        SYLAR_LOG_INFO(g_logger) << "watchdog start, stall_ms=" << s_stall_ms;
+    }
+}
+
+void Watchdog::stop() {
+    m_thread.stop();
+}
+
+uint64_t Watchdog::run() {
+    uint64_t stall_ms = s_stall_ms;
+    if (stall_ms) {
+        check(stall_ms);
+    }
+    // 检查间隔取阈值的1/4，卡顿被发现时最多比阈值晚25%
+    return std::min<uint64_t>(std::max<uint64_t>(stall_ms / 4, 10), 1000);
+}
+
+void Watchdog::check(uint64_t stall_ms) {
+    std::vector<Scheduler::RunningTask> tasks;
+    Scheduler::GetRunningTasks(tasks);
+    uint64_t now = GetElapsedUS();
+    std::map<int, uint64_t> reported;
+    for (auto& t : tasks) {
+        auto it = m_reported.find(t.thread);
+        if (it != m_reported.end() && it->second == t.startUs) {
+            reported[t.thread] = t.startUs;
+            continue;
+        }
+        if (now < t.startUs || now - t.startUs < stall_ms * 1000) {
+            continue;
+        }
+        reported[t.thread] = t.startUs;
+        uint64_t running_ms = (now - t.startUs) / 1000;
+        ++m_stallCount;
+
+        std::vector<std::string> bt;
+        int frames = s_backtrace_frames;
+        std::string site = "unknown";
+        if (frames > 0 && captureBacktrace(t.thread, frames, bt)) {
+            if (!IsSameTask(t)) {
+                bt.clear();
+            }
+            if (!bt.empty()) {
+                site = MakeSite(bt);
+            }
+        }
+        {
+            Mutex::Lock lock(m_sitesMutex);
+            StallSite& s = m_sites[site];
+            s.site = site;
+            ++s.count;
+            s.maxMs = std::max(s.maxMs, running_ms);
+        }
+
+        std::stringstream ss;
+        for (auto& i : bt) {
+            ss << std::endl << "    " << i;
+        }
+        SYLAR_LOG_WARN(g_logger) << "fiber stalled: scheduler=" << t.scheduler << " thread=" << t.thread
+                                 << " fiber=" << t.fiberId << " running=" << running_ms << "ms"
+                                 << " site=" << site << ss.str();
+    }
+    m_reported.swap(reported);
+}
+
+bool Watchdog::captureBacktrace(int thread, int frames, std::vector<std::string>& bt) {
+    if (!CaptureSignalInstalled()) {
+        return false;
+    }
+    s_frame_count = -1;
+    s_capture_tid = thread;
+    if (syscall(SYS_tgkill, getpid(), thread, GetCaptureSignal())) {
+        s_capture_tid = 0;
+        return false;
+    }
+    // 线程在不可中断的状态时信号要等一会儿才处理，最多等100ms
+    for (int i = 0; i < 100 && s_frame_count < 0; ++i) {
+        usleep(1000);
+    }
+    int expected = thread;
+    if (!s_capture_tid.compare_exchange_strong(expected, 0)) {
+        // 信号处理函数已经开始采集，等它写完
+        while (s_frame_count < 0) {
+            usleep(100);
+        }
+    }
+    int n = s_frame_count;
+    if (n <= s_handler_frames) {
+        return false;
+    }
+    SymbolizeBacktrace(s_frames + s_handler_frames,
+                       std::min(n - s_handler_frames, frames), bt);
+    return true;
+}
+
+void Watchdog::getStallSites(std::vector<StallSite>& sites) {
+    sites.clear();
+    {
+        Mutex::Lock lock(m_sitesMutex);
+        for (auto& i : m_sites) {
+            sites.push_back(i.second);
+        }
+    }
+    std::sort(sites.begin(), sites.end(), [](const StallSite& a, const StallSite& b) {
+        return a.count > b.count;
+    });
+}
+
+}
@@ -0,0 +1,103 @@
+/**
+ * @file watchdog.h
+ * @brief 协程执行时间看门狗
+ * @version 0.1
+ */
+#ifndef __SYLAR_WATCHDOG_H__
+#define __SYLAR_WATCHDOG_H__
+
+#include <map>
+#include <string>
+#include <vector>
+#include "mutex.h"
+#include "thread.h"
+#include "singleton.h"
+
+namespace sylar {
+
+/**
+ * @brief 看门狗，检查调度线程上执行太久没有让出的协程
+ * @details CPU密集的计算和没有经过hook的阻塞调用(文件IO、第三方库的阻塞调用)会让同一个调度线程上的其他协程都得不到调度。
+ *          后台线程定期检查所有调度器正在执行的任务，一个任务执行超过watchdog.stall_ms时记录一次协程id、线程和调用栈，
+ *          并按调用点计数。watchdog.backtrace_frames大于0时，调用栈由向该线程发送信号、在信号处理函数里采集，
+ *          信号设置了SA_RESTART，但nanosleep这类不能自动重启的阻塞调用会提前返回EINTR，所以默认不采集。
+ *          采集完成后任务已经换了的话丢弃调用栈。watchdog.stall_ms大于0时自动启动，改成0时停止
+ */
+class Watchdog : Noncopyable {
+public:
+    /**
+     * @brief 按调用点聚合的卡顿统计
+     */
+    struct StallSite {
+        /// 调用点，卡住时栈顶的几层函数
+        std::string site;
+        /// 卡顿次数
+        uint64_t count = 0;
+        /// 检测到时最长的执行时间(毫秒)
+        uint64_t maxMs = 0;
+    };
+
+    Watchdog();
+
+    ~Watchdog();
+
+    /**
+     * @brief 启动后台检查线程，已经启动时什么也不做
+     */
+    void start();
+
+    /**
+     * @brief 停止后台检查线程
+     */
+    void stop();
+
+    /**
+     * @brief 检测到的卡顿总数
+     */
+    uint64_t getStallCount() const { return m_stallCount;}
+
+    /**
+     * @brief 获取按调用点聚合的卡顿统计
+     * @param[out] sites 按卡顿次数从多到少排列
+     */
+    void getStallSites(std::vector<StallSite>& sites);
+private:
+    /**
+     * @brief 后台线程执行一次检查
+     * @return 到下一次检查之前等待的毫秒数
+     */
+    uint64_t run();
+
+    /**
+     * @brief 检查一次所有调度线程
+     * @param[in] stall_ms 卡顿阈值(毫秒)
+     */
+    void check(uint64_t stall_ms);
+
+    /**
+     * @brief 采集指定线程当前的调用栈
+     * @param[in] thread 线程id
+     * @param[in] frames 最多采集的层数
+     * @param[out] bt 调用栈，从栈顶开始
+     * @return 信号已经被应用程序占用或者线程没有及时响应信号时返回false
+     */
+    bool captureBacktrace(int thread, int frames, std::vector<std::string>& bt);
+private:
+    /// 保护m_sites
+    Mutex m_sitesMutex;
+    /// 后台检查线程
+    PeriodicThread m_thread;
+    /// 每个线程已经报告过的任务的开始时间，同一个任务只报告一次，只由后台线程访问
+    std::map<int, uint64_t> m_reported;
+    /// 按调用点聚合的卡顿统计
+    std::map<std::string, StallSite> m_sites;
+    /// 卡顿总数
+    std::atomic<uint64_t> m_stallCount{0};
+};
+
+/// 看门狗单例
+typedef Singleton<Watchdog> WatchdogMgr;
+
+}
+
+#endif
@@ -0,0 +1,103 @@
+/**
+ * @file work_stealing_queue.h
+ * @brief 固定容量的无锁任务窃取队列
+ * @version 0.1
+ */
+#ifndef __SYLAR_WORK_STEALING_QUEUE_H__
+#define __SYLAR_WORK_STEALING_QUEUE_H__
+
+#include <atomic>
+#include <memory>
+#include <stdint.h>
+#include "noncopyable.h"
+
+namespace sylar {
+
+/**
+ * @brief Chase-Lev风格的任务窃取队列，保存T*
+ * @details 只有所属线程可以push，任何线程(包括所属线程)都可以从队首steal。
+ *          和标准的Chase-Lev不同，所属线程也从队首取任务，保持和全局队列一样的FIFO顺序，
+ *          避免反复把自己加入调度的协程饿死同一个队列里的其他任务。容量固定，满了由调用方放到其他地方
+ */
+template<class T>
+class WorkStealingQueue : Noncopyable {
+public:
+    /**
+     * @brief 构造函数
+     * @param[in] capacity 容量，向上取整为2的幂
+     */
+    WorkStealingQueue(size_t capacity) {
+        size_t cap = 2;
+        while(cap < capacity) {
+            cap <<= 1;
+        }
+        m_mask = cap - 1;
+        m_buffer.reset(new std::atomic<T*>[cap]);
+        for(size_t i = 0; i < cap; ++i) {
+            m_buffer[i].store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * @brief 放入队尾，只能由所属线程调用
+     * @return 队列已满返回false
+     */
+    bool push(T* v) {
+        int64_t b = m_bottom.load(std::memory_order_relaxed);
+        int64_t t = m_top.load(std::memory_order_acquire);
+        if(b - t > (int64_t)m_mask) {
+            return false;
+        }
+        m_buffer[b & m_mask].store(v, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        m_bottom.store(b + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    /**
+     * @brief 从队首取出一个，任何线程都可以调用
+     * @return 队列为空返回nullptr
+     */
+    T* steal() {
+        while(true) {
+            int64_t t = m_top.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            int64_t b = m_bottom.load(std::memory_order_acquire);
+            if(t >= b) {
+                return nullptr;
+            }
+            T* v = m_buffer[t & m_mask].load(std::memory_order_relaxed);
+            if(m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                             std::memory_order_relaxed)) {
+                return v;
+            }
+            // 和其他线程竞争失败，重新读取队首
+        }
+    }
+
+    /**
+     * @brief 返回队列中元素数量的近似值
+     */
+    size_t size() const {
+        int64_t b = m_bottom.load(std::memory_order_relaxed);
+        int64_t t = m_top.load(std::memory_order_relaxed);
+        return b > t ? (size_t)(b - t) : 0;
+    }
+
+    bool empty() const { return size() == 0;}
+
+    size_t capacity() const { return m_mask + 1;}
+private:
+    /// 队首，steal的位置
+    std::atomic<int64_t> m_top{0};
+    /// 队尾，push的位置
+    std::atomic<int64_t> m_bottom{0};
+    /// 容量减一
+    size_t m_mask = 0;
+    /// 环形缓冲区
+    std::unique_ptr<std::atomic<T*>[]> m_buffer;
+};
+
+}
+
+#endif
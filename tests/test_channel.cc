@@ -0,0 +1,74 @@
+/**
+ * @file test_channel.cc
+ * @brief 协程通道测试
+ * @version 0.1
+ */
+#include "sylar/sylar.h"
+#include "sylar/channel.h"
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+/**
+ * @brief 非协程线程生产，协程消费，通道满时生产线程阻塞，通道空时消费协程挂起
+ */
+void test_pipeline() {
+    sylar::Channel<int>::ptr chan(new sylar::Channel<int>(4));
+    std::atomic<int> sum{0};
+    {
+        sylar::IOManager iom(2, false, "pipeline");
+        for(int i = 0; i < 3; ++i) {
+            iom.schedule([chan, &sum]() {
+                int v = 0;
+                while(chan->pop(v)) {
+                    sum += v;
+                }
+            });
+        }
+
+        sylar::Thread::ptr producer(new sylar::Thread([chan]() {
+            for(int i = 1; i <= 1000; ++i) {
+                chan->push(i);
+            }
+            chan->close();
+        }, "producer"));
+        producer->join();
+    }
+    SYLAR_LOG_INFO(g_logger) << "pipeline sum=" << sum << " (expect 500500)";
+}
+
+/**
+ * @brief 在多个通道上select，带超时
+ */
+void test_select() {
+    std::vector<sylar::Channel<std::string>::ptr> chans;
+    chans.push_back(std::make_shared<sylar::Channel<std::string> >(1));
+    chans.push_back(std::make_shared<sylar::Channel<std::string> >(1));
+
+    sylar::IOManager iom(1, false, "select");
+    iom.schedule([chans]() {
+        usleep(10 * 1000);
+        chans[1]->push("hello from chan 1");
+        usleep(10 * 1000);
+        chans[0]->push("hello from chan 0");
+    });
+    iom.schedule([chans]() {
+        std::string v;
+        while(true) {
+            int idx = sylar::Channel<std::string>::Select(chans, v, 100);
+            if(idx < 0) {
+                SYLAR_LOG_INFO(g_logger) << "select timeout";
+                break;
+            }
+            SYLAR_LOG_INFO(g_logger) << "select chan " << idx << ": " << v;
+        }
+    });
+}
+
+int main(int argc, char *argv[]) {
+    sylar::EnvMgr::GetInstance()->init(argc, argv);
+    sylar::Config::LoadFromConfDir(sylar::EnvMgr::GetInstance()->getConfigPath());
+
+    test_pipeline();
+    test_select();
+    return 0;
+}
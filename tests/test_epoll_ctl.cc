@@ -0,0 +1,106 @@
+/**
+ * @file test_epoll_ctl.cc
+ * @brief 常驻epoll注册测试，统计每个请求的epoll_ctl调用次数
+ * @details 同一个IOManager上跑若干对echo连接，每个请求客户端send之后recv阻塞，服务端recv阻塞之后send，
+ *          分别在一次性注册和常驻注册下统计epoll_ctl次数
+ * @version 0.1
+ */
+#include "sylar/sylar.h"
+#include <unistd.h>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static const int s_clients = 16;
+static const int s_rounds = 2000;
+
+static std::atomic<int> s_done{0};
+static sylar::Semaphore s_finished;
+
+void echo(sylar::Socket::ptr client) {
+    char buf[256];
+    while(true) {
+        int n = client->recv(buf, sizeof(buf));
+        if(n <= 0) {
+            break;
+        }
+        client->send(buf, n);
+    }
+    client->close();
+}
+
+void accept_loop(sylar::Socket::ptr server) {
+    while(true) {
+        auto client = server->accept();
+        if(!client) {
+            break;
+        }
+        sylar::IOManager::GetThis()->schedule(std::bind(&echo, client));
+    }
+}
+
+void client(sylar::Address::ptr addr) {
+    auto sock = sylar::Socket::CreateTCP(addr);
+    SYLAR_ASSERT(sock->connect(addr));
+    for(int i = 0; i < s_rounds; i++) {
+        std::string msg = "hello " + std::to_string(i);
+        sock->send(msg.c_str(), msg.size());
+        char buf[256];
+        size_t got = 0;
+        while(got < msg.size()) {
+            int n = sock->recv(buf + got, sizeof(buf) - got);
+            SYLAR_ASSERT(n > 0);
+            got += n;
+        }
+        SYLAR_ASSERT(std::string(buf, got) == msg);
+    }
+    sock->close();
+    if(++s_done == s_clients) {
+        s_finished.notify();
+    }
+}
+
+void bench(bool persistent, uint16_t port) {
+    sylar::Config::Lookup<bool>("iomanager.persistent_epoll")->setValue(persistent);
+    s_done = 0;
+    auto addr = sylar::Address::LookupAnyIPAddress("127.0.0.1:" + std::to_string(port));
+    sylar::Socket::ptr server;
+    sylar::Semaphore listening;
+    // 单线程，只统计系统调用次数
+    sylar::IOManager iom(1, false, "epoll_ctl");
+    // 监听socket要在hook开启的调度线程上创建，否则没有FdCtx，accept会阻塞线程
+    iom.schedule([&]() {
+        server = sylar::Socket::CreateTCP(addr);
+        SYLAR_ASSERT(server->bind(addr));
+        SYLAR_ASSERT(server->listen());
+        listening.notify();
+        accept_loop(server);
+    });
+    listening.wait();
+
+    sylar::Scheduler::Stats before;
+    iom.getStats(before);
+    uint64_t begin = sylar::GetElapsedMS();
+    for(int i = 0; i < s_clients; i++) {
+        iom.schedule(std::bind(&client, addr));
+    }
+    s_finished.wait();
+    uint64_t elapsed = sylar::GetElapsedMS() - begin;
+    sylar::Scheduler::Stats after;
+    iom.getStats(after);
+    iom.schedule([server]() { server->close(); });
+
+    uint64_t requests = (uint64_t)s_clients * s_rounds;
+    uint64_t ctls = after.epollCtls - before.epollCtls;
+    SYLAR_LOG_INFO(g_logger) << "persistent_epoll=" << persistent << " requests=" << requests
+                             << " epoll_ctls=" << ctls
+                             << " epoll_ctls_per_request=" << (double)ctls / requests
+                             << " elapsed_ms=" << elapsed;
+}
+
+int main(int argc, char *argv[]) {
+    // 一次性注册：每个请求两端各阻塞一次，添加事件和事件触发各一次epoll_ctl，约4次
+    bench(false, 12431);
+    // 常驻注册：每个socket只在第一次阻塞时注册，关闭时删除，约为0
+    bench(true, 12432);
+    return 0;
+}
@@ -0,0 +1,112 @@
+/**
+ * @file test_event_wake.cc
+ * @brief IO事件唤醒延迟测试，64个调度线程同时收发
+ * @details 若干对TCP连接互相发送时间戳，每次recv阻塞之后被唤醒时记录 当前时间-对端send之前的时间，
+ *          分别在一次性注册和常驻注册下输出唤醒延迟的分位数
+ * @version 0.1
+ */
+#include "sylar/sylar.h"
+#include <time.h>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static const int s_threads = 64;
+static const int s_conns = 128;
+static const int s_rounds = 1000;
+
+static std::atomic<int> s_done{0};
+static sylar::Semaphore s_finished;
+
+/// 每个连接端一个直方图，只由该端的协程记录
+static std::vector<std::shared_ptr<sylar::LatencyHistogram> > s_hists;
+
+static uint64_t NowNS() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static bool recv_all(sylar::Socket::ptr sock, void* buf, size_t len) {
+    size_t got = 0;
+    while(got < len) {
+        int n = sock->recv((char*)buf + got, len - got);
+        if(n <= 0) {
+            return false;
+        }
+        got += n;
+    }
+    return true;
+}
+
+/**
+ * @brief 收到对端的时间戳后记录延迟，再把自己的时间戳发回去
+ * @param[in] first 是否先发
+ */
+static void pingpong(sylar::Socket::ptr sock, sylar::LatencyHistogram* hist, bool first) {
+    uint64_t ts = 0;
+    if(first) {
+        ts = NowNS();
+        sock->send(&ts, sizeof(ts));
+    }
+    for(int i = 0; i < s_rounds; i++) {
+        if(!recv_all(sock, &ts, sizeof(ts))) {
+            break;
+        }
+        hist->record(NowNS() - ts);
+        if(!first && i == s_rounds - 1) {
+            break;
+        }
+        ts = NowNS();
+        sock->send(&ts, sizeof(ts));
+    }
+    sock->close();
+    if(++s_done == s_conns * 2) {
+        s_finished.notify();
+    }
+}
+
+static void bench(bool persistent, uint16_t port) {
+    sylar::Config::Lookup<bool>("iomanager.persistent_epoll")->setValue(persistent);
+    s_done = 0;
+    s_hists.clear();
+    for(int i = 0; i < s_conns * 2; i++) {
+        s_hists.push_back(std::make_shared<sylar::LatencyHistogram>());
+    }
+    auto addr = sylar::Address::LookupAnyIPAddress("127.0.0.1:" + std::to_string(port));
+    sylar::IOManager iom(s_threads, false, "event_wake");
+
+    uint64_t begin = sylar::GetElapsedMS();
+    // socket要在hook开启的调度线程上创建
+    iom.schedule([&]() {
+        auto server = sylar::Socket::CreateTCP(addr);
+        bool ok = server->bind(addr) && server->listen(s_conns);
+        SYLAR_ASSERT(ok);
+        for(int i = 0; i < s_conns; i++) {
+            auto client = sylar::Socket::CreateTCP(addr);
+            ok = client->connect(addr);
+            SYLAR_ASSERT(ok);
+            auto peer = server->accept();
+            SYLAR_ASSERT(peer);
+            sylar::IOManager::GetThis()->schedule(std::bind(&pingpong, client, s_hists[i * 2].get(), true));
+            sylar::IOManager::GetThis()->schedule(std::bind(&pingpong, peer, s_hists[i * 2 + 1].get(), false));
+        }
+        server->close();
+    });
+    s_finished.wait();
+    uint64_t elapsed = sylar::GetElapsedMS() - begin;
+
+    sylar::HistogramSnapshot s;
+    for(auto& i : s_hists) {
+        i->snapshot(s);
+    }
+    SYLAR_LOG_INFO(g_logger) << "persistent_epoll=" << persistent << " threads=" << s_threads
+                             << " wakes=" << s.count << " p50_ns=" << s.percentile(0.5)
+                             << " p99_ns=" << s.percentile(0.99) << " max_ns=" << s.max
+                             << " elapsed_ms=" << elapsed;
+}
+
+int main(int argc, char *argv[]) {
+    bench(false, 12441);
+    bench(true, 12442);
+    return 0;
+}
@@ -6,6 +6,8 @@
 #include "sylar/sylar.h"
 #include <string>
 #include <vector>
+#include <sys/mman.h>
+#include <unistd.h>
 
 sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
 
@@ -62,6 +64,122 @@ void test_fiber() {
     SYLAR_LOG_INFO(g_logger) << "test_fiber end";
 }
 
+/**
+ * @brief 协程析构后栈归还到线程的栈池，下一个协程直接复用
+ */
+void test_stack_pool() {
+    sylar::Fiber::GetThis();
+    for (int i = 0; i < 3; i++) {
+        sylar::Fiber::ptr fiber(new sylar::Fiber(run_in_fiber2, 0, false));
+        fiber->resume();
+    }
+
+    sylar::Fiber::StackPoolStats stats = sylar::Fiber::GetStackPoolStats();
+    SYLAR_LOG_INFO(g_logger) << "stack pool hits=" << stats.hits
+                             << " misses=" << stats.misses
+                             << " released=" << stats.released
+                             << " unmapped=" << stats.unmapped
+                             << " cached=" << stats.cached;
+}
+
+/**
+ * @brief 映射数用完之后mmap栈失败，协程退回malloc栈照常运行
+ */
+void test_malloc_fallback() {
+    sylar::Fiber::GetThis();
+    size_t page = sysconf(_SC_PAGESIZE);
+    std::vector<void*> maps;
+    // 相邻的映射权限交替，不会被内核合并，直到超过vm.max_map_count
+    while (maps.size() < 1000000) {
+        void* vp = mmap(nullptr, page, (maps.size() % 2) ? PROT_READ : PROT_NONE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (vp == MAP_FAILED) {
+            break;
+        }
+        maps.push_back(vp);
+    }
+    uint64_t before = sylar::Fiber::GetStackPoolStats().mallocFallbacks;
+    bool ran = false;
+    {
+        // 栈池里可能有空闲栈，用一个没用过的栈大小
+        sylar::Fiber::ptr fiber(new sylar::Fiber([&ran]() { ran = true; }, 200 * 1024, false));
+        fiber->resume();
+    }
+    for (auto vp : maps) {
+        munmap(vp, page);
+    }
+    SYLAR_LOG_INFO(g_logger) << "malloc fallback maps=" << maps.size() << " ran=" << ran
+                             << " fallbacks=" << sylar::Fiber::GetStackPoolStats().mallocFallbacks - before
+                             << " (expect 1 1)";
+}
+
+/**
+ * @brief 共享栈协程交替运行，挂起期间栈上的数据被拷出拷回后保持不变
+ */
+void run_in_shared_stack(int id) {
+    char buf[1024];
+    memset(buf, id, sizeof(buf));
+    for (int i = 0; i < 3; i++) {
+        sylar::Fiber::GetThis()->yield();
+        for (size_t j = 0; j < sizeof(buf); j++) {
+            SYLAR_ASSERT(buf[j] == id);
+        }
+    }
+    SYLAR_LOG_INFO(g_logger) << "run_in_shared_stack " << id << " end";
+}
+
+void test_shared_stack() {
+    sylar::Fiber::GetThis();
+    std::vector<sylar::Fiber::ptr> fibers;
+    for (int i = 0; i < 8; i++) {
+        fibers.push_back(sylar::Fiber::ptr(
+            new sylar::Fiber(std::bind(run_in_shared_stack, i), 0, false, true)));
+    }
+    for (int round = 0; round < 4; round++) {
+        for (auto &fiber : fibers) {
+            fiber->resume();
+        }
+    }
+
+    sylar::Fiber::SharedStackStats stats = sylar::Fiber::GetSharedStackStats();
+    SYLAR_LOG_INFO(g_logger) << "shared stack switches=" << stats.switches
+                             << " saves=" << stats.saves
+                             << " save_bytes=" << stats.save_bytes
+                             << " restores=" << stats.restores
+                             << " restore_bytes=" << stats.restore_bytes
+                             << " bytes/switch=" << (stats.save_bytes + stats.restore_bytes) / (stats.switches ? stats.switches : 1);
+}
+
+void shallow_task() {
+    volatile char buf[1024];
+    buf[0] = 1;
+    (void)buf[0];
+}
+
+void deep_task() {
+    volatile char buf[24 * 1024];
+    for (size_t i = 0; i < sizeof(buf); i += 512) {
+        buf[i] = 1;
+    }
+    sylar::Fiber::SetStackTag("deep_task");
+}
+
+void test_stack_profile() {
+    sylar::Config::Lookup<bool>("fiber.stack_profile")->setValue(true);
+
+    sylar::Scheduler sc(1, false, "profile");
+    sc.start();
+    for (int i = 0; i < 100; i++) {
+        // 很浅的回调用32KB的小栈
+        sc.schedule(&shallow_task, -1, 32 * 1024);
+        sc.schedule(&deep_task);
+    }
+    sc.stop();
+
+    sylar::Fiber::DumpStackProfile();
+    sylar::Config::Lookup<bool>("fiber.stack_profile")->setValue(false);
+}
+
 int main(int argc, char *argv[]) {
     sylar::EnvMgr::GetInstance()->init(argc, argv);
     sylar::Config::LoadFromConfDir(sylar::EnvMgr::GetInstance()->getConfigPath());
@@ -79,6 +197,11 @@ int main(int argc, char *argv[]) {
         i->join();
     }
 
+    test_stack_pool();
+    test_malloc_fallback();
+    test_shared_stack();
+    test_stack_profile();
+
     SYLAR_LOG_INFO(g_logger) << "main end";
     return 0;
 }
\ No newline at end of file
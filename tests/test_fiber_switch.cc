@@ -0,0 +1,101 @@
+/**
+ * @file test_fiber_switch.cc
+ * @brief 协程切换延迟测试
+ * @details 分别测试ucontext的swapcontext和boost.context的jump_fcontext来回切换的耗时，
+ *          以及当前编译选项下Fiber::resume/yield的耗时
+ * @version 0.1
+ */
+#include "sylar/sylar.h"
+#include <ucontext.h>
+#include <boost/context/detail/fcontext.hpp>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static const uint64_t s_rounds = 1000000;
+static const size_t s_stack_size = 128 * 1024;
+
+static uint64_t GetCurrentNS() {
+    struct timespec ts = {0};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void report(const char *name, uint64_t begin, uint64_t end) {
+    // 每一轮是一次切入加一次切出
+    SYLAR_LOG_INFO(g_logger) << name << ": " << s_rounds << " rounds, "
+                             << (double)(end - begin) / (s_rounds * 2) << " ns/switch";
+}
+
+static ucontext_t s_main_uctx;
+static ucontext_t s_uctx;
+
+static void ucontext_func() {
+    while (true) {
+        swapcontext(&s_uctx, &s_main_uctx);
+    }
+}
+
+void bench_ucontext() {
+    std::vector<char> stack(s_stack_size);
+    getcontext(&s_uctx);
+    s_uctx.uc_link = nullptr;
+    s_uctx.uc_stack.ss_sp = &stack[0];
+    s_uctx.uc_stack.ss_size = stack.size();
+    makecontext(&s_uctx, &ucontext_func, 0);
+
+    uint64_t begin = GetCurrentNS();
+    for (uint64_t i = 0; i < s_rounds; ++i) {
+        swapcontext(&s_main_uctx, &s_uctx);
+    }
+    report("ucontext swapcontext", begin, GetCurrentNS());
+}
+
+static void fcontext_func(boost::context::detail::transfer_t t) {
+    while (true) {
+        t = boost::context::detail::jump_fcontext(t.fctx, nullptr);
+    }
+}
+
+void bench_fcontext() {
+    std::vector<char> stack(s_stack_size);
+    boost::context::detail::fcontext_t ctx =
+        boost::context::detail::make_fcontext(&stack[0] + stack.size(), stack.size(), &fcontext_func);
+
+    uint64_t begin = GetCurrentNS();
+    for (uint64_t i = 0; i < s_rounds; ++i) {
+        ctx = boost::context::detail::jump_fcontext(ctx, nullptr).fctx;
+    }
+    report("boost.context jump_fcontext", begin, GetCurrentNS());
+}
+
+void bench_fiber() {
+    sylar::Fiber::GetThis();
+    sylar::Fiber::ptr fiber(new sylar::Fiber([] {
+        for (uint64_t i = 0; i < s_rounds; ++i) {
+            sylar::Fiber::GetThis()->yield();
+        }
+    }, 0, false));
+
+    uint64_t begin = GetCurrentNS();
+    for (uint64_t i = 0; i < s_rounds; ++i) {
+        fiber->resume();
+    }
+    uint64_t end = GetCurrentNS();
+    // 最后再resume一次，让协程执行结束
+    fiber->resume();
+#ifdef SYLAR_FIBER_UCONTEXT
+    report("Fiber resume/yield (ucontext)", begin, end);
+#else
+    report("Fiber resume/yield (fcontext)", begin, end);
+#endif
+}
+
+int main(int argc, char *argv[]) {
+    sylar::EnvMgr::GetInstance()->init(argc, argv);
+    sylar::Config::LoadFromConfDir(sylar::EnvMgr::GetInstance()->getConfigPath());
+
+    bench_ucontext();
+    bench_fcontext();
+    bench_fiber();
+    return 0;
+}
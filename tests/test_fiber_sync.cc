@@ -0,0 +1,88 @@
+/**
+ * @file test_fiber_sync.cc
+ * @brief 协程同步原语测试
+ * @version 0.1
+ */
+#include "sylar/sylar.h"
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static sylar::FiberMutex s_mutex;
+static int s_counter = 0;
+
+/**
+ * @brief 持有协程锁期间sleep，sleep被hook，只挂起当前协程，其他协程在等锁时也只挂起自己
+ */
+void test_mutex() {
+    for(int i = 0; i < 5; ++i) {
+        sylar::FiberMutex::Lock lock(s_mutex);
+        int v = s_counter;
+        usleep(1000);
+        s_counter = v + 1;
+    }
+}
+
+static sylar::FiberMutex s_queue_mutex;
+static sylar::FiberCondition s_queue_cond;
+static std::list<int> s_queue;
+
+void test_producer() {
+    for(int i = 0; i < 10; ++i) {
+        {
+            sylar::FiberMutex::Lock lock(s_queue_mutex);
+            s_queue.push_back(i);
+        }
+        s_queue_cond.notifyOne();
+        usleep(2000);
+    }
+}
+
+void test_consumer() {
+    int n = 0;
+    sylar::FiberMutex::Lock lock(s_queue_mutex);
+    while(n < 10) {
+        if(s_queue.empty()) {
+            if(!s_queue_cond.wait(lock, 1000)) {
+                SYLAR_LOG_ERROR(g_logger) << "consumer wait timeout";
+                return;
+            }
+            continue;
+        }
+        int v = s_queue.front();
+        s_queue.pop_front();
+        ++n;
+        SYLAR_LOG_INFO(g_logger) << "consume " << v << " on thread " << sylar::GetThreadId();
+    }
+}
+
+void test_semaphore() {
+    std::shared_ptr<sylar::FiberSemaphore> sem(new sylar::FiberSemaphore(0));
+    uint64_t begin = sylar::GetElapsedMS();
+    bool rt = sem->wait(100);
+    SYLAR_LOG_INFO(g_logger) << "semaphore wait timeout, rt=" << rt
+                             << " elapsed=" << sylar::GetElapsedMS() - begin << "ms";
+
+    sylar::IOManager::GetThis()->schedule([sem]() {
+        usleep(10 * 1000);
+        sem->notify();
+    });
+    rt = sem->wait(1000);
+    SYLAR_LOG_INFO(g_logger) << "semaphore wait notified, rt=" << rt;
+}
+
+int main(int argc, char *argv[]) {
+    sylar::EnvMgr::GetInstance()->init(argc, argv);
+    sylar::Config::LoadFromConfDir(sylar::EnvMgr::GetInstance()->getConfigPath());
+
+    {
+        sylar::IOManager iom(2);
+        for(int i = 0; i < 10; ++i) {
+            iom.schedule(&test_mutex);
+        }
+        iom.schedule(&test_consumer);
+        iom.schedule(&test_producer);
+        iom.schedule(&test_semaphore);
+    }
+    SYLAR_LOG_INFO(g_logger) << "counter=" << s_counter << " (expect 50)";
+    return 0;
+}
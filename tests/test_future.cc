@@ -0,0 +1,91 @@
+/**
+ * @file test_future.cc
+ * @brief Future/Promise测试
+ * @version 0.1
+ */
+#include "sylar/sylar.h"
+#include "sylar/future.h"
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+/**
+ * @brief 模拟一次后端调用，耗时ms毫秒
+ */
+int call_backend(int id, int ms) {
+    usleep(ms * 1000);
+    return id * 10;
+}
+
+/**
+ * @brief 从一个请求协程扇出到多个后端，等待全部完成后汇总，只恢复一次
+ */
+void test_fan_out() {
+    sylar::IOManager* iom = sylar::IOManager::GetThis();
+    std::vector<sylar::Future<int> > futures;
+    for(int i = 0; i < 5; ++i) {
+        futures.push_back(sylar::async(iom, std::bind(&call_backend, i, 10 + i * 5)));
+    }
+
+    uint64_t begin = sylar::GetElapsedMS();
+    sylar::Future<void> all = sylar::whenAll(futures);
+    if(!all.wait(1000)) {
+        SYLAR_LOG_ERROR(g_logger) << "whenAll timeout";
+        return;
+    }
+    int sum = 0;
+    for(auto& i : futures) {
+        sum += i.get();
+    }
+    SYLAR_LOG_INFO(g_logger) << "fan out sum=" << sum << " (expect 100) elapsed="
+                             << sylar::GetElapsedMS() - begin << "ms";
+
+    futures.clear();
+    futures.push_back(sylar::async(iom, std::bind(&call_backend, 1, 50)));
+    futures.push_back(sylar::async(iom, std::bind(&call_backend, 2, 5)));
+    size_t first = sylar::whenAny(futures).get();
+    SYLAR_LOG_INFO(g_logger) << "whenAny first=" << first << " value=" << futures[first].get();
+}
+
+void test_timeout_and_exception() {
+    sylar::IOManager* iom = sylar::IOManager::GetThis();
+    sylar::Future<int> slow = sylar::async(iom, std::bind(&call_backend, 1, 200));
+    SYLAR_LOG_INFO(g_logger) << "slow ready in 20ms: " << slow.wait(20);
+
+    sylar::Future<void> bad = sylar::async(iom, []() {
+        throw std::runtime_error("backend error");
+    });
+    try {
+        bad.get();
+    } catch(std::exception& e) {
+        SYLAR_LOG_INFO(g_logger) << "exception from future: " << e.what();
+    }
+    SYLAR_LOG_INFO(g_logger) << "slow value=" << slow.get();
+}
+
+/**
+ * @brief Promise的所有拷贝都没有设置结果就销毁，等待的一方收到broken_promise异常
+ */
+void test_broken_promise() {
+    sylar::Future<int> f;
+    {
+        sylar::Promise<int> p;
+        f = p.getFuture();
+        sylar::Promise<int> copy = p;
+    }
+    try {
+        f.get();
+    } catch(std::future_error& e) {
+        SYLAR_LOG_INFO(g_logger) << "broken promise: " << e.what();
+    }
+}
+
+int main(int argc, char *argv[]) {
+    sylar::EnvMgr::GetInstance()->init(argc, argv);
+    sylar::Config::LoadFromConfDir(sylar::EnvMgr::GetInstance()->getConfigPath());
+
+    sylar::IOManager iom(2);
+    iom.schedule(&test_fan_out);
+    iom.schedule(&test_timeout_and_exception);
+    iom.schedule(&test_broken_promise);
+    return 0;
+}
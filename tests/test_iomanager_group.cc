@@ -0,0 +1,159 @@
+/**
+ * @file test_iomanager_group.cc
+ * @brief 每核一个线程的IOManager分片组测试
+ * @version 0.1
+ */
+#include "sylar/sylar.h"
+#include <unistd.h>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static const int s_shards = 3;
+static const int s_clients = 9;
+static const int s_rounds = 50;
+
+/// 每个分片自己的计数，只在所属分片上修改
+static int s_counters[s_shards] = {0};
+/// 每个分片处理的连接数
+static std::atomic<int> s_conns[s_shards];
+/// 连接处理过程中换了线程的次数
+static std::atomic<int> s_migrated{0};
+static std::atomic<int> s_done{0};
+static sylar::Semaphore s_finished;
+
+class EchoServer : public sylar::TcpServer {
+public:
+    EchoServer(sylar::IOManagerGroup* group, sylar::IOManager* acceptor)
+        :sylar::TcpServer(nullptr, acceptor)
+        ,m_group(group) {
+        setIOWorkerGroup(group);
+    }
+protected:
+    void handleClient(sylar::Socket::ptr client) override {
+        int idx = m_group->getLocalIndex();
+        SYLAR_ASSERT(idx >= 0);
+        SYLAR_ASSERT(sylar::IOManager::GetThis() == m_group->getShard(idx));
+        ++s_conns[idx];
+        pid_t tid = sylar::GetThreadId();
+        char buf[256];
+        while(true) {
+            int n = client->recv(buf, sizeof(buf));
+            if(n <= 0) {
+                break;
+            }
+            if(sylar::GetThreadId() != tid) {
+                ++s_migrated;
+            }
+            client->send(buf, n);
+        }
+        client->close();
+    }
+private:
+    sylar::IOManagerGroup* m_group;
+};
+
+void client(sylar::Address::ptr addr) {
+    auto sock = sylar::Socket::CreateTCP(addr);
+    SYLAR_ASSERT(sock->connect(addr));
+    for(int i = 0; i < s_rounds; i++) {
+        std::string msg = "ping " + std::to_string(i);
+        sock->send(msg.c_str(), msg.size());
+        char buf[256];
+        size_t got = 0;
+        while(got < msg.size()) {
+            int n = sock->recv(buf + got, sizeof(buf) - got);
+            SYLAR_ASSERT(n > 0);
+            got += n;
+        }
+        SYLAR_ASSERT(std::string(buf, got) == msg);
+    }
+    sock->close();
+    if(++s_done == s_clients) {
+        s_finished.notify();
+    }
+}
+
+/**
+ * @brief 每个分片的GetThis返回自己，分片上的定时器在同一个线程触发
+ */
+void test_local(sylar::IOManagerGroup& group) {
+    std::vector<sylar::Future<int> > futures;
+    for(int i = 0; i < s_shards; i++) {
+        futures.push_back(sylar::async(group.getShard(i), [&group]() {
+            pid_t tid = sylar::GetThreadId();
+            sylar::FiberSemaphore sem;
+            bool same = false;
+            sylar::IOManager::GetThis()->addTimer(10, [&]() {
+                same = sylar::GetThreadId() == tid;
+                sem.notify();
+            });
+            sem.wait();
+            SYLAR_ASSERT(same);
+            return group.getLocalIndex();
+        }));
+    }
+    for(int i = 0; i < s_shards; i++) {
+        SYLAR_LOG_INFO(g_logger) << "shard " << i << " local index=" << futures[i].get();
+    }
+    SYLAR_LOG_INFO(g_logger) << "main local index=" << group.getLocalIndex() << " (expect -1)";
+}
+
+/**
+ * @brief 分片的数据只在所属分片上修改，其它分片通过post投递修改，通过async读取
+ */
+void test_message(sylar::IOManagerGroup& group) {
+    std::vector<sylar::Future<void> > posts;
+    for(int i = 0; i < 300; i++) {
+        int target = i % s_shards;
+        // 从一个分片向另一个分片投递
+        posts.push_back(sylar::async(group.getShard(i + 1), [&group, target]() {
+            group.post(target, [&group, target]() {
+                SYLAR_ASSERT(group.getLocalIndex() == target);
+                ++s_counters[target];
+            });
+        }));
+    }
+    sylar::whenAll(posts).get();
+    for(int i = 0; i < s_shards; i++) {
+        // 投递是先进先出的，读取的任务排在前面投递的任务后面
+        int v = sylar::async(group.getShard(i), [i]() { return s_counters[i]; }).get();
+        SYLAR_LOG_INFO(g_logger) << "shard " << i << " counter=" << v << " (expect 100)";
+    }
+}
+
+void test_server(sylar::IOManagerGroup& group) {
+    sylar::IOManager acceptor(1, false, "acceptor");
+    auto addr = sylar::IPv4Address::Create("127.0.0.1", 12431);
+    std::shared_ptr<EchoServer> server(new EchoServer(&group, &acceptor));
+    // 监听socket要在开启了hook的线程上创建
+    sylar::async(&acceptor, [server, addr]() {
+        SYLAR_ASSERT(server->bind(addr));
+        server->start();
+    }).get();
+    {
+        sylar::IOManager clients(1, false, "clients");
+        for(int i = 0; i < s_clients; i++) {
+            clients.schedule(std::bind(&client, addr));
+        }
+        s_finished.wait();
+    }
+    server->stop();
+    for(int i = 0; i < s_shards; i++) {
+        SYLAR_LOG_INFO(g_logger) << "shard " << i << " conns=" << s_conns[i].load()
+                                 << " (expect " << s_clients / s_shards << ")";
+    }
+    SYLAR_LOG_INFO(g_logger) << "migrated=" << s_migrated.load() << " (expect 0)";
+}
+
+int main(int argc, char *argv[]) {
+    for(int i = 0; i < s_shards; i++) {
+        s_conns[i] = 0;
+    }
+    sylar::IOManagerGroup group(s_shards, "reactor");
+    test_local(group);
+    test_message(group);
+    test_server(group);
+    group.stop();
+    SYLAR_LOG_INFO(g_logger) << "group stopped";
+    return 0;
+}
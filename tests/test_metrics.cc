@@ -0,0 +1,78 @@
+/**
+ * @file test_metrics.cc
+ * @brief 调度器运行时统计测试
+ * @version 0.1
+ */
+#include "sylar/sylar.h"
+#include <unistd.h>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+/**
+ * @brief 直方图的分位数误差不超过1/8
+ */
+void test_histogram() {
+    sylar::LatencyHistogram hist;
+    for (uint64_t i = 1; i <= 10000; i++) {
+        hist.record(i);
+    }
+    sylar::HistogramSnapshot s;
+    hist.snapshot(s);
+    SYLAR_LOG_INFO(g_logger) << "histogram " << s.toString()
+                             << " (expect avg=5000 p50~5000 p90~9000 p99~9900 max=10000)";
+
+    sylar::HistogramSnapshot prev = s;
+    for (int i = 0; i < 100; i++) {
+        hist.record(3);
+    }
+    sylar::HistogramSnapshot cur;
+    hist.snapshot(cur);
+    cur.subtract(prev);
+    SYLAR_LOG_INFO(g_logger) << "histogram delta " << cur.toString() << " (expect n=100 p99=3 max=3)";
+}
+
+/**
+ * @brief 一半时间在执行任务，一半时间在等待IO
+ */
+void worker() {
+    for (int i = 0; i < 20; i++) {
+        uint64_t end = sylar::GetElapsedUS() + 5000;
+        while (sylar::GetElapsedUS() < end);
+        usleep(5000);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    test_histogram();
+
+    SYLAR_LOG_NAME("system")->addAppender(sylar::LogAppender::ptr(new sylar::StdoutLogAppender));
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::INFO);
+    sylar::Config::Lookup<uint32_t>("metrics.dump_interval_ms")->setValue(100);
+    {
+        sylar::IOManager iom(2, false, "metrics");
+        for (int i = 0; i < 2; i++) {
+            iom.schedule(&worker);
+        }
+        usleep(100 * 1000);
+        std::vector<sylar::Scheduler::Stats> stats;
+        sylar::Scheduler::GetAllStats(stats);
+        for (auto &i : stats) {
+            SYLAR_LOG_INFO(g_logger) << "all stats: " << i.toString();
+        }
+    }
+    sylar::Config::Lookup<uint32_t>("metrics.dump_interval_ms")->setValue(0);
+
+    {
+        sylar::Scheduler sc(1, false, "plain");
+        sc.start();
+        for (int i = 0; i < 1000; i++) {
+            sc.schedule([]() {});
+        }
+        usleep(50 * 1000);
+        sylar::Scheduler::Stats s;
+        sc.getStats(s);
+        SYLAR_LOG_INFO(g_logger) << "plain " << s.toString() << " (expect run_us n>=1000 polls absent)";
+        sc.stop();
+    }
+    return 0;
+}
@@ -0,0 +1,174 @@
+/**
+ * @file test_offload.cc
+ * @brief 阻塞调用卸载线程池测试
+ * @version 0.1
+ */
+#include "sylar/sylar.h"
+#include <fcntl.h>
+#include <unistd.h>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static std::atomic<int> s_ticks{0};
+static std::atomic<int> s_done{0};
+static std::atomic<int> s_wrong_thread{0};
+
+/**
+ * @brief 没有经过hook的阻塞调用交给线程池，调度线程不被阻塞
+ */
+void test_blocking() {
+    int thread = sylar::GetThreadId();
+    int rt = sylar::offload([]() {
+        usleep_f(200 * 1000);
+        return 42;
+    });
+    if (rt != 42 || sylar::GetThreadId() != thread) {
+        ++s_wrong_thread;
+    }
+    ++s_done;
+}
+
+/**
+ * @brief 每10ms让出一次，统计阻塞调用期间的调度次数
+ */
+void ticker() {
+    while (s_done < 4) {
+        usleep(10 * 1000);
+        ++s_ticks;
+    }
+}
+
+void test_result() {
+    int rt = sylar::offload([]() {
+        errno = ENOENT;
+        return -1;
+    });
+    SYLAR_LOG_INFO(g_logger) << "offload rt=" << rt << " errno=" << errno
+                             << " (expect -1 " << ENOENT << ")";
+
+    try {
+        sylar::offload([]() {
+            throw std::runtime_error("offload error");
+        });
+    } catch (std::exception &e) {
+        SYLAR_LOG_INFO(g_logger) << "offload exception: " << e.what();
+    }
+
+    uint64_t begin = sylar::GetElapsedMS();
+    try {
+        sylar::offload([]() {
+            usleep_f(300 * 1000);
+        }, 50);
+        SYLAR_LOG_ERROR(g_logger) << "offload timeout not triggered";
+    } catch (sylar::OffloadTimeout &e) {
+        SYLAR_LOG_INFO(g_logger) << "offload timeout after " << sylar::GetElapsedMS() - begin
+                                 << "ms errno=" << errno << " (expect " << ETIMEDOUT << ")";
+    }
+
+    std::vector<sylar::Address::ptr> addrs;
+    bool ok = sylar::Address::Lookup(addrs, "localhost:80");
+    SYLAR_LOG_INFO(g_logger) << "lookup localhost ok=" << ok
+                             << " first=" << (addrs.empty() ? "" : addrs[0]->toString());
+}
+
+static uint64_t blocking_reads() {
+    std::vector<sylar::BlockingCallStats> stats;
+    sylar::get_blocking_call_stats(stats);
+    for (auto &i : stats) {
+        if (i.name == "read") {
+            return i.count;
+        }
+    }
+    return 0;
+}
+
+void test_file_io() {
+    sylar::Config::Lookup<bool>("offload.file_io")->setValue(true);
+    uint64_t before = blocking_reads();
+    int fd = open("/proc/self/exe", O_RDONLY);
+    char buf[4096];
+    ssize_t total = 0;
+    for (int i = 0; i < 100; i++) {
+        lseek(fd, 0, SEEK_SET);
+        total += read(fd, buf, sizeof(buf));
+    }
+    close(fd);
+    SYLAR_LOG_INFO(g_logger) << "file read total=" << total << " (expect " << 100 * sizeof(buf)
+                             << ") blocking reads=" << blocking_reads() - before << " (expect 0)";
+    sylar::Config::Lookup<bool>("offload.file_io")->setValue(false);
+}
+
+/**
+ * @brief 多线程IOManager上开启offload.file_io，调度线程空闲唤醒时不会把内部管道交给线程池
+ */
+void test_file_io_mt() {
+    sylar::Config::Lookup<bool>("offload.file_io")->setValue(true);
+    uint64_t before = blocking_reads();
+    std::atomic<ssize_t> total{0};
+    {
+        sylar::IOManager iom(2, false, "offload_mt");
+        for (int i = 0; i < 200; i++) {
+            iom.schedule([]{});
+            if (i % 20 == 0) {
+                iom.schedule([&total]() {
+                    int fd = open("/proc/self/exe", O_RDONLY);
+                    char buf[4096];
+                    total += read(fd, buf, sizeof(buf));
+                    close(fd);
+                });
+            }
+            usleep(100);
+        }
+    }
+    SYLAR_LOG_INFO(g_logger) << "mt file read total=" << total << " (expect " << 10 * 4096
+                             << ") blocking reads=" << blocking_reads() - before << " (expect 0)";
+    sylar::Config::Lookup<bool>("offload.file_io")->setValue(false);
+}
+
+/**
+ * @brief 反复缩容扩容，缩容退出的线程在扩容时被join回收
+ */
+void test_resize() {
+    sylar::OffloadPool pool(4, 0, "resize");
+    for (int round = 0; round < 5; ++round) {
+        pool.setMaxThreads(4);
+        std::atomic<int> done{0};
+        for (int i = 0; i < 4; ++i) {
+            pool.submit([&done]() {
+                usleep_f(20 * 1000);
+                ++done;
+            });
+        }
+        while (done < 4) {
+            usleep(1000);
+        }
+        pool.setMaxThreads(1);
+        while (pool.getThreadCount() > 1) {
+            usleep(1000);
+        }
+    }
+    SYLAR_LOG_INFO(g_logger) << "resize threads=" << pool.getThreadCount() << " (expect 1)";
+}
+
+int main(int argc, char *argv[]) {
+    {
+        sylar::IOManager iom(1, false, "offload");
+        iom.schedule(&ticker);
+        for (int i = 0; i < 4; i++) {
+            iom.schedule(&test_blocking);
+        }
+    }
+    // 4个200ms的阻塞调用并行执行，期间调度线程一直在运行ticker
+    SYLAR_LOG_INFO(g_logger) << "blocking done=" << s_done << " wrong thread=" << s_wrong_thread
+                             << " ticks=" << s_ticks << " (expect ~20)"
+                             << " pool threads=" << sylar::OffloadPoolMgr::GetInstance()->getThreadCount();
+
+    {
+        sylar::IOManager iom(1, false, "offload");
+        iom.schedule(&test_result);
+        iom.schedule(&test_file_io);
+        iom.schedule(&test_resize);
+    }
+    test_file_io_mt();
+    return 0;
+}
@@ -69,9 +69,239 @@ void test_fiber4() {
     SYLAR_LOG_INFO(g_logger) << "test_fiber4 end";
 }
 
+/**
+ * @brief 演示回调任务的协程复用，回调执行完之后协程放回线程的空闲列表，下一个回调任务直接reset复用
+ */
+void test_fiber_reuse() {
+    sylar::Scheduler sc(2, false, "reuse");
+    sc.start();
+    for (int i = 0; i < 1000; i++) {
+        sc.schedule(test_fiber3);
+    }
+    sc.stop();
+
+    std::vector<sylar::Scheduler::WorkerStats> stats;
+    sc.getWorkerStats(stats);
+    for (auto &i : stats) {
+        SYLAR_LOG_INFO(g_logger) << "thread=" << i.thread << " reused=" << i.reused
+                                 << " allocated=" << i.allocated << " stolen=" << i.stolen
+                                 << " overflowed=" << i.overflowed;
+    }
+}
+
+/**
+ * @brief 演示任务窃取，在调度线程中添加的任务进入该线程的本地队列，其他空闲线程从这个队列窃取任务
+ */
+void test_work_stealing() {
+    sylar::IOManager iom(4, false, "steal");
+    std::atomic<int> done{0};
+    iom.schedule([&iom, &done]() {
+        for (int i = 0; i < 10000; i++) {
+            iom.schedule([&done]() { ++done; });
+        }
+    });
+    iom.stop();
+
+    std::vector<sylar::Scheduler::WorkerStats> stats;
+    iom.getWorkerStats(stats);
+    for (auto &i : stats) {
+        SYLAR_LOG_INFO(g_logger) << "thread=" << i.thread << " stolen=" << i.stolen
+                                 << " overflowed=" << i.overflowed;
+    }
+    SYLAR_LOG_INFO(g_logger) << "work stealing done=" << done;
+}
+
+/**
+ * @brief 在指定的线程之间依次接力，每一跳都放入下一个线程的收件箱并只唤醒该线程
+ */
+void pinned_hop(sylar::IOManager* iom, std::vector<int>* threads, int left, sylar::FiberSemaphore* done) {
+    if (left == 0) {
+        done->notify();
+        return;
+    }
+    int next = (*threads)[left % threads->size()];
+    iom->schedule(std::bind(&pinned_hop, iom, threads, left - 1, done), next);
+}
+
+/**
+ * @brief 演示指定线程的任务，任务进入目标线程的收件箱，只在该线程上执行
+ */
+void test_pinned() {
+    sylar::IOManager iom(4, false, "pinned");
+    // 等所有调度线程进入run
+    usleep(10 * 1000);
+    std::vector<sylar::Scheduler::WorkerStats> stats;
+    iom.getWorkerStats(stats);
+    std::vector<int> threads;
+    for (auto &i : stats) {
+        threads.push_back(i.thread);
+    }
+
+    std::atomic<int> done{0};
+    std::atomic<int> wrong{0};
+    for (int i = 0; i < 10000; i++) {
+        int thread = threads[i % threads.size()];
+        iom.schedule([thread, &done, &wrong]() {
+            if (sylar::GetThreadId() != thread) {
+                ++wrong;
+            }
+            ++done;
+        }, thread);
+    }
+
+    sylar::FiberSemaphore hops;
+    uint64_t begin = sylar::GetCurrentUS();
+    iom.schedule(std::bind(&pinned_hop, &iom, &threads, 10000, &hops));
+    hops.wait();
+    SYLAR_LOG_INFO(g_logger) << "10000 pinned hops elapsed=" << sylar::GetCurrentUS() - begin << "us";
+    iom.stop();
+
+    iom.getWorkerStats(stats);
+    for (auto &i : stats) {
+        SYLAR_LOG_INFO(g_logger) << "thread=" << i.thread << " pinned=" << i.pinned;
+    }
+    SYLAR_LOG_INFO(g_logger) << "pinned done=" << done << " wrong thread=" << wrong;
+}
+
+/**
+ * @brief 模拟一个占用CPU的任务
+ */
+void busy_task(uint64_t us) {
+    uint64_t begin = sylar::GetCurrentUS();
+    while (sylar::GetCurrentUS() - begin < us);
+}
+
+/**
+ * @brief 演示优先级车道，大量后台任务排队时，高优先级任务的等待时间不受影响
+ */
+void test_priority_lanes() {
+    sylar::IOManager iom(1, false, "lanes");
+    for (int i = 0; i < 2000; i++) {
+        iom.schedule(std::bind(&busy_task, 20), -1, 0, sylar::Scheduler::BACKGROUND);
+        if (i % 20 == 0) {
+            iom.schedule(std::bind(&busy_task, 20), -1, 0, sylar::Scheduler::HIGH);
+            iom.schedule(std::bind(&busy_task, 20));
+        }
+    }
+    std::vector<sylar::Scheduler::LaneStats> stats;
+    iom.getLaneStats(stats);
+    SYLAR_LOG_INFO(g_logger) << "background depth=" << stats[sylar::Scheduler::BACKGROUND].depth;
+    iom.stop();
+
+    iom.getLaneStats(stats);
+    for (auto &i : stats) {
+        SYLAR_LOG_INFO(g_logger) << "lane=" << sylar::Scheduler::PriorityToString(i.priority)
+                                 << " dequeued=" << i.dequeued << " avg_wait=" << i.avgWaitUs
+                                 << "us p50<=" << i.p50WaitUs << "us p99<=" << i.p99WaitUs
+                                 << "us max=" << i.maxWaitUs << "us";
+    }
+}
+
+/**
+ * @brief 演示自旋等待，任务间隔很短时空闲线程在自旋期间就能拿到任务，间隔很长时自旋时间逐渐缩短
+ */
+void test_spin() {
+    sylar::IOManager iom(2, false, "spin");
+    std::atomic<int> done{0};
+    // 短间隔，大部分任务在自旋期间到达
+    for (int i = 0; i < 2000; i++) {
+        iom.schedule([&done]{ ++done; });
+        busy_task(5);
+    }
+    // 长间隔，自旋没有等到任务，线程阻塞
+    for (int i = 0; i < 20; i++) {
+        iom.schedule([&done]{ ++done; });
+        usleep(2000);
+    }
+    std::vector<sylar::Scheduler::WorkerStats> stats;
+    iom.getWorkerStats(stats);
+    for (auto &i : stats) {
+        SYLAR_LOG_INFO(g_logger) << "thread=" << i.thread << " spins=" << i.spins
+                                 << " spin_hits=" << i.spinHits << " parks=" << i.parks
+                                 << " spin_us=" << i.spinUs << " spin_budget=" << i.spinBudgetUs << "us";
+    }
+    iom.stop();
+    SYLAR_LOG_INFO(g_logger) << "spin done=" << done << " (expect 2020)";
+}
+
+/**
+ * @brief 演示弹性线程池，任务积压时增加线程，空闲一段时间后增加的线程退出
+ */
+void test_elastic() {
+    sylar::Config::Lookup<uint32_t>("scheduler.grow_wait_us")->setValue(2000);
+    sylar::Config::Lookup<uint32_t>("scheduler.retire_idle_ms")->setValue(200);
+    sylar::IOManager iom(1, false, "elastic");
+    iom.setThreadRange(1, 4);
+    std::atomic<int> done{0};
+    for (int i = 0; i < 200; i++) {
+        iom.schedule([&done]{
+            busy_task(500);
+            ++done;
+        });
+    }
+    size_t peak = 0;
+    while (done < 200) {
+        peak = std::max(peak, iom.getThreadCount());
+        usleep(1000);
+    }
+    SYLAR_LOG_INFO(g_logger) << "elastic peak threads=" << peak << " (max 4)";
+    usleep(1000 * 1000);
+    SYLAR_LOG_INFO(g_logger) << "elastic threads after idle=" << iom.getThreadCount() << " (expect 1)";
+    iom.stop();
+    SYLAR_LOG_INFO(g_logger) << "elastic done=" << done << " (expect 200)";
+}
+
+static uint64_t process_cpu_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+/**
+ * @brief 基础调度器空闲时阻塞在停车位上，测量空闲时的CPU占用和从schedule到任务开始执行的唤醒延迟
+ */
+void test_idle_park() {
+    sylar::Scheduler sc(4, false, "park");
+    sc.start();
+    usleep(100 * 1000);
+
+    uint64_t cpu = process_cpu_us();
+    uint64_t wall = sylar::GetElapsedUS();
+    usleep(500 * 1000);
+    cpu = process_cpu_us() - cpu;
+    wall = sylar::GetElapsedUS() - wall;
+    SYLAR_LOG_INFO(g_logger) << "idle park: 4 threads idle cpu=" << cpu * 100.0 / wall << "%";
+
+    std::vector<uint64_t> latency;
+    for (int i = 0; i < 1000; i++) {
+        sylar::Semaphore sem;
+        uint64_t begin = sylar::GetElapsedUS();
+        sc.schedule([&latency, &sem, begin]{
+            latency.push_back(sylar::GetElapsedUS() - begin);
+            sem.notify();
+        });
+        sem.wait();
+        // 等调度线程重新阻塞
+        usleep(200);
+    }
+    std::sort(latency.begin(), latency.end());
+    SYLAR_LOG_INFO(g_logger) << "idle park: wake latency p50=" << latency[latency.size() / 2]
+                             << "us p99=" << latency[latency.size() * 99 / 100]
+                             << "us max=" << latency.back() << "us";
+    sc.stop();
+}
+
 int main() {
     SYLAR_LOG_INFO(g_logger) << "main begin";
 
+    test_fiber_reuse();
+    test_work_stealing();
+    test_pinned();
+    test_priority_lanes();
+    test_spin();
+    test_elastic();
+    test_idle_park();
+
     /** 
      * 只使用main函数线程进行协程调度，相当于先攒下一波协程，然后切换到调度器的run方法将这些协程
      * 消耗掉，然后再返回main函数往下执行
@@ -23,6 +23,67 @@ void func1(void *arg) {
     }
 }
 
+void print_cpu() {
+    SYLAR_LOG_INFO(g_logger) << "name:" << sylar::Thread::GetName()
+        << " cpu:" << sched_getcpu()
+        << " numa node:" << sylar::Thread::GetNumaNode();
+}
+
+/**
+ * @brief 线程绑定CPU，以及按scheduler.affinity放置调度线程
+ */
+void test_affinity() {
+    sylar::CpuTopology* topo = sylar::CpuTopologyMgr::GetInstance();
+    SYLAR_LOG_INFO(g_logger) << topo->toString();
+
+    sylar::Thread::ptr thr(new sylar::Thread(&print_cpu, "pinned",
+                                             std::vector<int>(1, topo->getCpus().back())));
+    thr->join();
+
+    // 一般写在配置文件里，比如 scheduler: {affinity: {"*": core, io: node}}
+    std::map<std::string, std::string> policies;
+    policies["core_sc"] = "core";
+    policies["node_sc"] = "node:0";
+    sylar::Config::Lookup<std::map<std::string, std::string> >("scheduler.affinity")->setValue(policies);
+    {
+        sylar::IOManager iom(3, false, "core_sc");
+        for(int i = 0; i < 3; i++) {
+            iom.schedule(&print_cpu);
+        }
+    }
+    {
+        sylar::IOManager iom(2, false, "node_sc");
+        iom.schedule(&print_cpu);
+    }
+}
+
+/**
+ * @brief 两个线程并发地反复启动停止，结束之后PeriodicThread仍然可以启动
+ */
+void test_periodic_start_stop() {
+    std::atomic<uint64_t> runs{0};
+    sylar::PeriodicThread pt("periodic", [&runs]() -> uint64_t {
+        ++runs;
+        return 1;
+    });
+    std::vector<sylar::Thread::ptr> thrs;
+    for(int i = 0; i < 2; i++) {
+        thrs.push_back(sylar::Thread::ptr(new sylar::Thread([&pt]() {
+            for(int j = 0; j < 200; j++) {
+                pt.start();
+                pt.stop();
+            }
+        }, "start_stop_" + std::to_string(i))));
+    }
+    for(auto& i : thrs) {
+        i->join();
+    }
+    bool started = pt.start();
+    pt.stop();
+    SYLAR_LOG_INFO(g_logger) << "periodic start after races=" << started
+                             << " runs=" << runs << " (expect 1)";
+}
+
 int main(int argc, char *argv[]) {
     sylar::EnvMgr::GetInstance()->init(argc, argv);
     sylar::Config::LoadFromConfDir(sylar::EnvMgr::GetInstance()->getConfigPath());
@@ -40,5 +101,8 @@ int main(int argc, char *argv[]) {
     }
     
     SYLAR_LOG_INFO(g_logger) << "count = " << count;
+
+    test_affinity();
+    test_periodic_start_stop();
     return 0;
 }
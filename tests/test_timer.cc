@@ -34,6 +34,49 @@ void test_timer() {
     iom.addTimer(5000, []{
         SYLAR_LOG_INFO(g_logger) << "5000ms timeout";
     });
+
+    // inline定时器，回调不会阻塞，直接在调度协程上执行
+    iom.addTimer(800, []{
+        SYLAR_LOG_INFO(g_logger) << "800ms inline timeout, in inline task: "
+                                 << sylar::Scheduler::InInlineTask();
+    }, false, true);
+
+    // 普通回调也可以用scheduleInline直接在调度协程上执行
+    for(int i = 0; i < 3; ++i) {
+        iom.scheduleInline([i]{
+            SYLAR_LOG_INFO(g_logger) << "inline task " << i;
+        });
+    }
+}
+
+/**
+ * @brief 大量连接的空闲超时同时到期，超时回调批量调度
+ */
+void test_timer_storm() {
+    std::atomic<int> fired{0};
+    uint64_t begin = 0;
+    {
+        sylar::IOManager iom(4, false, "storm");
+        for(int i = 0; i < 10000; ++i) {
+            iom.addTimer(100, [&fired]{
+                ++fired;
+            });
+        }
+        begin = sylar::GetCurrentMS();
+    }
+    SYLAR_LOG_INFO(g_logger) << "timer storm fired=" << fired << " (expect 10000) elapsed="
+                             << sylar::GetCurrentMS() - begin << "ms";
+
+    // 也可以直接批量调度一组任务
+    std::vector<std::function<void()> > cbs;
+    for(int i = 0; i < 1000; ++i) {
+        cbs.push_back([&fired]{ ++fired; });
+    }
+    {
+        sylar::IOManager iom(4, false, "batch");
+        iom.scheduleBatch(cbs.begin(), cbs.end());
+    }
+    SYLAR_LOG_INFO(g_logger) << "batch fired=" << fired << " (expect 11000)";
 }
 
 int main(int argc, char *argv[]) {
@@ -41,6 +84,7 @@ int main(int argc, char *argv[]) {
     sylar::Config::LoadFromConfDir(sylar::EnvMgr::GetInstance()->getConfigPath());
 
     test_timer();
+    test_timer_storm();
 
     SYLAR_LOG_INFO(g_logger) << "end";
 
@@ -0,0 +1,158 @@
+/**
+ * @file test_uring.cc
+ * @brief io_uring后端测试
+ * @version 0.1
+ */
+#include "sylar/sylar.h"
+#include <unistd.h>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static const int s_clients = 20;
+static const int s_rounds = 100;
+static std::atomic<int> s_done{0};
+static sylar::Socket::ptr s_server;
+/// 地址解析在阻塞调用线程池里执行，等待期间的协程不算调度器的任务，main要等run结束再停止调度器
+static sylar::Semaphore s_finished;
+
+void echo(sylar::Socket::ptr client) {
+    char buf[256];
+    while(true) {
+        int n = client->recv(buf, sizeof(buf));
+        if(n <= 0) {
+            break;
+        }
+        client->send(buf, n);
+    }
+    client->close();
+}
+
+void accept_loop() {
+    while(true) {
+        auto client = s_server->accept();
+        if(!client) {
+            SYLAR_LOG_INFO(g_logger) << "accept loop exit errno=" << errno << " (expect EBADF after close)";
+            break;
+        }
+        sylar::IOManager::GetThis()->schedule(std::bind(&echo, client));
+    }
+}
+
+void client(sylar::Address::ptr addr) {
+    auto sock = sylar::Socket::CreateTCP(addr);
+    if(!sock->connect(addr)) {
+        SYLAR_LOG_ERROR(g_logger) << "connect error errno=" << errno;
+        return;
+    }
+    for(int i = 0; i < s_rounds; i++) {
+        std::string msg = "hello " + std::to_string(i);
+        sock->send(msg.c_str(), msg.size());
+        char buf[256];
+        size_t got = 0;
+        while(got < msg.size()) {
+            int n = sock->recv(buf + got, sizeof(buf) - got);
+            if(n <= 0) {
+                SYLAR_LOG_ERROR(g_logger) << "recv error n=" << n << " errno=" << errno;
+                return;
+            }
+            got += n;
+        }
+        SYLAR_ASSERT(std::string(buf, got) == msg);
+    }
+    sock->close();
+    if(++s_done == s_clients) {
+        SYLAR_LOG_INFO(g_logger) << "echo done clients=" << s_done.load();
+    }
+}
+
+void test_timeout(sylar::Address::ptr addr) {
+    auto sock = sylar::Socket::CreateTCP(addr);
+    SYLAR_ASSERT(sock->connect(addr));
+    sock->setRecvTimeout(100);
+    char buf[16];
+    uint64_t begin = sylar::GetElapsedMS();
+    int n = sock->recv(buf, sizeof(buf));
+    SYLAR_LOG_INFO(g_logger) << "recv timeout n=" << n << " errno=" << errno
+                             << " elapsed_ms=" << sylar::GetElapsedMS() - begin
+                             << " (expect n=-1 errno=" << ETIMEDOUT << " elapsed_ms~100)";
+    sock->close();
+}
+
+void test_refused() {
+    auto addr = sylar::Address::LookupAnyIPAddress("127.0.0.1:1");
+    auto sock = sylar::Socket::CreateTCP(addr);
+    bool ok = sock->connect(addr, 1000);
+    SYLAR_LOG_INFO(g_logger) << "connect refused ok=" << ok << " errno=" << errno
+                             << " (expect ok=0 errno=" << ECONNREFUSED << ")";
+}
+
+/**
+ * @brief 一批连接同时到达，超过iomanager.accept_queue_max的连接留在backlog里，队列取空之后仍然都能accept
+ */
+void test_accept_burst() {
+    auto addr = sylar::Address::LookupAnyIPAddress("127.0.0.1:12422");
+    auto server = sylar::Socket::CreateTCP(addr);
+    SYLAR_ASSERT(server->bind(addr));
+    SYLAR_ASSERT(server->listen());
+    server->setRecvTimeout(50);
+    // 第一次accept注册multishot accept
+    SYLAR_ASSERT(!server->accept());
+
+    std::vector<sylar::Socket::ptr> socks;
+    for(int i = 0; i < s_clients; i++) {
+        auto sock = sylar::Socket::CreateTCP(addr);
+        SYLAR_ASSERT(sock->connect(addr));
+        socks.push_back(sock);
+    }
+    usleep(100 * 1000);
+
+    server->setRecvTimeout(1000);
+    int accepted = 0;
+    while(accepted < s_clients && server->accept()) {
+        ++accepted;
+    }
+    SYLAR_LOG_INFO(g_logger) << "accept burst accepted=" << accepted << " (expect " << s_clients << ")";
+    server->close();
+}
+
+void run() {
+    auto addr = sylar::Address::LookupAnyIPAddress("127.0.0.1:12421");
+    s_server = sylar::Socket::CreateTCP(addr);
+    SYLAR_ASSERT(s_server->bind(addr));
+    SYLAR_ASSERT(s_server->listen());
+    sylar::IOManager* iom = sylar::IOManager::GetThis();
+    SYLAR_LOG_INFO(g_logger) << "io_uring backend=" << iom->canSubmitIo();
+    iom->schedule(&accept_loop);
+
+    for(int i = 0; i < s_clients; i++) {
+        iom->schedule(std::bind(&client, addr));
+    }
+    test_timeout(addr);
+    test_refused();
+    test_accept_burst();
+    while(s_done < s_clients) {
+        usleep(10 * 1000);
+    }
+    // 关闭监听socket，等待中的accept返回
+    s_server->close();
+    s_finished.notify();
+}
+
+int main(int argc, char *argv[]) {
+    sylar::Config::Lookup<std::string>("iomanager.backend")->setValue("io_uring");
+    sylar::Config::Lookup<uint32_t>("iomanager.accept_queue_max")->setValue(4);
+    {
+        sylar::IOManager iom(2, false, "uring");
+        iom.schedule(&run);
+        s_finished.wait();
+    }
+    SYLAR_LOG_INFO(g_logger) << "uring iomanager stopped";
+
+    // epoll后端不提交完成式IO
+    sylar::Config::Lookup<std::string>("iomanager.backend")->setValue("epoll");
+    {
+        sylar::IOManager iom(1, false, "epoll");
+        SYLAR_LOG_INFO(g_logger) << "epoll backend io_uring=" << iom.canSubmitIo() << " (expect 0)";
+    }
+    return 0;
+}
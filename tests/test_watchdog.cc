@@ -0,0 +1,135 @@
+/**
+ * @file test_watchdog.cc
+ * @brief 看门狗测试，检测执行太久没有让出的协程和直接阻塞的IO调用
+ * @version 0.1
+ */
+#include "sylar/sylar.h"
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+/**
+ * @brief CPU密集的计算，一直不让出
+ */
+void cpu_heavy(uint64_t ms) {
+    uint64_t end = sylar::GetElapsedUS() + ms * 1000;
+    volatile uint64_t n = 0;
+    while (sylar::GetElapsedUS() < end) {
+        ++n;
+    }
+}
+
+/**
+ * @brief 没有经过hook的阻塞调用
+ */
+void unhooked_sleep(uint64_t ms) {
+    // 采集调用栈的信号会让usleep提前返回EINTR，睡够为止
+    uint64_t end = sylar::GetElapsedUS() + ms * 1000;
+    uint64_t now = 0;
+    while ((now = sylar::GetElapsedUS()) < end) {
+        usleep_f(end - now);
+    }
+}
+
+/**
+ * @brief 读普通文件，hook之后仍然直接阻塞执行
+ */
+void read_file() {
+    int fd = open("/proc/self/exe", O_RDONLY);
+    char buf[4096];
+    for (int i = 0; i < 100; i++) {
+        lseek(fd, 0, SEEK_SET);
+        read(fd, buf, sizeof(buf));
+    }
+    close(fd);
+}
+
+/**
+ * @brief 阻塞调用统计中某个hook函数的调用次数
+ */
+static uint64_t blocking_count(const std::string &name) {
+    std::vector<sylar::BlockingCallStats> calls;
+    sylar::get_blocking_call_stats(calls);
+    for (auto &i : calls) {
+        if (i.name == name) {
+            return i.count;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief 调度器唤醒用的内部管道不计入阻塞调用统计
+ */
+void test_tickle_not_counted() {
+    uint64_t reads = blocking_count("read");
+    uint64_t writes = blocking_count("write");
+    {
+        sylar::IOManager iom(2, false, "tickle");
+        for (int i = 0; i < 200; i++) {
+            iom.schedule([]{});
+            usleep(100);
+        }
+    }
+    SYLAR_LOG_INFO(g_logger) << "tickle pipe blocking reads=" << blocking_count("read") - reads
+                             << " writes=" << blocking_count("write") - writes << " (expect 0 0)";
+}
+
+/**
+ * @brief 不采集调用栈时不安装信号处理函数
+ */
+void test_no_backtrace() {
+    sylar::Config::Lookup<uint32_t>("watchdog.stall_ms")->setValue(100);
+    {
+        sylar::IOManager iom(1, false, "no_backtrace");
+        iom.schedule(std::bind(&cpu_heavy, 300));
+    }
+    struct sigaction sa;
+    sigaction(SIGRTMIN + 1, nullptr, &sa);
+    SYLAR_LOG_INFO(g_logger) << "no backtrace stalls=" << sylar::WatchdogMgr::GetInstance()->getStallCount()
+                             << " handler installed=" << (sa.sa_handler != SIG_DFL) << " (expect 1 0)";
+}
+
+int main(int argc, char *argv[]) {
+    // 卡顿报告输出到system日志器
+    SYLAR_LOG_NAME("system")->addAppender(sylar::LogAppender::ptr(new sylar::StdoutLogAppender));
+    test_no_backtrace();
+    // 采集调用栈用于按调用点聚合
+    sylar::Config::Lookup<uint32_t>("watchdog.backtrace_frames")->setValue(16);
+    sylar::Config::Lookup<uint32_t>("watchdog.stall_ms")->setValue(100);
+    {
+        sylar::IOManager iom(2, false, "watchdog");
+        for (int i = 0; i < 3; i++) {
+            iom.schedule(std::bind(&cpu_heavy, 300));
+        }
+        iom.schedule(std::bind(&unhooked_sleep, 300));
+        iom.schedule(&read_file);
+        // 正常让出的协程不会被报告
+        iom.schedule([]{
+            sleep(1);
+        });
+        usleep(1500 * 1000);
+    }
+
+    SYLAR_LOG_INFO(g_logger) << "stalls=" << sylar::WatchdogMgr::GetInstance()->getStallCount()
+                             << " (expect 5)";
+    std::vector<sylar::Watchdog::StallSite> sites;
+    sylar::WatchdogMgr::GetInstance()->getStallSites(sites);
+    for (auto& i : sites) {
+        SYLAR_LOG_INFO(g_logger) << "stall site count=" << i.count << " max=" << i.maxMs
+                                 << "ms site=" << i.site;
+    }
+
+    std::vector<sylar::BlockingCallStats> calls;
+    sylar::get_blocking_call_stats(calls);
+    for (auto& i : calls) {
+        SYLAR_LOG_INFO(g_logger) << "blocking call " << i.name << " count=" << i.count
+                                 << " total=" << i.totalUs << "us max=" << i.maxUs << "us";
+    }
+
+    sylar::Config::Lookup<uint32_t>("watchdog.stall_ms")->setValue(0);
+    test_tickle_not_counted();
+    return 0;
+}